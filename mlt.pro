@@ -17,6 +17,7 @@ HEADERS += \
     src/framework/mlt.h \
     src/framework/mlt_animation.h \
     src/framework/mlt_audio.h \
+    src/framework/mlt_audio_dsp.h \
     src/framework/mlt_cache.h \
     src/framework/mlt_chain.h \
     src/framework/mlt_consumer.h \
@@ -36,6 +37,7 @@ HEADERS += \
     src/framework/mlt_pool.h \
     src/framework/mlt_producer.h \
     src/framework/mlt_profile.h \
+    src/framework/mlt_profiler.h \
     src/framework/mlt_properties.h \
     src/framework/mlt_property.h \
     src/framework/mlt_repository.h \
@@ -78,6 +80,7 @@ HEADERS += \
     src/modules/avformat/mmx.h \
     src/modules/core/image_proc.h \
     src/modules/core/transition_composite.h \
+    src/modules/normalize/loudness_meter.h \
     src/modules/oldfilm/commonoldfilm.h \
     src/modules/plus/interp.h \
     src/modules/qt/ImageWebp.h \
@@ -93,6 +96,7 @@ HEADERS += \
 SOURCES += \
     src/framework/mlt_animation.c \
     src/framework/mlt_audio.c \
+    src/framework/mlt_audio_dsp.c \
     src/framework/mlt_cache.c \
     src/framework/mlt_chain.c \
     src/framework/mlt_consumer.c \
@@ -112,6 +116,7 @@ SOURCES += \
     src/framework/mlt_pool.c \
     src/framework/mlt_producer.c \
     src/framework/mlt_profile.c \
+    src/framework/mlt_profiler.c \
     src/framework/mlt_properties.c \
     src/framework/mlt_property.c \
     src/framework/mlt_repository.c \
@@ -187,6 +192,7 @@ SOURCES += \
     src/modules/core/filter_transpose.c \
     src/modules/core/filter_watermark.c \
     src/modules/core/filter_watermark_affine.c \
+    src/modules/core/image_convert_simd.c \
     src/modules/core/image_proc.c \
     src/modules/core/link_timeremap.c \
     src/modules/core/producer_colour.c \
@@ -195,6 +201,7 @@ SOURCES += \
     src/modules/core/producer_loader.c \
     src/modules/core/producer_melt.c \
     src/modules/core/producer_noise.c \
+    src/modules/core/producer_prerender.c \
     src/modules/core/producer_timewarp.c \
     src/modules/core/producer_tone.c \
     src/modules/core/transition_composite.c \
@@ -204,6 +211,7 @@ SOURCES += \
     src/modules/normalize/factorynormalize.c \
     src/modules/normalize/filter_audiolevel.c \
     src/modules/normalize/filter_volume.c \
+    src/modules/normalize/loudness_meter.c \
     src/modules/oldfilm/commonoldfilm.c \
     src/modules/oldfilm/factoryoldfilm.c \
     src/modules/oldfilm/filter_dust.c \
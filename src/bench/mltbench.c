@@ -0,0 +1,1024 @@
+/*
+ * mltbench.c -- MLT framework and rendering benchmarks
+ * Copyright (C) 2022 Meltytech, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <locale.h>
+
+#ifdef _WIN32
+#define PSAPI_VERSION 2
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <framework/mlt.h>
+
+/** The options given on the command line. */
+
+static struct
+{
+	double seconds;
+	int frames;
+	int tracks;
+	int real_time;
+	int width;
+	int height;
+	const char *profile;
+	const char *match;
+	int micro;
+	int macro;
+} options = { 1.0, 250, 4, -1, 1920, 1080, NULL, NULL, 1, 1 };
+
+static double now( )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Start measuring a new peak resident size.
+
+    The pool is emptied first so that each benchmark starts from the same
+    state. Linux lets the high water mark be reset; elsewhere the peak is
+    that of the whole process so far.
+*/
+
+static void reset_peak_memory( )
+{
+	mlt_pool_purge( );
+#ifdef __linux__
+	FILE *f = fopen( "/proc/self/clear_refs", "w" );
+	if ( f )
+	{
+		fputs( "5", f );
+		fclose( f );
+	}
+#endif
+}
+
+/** Get the peak resident size in KiB. */
+
+static long peak_memory( )
+{
+	long kib = -1;
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if ( GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) )
+		kib = counters.PeakWorkingSetSize / 1024;
+#else
+#ifdef __linux__
+	FILE *f = fopen( "/proc/self/status", "r" );
+	if ( f )
+	{
+		char line[ 128 ];
+		while ( kib < 0 && fgets( line, sizeof( line ), f ) )
+			if ( !strncmp( line, "VmHWM:", 6 ) )
+				kib = strtol( line + 6, NULL, 10 );
+		fclose( f );
+	}
+#endif
+	if ( kib < 0 )
+	{
+		struct rusage usage;
+		if ( !getrusage( RUSAGE_SELF, &usage ) )
+#ifdef __APPLE__
+			kib = usage.ru_maxrss / 1024;
+#else
+			kib = usage.ru_maxrss;
+#endif
+	}
+#endif
+	return kib;
+}
+
+static int compare_double( const void *a, const void *b )
+{
+	double x = *(const double*) a;
+	double y = *(const double*) b;
+	return x < y ? -1 : x > y;
+}
+
+/** Sort the samples and get a percentile from them. */
+
+static double percentile( double *samples, int count, double p )
+{
+	if ( count <= 0 )
+		return 0;
+	return samples[ (int)( p * ( count - 1 ) + 0.5 ) ];
+}
+
+static void print_distribution( const char *name, double *samples, int count, double scale )
+{
+	qsort( samples, count, sizeof( double ), compare_double );
+	printf( ",\"%s\":{\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f,\"max\":%.3f}", name,
+		percentile( samples, count, 0.50 ) * scale, percentile( samples, count, 0.95 ) * scale,
+		percentile( samples, count, 0.99 ) * scale, count ? samples[ count - 1 ] * scale : 0 );
+}
+
+static int selected( const char *name )
+{
+	return !options.match || strstr( name, options.match );
+}
+
+/* Microbenchmarks
+ *
+ * Each one runs its operation in batches, growing the batch until it takes
+ * long enough to time, and then repeats batches for the requested duration.
+ * The distribution is of the time per operation within each batch.
+ */
+
+typedef struct
+{
+	const char *name;
+	void *( *setup )( void );
+	void ( *run )( void *context, int iterations );
+	void ( *teardown )( void *context );
+} micro_benchmark;
+
+#define MAX_SAMPLES 100000
+
+static void run_micro( micro_benchmark *bench )
+{
+	void *context;
+	double *samples = malloc( MAX_SAMPLES * sizeof( double ) );
+	double start, elapsed = 0, total = 0;
+	int64_t iterations = 0;
+	int batch = 1, count = 0;
+
+	reset_peak_memory( );
+	context = bench->setup ? bench->setup( ) : NULL;
+	if ( bench->setup && !context )
+	{
+		fprintf( stderr, "%s: could not create the services\n", bench->name );
+		free( samples );
+		return;
+	}
+
+	// Warm up and then find a batch size that takes at least 100us
+	bench->run( context, 1 );
+	while ( batch < ( 1 << 20 ) )
+	{
+		start = now( );
+		bench->run( context, batch );
+		if ( now( ) - start >= 1e-4 )
+			break;
+		batch *= 2;
+	}
+
+	start = now( );
+	while ( count < MAX_SAMPLES && ( elapsed < options.seconds || count < 10 ) )
+	{
+		double t = now( );
+		bench->run( context, batch );
+		t = now( ) - t;
+		samples[ count++ ] = t / batch;
+		iterations += batch;
+		total += t;
+		elapsed = now( ) - start;
+	}
+
+	if ( bench->teardown )
+		bench->teardown( context );
+
+	printf( "{\"benchmark\":\"%s\",\"type\":\"micro\",\"iterations\":%" PRId64 ",\"seconds\":%.3f,\"ops_per_second\":%.1f,\"ns_per_op\":%.2f",
+		bench->name, iterations, total, iterations / total, total / iterations * 1e9 );
+	print_distribution( "ns_per_op_percentiles", samples, count, 1e9 );
+	printf( ",\"peak_rss_kib\":%ld}\n", peak_memory( ) );
+	fflush( stdout );
+	free( samples );
+}
+
+#define PROPERTY_COUNT 64
+
+static const char *property_names[ PROPERTY_COUNT ];
+
+static void *properties_setup( void )
+{
+	mlt_properties properties = mlt_properties_new( );
+	int i;
+	for ( i = 0; i < PROPERTY_COUNT; i++ )
+	{
+		char name[ 32 ];
+		snprintf( name, sizeof( name ), "property_%d", i );
+		mlt_properties_set_int( properties, name, i );
+		property_names[ i ] = mlt_properties_get_name( properties, i );
+	}
+	return properties;
+}
+
+static void properties_teardown( void *context )
+{
+	mlt_properties_close( context );
+}
+
+static void properties_int_run( void *context, int iterations )
+{
+	int i, sum = 0;
+	for ( i = 0; i < iterations; i++ )
+	{
+		const char *name = property_names[ ( i * 7 ) % PROPERTY_COUNT ];
+		mlt_properties_set_int( context, name, i );
+		sum += mlt_properties_get_int( context, name );
+	}
+	mlt_properties_set_int( context, "sum", sum );
+}
+
+static void properties_string_run( void *context, int iterations )
+{
+	int i;
+	for ( i = 0; i < iterations; i++ )
+	{
+		const char *name = property_names[ ( i * 7 ) % PROPERTY_COUNT ];
+		mlt_properties_set( context, name, "0=0/0:100%x100%;50=10%/10%:80%x80%" );
+		mlt_properties_get( context, name );
+	}
+}
+
+static void properties_anim_run( void *context, int iterations )
+{
+	int i;
+	mlt_properties_set( context, "anim", "0=0;25=100;50=0;75~=100;100|=0;125$=100;150=0" );
+	for ( i = 0; i < iterations; i++ )
+		mlt_properties_anim_get_double( context, "anim", i % 150, 150 );
+}
+
+static void pool_run( void *context, int iterations )
+{
+	static const int sizes[] = { 1920, 8192, 65536, 1920 * 1080 * 2, 1920 * 1080 * 4 };
+	void *blocks[ 8 ];
+	int i, j;
+	for ( i = 0; i < iterations; i++ )
+	{
+		for ( j = 0; j < 8; j++ )
+			blocks[ j ] = mlt_pool_alloc( sizes[ ( i + j ) % 5 ] );
+		for ( j = 0; j < 8; j++ )
+			mlt_pool_release( blocks[ j ] );
+	}
+}
+
+typedef struct
+{
+	mlt_cache cache;
+	char objects[ 20 ];
+} cache_context;
+
+static void *cache_setup( void )
+{
+	cache_context *context = calloc( 1, sizeof( cache_context ) );
+	context->cache = mlt_cache_init( );
+	mlt_cache_set_size( context->cache, 10 );
+	return context;
+}
+
+static void cache_teardown( void *context )
+{
+	mlt_cache_close( ( (cache_context*) context )->cache );
+	free( context );
+}
+
+static void cache_run( void *arg, int iterations )
+{
+	cache_context *context = arg;
+	int i;
+	// Twice as many objects as the cache holds so that some gets miss
+	for ( i = 0; i < iterations; i++ )
+	{
+		void *object = &context->objects[ ( i * 13 ) % 20 ];
+		mlt_cache_item item = mlt_cache_get( context->cache, object );
+		if ( item )
+			mlt_cache_item_close( item );
+		else
+			mlt_cache_put( context->cache, object, mlt_pool_alloc( 4096 ), 4096, mlt_pool_release );
+	}
+}
+
+typedef struct
+{
+	uint8_t *image;
+	int width;
+	int height;
+	int64_t sums[ 256 ];
+} slices_context;
+
+static void *slices_setup( void )
+{
+	slices_context *context = calloc( 1, sizeof( slices_context ) );
+	context->width = options.width;
+	context->height = options.height;
+	context->image = malloc( context->width * context->height * 4 );
+	memset( context->image, 128, context->width * context->height * 4 );
+	return context;
+}
+
+static void slices_teardown( void *arg )
+{
+	slices_context *context = arg;
+	free( context->image );
+	free( context );
+}
+
+static int slices_proc( int id, int index, int jobs, void *cookie )
+{
+	slices_context *context = cookie;
+	int start, x, y;
+	int height = mlt_slices_size_slice( jobs, index, context->height, &start );
+	int64_t sum = 0;
+	for ( y = start; y < start + height; y++ )
+	{
+		uint8_t *p = context->image + y * context->width * 4;
+		for ( x = 0; x < context->width * 4; x++ )
+			sum += p[ x ];
+	}
+	context->sums[ index % 256 ] = sum;
+	return 0;
+}
+
+static void slices_run( void *context, int iterations )
+{
+	int i;
+	for ( i = 0; i < iterations; i++ )
+		mlt_slices_run_normal( 0, slices_proc, context );
+}
+
+typedef struct
+{
+	mlt_animation animation;
+	struct mlt_animation_item_s item;
+	int length;
+} animation_context;
+
+static void *animation_setup( void )
+{
+	animation_context *context = calloc( 1, sizeof( animation_context ) );
+	char *data = malloc( 50 * 32 );
+	int i, n = 0;
+	for ( i = 0; i < 50; i++ )
+		n += sprintf( data + n, "%s%d%s=%d", i ? ";" : "", i * 10, i % 3 == 1 ? "~" : "", i * 37 % 100 );
+	context->length = 500;
+	context->animation = mlt_animation_new( );
+	mlt_animation_parse( context->animation, data, context->length, 25.0, NULL );
+	context->item.property = mlt_property_init( );
+	free( data );
+	return context;
+}
+
+static void animation_teardown( void *arg )
+{
+	animation_context *context = arg;
+	mlt_property_close( context->item.property );
+	mlt_animation_close( context->animation );
+	free( context );
+}
+
+static void animation_run( void *arg, int iterations )
+{
+	animation_context *context = arg;
+	int i;
+	for ( i = 0; i < iterations; i++ )
+		mlt_animation_get_item( context->animation, &context->item, ( i * 97 ) % context->length );
+}
+
+/** Setting properties of a service, which fires "property-changed". */
+
+static void event_listener( mlt_properties owner, void *data, mlt_event_data event_data )
+{
+	( *( int* ) data )++;
+}
+
+static int event_count;
+
+static void *events_setup( void )
+{
+	mlt_properties properties = properties_setup( );
+	mlt_events_init( properties );
+	mlt_events_register( properties, "service-changed" );
+	mlt_events_register( properties, "property-changed" );
+	return properties;
+}
+
+static void *events_listened_setup( void )
+{
+	mlt_properties properties = events_setup( );
+	mlt_events_listen( properties, &event_count, "property-changed", ( mlt_listener ) event_listener );
+	return properties;
+}
+
+static void events_batched_run( void *context, int iterations )
+{
+	mlt_events_begin_batch( context );
+	properties_int_run( context, iterations );
+	mlt_events_end_batch( context );
+}
+
+/** Conversions are timed through the normalising filters that a consumer
+    attaches, so they include whatever those pick (imageconvert or
+    avcolor_space, audioconvert).
+*/
+
+typedef struct
+{
+	mlt_profile profile;
+	mlt_filter filter;
+	mlt_image_format image_from;
+	mlt_image_format image_to;
+	mlt_audio_format audio_from;
+	mlt_audio_format audio_to;
+	uint8_t *source;
+} convert_context;
+
+static convert_context *convert_new( const char *filter )
+{
+	convert_context *context = calloc( 1, sizeof( convert_context ) );
+	context->profile = mlt_profile_init( NULL );
+	context->filter = mlt_factory_filter( context->profile, filter, NULL );
+	return context;
+}
+
+static void convert_teardown( void *arg )
+{
+	convert_context *context = arg;
+	mlt_filter_close( context->filter );
+	mlt_profile_close( context->profile );
+	free( context->source );
+	free( context );
+}
+
+static void *image_setup( mlt_image_format from, mlt_image_format to )
+{
+	convert_context *context = convert_new( "avcolor_space" );
+	int size = mlt_image_format_size( from, options.width, options.height, NULL );
+	int i;
+	if ( !context->filter )
+		context->filter = mlt_factory_filter( context->profile, "imageconvert", NULL );
+	if ( !context->filter )
+	{
+		convert_teardown( context );
+		return NULL;
+	}
+	context->image_from = from;
+	context->image_to = to;
+	context->source = malloc( size );
+	for ( i = 0; i < size; i++ )
+		context->source[ i ] = i * 31;
+	return context;
+}
+
+static void *rgba_to_yuv422_setup( void )
+{
+	return image_setup( mlt_image_rgba, mlt_image_yuv422 );
+}
+
+static void *yuv422_to_rgba_setup( void )
+{
+	return image_setup( mlt_image_yuv422, mlt_image_rgba );
+}
+
+static void *yuv422_to_yuv420p_setup( void )
+{
+	return image_setup( mlt_image_yuv422, mlt_image_yuv420p );
+}
+
+static void *rgb_to_yuv422_setup( void )
+{
+	return image_setup( mlt_image_rgb, mlt_image_yuv422 );
+}
+
+static void image_run( void *arg, int iterations )
+{
+	convert_context *context = arg;
+	int i;
+	for ( i = 0; i < iterations; i++ )
+	{
+		mlt_frame frame = mlt_frame_init( NULL );
+		mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+		mlt_image_format format = context->image_to;
+		int width = options.width;
+		int height = options.height;
+		uint8_t *image = NULL;
+
+		mlt_frame_set_image( frame, context->source, 0, NULL );
+		mlt_properties_set_int( properties, "format", context->image_from );
+		mlt_properties_set_int( properties, "width", width );
+		mlt_properties_set_int( properties, "height", height );
+		mlt_filter_process( context->filter, frame );
+		mlt_frame_get_image( frame, &image, &format, &width, &height, 0 );
+		mlt_frame_close( frame );
+	}
+}
+
+static void *audio_setup( mlt_audio_format from, mlt_audio_format to )
+{
+	convert_context *context = convert_new( "audioconvert" );
+	int size = mlt_audio_format_size( from, 1920, 2 );
+	int i;
+	if ( !context->filter )
+	{
+		convert_teardown( context );
+		return NULL;
+	}
+	context->audio_from = from;
+	context->audio_to = to;
+	context->source = malloc( size );
+	// Any pattern is a valid s16 or a finite float sample
+	for ( i = 0; i < size; i++ )
+		context->source[ i ] = i & 3 ? i * 31 : 0;
+	return context;
+}
+
+static void *s16_to_float_setup( void )
+{
+	return audio_setup( mlt_audio_s16, mlt_audio_float );
+}
+
+static void *float_to_s16_setup( void )
+{
+	return audio_setup( mlt_audio_float, mlt_audio_s16 );
+}
+
+static void *f32le_to_s32_setup( void )
+{
+	return audio_setup( mlt_audio_f32le, mlt_audio_s32 );
+}
+
+static void audio_run( void *arg, int iterations )
+{
+	convert_context *context = arg;
+	int i;
+	for ( i = 0; i < iterations; i++ )
+	{
+		mlt_frame frame = mlt_frame_init( NULL );
+		mlt_audio_format format = context->audio_to;
+		int frequency = 48000;
+		int channels = 2;
+		int samples = 1920;
+		void *audio = NULL;
+
+		mlt_frame_set_audio( frame, context->source, context->audio_from, 0, NULL );
+		mlt_properties_set_int( MLT_FRAME_PROPERTIES( frame ), "audio_frequency", frequency );
+		mlt_properties_set_int( MLT_FRAME_PROPERTIES( frame ), "audio_channels", channels );
+		mlt_properties_set_int( MLT_FRAME_PROPERTIES( frame ), "audio_samples", samples );
+		mlt_filter_process( context->filter, frame );
+		mlt_frame_get_audio( frame, &audio, &format, &frequency, &channels, &samples );
+		mlt_frame_close( frame );
+	}
+}
+
+/** The audio kernels are timed on one 48kHz stereo frame at 25fps, along
+    with a plain loop of the same gain and mix as a baseline.
+*/
+
+#define DSP_SAMPLES 1920
+
+typedef struct
+{
+	float a[ DSP_SAMPLES * 2 ];
+	float b[ DSP_SAMPLES * 2 ];
+	int16_t s16[ DSP_SAMPLES * 2 ];
+} dsp_context;
+
+static void *dsp_setup( void )
+{
+	dsp_context *context = calloc( 1, sizeof( dsp_context ) );
+	int i;
+	for ( i = 0; i < DSP_SAMPLES * 2; i++ )
+	{
+		context->a[ i ] = context->b[ i ] = ( i % 200 - 100 ) / 100.0f;
+		context->s16[ i ] = i * 31;
+	}
+	return context;
+}
+
+static void dsp_teardown( void *context )
+{
+	free( context );
+}
+
+static void dsp_gain_run( void *arg, int iterations )
+{
+	dsp_context *context = arg;
+	int i;
+	for ( i = 0; i < iterations; i++ )
+		mlt_audio_dsp_gain( context->a, 2, DSP_SAMPLES, i & 1 ? 0.5 : 2.0, 1e-6 );
+}
+
+static void dsp_gain_scalar_run( void *arg, int iterations )
+{
+	dsp_context *context = arg;
+	int i, s, c;
+	for ( i = 0; i < iterations; i++ )
+	{
+		double gain = i & 1 ? 0.5 : 2.0;
+		for ( s = 0; s < DSP_SAMPLES; s++, gain += 1e-6 )
+			for ( c = 0; c < 2; c++ )
+				context->a[ s * 2 + c ] *= gain;
+	}
+}
+
+static void dsp_mix_run( void *arg, int iterations )
+{
+	dsp_context *context = arg;
+	int i;
+	for ( i = 0; i < iterations; i++ )
+		mlt_audio_dsp_mix( context->a, context->b, 2, DSP_SAMPLES, 0.0, 1.0 / DSP_SAMPLES );
+}
+
+static void dsp_mix_scalar_run( void *arg, int iterations )
+{
+	dsp_context *context = arg;
+	int i, s, c;
+	for ( i = 0; i < iterations; i++ )
+	{
+		double weight = 0;
+		for ( s = 0; s < DSP_SAMPLES; s++, weight += 1.0 / DSP_SAMPLES )
+			for ( c = 0; c < 2; c++ )
+				context->a[ s * 2 + c ] = context->a[ s * 2 + c ] * ( 1.0 - weight ) + context->b[ s * 2 + c ] * weight;
+	}
+}
+
+static void dsp_s16_to_float_run( void *arg, int iterations )
+{
+	dsp_context *context = arg;
+	int i;
+	for ( i = 0; i < iterations; i++ )
+		mlt_audio_dsp_s16_to_float( context->a, context->s16, DSP_SAMPLES * 2 );
+}
+
+static micro_benchmark micro_benchmarks[] =
+{
+	{ "properties_set_get_int", properties_setup, properties_int_run, properties_teardown },
+	{ "properties_set_get_string", properties_setup, properties_string_run, properties_teardown },
+	{ "properties_anim_get_double", properties_setup, properties_anim_run, properties_teardown },
+	{ "pool_alloc_release_x8", NULL, pool_run, NULL },
+	{ "cache_get_put", cache_setup, cache_run, cache_teardown },
+	{ "slices_run_sum_rgba", slices_setup, slices_run, slices_teardown },
+	{ "animation_get_item", animation_setup, animation_run, animation_teardown },
+	{ "events_set_int", events_setup, properties_int_run, properties_teardown },
+	{ "events_set_int_listened", events_listened_setup, properties_int_run, properties_teardown },
+	{ "events_set_int_batched", events_listened_setup, events_batched_run, properties_teardown },
+	{ "image_rgba_to_yuv422", rgba_to_yuv422_setup, image_run, convert_teardown },
+	{ "image_yuv422_to_rgba", yuv422_to_rgba_setup, image_run, convert_teardown },
+	{ "image_yuv422_to_yuv420p", yuv422_to_yuv420p_setup, image_run, convert_teardown },
+	{ "image_rgb_to_yuv422", rgb_to_yuv422_setup, image_run, convert_teardown },
+	{ "audio_s16_to_float", s16_to_float_setup, audio_run, convert_teardown },
+	{ "audio_float_to_s16", float_to_s16_setup, audio_run, convert_teardown },
+	{ "audio_f32le_to_s32", f32le_to_s32_setup, audio_run, convert_teardown },
+	{ "audio_dsp_gain", dsp_setup, dsp_gain_run, dsp_teardown },
+	{ "audio_scalar_gain", dsp_setup, dsp_gain_scalar_run, dsp_teardown },
+	{ "audio_dsp_mix", dsp_setup, dsp_mix_run, dsp_teardown },
+	{ "audio_scalar_mix", dsp_setup, dsp_mix_scalar_run, dsp_teardown },
+	{ "audio_dsp_s16_to_float", dsp_setup, dsp_s16_to_float_run, dsp_teardown },
+	{ NULL }
+};
+
+/* Macro scenarios
+ *
+ * Each builds a graph of synthetic producers and renders it with the null
+ * consumer (or several through the multi consumer), recording when every
+ * frame is shown.
+ */
+
+typedef struct
+{
+	double *shown;
+	int count;
+	int size;
+} frame_times;
+
+static void on_frame_show( mlt_properties owner, frame_times *times, mlt_event_data event_data )
+{
+	if ( times->count < times->size )
+		times->shown[ times->count++ ] = now( );
+}
+
+static mlt_producer create_producer( mlt_profile profile, const char *service, const char *arg, int length )
+{
+	mlt_producer producer = mlt_factory_producer( profile, service, arg );
+	if ( producer )
+	{
+		mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( producer ), "length", length );
+		mlt_producer_set_in_and_out( producer, 0, length - 1 );
+	}
+	return producer;
+}
+
+/** Add a track to a tractor and let the tractor own it. */
+
+static int add_track( mlt_tractor tractor, mlt_producer producer, int track )
+{
+	if ( !producer )
+		return 1;
+	mlt_tractor_set_track( tractor, producer, track );
+	mlt_producer_close( producer );
+	return 0;
+}
+
+static int add_transition( mlt_tractor tractor, const char *service, int a_track, int b_track, const char *name, const char *value )
+{
+	mlt_transition transition = mlt_factory_transition( mlt_service_profile( MLT_TRACTOR_SERVICE( tractor ) ), service, NULL );
+	if ( !transition )
+		return 1;
+	if ( name )
+		mlt_properties_set( MLT_TRANSITION_PROPERTIES( transition ), name, value );
+	mlt_properties_set_int( MLT_TRANSITION_PROPERTIES( transition ), "always_active", 1 );
+	mlt_field_plant_transition( mlt_tractor_field( tractor ), transition, a_track, b_track );
+	mlt_transition_close( transition );
+	return 0;
+}
+
+/** Composite tracks - 1 noise images, scaled and moving, over a colour. */
+
+static mlt_producer composite_graph( mlt_profile profile, int frames )
+{
+	mlt_tractor tractor = mlt_tractor_new( );
+	int error = 0, i;
+
+	mlt_service_set_profile( MLT_TRACTOR_SERVICE( tractor ), profile );
+	error |= add_track( tractor, create_producer( profile, "colour", "0x202020ff", frames ), 0 );
+	for ( i = 1; i < options.tracks; i++ )
+	{
+		char geometry[ 64 ];
+		snprintf( geometry, sizeof( geometry ), "0=0/0:100%%x100%%;-1=%d%%/%d%%:50%%x50%%:50", i * 5, i * 5 );
+		error |= add_track( tractor, create_producer( profile, "noise", NULL, frames ), i );
+		error |= add_transition( tractor, "composite", 0, i, "geometry", geometry );
+	}
+	error |= add_track( tractor, create_producer( profile, "tone", NULL, frames ), options.tracks );
+	if ( error )
+	{
+		mlt_tractor_close( tractor );
+		return NULL;
+	}
+	return MLT_TRACTOR_PRODUCER( tractor );
+}
+
+/** Dissolve between a colour and noise with a luma transition. */
+
+static mlt_producer luma_graph( mlt_profile profile, int frames )
+{
+	mlt_tractor tractor = mlt_tractor_new( );
+	int error = 0;
+
+	mlt_service_set_profile( MLT_TRACTOR_SERVICE( tractor ), profile );
+	error |= add_track( tractor, create_producer( profile, "colour", "red", frames ), 0 );
+	error |= add_track( tractor, create_producer( profile, "noise", NULL, frames ), 1 );
+	error |= add_transition( tractor, "luma", 0, 1, NULL, NULL );
+	error |= add_track( tractor, create_producer( profile, "tone", NULL, frames ), 2 );
+	if ( error )
+	{
+		mlt_tractor_close( tractor );
+		return NULL;
+	}
+	return MLT_TRACTOR_PRODUCER( tractor );
+}
+
+static mlt_consumer null_consumer( mlt_profile profile )
+{
+	return mlt_factory_consumer( profile, "null", NULL );
+}
+
+/** Render the dissolve to two outputs, the second at half the size. */
+
+static mlt_consumer multi_consumer( mlt_profile profile )
+{
+	mlt_consumer consumer = mlt_factory_consumer( profile, "multi", NULL );
+	if ( consumer )
+	{
+		mlt_properties properties = MLT_CONSUMER_PROPERTIES( consumer );
+		mlt_properties_set( properties, "0", "null" );
+		mlt_properties_set( properties, "1", "null" );
+		mlt_properties_set_int( properties, "1.width", profile->width / 2 );
+		mlt_properties_set_int( properties, "1.height", profile->height / 2 );
+		mlt_properties_set_int( properties, "0.real_time", options.real_time );
+		mlt_properties_set_int( properties, "1.real_time", options.real_time );
+	}
+	return consumer;
+}
+
+typedef struct
+{
+	const char *name;
+	mlt_producer ( *graph )( mlt_profile profile, int frames );
+	mlt_consumer ( *consumer )( mlt_profile profile );
+} macro_benchmark;
+
+static macro_benchmark macro_benchmarks[] =
+{
+	{ "composite", composite_graph, null_consumer },
+	{ "luma_dissolve", luma_graph, null_consumer },
+	{ "multi_output", luma_graph, multi_consumer },
+	{ NULL }
+};
+
+static mlt_profile create_profile( )
+{
+	mlt_profile profile = mlt_profile_init( options.profile );
+	if ( !options.profile )
+	{
+		profile->width = options.width;
+		profile->height = options.height;
+		profile->frame_rate_num = 25;
+		profile->frame_rate_den = 1;
+		profile->progressive = 1;
+		profile->sample_aspect_num = 1;
+		profile->sample_aspect_den = 1;
+		profile->display_aspect_num = options.width;
+		profile->display_aspect_den = options.height;
+		profile->colorspace = 709;
+	}
+	return profile;
+}
+
+static void run_macro( macro_benchmark *bench )
+{
+	mlt_profile profile = create_profile( );
+	mlt_producer producer;
+	mlt_consumer consumer;
+	frame_times times;
+	double start, *intervals;
+	char name[ 64 ];
+	int i;
+
+	reset_peak_memory( );
+	producer = bench->graph( profile, options.frames );
+	consumer = producer ? bench->consumer( profile ) : NULL;
+	if ( !consumer )
+	{
+		fprintf( stderr, "%s: could not create the services\n", bench->name );
+		mlt_producer_close( producer );
+		mlt_profile_close( profile );
+		return;
+	}
+
+	times.size = options.frames;
+	times.count = 0;
+	times.shown = calloc( times.size, sizeof( double ) );
+	intervals = calloc( times.size, sizeof( double ) );
+
+	mlt_properties_set_int( MLT_CONSUMER_PROPERTIES( consumer ), "real_time", options.real_time );
+	mlt_properties_set_int( MLT_CONSUMER_PROPERTIES( consumer ), "terminate_on_pause", 1 );
+	mlt_events_listen( MLT_CONSUMER_PROPERTIES( consumer ), &times, "consumer-frame-show", (mlt_listener) on_frame_show );
+	mlt_consumer_connect( consumer, MLT_PRODUCER_SERVICE( producer ) );
+
+	start = now( );
+	mlt_consumer_start( consumer );
+	while ( !mlt_consumer_is_stopped( consumer ) )
+	{
+		struct timespec tm = { 0, 1000000 };
+		nanosleep( &tm, NULL );
+	}
+	mlt_consumer_stop( consumer );
+
+	for ( i = 0; i < times.count; i++ )
+		intervals[ i ] = times.shown[ i ] - ( i ? times.shown[ i - 1 ] : start );
+
+	if ( bench->graph == composite_graph )
+		snprintf( name, sizeof( name ), "%s_%d_tracks", bench->name, options.tracks );
+	else
+		snprintf( name, sizeof( name ), "%s", bench->name );
+	printf( "{\"benchmark\":\"%s\",\"type\":\"macro\",\"width\":%d,\"height\":%d,\"real_time\":%d,\"frames\":%d",
+		name, profile->width, profile->height, options.real_time, times.count );
+	if ( times.count > 0 )
+		printf( ",\"seconds\":%.3f,\"fps\":%.2f,\"first_frame_ms\":%.3f",
+			times.shown[ times.count - 1 ] - start, times.count / ( times.shown[ times.count - 1 ] - start ),
+			intervals[ 0 ] * 1000 );
+	print_distribution( "frame_ms", intervals, times.count, 1000 );
+	printf( ",\"peak_rss_kib\":%ld}\n", peak_memory( ) );
+	fflush( stdout );
+
+	mlt_consumer_close( consumer );
+	mlt_producer_close( producer );
+	mlt_profile_close( profile );
+	free( times.shown );
+	free( intervals );
+}
+
+static void show_usage( char *program_name )
+{
+	fprintf( stderr,
+"Usage: %s [options]\n"
+"Options:\n"
+"  -filter text        Only run the benchmarks whose name contains text\n"
+"  -frames number      Frames to render in each scenario (default 250)\n"
+"  -help               Show this message\n"
+"  -list               List the benchmarks\n"
+"  -macro              Only run the rendering scenarios\n"
+"  -micro              Only run the microbenchmarks\n"
+"  -profile name       Use this profile rather than 1920x1080 25p\n"
+"  -real_time number   The consumer real_time for the scenarios (default -1)\n"
+"  -seconds number     Time to spend on each microbenchmark (default 1)\n"
+"  -size WxH           The image size when no profile is given\n"
+"  -tracks number      Tracks in the composite scenario (default 4)\n"
+"\n"
+"Each result is written to stdout as one line of JSON. Set MLT_AUDIO_DSP=c\n"
+"to time the portable audio kernels.\n",
+	program_name );
+}
+
+int main( int argc, char **argv )
+{
+	int i;
+
+	for ( i = 1; i < argc; i++ )
+	{
+		const char *arg = argv[ i ];
+		const char *value = i + 1 < argc ? argv[ i + 1 ] : NULL;
+
+		if ( !strcmp( arg, "-micro" ) )
+			options.macro = 0;
+		else if ( !strcmp( arg, "-macro" ) )
+			options.micro = 0;
+		else if ( !strcmp( arg, "-list" ) )
+		{
+			micro_benchmark *micro;
+			macro_benchmark *macro;
+			for ( micro = micro_benchmarks; micro->name; micro++ )
+				printf( "%s\n", micro->name );
+			for ( macro = macro_benchmarks; macro->name; macro++ )
+				printf( "%s\n", macro->name );
+			return 0;
+		}
+		else if ( !strcmp( arg, "-help" ) || !strcmp( arg, "--help" ) )
+		{
+			show_usage( argv[ 0 ] );
+			return 0;
+		}
+		else if ( value && !strcmp( arg, "-filter" ) )
+			options.match = argv[ ++i ];
+		else if ( value && !strcmp( arg, "-frames" ) )
+			options.frames = atoi( argv[ ++i ] );
+		else if ( value && !strcmp( arg, "-profile" ) )
+			options.profile = argv[ ++i ];
+		else if ( value && !strcmp( arg, "-real_time" ) )
+			options.real_time = atoi( argv[ ++i ] );
+		else if ( value && !strcmp( arg, "-seconds" ) )
+			options.seconds = atof( argv[ ++i ] );
+		else if ( value && !strcmp( arg, "-size" ) )
+			sscanf( argv[ ++i ], "%dx%d", &options.width, &options.height );
+		else if ( value && !strcmp( arg, "-tracks" ) )
+			options.tracks = atoi( argv[ ++i ] );
+		else
+		{
+			show_usage( argv[ 0 ] );
+			return 1;
+		}
+	}
+	if ( options.frames < 1 || options.tracks < 1 || options.width < 2 || options.height < 2 )
+	{
+		show_usage( argv[ 0 ] );
+		return 1;
+	}
+
+	setlocale( LC_ALL, "C" );
+	if ( !mlt_factory_init( NULL ) )
+	{
+		fprintf( stderr, "%s: unable to initialize the MLT framework\n", argv[ 0 ] );
+		return 1;
+	}
+	mlt_log_set_level( MLT_LOG_ERROR );
+
+	printf( "{\"mlt_version\":\"%s\",\"audio_dsp\":\"%s\",\"slices\":%d}\n",
+		mlt_version_get_string( ), mlt_audio_dsp_name( ), mlt_slices_count_normal( ) );
+	fflush( stdout );
+
+	if ( options.micro )
+	{
+		micro_benchmark *bench;
+		for ( bench = micro_benchmarks; bench->name; bench++ )
+			if ( selected( bench->name ) )
+				run_micro( bench );
+	}
+	if ( options.macro )
+	{
+		macro_benchmark *bench;
+		for ( bench = macro_benchmarks; bench->name; bench++ )
+			if ( selected( bench->name ) )
+				run_macro( bench );
+	}
+
+	mlt_factory_close( );
+	return 0;
+}
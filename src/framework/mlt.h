@@ -38,6 +38,7 @@ extern "C"
 
 #include "mlt_animation.h"
 #include "mlt_audio.h"
+#include "mlt_audio_dsp.h"
 #include "mlt_factory.h"
 #include "mlt_frame.h"
 #include "mlt_image.h"
@@ -59,6 +60,7 @@ extern "C"
 #include "mlt_cache.h"
 #include "mlt_version.h"
 #include "mlt_slices.h"
+#include "mlt_profiler.h"
 #include "mlt_link.h"
 #include "mlt_chain.h"
 
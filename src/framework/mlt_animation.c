@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <float.h>
 
 /** \brief animation list node pointer */
 typedef struct animation_node_s *animation_node;
@@ -52,9 +53,24 @@ struct mlt_animation_s
 	double fps;           /**< framerate to use when converting time clock strings to frame units */
 	locale_t locale;      /**< pointer to a locale to use when converting strings to numeric values */
 	animation_node nodes; /**< a linked list of keyframes (and possibly non-keyframe values) */
+
+	int compiled;         /**< whether the arrays below reflect the nodes */
+	int count;            /**< the number of nodes */
+	int size;             /**< the allocated length of the arrays */
+	int sorted;           /**< whether the frames are in ascending order */
+	int cursor;           /**< the index of the node found by the last lookup */
+	animation_node *index; /**< the nodes in list order */
+	int *frames;          /**< the frame of each node */
+	uint8_t *types;       /**< the keyframe type of each node */
+	uint8_t *numeric;     /**< whether each node's value is numeric */
+	double *doubles;      /**< each node's value as a real number, NULL until needed */
+	int *ints;            /**< each node's value as an integer, NULL until needed */
+	mlt_rect *rects;      /**< each node's value as a rectangle, NULL until needed */
+	mlt_color *colors;    /**< each node's value as a color, NULL until needed */
 };
 
 static void mlt_animation_clear_string( mlt_animation self );
+static void mlt_animation_changed( mlt_animation self );
 
 /** Create a new animation object.
  *
@@ -79,6 +95,7 @@ void mlt_animation_interpolate( mlt_animation self )
 	// Parse all items to ensure non-keyframes are calculated correctly.
 	if ( self && self->nodes )
 	{
+		mlt_animation_changed( self );
 		animation_node current = self->nodes;
 		while ( current )
 		{
@@ -148,6 +165,7 @@ static int mlt_animation_drop( mlt_animation self, animation_node node )
 	}
 	mlt_property_close( node->item.property );
 	free( node );
+	mlt_animation_changed( self );
 
 	return 0;
 }
@@ -199,6 +217,7 @@ int mlt_animation_parse(mlt_animation self, const char *data, int length, double
 	self->length = length;
 	self->fps = fps;
 	self->locale = locale;
+	mlt_animation_changed( self );
 	item.property = mlt_property_init();
 	item.frame = item.is_key = 0;
 	item.keyframe_type = mlt_keyframe_discrete;
@@ -382,6 +401,337 @@ int mlt_animation_parse_item( mlt_animation self, mlt_animation_item item, const
 	return error;
 }
 
+/** Mark the compiled form of the animation out of date.
+ *
+ * \private \memberof mlt_animation_s
+ * \param self an animation
+ */
+
+static void mlt_animation_changed( mlt_animation self )
+{
+	self->compiled = 0;
+	free( self->doubles );
+	free( self->ints );
+	free( self->rects );
+	free( self->colors );
+	self->doubles = NULL;
+	self->ints = NULL;
+	self->rects = NULL;
+	self->colors = NULL;
+}
+
+/** Copy the nodes into arrays indexed by their position in the list.
+ *
+ * The values are converted separately for each type when first needed.
+ * \private \memberof mlt_animation_s
+ * \param self an animation
+ * \return the number of nodes
+ */
+
+static int compile( mlt_animation self )
+{
+	animation_node node;
+	int i;
+
+	if ( self->compiled )
+		return self->count;
+
+	for ( i = 0, node = self->nodes; node; node = node->next )
+		i++;
+	if ( i > self->size )
+	{
+		self->size = i + 8;
+		self->index = realloc( self->index, self->size * sizeof( *self->index ) );
+		self->frames = realloc( self->frames, self->size * sizeof( *self->frames ) );
+		self->types = realloc( self->types, self->size * sizeof( *self->types ) );
+		self->numeric = realloc( self->numeric, self->size * sizeof( *self->numeric ) );
+	}
+	self->count = i;
+	self->sorted = 1;
+	self->cursor = 0;
+	for ( i = 0, node = self->nodes; node; node = node->next, i++ )
+	{
+		self->index[ i ] = node;
+		self->frames[ i ] = node->item.frame;
+		self->types[ i ] = node->item.keyframe_type;
+		self->numeric[ i ] = mlt_property_is_numeric( node->item.property, self->locale );
+		if ( i > 0 && self->frames[ i ] < self->frames[ i - 1 ] )
+			self->sorted = 0;
+	}
+	self->compiled = 1;
+
+	return self->count;
+}
+
+/** Find the last node at or before a position, or else the first node.
+ *
+ * Consecutive lookups usually land in the same or the next segment, so that
+ * is tried before a binary search.
+ * \private \memberof mlt_animation_s
+ * \param self a compiled animation with at least one node
+ * \param position a frame number
+ * \return the index of the node
+ */
+
+static int find_node( mlt_animation self, int position )
+{
+	const int *frames = self->frames;
+	int last = self->count - 1;
+	int i = self->cursor;
+
+	if ( !self->sorted )
+	{
+		// Keyframes moved out of order are searched as the list would be
+		for ( i = 0; i < last && position >= frames[ i + 1 ]; i++ );
+		return i;
+	}
+	if ( i > last )
+		i = 0;
+	if ( position >= frames[ i ] && ( i == last || position < frames[ i + 1 ] ) )
+		return i;
+	if ( i < last && position >= frames[ i + 1 ] && ( i + 1 == last || position < frames[ i + 2 ] ) )
+		return self->cursor = i + 1;
+
+	// The last node whose frame is not after the position
+	int low = 0, high = last;
+	while ( low < high )
+	{
+		int middle = ( low + high + 1 ) / 2;
+		if ( frames[ middle ] <= position )
+			low = middle;
+		else
+			high = middle - 1;
+	}
+	return self->cursor = low;
+}
+
+/** Find the keyframes around a position.
+ *
+ * \private \memberof mlt_animation_s
+ * \param self a compiled animation with at least one node
+ * \param position a frame number
+ * \param[out] progress how far the position is from node \p index to the next
+ * \param[out] index the node at or before the position
+ * \return true if the value must be interpolated, false to use node \p index
+ */
+
+static int find_segment( mlt_animation self, int position, int *index, double *progress )
+{
+	int i = find_node( self, position );
+
+	*index = i;
+	if ( position <= self->frames[ i ] || i == self->count - 1 )
+		return 0;
+	*progress = position - self->frames[ i ];
+	*progress /= self->frames[ i + 1 ] - self->frames[ i ];
+	return 1;
+}
+
+/** The same interpolations as mlt_property_interpolate() uses. */
+
+static inline double linear_interpolate( double y1, double y2, double t )
+{
+	return y1 + ( y2 - y1 ) * t;
+}
+
+static inline double catmull_rom_interpolate( double y0, double y1, double y2, double y3, double t )
+{
+	double t2 = t * t;
+	double a0 = -0.5 * y0 + 1.5 * y1 - 1.5 * y2 + 0.5 * y3;
+	double a1 = y0 - 2.5 * y1 + 2 * y2 - 0.5 * y3;
+	double a2 = -0.5 * y0 + 0.5 * y2;
+	double a3 = y1;
+	return a0 * t * t2 + a1 * t2 + a2 * t + a3;
+}
+
+static double *compile_doubles( mlt_animation self )
+{
+	int i;
+	if ( !self->doubles )
+	{
+		self->doubles = malloc( self->count * sizeof( double ) );
+		for ( i = 0; i < self->count; i++ )
+			self->doubles[ i ] = mlt_property_get_double( self->index[ i ]->item.property, self->fps, self->locale );
+	}
+	return self->doubles;
+}
+
+/** Interpolate the real numbers of segment \p i like mlt_property_interpolate(). */
+
+static int interpolate_double( mlt_animation self, int i, double progress, double *result )
+{
+	const double *values = self->doubles;
+	int last = self->count - 1;
+
+	if ( self->types[ i ] == mlt_keyframe_discrete || !self->numeric[ i ] || !self->numeric[ i + 1 ] )
+		return 0;
+	if ( self->types[ i ] == mlt_keyframe_smooth )
+		*result = catmull_rom_interpolate( values[ i > 0 ? i - 1 : i ], values[ i ], values[ i + 1 ],
+			values[ i + 1 < last ? i + 2 : i + 1 ], progress );
+	else
+		*result = linear_interpolate( values[ i ], values[ i + 1 ], progress );
+	return 1;
+}
+
+/** Get the real number at a frame position.
+ *
+ * This gives the same result as loading the item with mlt_animation_get_item()
+ * and getting its property as a real number, but it does not need to convert
+ * any strings once the keyframes have been compiled.
+ * \public \memberof mlt_animation_s
+ * \param self an animation
+ * \param position the frame number
+ * \return the real number, 0 if there are no keyframes
+ */
+
+double mlt_animation_get_double( mlt_animation self, int position )
+{
+	double progress, result;
+	int i;
+
+	if ( !self || !compile( self ) )
+		return 0;
+	compile_doubles( self );
+	if ( !find_segment( self, position, &i, &progress ) || !interpolate_double( self, i, progress, &result ) )
+		result = self->doubles[ i ];
+	return result;
+}
+
+/** Get the integer at a frame position.
+ *
+ * Interpolated values are truncated like a property holding a real number.
+ * \public \memberof mlt_animation_s
+ * \param self an animation
+ * \param position the frame number
+ * \return the integer, 0 if there are no keyframes
+ */
+
+int mlt_animation_get_int( mlt_animation self, int position )
+{
+	double progress, result;
+	int i;
+
+	if ( !self || !compile( self ) )
+		return 0;
+	compile_doubles( self );
+	if ( find_segment( self, position, &i, &progress ) && interpolate_double( self, i, progress, &result ) )
+		return ( int ) result;
+	if ( !self->ints )
+	{
+		int n;
+		self->ints = malloc( self->count * sizeof( int ) );
+		for ( n = 0; n < self->count; n++ )
+			self->ints[ n ] = mlt_property_get_int( self->index[ n ]->item.property, self->fps, self->locale );
+	}
+	return self->ints[ i ];
+}
+
+/** Get the rectangle at a frame position.
+ *
+ * \public \memberof mlt_animation_s
+ * \param self an animation
+ * \param position the frame number
+ * \return the rectangle, whose fields are DBL_MIN if there are no keyframes
+ */
+
+mlt_rect mlt_animation_get_rect( mlt_animation self, int position )
+{
+	mlt_rect result = { DBL_MIN, DBL_MIN, DBL_MIN, DBL_MIN, DBL_MIN };
+	const mlt_rect *r;
+	double t;
+	int i;
+
+	if ( !self || !compile( self ) )
+		return result;
+	if ( !self->rects )
+	{
+		self->rects = malloc( self->count * sizeof( mlt_rect ) );
+		for ( i = 0; i < self->count; i++ )
+			self->rects[ i ] = mlt_property_get_rect( self->index[ i ]->item.property, self->locale );
+	}
+	r = self->rects;
+	if ( !find_segment( self, position, &i, &t ) || self->types[ i ] == mlt_keyframe_discrete
+		 || !self->numeric[ i ] || !self->numeric[ i + 1 ] )
+	{
+		result = r[ i ];
+	}
+	else if ( self->types[ i ] == mlt_keyframe_smooth )
+	{
+		int last = self->count - 1;
+		const mlt_rect *a = &r[ i > 0 ? i - 1 : i ];
+		const mlt_rect *d = &r[ i + 1 < last ? i + 2 : i + 1 ];
+		result.x = catmull_rom_interpolate( a->x, r[ i ].x, r[ i + 1 ].x, d->x, t );
+		result.y = catmull_rom_interpolate( a->y, r[ i ].y, r[ i + 1 ].y, d->y, t );
+		result.w = catmull_rom_interpolate( a->w, r[ i ].w, r[ i + 1 ].w, d->w, t );
+		result.h = catmull_rom_interpolate( a->h, r[ i ].h, r[ i + 1 ].h, d->h, t );
+		result.o = catmull_rom_interpolate( a->o, r[ i ].o, r[ i + 1 ].o, d->o, t );
+	}
+	else
+	{
+		result.x = linear_interpolate( r[ i ].x, r[ i + 1 ].x, t );
+		result.y = linear_interpolate( r[ i ].y, r[ i + 1 ].y, t );
+		result.w = linear_interpolate( r[ i ].w, r[ i + 1 ].w, t );
+		result.h = linear_interpolate( r[ i ].h, r[ i + 1 ].h, t );
+		result.o = linear_interpolate( r[ i ].o, r[ i + 1 ].o, t );
+	}
+	return result;
+}
+
+static uint8_t clamp_color( double value )
+{
+	return value <= 0.0 ? 0 : value >= 255.0 ? 255 : (uint8_t) ( value + 0.5 );
+}
+
+/** Get the color at a frame position.
+ *
+ * Each component is interpolated unless the keyframe is discrete.
+ * \public \memberof mlt_animation_s
+ * \param self an animation
+ * \param position the frame number
+ * \return the color, opaque white if there are no keyframes
+ * \see mlt_property_get_color
+ */
+
+mlt_color mlt_animation_get_color( mlt_animation self, int position )
+{
+	mlt_color result = { 0xff, 0xff, 0xff, 0xff };
+	const mlt_color *c;
+	double t;
+	int i;
+
+	if ( !self || !compile( self ) )
+		return result;
+	if ( !self->colors )
+	{
+		self->colors = malloc( self->count * sizeof( mlt_color ) );
+		for ( i = 0; i < self->count; i++ )
+			self->colors[ i ] = mlt_property_get_color( self->index[ i ]->item.property, self->fps, self->locale );
+	}
+	c = self->colors;
+	if ( !find_segment( self, position, &i, &t ) || self->types[ i ] == mlt_keyframe_discrete )
+	{
+		result = c[ i ];
+	}
+	else if ( self->types[ i ] == mlt_keyframe_smooth )
+	{
+		int last = self->count - 1;
+		const mlt_color *a = &c[ i > 0 ? i - 1 : i ];
+		const mlt_color *d = &c[ i + 1 < last ? i + 2 : i + 1 ];
+		result.r = clamp_color( catmull_rom_interpolate( a->r, c[ i ].r, c[ i + 1 ].r, d->r, t ) );
+		result.g = clamp_color( catmull_rom_interpolate( a->g, c[ i ].g, c[ i + 1 ].g, d->g, t ) );
+		result.b = clamp_color( catmull_rom_interpolate( a->b, c[ i ].b, c[ i + 1 ].b, d->b, t ) );
+		result.a = clamp_color( catmull_rom_interpolate( a->a, c[ i ].a, c[ i + 1 ].a, d->a, t ) );
+	}
+	else
+	{
+		result.r = clamp_color( linear_interpolate( c[ i ].r, c[ i + 1 ].r, t ) );
+		result.g = clamp_color( linear_interpolate( c[ i ].g, c[ i + 1 ].g, t ) );
+		result.b = clamp_color( linear_interpolate( c[ i ].b, c[ i + 1 ].b, t ) );
+		result.a = clamp_color( linear_interpolate( c[ i ].a, c[ i + 1 ].a, t ) );
+	}
+	return result;
+}
+
 /** Load an animation item for an absolute position.
  *
  * This performs interpolation if there is no keyframe at the \p position.
@@ -398,11 +748,10 @@ int mlt_animation_get_item( mlt_animation self, mlt_animation_item item, int pos
 
 	int error = 0;
 	// Need to find the nearest keyframe to the position specified
-	animation_node node = self->nodes;
+	animation_node node = NULL;
 
-	// Iterate through the keyframes until we reach last or have
-	while ( node && node->next && position >= node->next->item.frame )
-		node = node->next;
+	if ( compile( self ) )
+		node = self->index[ find_node( self, position ) ];
 
 	if ( node )
 	{
@@ -524,6 +873,7 @@ int mlt_animation_insert( mlt_animation self, mlt_animation_item item )
 		// Set the first item
 		self->nodes = node;
 	}
+	mlt_animation_changed( self );
 	mlt_animation_clear_string( self );
 
 	return error;
@@ -883,6 +1233,10 @@ void mlt_animation_close( mlt_animation self )
 	if ( self )
 	{
 		mlt_animation_clean( self );
+		free( self->index );
+		free( self->frames );
+		free( self->types );
+		free( self->numeric );
 		free( self );
 	}
 }
@@ -910,6 +1264,7 @@ int mlt_animation_key_set_type(mlt_animation self, int index, mlt_keyframe_type
 
 	if ( node ) {
 		node->item.keyframe_type = type;
+		mlt_animation_changed( self );
 		mlt_animation_interpolate(self);
 		mlt_animation_clear_string( self );
 	} else {
@@ -942,6 +1297,7 @@ int mlt_animation_key_set_frame(mlt_animation self, int index, int frame)
 
 	if ( node ) {
 		node->item.frame = frame;
+		mlt_animation_changed( self );
 		mlt_animation_interpolate(self);
 		mlt_animation_clear_string( self );
 	} else {
@@ -965,6 +1321,7 @@ void mlt_animation_shift_frames( mlt_animation self, int shift )
 		node->item.frame += shift;
 		node = node->next;
 	}
+	mlt_animation_changed( self );
 	mlt_animation_clear_string( self );
 	mlt_animation_interpolate(self);
 }
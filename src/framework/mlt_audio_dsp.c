@@ -0,0 +1,731 @@
+/**
+ * \file mlt_audio_dsp.c
+ * \brief vectorized kernels for interleaved float audio
+ * \see mlt_audio_dsp.h
+ *
+ * Copyright (C) 2022 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "mlt_audio_dsp.h"
+#include "mlt_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(USE_SSE) && defined(ARCH_X86_64)
+#define DSP_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define DSP_NEON 1
+#include <arm_neon.h>
+#endif
+
+// A gain or mix weight ramps once per sample, so along interleaved data it
+// steps every channels floats. The ramp kernels take a period of offsets that
+// is a whole number of samples and of vectors, and add it to the weight at the
+// start of each period. Every kernel does as many whole vectors as it can and
+// returns how many floats it did, always whole samples; the rest is done here
+// in plain C.
+
+/** the longest period of ramp offsets, enough for up to 32 channels */
+
+#define RAMP_MAX 256
+
+/** every vector width divides this */
+
+#define RAMP_ALIGN 8
+
+typedef int ( *ramp_kernel )( float *dst, const float *src, int count, const float *offsets, int period, int frames, double start, double step );
+
+/** \brief private to mlt_audio_dsp, one instruction set's kernels
+ *
+ * A NULL kernel leaves all the work to the C code.
+ */
+
+typedef struct
+{
+	const char *name;
+	ramp_kernel gain;
+	ramp_kernel mix;
+	ramp_kernel sum;
+	int ( *plane )( float *dst, const float *src, int samples, double start, double step, int accumulate );
+	int ( *deinterleave2 )( float *left, float *right, const float *src, int samples );
+	int ( *interleave2 )( float *dst, const float *left, const float *right, int samples );
+	int ( *s16_to_float )( float *dst, const int16_t *src, int count );
+	int ( *float_to_s16 )( int16_t *dst, const float *src, int count );
+} dsp_kernels;
+
+#ifdef DSP_X86
+
+static int gain_sse2( float *dst, const float *src, int count, const float *offsets, int period, int frames, double start, double step )
+{
+	int e, k, frame = 0;
+	for ( e = 0; e + period <= count; e += period, frame += frames )
+	{
+		__m128 base = _mm_set1_ps( start + frame * step );
+		for ( k = 0; k < period; k += 4 )
+		{
+			__m128 w = _mm_add_ps( base, _mm_loadu_ps( offsets + k ) );
+			_mm_storeu_ps( dst + e + k, _mm_mul_ps( _mm_loadu_ps( dst + e + k ), w ) );
+		}
+	}
+	return e;
+}
+
+static int mix_sse2( float *dst, const float *src, int count, const float *offsets, int period, int frames, double start, double step )
+{
+	const __m128 one = _mm_set1_ps( 1.0f );
+	int e, k, frame = 0;
+	for ( e = 0; e + period <= count; e += period, frame += frames )
+	{
+		__m128 base = _mm_set1_ps( start + frame * step );
+		for ( k = 0; k < period; k += 4 )
+		{
+			__m128 w = _mm_add_ps( base, _mm_loadu_ps( offsets + k ) );
+			__m128 a = _mm_loadu_ps( dst + e + k );
+			__m128 b = _mm_loadu_ps( src + e + k );
+			_mm_storeu_ps( dst + e + k, _mm_add_ps( _mm_mul_ps( w, b ), _mm_mul_ps( _mm_sub_ps( one, w ), a ) ) );
+		}
+	}
+	return e;
+}
+
+static int sum_sse2( float *dst, const float *src, int count, const float *offsets, int period, int frames, double start, double step )
+{
+	int e, k, frame = 0;
+	for ( e = 0; e + period <= count; e += period, frame += frames )
+	{
+		__m128 base = _mm_set1_ps( start + frame * step );
+		for ( k = 0; k < period; k += 4 )
+		{
+			__m128 w = _mm_add_ps( base, _mm_loadu_ps( offsets + k ) );
+			__m128 a = _mm_loadu_ps( dst + e + k );
+			__m128 b = _mm_loadu_ps( src + e + k );
+			_mm_storeu_ps( dst + e + k, _mm_add_ps( a, _mm_mul_ps( w, b ) ) );
+		}
+	}
+	return e;
+}
+
+static int plane_sse2( float *dst, const float *src, int samples, double start, double step, int accumulate )
+{
+	const __m128 lanes = _mm_setr_ps( 0, step, 2 * step, 3 * step );
+	int i;
+	for ( i = 0; i + 4 <= samples; i += 4 )
+	{
+		__m128 w = _mm_add_ps( _mm_set1_ps( start + i * step ), lanes );
+		__m128 v = _mm_mul_ps( w, _mm_loadu_ps( src + i ) );
+		if ( accumulate )
+			v = _mm_add_ps( v, _mm_loadu_ps( dst + i ) );
+		_mm_storeu_ps( dst + i, v );
+	}
+	return i;
+}
+
+static int deinterleave2_sse2( float *left, float *right, const float *src, int samples )
+{
+	int i;
+	for ( i = 0; i + 4 <= samples; i += 4 )
+	{
+		__m128 a = _mm_loadu_ps( src + 2 * i );
+		__m128 b = _mm_loadu_ps( src + 2 * i + 4 );
+		_mm_storeu_ps( left + i, _mm_shuffle_ps( a, b, _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+		_mm_storeu_ps( right + i, _mm_shuffle_ps( a, b, _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+	}
+	return i;
+}
+
+static int interleave2_sse2( float *dst, const float *left, const float *right, int samples )
+{
+	int i;
+	for ( i = 0; i + 4 <= samples; i += 4 )
+	{
+		__m128 l = _mm_loadu_ps( left + i );
+		__m128 r = _mm_loadu_ps( right + i );
+		_mm_storeu_ps( dst + 2 * i, _mm_unpacklo_ps( l, r ) );
+		_mm_storeu_ps( dst + 2 * i + 4, _mm_unpackhi_ps( l, r ) );
+	}
+	return i;
+}
+
+static int s16_to_float_sse2( float *dst, const int16_t *src, int count )
+{
+	const __m128 scale = _mm_set1_ps( 1.0f / 32768.0f );
+	int i;
+	for ( i = 0; i + 8 <= count; i += 8 )
+	{
+		__m128i s = _mm_loadu_si128( ( const __m128i* )( src + i ) );
+		__m128i lo = _mm_srai_epi32( _mm_unpacklo_epi16( s, s ), 16 );
+		__m128i hi = _mm_srai_epi32( _mm_unpackhi_epi16( s, s ), 16 );
+		_mm_storeu_ps( dst + i, _mm_mul_ps( _mm_cvtepi32_ps( lo ), scale ) );
+		_mm_storeu_ps( dst + i + 4, _mm_mul_ps( _mm_cvtepi32_ps( hi ), scale ) );
+	}
+	return i;
+}
+
+static int float_to_s16_sse2( int16_t *dst, const float *src, int count )
+{
+	const __m128 lower = _mm_set1_ps( -1.0f );
+	const __m128 upper = _mm_set1_ps( 1.0f );
+	const __m128 scale = _mm_set1_ps( 32767.0f );
+	int i;
+	for ( i = 0; i + 8 <= count; i += 8 )
+	{
+		__m128 a = _mm_min_ps( _mm_max_ps( _mm_loadu_ps( src + i ), lower ), upper );
+		__m128 b = _mm_min_ps( _mm_max_ps( _mm_loadu_ps( src + i + 4 ), lower ), upper );
+		__m128i lo = _mm_cvttps_epi32( _mm_mul_ps( a, scale ) );
+		__m128i hi = _mm_cvttps_epi32( _mm_mul_ps( b, scale ) );
+		_mm_storeu_si128( ( __m128i* )( dst + i ), _mm_packs_epi32( lo, hi ) );
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int gain_avx2( float *dst, const float *src, int count, const float *offsets, int period, int frames, double start, double step )
+{
+	int e, k, frame = 0;
+	for ( e = 0; e + period <= count; e += period, frame += frames )
+	{
+		__m256 base = _mm256_set1_ps( start + frame * step );
+		for ( k = 0; k < period; k += 8 )
+		{
+			__m256 w = _mm256_add_ps( base, _mm256_loadu_ps( offsets + k ) );
+			_mm256_storeu_ps( dst + e + k, _mm256_mul_ps( _mm256_loadu_ps( dst + e + k ), w ) );
+		}
+	}
+	return e;
+}
+
+__attribute__((target("avx2")))
+static int mix_avx2( float *dst, const float *src, int count, const float *offsets, int period, int frames, double start, double step )
+{
+	const __m256 one = _mm256_set1_ps( 1.0f );
+	int e, k, frame = 0;
+	for ( e = 0; e + period <= count; e += period, frame += frames )
+	{
+		__m256 base = _mm256_set1_ps( start + frame * step );
+		for ( k = 0; k < period; k += 8 )
+		{
+			__m256 w = _mm256_add_ps( base, _mm256_loadu_ps( offsets + k ) );
+			__m256 a = _mm256_loadu_ps( dst + e + k );
+			__m256 b = _mm256_loadu_ps( src + e + k );
+			_mm256_storeu_ps( dst + e + k, _mm256_add_ps( _mm256_mul_ps( w, b ), _mm256_mul_ps( _mm256_sub_ps( one, w ), a ) ) );
+		}
+	}
+	return e;
+}
+
+__attribute__((target("avx2")))
+static int sum_avx2( float *dst, const float *src, int count, const float *offsets, int period, int frames, double start, double step )
+{
+	int e, k, frame = 0;
+	for ( e = 0; e + period <= count; e += period, frame += frames )
+	{
+		__m256 base = _mm256_set1_ps( start + frame * step );
+		for ( k = 0; k < period; k += 8 )
+		{
+			__m256 w = _mm256_add_ps( base, _mm256_loadu_ps( offsets + k ) );
+			__m256 a = _mm256_loadu_ps( dst + e + k );
+			__m256 b = _mm256_loadu_ps( src + e + k );
+			_mm256_storeu_ps( dst + e + k, _mm256_add_ps( a, _mm256_mul_ps( w, b ) ) );
+		}
+	}
+	return e;
+}
+
+__attribute__((target("avx2")))
+static int plane_avx2( float *dst, const float *src, int samples, double start, double step, int accumulate )
+{
+	const __m256 lanes = _mm256_setr_ps( 0, step, 2 * step, 3 * step, 4 * step, 5 * step, 6 * step, 7 * step );
+	int i;
+	for ( i = 0; i + 8 <= samples; i += 8 )
+	{
+		__m256 w = _mm256_add_ps( _mm256_set1_ps( start + i * step ), lanes );
+		__m256 v = _mm256_mul_ps( w, _mm256_loadu_ps( src + i ) );
+		if ( accumulate )
+			v = _mm256_add_ps( v, _mm256_loadu_ps( dst + i ) );
+		_mm256_storeu_ps( dst + i, v );
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int s16_to_float_avx2( float *dst, const int16_t *src, int count )
+{
+	const __m256 scale = _mm256_set1_ps( 1.0f / 32768.0f );
+	int i;
+	for ( i = 0; i + 8 <= count; i += 8 )
+	{
+		__m256i s = _mm256_cvtepi16_epi32( _mm_loadu_si128( ( const __m128i* )( src + i ) ) );
+		_mm256_storeu_ps( dst + i, _mm256_mul_ps( _mm256_cvtepi32_ps( s ), scale ) );
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int float_to_s16_avx2( int16_t *dst, const float *src, int count )
+{
+	const __m256 lower = _mm256_set1_ps( -1.0f );
+	const __m256 upper = _mm256_set1_ps( 1.0f );
+	const __m256 scale = _mm256_set1_ps( 32767.0f );
+	int i;
+	for ( i = 0; i + 8 <= count; i += 8 )
+	{
+		__m256 a = _mm256_min_ps( _mm256_max_ps( _mm256_loadu_ps( src + i ), lower ), upper );
+		__m256i s = _mm256_cvttps_epi32( _mm256_mul_ps( a, scale ) );
+		_mm_storeu_si128( ( __m128i* )( dst + i ), _mm_packs_epi32( _mm256_castsi256_si128( s ), _mm256_extracti128_si256( s, 1 ) ) );
+	}
+	return i;
+}
+
+static const dsp_kernels kernels_sse2 =
+{
+	"sse2", gain_sse2, mix_sse2, sum_sse2, plane_sse2,
+	deinterleave2_sse2, interleave2_sse2, s16_to_float_sse2, float_to_s16_sse2
+};
+
+static const dsp_kernels kernels_avx2 =
+{
+	"avx2", gain_avx2, mix_avx2, sum_avx2, plane_avx2,
+	deinterleave2_sse2, interleave2_sse2, s16_to_float_avx2, float_to_s16_avx2
+};
+
+#endif // DSP_X86
+
+#ifdef DSP_NEON
+
+static int gain_neon( float *dst, const float *src, int count, const float *offsets, int period, int frames, double start, double step )
+{
+	int e, k, frame = 0;
+	for ( e = 0; e + period <= count; e += period, frame += frames )
+	{
+		float32x4_t base = vdupq_n_f32( start + frame * step );
+		for ( k = 0; k < period; k += 4 )
+		{
+			float32x4_t w = vaddq_f32( base, vld1q_f32( offsets + k ) );
+			vst1q_f32( dst + e + k, vmulq_f32( vld1q_f32( dst + e + k ), w ) );
+		}
+	}
+	return e;
+}
+
+static int mix_neon( float *dst, const float *src, int count, const float *offsets, int period, int frames, double start, double step )
+{
+	const float32x4_t one = vdupq_n_f32( 1.0f );
+	int e, k, frame = 0;
+	for ( e = 0; e + period <= count; e += period, frame += frames )
+	{
+		float32x4_t base = vdupq_n_f32( start + frame * step );
+		for ( k = 0; k < period; k += 4 )
+		{
+			float32x4_t w = vaddq_f32( base, vld1q_f32( offsets + k ) );
+			float32x4_t a = vld1q_f32( dst + e + k );
+			float32x4_t b = vld1q_f32( src + e + k );
+			vst1q_f32( dst + e + k, vaddq_f32( vmulq_f32( w, b ), vmulq_f32( vsubq_f32( one, w ), a ) ) );
+		}
+	}
+	return e;
+}
+
+static int sum_neon( float *dst, const float *src, int count, const float *offsets, int period, int frames, double start, double step )
+{
+	int e, k, frame = 0;
+	for ( e = 0; e + period <= count; e += period, frame += frames )
+	{
+		float32x4_t base = vdupq_n_f32( start + frame * step );
+		for ( k = 0; k < period; k += 4 )
+		{
+			float32x4_t w = vaddq_f32( base, vld1q_f32( offsets + k ) );
+			float32x4_t a = vld1q_f32( dst + e + k );
+			float32x4_t b = vld1q_f32( src + e + k );
+			vst1q_f32( dst + e + k, vaddq_f32( a, vmulq_f32( w, b ) ) );
+		}
+	}
+	return e;
+}
+
+static int plane_neon( float *dst, const float *src, int samples, double start, double step, int accumulate )
+{
+	const float lane_steps[ 4 ] = { 0, step, 2 * step, 3 * step };
+	const float32x4_t lanes = vld1q_f32( lane_steps );
+	int i;
+	for ( i = 0; i + 4 <= samples; i += 4 )
+	{
+		float32x4_t w = vaddq_f32( vdupq_n_f32( start + i * step ), lanes );
+		float32x4_t v = vmulq_f32( w, vld1q_f32( src + i ) );
+		if ( accumulate )
+			v = vaddq_f32( v, vld1q_f32( dst + i ) );
+		vst1q_f32( dst + i, v );
+	}
+	return i;
+}
+
+static int deinterleave2_neon( float *left, float *right, const float *src, int samples )
+{
+	int i;
+	for ( i = 0; i + 4 <= samples; i += 4 )
+	{
+		float32x4x2_t v = vld2q_f32( src + 2 * i );
+		vst1q_f32( left + i, v.val[ 0 ] );
+		vst1q_f32( right + i, v.val[ 1 ] );
+	}
+	return i;
+}
+
+static int interleave2_neon( float *dst, const float *left, const float *right, int samples )
+{
+	int i;
+	for ( i = 0; i + 4 <= samples; i += 4 )
+	{
+		float32x4x2_t v;
+		v.val[ 0 ] = vld1q_f32( left + i );
+		v.val[ 1 ] = vld1q_f32( right + i );
+		vst2q_f32( dst + 2 * i, v );
+	}
+	return i;
+}
+
+static int s16_to_float_neon( float *dst, const int16_t *src, int count )
+{
+	int i;
+	for ( i = 0; i + 8 <= count; i += 8 )
+	{
+		int16x8_t s = vld1q_s16( src + i );
+		vst1q_f32( dst + i, vmulq_n_f32( vcvtq_f32_s32( vmovl_s16( vget_low_s16( s ) ) ), 1.0f / 32768.0f ) );
+		vst1q_f32( dst + i + 4, vmulq_n_f32( vcvtq_f32_s32( vmovl_s16( vget_high_s16( s ) ) ), 1.0f / 32768.0f ) );
+	}
+	return i;
+}
+
+static int float_to_s16_neon( int16_t *dst, const float *src, int count )
+{
+	const float32x4_t lower = vdupq_n_f32( -1.0f );
+	const float32x4_t upper = vdupq_n_f32( 1.0f );
+	int i;
+	for ( i = 0; i + 8 <= count; i += 8 )
+	{
+		float32x4_t a = vminq_f32( vmaxq_f32( vld1q_f32( src + i ), lower ), upper );
+		float32x4_t b = vminq_f32( vmaxq_f32( vld1q_f32( src + i + 4 ), lower ), upper );
+		int32x4_t lo = vcvtq_s32_f32( vmulq_n_f32( a, 32767.0f ) );
+		int32x4_t hi = vcvtq_s32_f32( vmulq_n_f32( b, 32767.0f ) );
+		vst1q_s16( dst + i, vcombine_s16( vmovn_s32( lo ), vmovn_s32( hi ) ) );
+	}
+	return i;
+}
+
+static const dsp_kernels kernels_neon =
+{
+	"neon", gain_neon, mix_neon, sum_neon, plane_neon,
+	deinterleave2_neon, interleave2_neon, s16_to_float_neon, float_to_s16_neon
+};
+
+#endif // DSP_NEON
+
+static const dsp_kernels kernels_c = { "c" };
+
+static const dsp_kernels *kernels = &kernels_c;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void choose_kernels( )
+{
+	const char *choice = getenv( "MLT_AUDIO_DSP" );
+
+	if ( choice && !strcmp( choice, "c" ) )
+		return;
+#ifdef DSP_X86
+	kernels = &kernels_sse2;
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports( "avx2" ) && !( choice && !strcmp( choice, "sse2" ) ) )
+		kernels = &kernels_avx2;
+#elif defined( DSP_NEON )
+	kernels = &kernels_neon;
+#endif
+	mlt_log_debug( NULL, "[mlt_audio_dsp] using %s kernels\n", kernels->name );
+}
+
+static inline const dsp_kernels *dsp( )
+{
+	pthread_once( &kernels_once, choose_kernels );
+	return kernels;
+}
+
+/** Fill a period of ramp offsets for interleaved samples.
+ *
+ * \param[out] offsets RAMP_MAX floats
+ * \param channels the number of channels
+ * \param step the change of the ramp per sample
+ * \param[out] frames the number of samples in the period
+ * \return the number of floats in the period, or 0 if there are too many channels
+ */
+
+static int ramp_offsets( float *offsets, int channels, double step, int *frames )
+{
+	int period = channels;
+	int k;
+
+	if ( channels <= 0 )
+		return 0;
+	while ( period % RAMP_ALIGN )
+		period += channels;
+	if ( period > RAMP_MAX )
+		return 0;
+	for ( k = 0; k < period; k ++ )
+		offsets[ k ] = ( k / channels ) * step;
+	*frames = period / channels;
+	return period;
+}
+
+/** Run a ramp kernel over interleaved samples.
+ *
+ * \return the number of floats done
+ */
+
+static int ramp_run( ramp_kernel kernel, float *dst, const float *src, int channels, int samples, double start, double step )
+{
+	float offsets[ RAMP_MAX ];
+	int frames = 0;
+	int period = kernel ? ramp_offsets( offsets, channels, step, &frames ) : 0;
+
+	return period ? kernel( dst, src, channels * samples, offsets, period, frames, start, step ) : 0;
+}
+
+/** Get the name of the kernels in use.
+ *
+ * \return "avx2", "sse2", "neon" or "c"
+ */
+
+const char *mlt_audio_dsp_name( )
+{
+	return dsp( )->name;
+}
+
+/** Apply a gain that ramps linearly over the samples.
+ *
+ * \param buffer interleaved float samples, changed in place
+ * \param channels the number of channels
+ * \param samples the number of samples per channel
+ * \param gain_start the gain of the first sample
+ * \param gain_step the change of the gain from one sample to the next
+ */
+
+void mlt_audio_dsp_gain( float *buffer, int channels, int samples, double gain_start, double gain_step )
+{
+	int i = ramp_run( dsp( )->gain, buffer, NULL, channels, samples, gain_start, gain_step ) / channels;
+	int c;
+
+	for ( ; i < samples; i ++ )
+	{
+		double gain = gain_start + i * gain_step;
+		for ( c = 0; c < channels; c ++ )
+			buffer[ i * channels + c ] *= gain;
+	}
+}
+
+/** Crossfade one buffer into another with a weight that ramps linearly.
+ *
+ * Each output is weight * src + ( 1 - weight ) * dst.
+ *
+ * \param dst interleaved float samples, changed in place
+ * \param src interleaved float samples with the same layout as \p dst
+ * \param channels the number of channels
+ * \param samples the number of samples per channel
+ * \param weight_start the weight of \p src at the first sample
+ * \param weight_step the change of the weight from one sample to the next
+ */
+
+void mlt_audio_dsp_mix( float *dst, const float *src, int channels, int samples, double weight_start, double weight_step )
+{
+	int i = ramp_run( dsp( )->mix, dst, src, channels, samples, weight_start, weight_step ) / channels;
+	int c, k;
+
+	for ( ; i < samples; i ++ )
+	{
+		double weight = weight_start + i * weight_step;
+		for ( c = 0, k = i * channels; c < channels; c ++, k ++ )
+			dst[ k ] = weight * src[ k ] + ( 1.0 - weight ) * dst[ k ];
+	}
+}
+
+/** Add one buffer to another with a weight that ramps linearly.
+ *
+ * Each output is dst + weight * src.
+ *
+ * \param dst interleaved float samples, changed in place
+ * \param src interleaved float samples with the same layout as \p dst
+ * \param channels the number of channels
+ * \param samples the number of samples per channel
+ * \param weight_start the weight of \p src at the first sample
+ * \param weight_step the change of the weight from one sample to the next
+ */
+
+void mlt_audio_dsp_sum( float *dst, const float *src, int channels, int samples, double weight_start, double weight_step )
+{
+	int i = ramp_run( dsp( )->sum, dst, src, channels, samples, weight_start, weight_step ) / channels;
+	int c, k;
+
+	for ( ; i < samples; i ++ )
+	{
+		double weight = weight_start + i * weight_step;
+		for ( c = 0, k = i * channels; c < channels; c ++, k ++ )
+			dst[ k ] += weight * src[ k ];
+	}
+}
+
+/** Multiply a plane by a ramp and store or add the result. */
+
+static void plane_ramp( float *dst, const float *src, int samples, double start, double step, int accumulate )
+{
+	int i = dsp( )->plane ? dsp( )->plane( dst, src, samples, start, step, accumulate ) : 0;
+
+	if ( accumulate )
+		for ( ; i < samples; i ++ )
+			dst[ i ] += ( start + i * step ) * src[ i ];
+	else
+		for ( ; i < samples; i ++ )
+			dst[ i ] = ( start + i * step ) * src[ i ];
+}
+
+/** Remix the channels with a matrix that ramps linearly.
+ *
+ * Output channel o of sample i is the sum over the input channels c of
+ * ( matrix_start[ c * channels + o ] + i * matrix_step[ c * channels + o ] ) * src[ c ].
+ * The work is done on planes, so that the vectors run along time.
+ *
+ * \param dst interleaved float samples, which may be \p src
+ * \param src interleaved float samples
+ * \param channels the number of channels
+ * \param samples the number of samples per channel
+ * \param matrix_start the channels by channels weights at the first sample, indexed [input][output]
+ * \param matrix_step the change of each weight from one sample to the next
+ */
+
+void mlt_audio_dsp_pan( float *dst, const float *src, int channels, int samples, const float *matrix_start, const float *matrix_step )
+{
+	int size = channels * samples;
+	float *planes = mlt_pool_alloc( 2 * size * sizeof( float ) );
+	float *out = planes + size;
+	int c, o;
+
+	if ( planes == NULL )
+		return;
+
+	mlt_audio_dsp_deinterleave( planes, src, channels, samples );
+	for ( o = 0; o < channels; o ++ )
+	{
+		float *plane = out + o * samples;
+		int accumulate = 0;
+
+		for ( c = 0; c < channels; c ++ )
+		{
+			float start = matrix_start[ c * channels + o ];
+			float step = matrix_step[ c * channels + o ];
+
+			// Most of a pan matrix is zero
+			if ( start == 0.0f && step == 0.0f )
+				continue;
+			plane_ramp( plane, planes + c * samples, samples, start, step, accumulate );
+			accumulate = 1;
+		}
+		if ( !accumulate )
+			memset( plane, 0, samples * sizeof( float ) );
+	}
+	mlt_audio_dsp_interleave( dst, out, channels, samples );
+
+	mlt_pool_release( planes );
+}
+
+/** Convert planar float samples to interleaved.
+ *
+ * \param dst interleaved float samples
+ * \param src one plane per channel, each of \p samples floats
+ * \param channels the number of channels
+ * \param samples the number of samples per channel
+ */
+
+void mlt_audio_dsp_interleave( float *dst, const float *src, int channels, int samples )
+{
+	int c, i = 0;
+
+	if ( channels == 1 )
+	{
+		memmove( dst, src, samples * sizeof( float ) );
+		return;
+	}
+	if ( channels == 2 && dsp( )->interleave2 )
+		i = dsp( )->interleave2( dst, src, src + samples, samples );
+	for ( ; i < samples; i ++ )
+		for ( c = 0; c < channels; c ++ )
+			dst[ i * channels + c ] = src[ c * samples + i ];
+}
+
+/** Convert interleaved float samples to planar.
+ *
+ * \param dst one plane per channel, each of \p samples floats
+ * \param src interleaved float samples
+ * \param channels the number of channels
+ * \param samples the number of samples per channel
+ */
+
+void mlt_audio_dsp_deinterleave( float *dst, const float *src, int channels, int samples )
+{
+	int c, i = 0, j;
+
+	if ( channels == 1 )
+	{
+		memmove( dst, src, samples * sizeof( float ) );
+		return;
+	}
+	if ( channels == 2 && dsp( )->deinterleave2 )
+		i = dsp( )->deinterleave2( dst, dst + samples, src, samples );
+	for ( c = 0; c < channels; c ++ )
+		for ( j = i; j < samples; j ++ )
+			dst[ c * samples + j ] = src[ j * channels + c ];
+}
+
+/** Convert signed 16-bit samples to float.
+ *
+ * \param dst \p count floats in the range -1 to 1
+ * \param src \p count samples
+ * \param count the number of samples in all channels
+ */
+
+void mlt_audio_dsp_s16_to_float( float *dst, const int16_t *src, int count )
+{
+	int i = dsp( )->s16_to_float ? dsp( )->s16_to_float( dst, src, count ) : 0;
+
+	for ( ; i < count; i ++ )
+		dst[ i ] = ( float ) src[ i ] / 32768.0f;
+}
+
+/** Convert float samples to signed 16-bit, clipping them to the range -1 to 1.
+ *
+ * \param dst \p count samples
+ * \param src \p count floats
+ * \param count the number of samples in all channels
+ */
+
+void mlt_audio_dsp_float_to_s16( int16_t *dst, const float *src, int count )
+{
+	int i = dsp( )->float_to_s16 ? dsp( )->float_to_s16( dst, src, count ) : 0;
+
+	for ( ; i < count; i ++ )
+	{
+		float f = CLAMP( src[ i ], -1.0f, 1.0f );
+		dst[ i ] = 32767 * f;
+	}
+}
@@ -0,0 +1,42 @@
+/**
+ * \file mlt_audio_dsp.h
+ * \brief vectorized kernels for interleaved float audio
+ *
+ * Copyright (C) 2022 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MLT_AUDIO_DSP_H
+#define MLT_AUDIO_DSP_H
+
+#include "mlt_types.h"
+
+/**
+ * \envvar \em MLT_AUDIO_DSP Set to "c" to use the portable kernels instead
+ * of the SSE2, AVX2 or NEON ones, for example to compare them.
+ */
+
+extern const char *mlt_audio_dsp_name( );
+extern void mlt_audio_dsp_gain( float *buffer, int channels, int samples, double gain_start, double gain_step );
+extern void mlt_audio_dsp_mix( float *dst, const float *src, int channels, int samples, double weight_start, double weight_step );
+extern void mlt_audio_dsp_sum( float *dst, const float *src, int channels, int samples, double weight_start, double weight_step );
+extern void mlt_audio_dsp_pan( float *dst, const float *src, int channels, int samples, const float *matrix_start, const float *matrix_step );
+extern void mlt_audio_dsp_interleave( float *dst, const float *src, int channels, int samples );
+extern void mlt_audio_dsp_deinterleave( float *dst, const float *src, int channels, int samples );
+extern void mlt_audio_dsp_s16_to_float( float *dst, const int16_t *src, int count );
+extern void mlt_audio_dsp_float_to_s16( int16_t *dst, const float *src, int count );
+
+#endif
@@ -29,12 +29,12 @@
 #include <stdlib.h>
 #include <pthread.h>
 
-/** the maximum number of data objects to cache per line */
-#define MAX_CACHE_SIZE (200)
-
 /** the default number of data objects to cache per line */
 #define DEFAULT_CACHE_SIZE (4)
 
+/** the initial number of hash buckets, must be a power of two */
+#define INITIAL_BUCKETS (16)
+
 /** \brief Cache item class
  *
  * A cache item is a structure holding information about a data object including
@@ -54,15 +54,21 @@ typedef struct mlt_cache_item_s
 	int size;                  /**< the size of the cached data */
 	int refcount;              /**< a reference counter to control when destructor is called */
 	mlt_destructor destructor; /**< a function to release or destroy the cached data */
+	mlt_position position;     /**< the frame position that identifies the item in a frame cache */
+	int is_cached;             /**< whether the item is currently in the least recently used list */
+	struct mlt_cache_item_s *prev;  /**< the next more recently used item */
+	struct mlt_cache_item_s *next;  /**< the next less recently used item */
+	struct mlt_cache_item_s *chain; /**< the next item in the same hash bucket */
 } mlt_cache_item_s;
 
 /** \brief Cache class
  *
  * This is a utility class for implementing a Least Recently Used (LRU) cache
  * of data blobs indexed by the address of some other object (e.g., a service).
- * Instead of sorting and manipulating linked lists, it tries to be simple and
- * elegant by copying pointers between two arrays of fixed size to shuffle the
- * order of elements.
+ * Items are found through a hash table and kept in a doubly linked list
+ * ordered by use, so getting and putting an item does not depend on the
+ * number of items in the cache. The cache can be bounded by a number of items
+ * and by the total size of the cached data.
  *
  * This class is useful if you have a service that wants to cache something
  * somewhat large, but will not scale if there are many instances of the service.
@@ -81,20 +87,181 @@ typedef struct mlt_cache_item_s
 struct mlt_cache_s
 {
 	int count;             /**< the number of items currently in the cache */
-	int size;              /**< the maximum number of items permitted in the cache <= \p MAX_CACHE_SIZE */
+	int size;              /**< the maximum number of items permitted in the cache */
 	int is_frames;         /**< indicates if this cache is used to cache frames */
-	void* *current;        /**< pointer to the current array of pointers */
-	void* A[ MAX_CACHE_SIZE ];
-	void* B[ MAX_CACHE_SIZE ];
+	int64_t memory;        /**< the number of bytes of data currently in the cache */
+	int64_t memory_limit;  /**< the maximum number of bytes permitted in the cache, 0 for no limit */
+	int64_t hits;          /**< the number of successful lookups */
+	int64_t misses;        /**< the number of failed lookups */
+	int64_t evictions;     /**< the number of items pushed out of the cache */
+	mlt_cache_item mru;    /**< the most recently used item */
+	mlt_cache_item lru;    /**< the least recently used item */
+	mlt_cache_item *buckets; /**< the hash table of all items including those with outstanding references */
+	int bucket_count;      /**< the number of hash buckets */
+	int item_count;        /**< the number of items in the hash table */
 	pthread_mutex_t mutex; /**< a mutex to prevent multi-threaded race conditions */
-	mlt_properties active; /**< a list of cache items some of which may no longer
-	                            be in \p current but to which there are
-	                            outstanding references */
 	mlt_properties garbage;/**< a list cache items pending release. A cache item
 	                            is copied to this list when it is updated but there
 	                            are outstanding references to the old data object. */
 };
 
+/** Compute the hash bucket for an object or frame position.
+ *
+ * \private \memberof mlt_cache_s
+ * \param cache a cache
+ * \param object the object that owns the cached data
+ * \param position the frame position if this is a frame cache
+ * \return the bucket index
+ */
+
+static int hash_bucket( mlt_cache cache, void *object, mlt_position position )
+{
+	uint64_t key = cache->is_frames ? (uint64_t)(int64_t) position : (uint64_t)(uintptr_t) object >> 4;
+	key *= UINT64_C( 0x9E3779B97F4A7C15 );
+	return (int)( key >> 32 ) & ( cache->bucket_count - 1 );
+}
+
+/** Find the item for an object or frame position.
+ *
+ * \private \memberof mlt_cache_s
+ * \param cache a cache
+ * \param object the object that owns the cached data
+ * \param position the frame position if this is a frame cache
+ * \return the cache item or NULL if there is none
+ */
+
+static mlt_cache_item hash_find( mlt_cache cache, void *object, mlt_position position )
+{
+	mlt_cache_item item = cache->buckets[ hash_bucket( cache, object, position ) ];
+	if ( cache->is_frames )
+		while ( item && item->position != position )
+			item = item->chain;
+	else
+		while ( item && item->object != object )
+			item = item->chain;
+	return item;
+}
+
+/** Add an item to the hash table, growing the table as needed.
+ *
+ * \private \memberof mlt_cache_s
+ * \param cache a cache
+ * \param item the item to add
+ */
+
+static void hash_insert( mlt_cache cache, mlt_cache_item item )
+{
+	int i;
+
+	if ( cache->item_count >= cache->bucket_count )
+	{
+		mlt_cache_item *old = cache->buckets;
+		int old_count = cache->bucket_count;
+		mlt_cache_item *buckets = calloc( old_count * 2, sizeof( mlt_cache_item ) );
+		if ( buckets )
+		{
+			cache->buckets = buckets;
+			cache->bucket_count = old_count * 2;
+			for ( i = 0; i < old_count; i++ )
+			{
+				while ( old[ i ] )
+				{
+					mlt_cache_item o = old[ i ];
+					int bucket = hash_bucket( cache, o->object, o->position );
+					old[ i ] = o->chain;
+					o->chain = cache->buckets[ bucket ];
+					cache->buckets[ bucket ] = o;
+				}
+			}
+			free( old );
+		}
+	}
+	i = hash_bucket( cache, item->object, item->position );
+	item->chain = cache->buckets[ i ];
+	cache->buckets[ i ] = item;
+	cache->item_count++;
+}
+
+/** Remove an item from the hash table.
+ *
+ * \private \memberof mlt_cache_s
+ * \param cache a cache
+ * \param item the item to remove
+ */
+
+static void hash_remove( mlt_cache cache, mlt_cache_item item )
+{
+	mlt_cache_item *p = &cache->buckets[ hash_bucket( cache, item->object, item->position ) ];
+	while ( *p && *p != item )
+		p = &( *p )->chain;
+	if ( *p )
+	{
+		*p = item->chain;
+		item->chain = NULL;
+		cache->item_count--;
+	}
+}
+
+/** Remove an item from the least recently used list.
+ *
+ * \private \memberof mlt_cache_s
+ * \param cache a cache
+ * \param item the item to remove
+ */
+
+static void list_unlink( mlt_cache cache, mlt_cache_item item )
+{
+	if ( item->prev )
+		item->prev->next = item->next;
+	else
+		cache->mru = item->next;
+	if ( item->next )
+		item->next->prev = item->prev;
+	else
+		cache->lru = item->prev;
+	item->prev = item->next = NULL;
+	item->is_cached = 0;
+	cache->count--;
+	cache->memory -= item->size;
+}
+
+/** Add an item to the most recently used end of the list.
+ *
+ * \private \memberof mlt_cache_s
+ * \param cache a cache
+ * \param item the item to add
+ */
+
+static void list_push( mlt_cache cache, mlt_cache_item item )
+{
+	item->prev = NULL;
+	item->next = cache->mru;
+	if ( cache->mru )
+		cache->mru->prev = item;
+	else
+		cache->lru = item;
+	cache->mru = item;
+	item->is_cached = 1;
+	cache->count++;
+	cache->memory += item->size;
+}
+
+/** Move an item to the most recently used end of the list.
+ *
+ * \private \memberof mlt_cache_s
+ * \param cache a cache
+ * \param item the item to move
+ */
+
+static void list_touch( mlt_cache cache, mlt_cache_item item )
+{
+	if ( cache->mru != item )
+	{
+		list_unlink( cache, item );
+		list_push( cache, item );
+	}
+}
+
 /** Get the data pointer from the cache item.
  *
  * \public \memberof mlt_cache_s
@@ -110,41 +277,36 @@ void *mlt_cache_item_data( mlt_cache_item item, int *size )
 	return item? item->data : NULL;
 }
 
-/** Close a cache item given its parent object pointer.
+/** Release the cache's or a client's reference to a cache item.
  *
  * \private \memberof mlt_cache_s
  * \param cache a cache
- * \param object the object to which the data object belongs
+ * \param item the cache item
  * \param data the data object, which might be in the garbage list (optional)
  */
 
-static void cache_object_close( mlt_cache cache, void *object, void* data )
+static void cache_object_close( mlt_cache cache, mlt_cache_item item, void* data )
 {
 	char key[19];
 
 	if ( cache->is_frames )
 	{
 		// Frame caches are easy - just close the object as mlt_frame.
-		mlt_frame_close( object );
+		mlt_frame_close( item->data );
+		item->data = NULL;
 		return;
 	}
 
-	// Fetch the cache item from the active list by its owner's address
-	sprintf( key, "%p", object );
-	mlt_cache_item item = mlt_properties_get_data( cache->active, key, NULL );
-	if ( item )
+	mlt_log( NULL, MLT_LOG_DEBUG, "%s: item %p object %p data %p refcount %d\n", __FUNCTION__,
+		item, item->object, item->data, item->refcount );
+	if ( item->destructor && --item->refcount <= 0 )
 	{
-		mlt_log( NULL, MLT_LOG_DEBUG, "%s: item %p object %p data %p refcount %d\n", __FUNCTION__,
-			item, item->object, item->data, item->refcount );
-		if ( item->destructor && --item->refcount <= 0 )
-		{
-			// Destroy the data object
-			item->destructor( item->data );
-			item->data = NULL;
-			item->destructor = NULL;
-			// Do not dispose of the cache item because it could likely be used
-			// again.
-		}
+		// Destroy the data object
+		item->destructor( item->data );
+		item->data = NULL;
+		item->destructor = NULL;
+		// Do not dispose of the cache item because it could likely be used
+		// again.
 	}
 
 	// Fetch the cache item from the garbage collection by its data address
@@ -168,6 +330,47 @@ static void cache_object_close( mlt_cache cache, void *object, void* data )
 	}
 }
 
+/** Remove an item from the cache and release the cache's reference to its data.
+ *
+ * Items of a frame cache are also disposed because nobody else refers to them.
+ *
+ * \private \memberof mlt_cache_s
+ * \param cache a cache
+ * \param item the item to remove
+ */
+
+static void cache_remove( mlt_cache cache, mlt_cache_item item )
+{
+	list_unlink( cache, item );
+	cache_object_close( cache, item, NULL );
+	if ( cache->is_frames )
+	{
+		hash_remove( cache, item );
+		free( item );
+	}
+}
+
+/** Remove the least recently used items until the cache is within its limits.
+ *
+ * The most recently used item is always kept even if it alone exceeds the
+ * memory limit.
+ *
+ * \private \memberof mlt_cache_s
+ * \param cache a cache
+ */
+
+static void cache_evict( mlt_cache cache )
+{
+	while ( cache->lru && ( cache->count > cache->size ||
+		( cache->memory_limit > 0 && cache->memory > cache->memory_limit && cache->count > 1 ) ) )
+	{
+		mlt_log( NULL, MLT_LOG_DEBUG, "%s: evict %p count %d memory %" PRId64 "\n", __FUNCTION__,
+			cache->lru->object, cache->count, cache->memory );
+		cache->evictions++;
+		cache_remove( cache, cache->lru );
+	}
+}
+
 /** Close a cache item.
  *
  * Release a reference and call the destructor on the data object when all
@@ -182,7 +385,7 @@ void mlt_cache_item_close( mlt_cache_item item )
 	if ( item )
 	{
 		pthread_mutex_lock( &item->cache->mutex );
-		cache_object_close( item->cache, item->object, item->data );
+		cache_object_close( item->cache, item, item->data );
 		pthread_mutex_unlock( &item->cache->mutex );
 	}
 }
@@ -200,9 +403,9 @@ mlt_cache mlt_cache_init()
 	if ( result )
 	{
 		result->size = DEFAULT_CACHE_SIZE;
-		result->current = result->A;
+		result->bucket_count = INITIAL_BUCKETS;
+		result->buckets = calloc( INITIAL_BUCKETS, sizeof( mlt_cache_item ) );
 		pthread_mutex_init( &result->mutex, NULL );
-		result->active = mlt_properties_new();
 		result->garbage = mlt_properties_new();
 	}
 	return result;
@@ -210,8 +413,8 @@ mlt_cache mlt_cache_init()
 
 /** Set the number of items to cache.
  *
- * This must be called before using the cache. The size can not be more
- * than \p MAX_CACHE_SIZE.
+ * This should be called before using the cache. Lowering the size of a
+ * cache in use flushes the least recently used items.
  * \public \memberof mlt_cache_s
  * \param cache the cache to adjust
  * \param size the new size of the cache
@@ -219,8 +422,13 @@ mlt_cache mlt_cache_init()
 
 void mlt_cache_set_size( mlt_cache cache, int size )
 {
-	if ( size <= MAX_CACHE_SIZE )
+	if ( size >= 0 )
+	{
+		pthread_mutex_lock( &cache->mutex );
 		cache->size = size;
+		cache_evict( cache );
+		pthread_mutex_unlock( &cache->mutex );
+	}
 }
 
 /** Get the number of possible cache items.
@@ -235,6 +443,66 @@ int mlt_cache_get_size( mlt_cache cache )
     return cache->size;
 }
 
+/** Set the maximum number of bytes of data to cache.
+ *
+ * This uses the size given to mlt_cache_put() or, for a frame cache, the
+ * size of the image, alpha, and audio of the frame. When the limit is
+ * exceeded the least recently used items are flushed.
+ * \public \memberof mlt_cache_s
+ * \param cache the cache to adjust
+ * \param limit the number of bytes or 0 for no limit
+ */
+
+void mlt_cache_set_memory_limit( mlt_cache cache, int64_t limit )
+{
+	pthread_mutex_lock( &cache->mutex );
+	cache->memory_limit = MAX( limit, 0 );
+	cache_evict( cache );
+	pthread_mutex_unlock( &cache->mutex );
+}
+
+/** Get the maximum number of bytes of data to cache.
+ *
+ * \public \memberof mlt_cache_s
+ * \param cache the cache to check
+ * \return the number of bytes or 0 if there is no limit
+ */
+
+int64_t mlt_cache_get_memory_limit( mlt_cache cache )
+{
+	return cache->memory_limit;
+}
+
+/** Get the usage statistics of a cache.
+ *
+ * This sets the properties "hits", "misses", "evictions", "count",
+ * "memory", and "memory_limit".
+ * \public \memberof mlt_cache_s
+ * \param cache the cache to check
+ * \param properties the properties list to receive the values
+ */
+
+void mlt_cache_get_stats( mlt_cache cache, mlt_properties properties )
+{
+	if ( cache && properties )
+	{
+		pthread_mutex_lock( &cache->mutex );
+		int64_t hits = cache->hits;
+		int64_t misses = cache->misses;
+		int64_t evictions = cache->evictions;
+		int count = cache->count;
+		int64_t memory = cache->memory;
+		pthread_mutex_unlock( &cache->mutex );
+
+		mlt_properties_set_int64( properties, "hits", hits );
+		mlt_properties_set_int64( properties, "misses", misses );
+		mlt_properties_set_int64( properties, "evictions", evictions );
+		mlt_properties_set_int( properties, "count", count );
+		mlt_properties_set_int64( properties, "memory", memory );
+		mlt_properties_set_int64( properties, "memory_limit", cache->memory_limit );
+	}
+}
+
 /** Destroy a cache.
  *
  * \public \memberof mlt_cache_s
@@ -245,13 +513,23 @@ void mlt_cache_close( mlt_cache cache )
 {
 	if ( cache )
 	{
-		while ( cache->count-- )
+		int i;
+
+		while ( cache->lru )
 		{
-			void *object = cache->current[ cache->count ];
-			mlt_log( NULL, MLT_LOG_DEBUG, "%s: %d = %p\n", __FUNCTION__, cache->count, object );
-			cache_object_close( cache, object, NULL );
+			mlt_log( NULL, MLT_LOG_DEBUG, "%s: %d = %p\n", __FUNCTION__, cache->count - 1, cache->lru->object );
+			cache_remove( cache, cache->lru );
 		}
-		mlt_properties_close( cache->active );
+		for ( i = 0; i < cache->bucket_count; i++ )
+		{
+			while ( cache->buckets[ i ] )
+			{
+				mlt_cache_item item = cache->buckets[ i ];
+				cache->buckets[ i ] = item->chain;
+				free( item );
+			}
+		}
+		free( cache->buckets );
 		mlt_properties_close( cache->garbage );
 		pthread_mutex_destroy( &cache->mutex );
 		free( cache );
@@ -269,87 +547,34 @@ void mlt_cache_purge( mlt_cache cache, void *object )
 {
 	if (!cache) return;
 	pthread_mutex_lock( &cache->mutex );
-	if ( cache && object )
+	if ( object )
 	{
-		int i, j;
-		void **alt = cache->current == cache->A ? cache->B : cache->A;
-
-		for ( i = 0, j = 0; i < cache->count; i++ )
+		if ( cache->is_frames )
 		{
-			void *o = cache->current[ i ];
-
-			if ( o == object )
-			{
-				cache_object_close( cache, o, NULL );
-			}
-			else
+			mlt_cache_item item = cache->mru;
+			while ( item )
 			{
-				alt[ j++ ] = o;
+				mlt_cache_item next = item->next;
+				if ( item->data == object )
+					cache_remove( cache, item );
+				item = next;
 			}
 		}
-		cache->count = j;
-		cache->current = alt;
-	}
-	pthread_mutex_unlock( &cache->mutex );
-}
-
-/** Shuffle the cache entries between the two arrays and return the cache entry for an object.
- *
- * \private \memberof mlt_cache_s
- * \param cache a cache object
- * \param object the object that owns the cached data
- * \return a cache entry if there was a hit or NULL for a miss
- */
-
-static void** shuffle_get_hit( mlt_cache cache, void *object )
-{
-	int i = cache->count;
-	int j = cache->count - 1;
-	void **hit = NULL;
-	void **alt = cache->current == cache->A ? cache->B : cache->A;
-
-	if ( cache->count > 0 && cache->count < cache->size )
-	{
-		// first determine if we have a hit
-		while ( i-- && !hit )
-		{
-			void **o = &cache->current[ i ];
-			if ( *o == object )
-				hit = o;
-		}
-		// if there was no hit, we will not be shuffling out an entry
-		// and are still filling the cache
-		if ( !hit )
-			++j;
-		// reset these
-		i = cache->count;
-		hit = NULL;
-	}
-
-	// shuffle the existing entries to the alternate array
-	while ( i-- )
-	{
-		void **o = &cache->current[ i ];
-
-		if ( !hit && *o == object )
-		{
-			hit = o;
-		}
-		else if ( j > 0 )
+		else
 		{
-			alt[ --j ] = *o;
-// 			mlt_log( NULL, MLT_LOG_DEBUG, "%s: shuffle %d = %p\n", __FUNCTION__, j, alt[j] );
+			mlt_cache_item item = hash_find( cache, object, 0 );
+			if ( item && item->is_cached )
+				cache_remove( cache, item );
 		}
 	}
-	return hit;
+	pthread_mutex_unlock( &cache->mutex );
 }
 
 /** Put a chunk of data in the cache.
  *
- * This function and mlt_cache_get() are not scalable with a large volume
- * of unique \p object parameter values. Therefore, it does not make sense
- * to use it for a frame/image cache using the frame position for \p object.
- * Instead, use mlt_cache_put_frame() for that.
+ * This function and mlt_cache_get() are meant for a small number of data
+ * objects owned by services. Do not use it for a frame/image cache using
+ * the frame position for \p object. Instead, use mlt_cache_put_frame() for that.
  *
  * \public \memberof mlt_cache_s
  * \param cache a cache object
@@ -362,43 +587,25 @@ static void** shuffle_get_hit( mlt_cache cache, void *object )
 void mlt_cache_put( mlt_cache cache, void *object, void* data, int size, mlt_destructor destructor )
 {
 	pthread_mutex_lock( &cache->mutex );
-	void **hit = shuffle_get_hit( cache, object );
-	void **alt = cache->current == cache->A ? cache->B : cache->A;
+	mlt_cache_item item = hash_find( cache, object, 0 );
 
-	// add the object to the cache
-	if ( hit )
+	if ( item && item->is_cached )
 	{
 		// release the old data
-		cache_object_close( cache, *hit, NULL );
-		// the MRU end gets the updated data
-		hit = &alt[ cache->count - 1 ];
-	}
-	else if ( cache->count < cache->size )
-	{
-		// more room in cache, add it to MRU end
-		hit = &alt[ cache->count++ ];
-	}
-	else
-	{
-		// release the entry at the LRU end
-		cache_object_close( cache, cache->current[0], NULL );
-
-		// The MRU end gets the new item
-		hit = &alt[ cache->count - 1 ];
+		list_unlink( cache, item );
+		cache_object_close( cache, item, NULL );
 	}
-	*hit = object;
-	mlt_log( NULL, MLT_LOG_DEBUG, "%s: put %d = %p, %p\n", __FUNCTION__, cache->count - 1, object, data );
-
-	// Fetch the cache item
-	char key[19];
-	sprintf( key, "%p", object );
-	mlt_cache_item item = mlt_properties_get_data( cache->active, key, NULL );
-	if ( !item )
+	else if ( !item )
 	{
 		item = calloc( 1, sizeof( mlt_cache_item_s ) );
 		if ( item )
-			mlt_properties_set_data( cache->active, key, item, 0, free, NULL );
+		{
+			item->object = object;
+			hash_insert( cache, item );
+		}
 	}
+	mlt_log( NULL, MLT_LOG_DEBUG, "%s: put %d = %p, %p\n", __FUNCTION__, cache->count, object, data );
+
 	if ( item )
 	{
 		// If updating the cache item but not all references are released
@@ -408,25 +615,25 @@ void mlt_cache_put( mlt_cache cache, void *object, void* data, int size, mlt_des
 			mlt_cache_item orphan = calloc( 1, sizeof( mlt_cache_item_s ) );
 			if ( orphan )
 			{
+				char key[19];
 				mlt_log( NULL, MLT_LOG_DEBUG, "adding to garbage collection object %p data %p\n", item->object, item->data );
 				*orphan = *item;
+				orphan->prev = orphan->next = orphan->chain = NULL;
 				sprintf( key, "%p", orphan->data );
 				// We store in the garbage collection by data address, not the owner's!
 				mlt_properties_set_data( cache->garbage, key, orphan, 0, free, NULL );
 			}
 		}
 
-		// Set/update the cache item
+		// Set/update the cache item and make it the most recently used
 		item->cache = cache;
-		item->object = object;
 		item->data = data;
 		item->size = size;
 		item->destructor = destructor;
 		item->refcount = 1;
+		list_push( cache, item );
+		cache_evict( cache );
 	}
-	
-	// swap the current array
-	cache->current = alt;
 	pthread_mutex_unlock( &cache->mutex );
 }
 
@@ -442,81 +649,50 @@ mlt_cache_item mlt_cache_get( mlt_cache cache, void *object )
 {
 	mlt_cache_item result = NULL;
 	pthread_mutex_lock( &cache->mutex );
-	void **hit = shuffle_get_hit( cache, object );
-	void **alt = cache->current == cache->A ? cache->B : cache->A;
+	mlt_cache_item item = hash_find( cache, object, 0 );
 
-	if ( hit )
+	if ( item && item->is_cached )
 	{
-		// copy the hit to the MRU end
-		alt[ cache->count - 1 ] = *hit;
-		hit = &alt[ cache->count - 1 ];
-
-		char key[19];
-		sprintf( key, "%p", *hit );
-		result = mlt_properties_get_data( cache->active, key, NULL );
-		if ( result && result->data )
+		// move the hit to the MRU end
+		list_touch( cache, item );
+		result = item;
+		if ( result->data )
 		{
 			result->refcount++;
-			mlt_log( NULL, MLT_LOG_DEBUG, "%s: get %d = %p, %p\n", __FUNCTION__, cache->count - 1, *hit, result->data );
+			mlt_log( NULL, MLT_LOG_DEBUG, "%s: get %d = %p, %p\n", __FUNCTION__, cache->count - 1, object, result->data );
 		}
-
-		// swap the current array
-		cache->current = alt;
+		cache->hits++;
+	}
+	else
+	{
+		cache->misses++;
 	}
 	pthread_mutex_unlock( &cache->mutex );
 	
 	return result;
 }
 
-/** Shuffle the cache entries between the two arrays and return the frame for a position.
+/** Compute the number of bytes held by a cached frame.
  *
  * \private \memberof mlt_cache_s
- * \param cache a cache object
- * \param position the position of the frame that you want
- * \return a frame if there was a hit or NULL for a miss
+ * \param frame a frame
+ * \return the size of its image, alpha, and audio
  */
 
-static mlt_frame* shuffle_get_frame( mlt_cache cache, mlt_position position )
+static int frame_size( mlt_frame frame )
 {
-	int i = cache->count;
-	int j = cache->count - 1;
-	mlt_frame *hit = NULL;
-	mlt_frame *alt = (mlt_frame*) ( cache->current == cache->A ? cache->B : cache->A );
-
-	if ( cache->count > 0 && cache->count < cache->size )
-	{
-		// first determine if we have a hit
-		while ( i-- && !hit )
-		{
-			mlt_frame *o = (mlt_frame*) &cache->current[ i ];
-			if ( mlt_frame_original_position( *o ) == position )
-				hit = o;
-		}
-		// if there was no hit, we will not be shuffling out an entry
-		// and are still filling the cache
-		if ( !hit )
-			++j;
-		// reset these
-		i = cache->count;
-		hit = NULL;
-	}
-
-	// shuffle the existing entries to the alternate array
-	while ( i-- )
-	{
-		mlt_frame *o = (mlt_frame*) &cache->current[ i ];
-
-		if ( !hit && mlt_frame_original_position( *o ) == position )
-		{
-			hit = o;
-		}
-		else if ( j > 0 )
-		{
-			alt[ --j ] = *o;
-// 			mlt_log( NULL, MLT_LOG_DEBUG, "%s: shuffle %d = %p\n", __FUNCTION__, j, alt[j] );
-		}
-	}
-	return hit;
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	int size = 0, result = 0;
+
+	if ( mlt_properties_get_data( properties, "image", &size ) )
+		result += size;
+	size = 0;
+	if ( mlt_frame_get_alpha_size( frame, &size ) )
+		result += size;
+	size = 0;
+	if ( mlt_properties_get_data( properties, "audio", &size ) )
+		result += size;
+	return result;
 }
 
 /** Put a frame in the cache.
@@ -534,37 +710,36 @@ static mlt_frame* shuffle_get_frame( mlt_cache cache, mlt_position position )
 
 void mlt_cache_put_frame( mlt_cache cache, mlt_frame frame )
 {
+	mlt_position position = mlt_frame_original_position( frame );
 	pthread_mutex_lock( &cache->mutex );
-	mlt_frame *hit = shuffle_get_frame( cache, mlt_frame_original_position( frame ) );
-	mlt_frame *alt = (mlt_frame*) ( cache->current == cache->A ? cache->B : cache->A );
+	cache->is_frames = 1;
+	mlt_cache_item item = hash_find( cache, NULL, position );
 
 	// add the frame to the cache
-	if ( hit )
+	if ( item )
 	{
 		// release the old data
-		mlt_frame_close( *hit );
-		// the MRU end gets the updated data
-		hit = &alt[ cache->count - 1 ];
+		list_unlink( cache, item );
+		cache_object_close( cache, item, NULL );
 	}
-	else if ( cache->count < cache->size )
+	else
 	{
-		// more room in cache, add it to MRU end
-		hit = &alt[ cache->count++ ];
+		item = calloc( 1, sizeof( mlt_cache_item_s ) );
+		if ( item )
+		{
+			item->cache = cache;
+			item->position = position;
+			hash_insert( cache, item );
+		}
 	}
-	else
+	if ( item )
 	{
-		// release the entry at the LRU end
-		mlt_frame_close( cache->current[0] );
-
-		// The MRU end gets the new item
-		hit = &alt[ cache->count - 1 ];
+		item->data = mlt_frame_clone( frame, 1 );
+		item->size = frame_size( item->data );
+		list_push( cache, item );
+		mlt_log( NULL, MLT_LOG_DEBUG, "%s: put %d = %p\n", __FUNCTION__, cache->count - 1, frame );
+		cache_evict( cache );
 	}
-	*hit = mlt_frame_clone( frame, 1 );
-	mlt_log( NULL, MLT_LOG_DEBUG, "%s: put %d = %p\n", __FUNCTION__, cache->count - 1, frame );
-
-	// swap the current array
-	cache->current = (void**) alt;
-	cache->is_frames = 1;
 	pthread_mutex_unlock( &cache->mutex );
 }
 
@@ -583,20 +758,19 @@ mlt_frame mlt_cache_get_frame( mlt_cache cache, mlt_position position )
 {
 	mlt_frame result = NULL;
 	pthread_mutex_lock( &cache->mutex );
-	mlt_frame *hit = shuffle_get_frame( cache, position );
-	mlt_frame *alt = (mlt_frame*) ( cache->current == cache->A ? cache->B : cache->A );
+	mlt_cache_item item = cache->is_frames ? hash_find( cache, NULL, position ) : NULL;
 
-	if ( hit )
+	if ( item )
 	{
-		// copy the hit to the MRU end
-		alt[ cache->count - 1 ] = *hit;
-		hit = &alt[ cache->count - 1 ];
-
-		result = mlt_frame_clone( *hit, 1 );
-		mlt_log( NULL, MLT_LOG_DEBUG, "%s: get %d = %p\n", __FUNCTION__, cache->count - 1, *hit );
-
-		// swap the current array
-		cache->current = (void**) alt;
+		// move the hit to the MRU end
+		list_touch( cache, item );
+		result = mlt_frame_clone( item->data, 1 );
+		mlt_log( NULL, MLT_LOG_DEBUG, "%s: get %d = %p\n", __FUNCTION__, cache->count - 1, item->data );
+		cache->hits++;
+	}
+	else
+	{
+		cache->misses++;
 	}
 	pthread_mutex_unlock( &cache->mutex );
 
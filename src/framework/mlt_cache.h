@@ -31,6 +31,9 @@ extern void mlt_cache_item_close( mlt_cache_item item );
 extern mlt_cache mlt_cache_init();
 extern void mlt_cache_set_size( mlt_cache cache, int size );
 extern int mlt_cache_get_size( mlt_cache cache );
+extern void mlt_cache_set_memory_limit( mlt_cache cache, int64_t limit );
+extern int64_t mlt_cache_get_memory_limit( mlt_cache cache );
+extern void mlt_cache_get_stats( mlt_cache cache, mlt_properties properties );
 extern void mlt_cache_close( mlt_cache cache );
 extern void mlt_cache_purge( mlt_cache cache, void *object );
 extern void mlt_cache_put( mlt_cache cache, void *object, void* data, int size, mlt_destructor destructor );
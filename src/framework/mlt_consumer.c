@@ -26,6 +26,7 @@
 #include "mlt_frame.h"
 #include "mlt_profile.h"
 #include "mlt_log.h"
+#include "mlt_profiler.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -81,8 +82,12 @@ typedef struct
 	int consecutive_dropped;
 	int consecutive_rendered;
 	int process_head;
+	int audio_first; /**< audio is pulled on its own thread ahead of the workers */
+	int purge_count; /**< incremented by mlt_consumer_purge to discard frames in flight */
 	atomic_int started;
 	pthread_t *threads; /**< used to deallocate all threads */
+	int profiler; /**< true if this consumer started the profiler */
+	int pool_size; /**< the image size added to the memory pool, or 0 */
 }
 consumer_private;
 
@@ -473,6 +478,47 @@ static void set_image_format( mlt_consumer self )
 	}
 }
 
+/** Add the size of the images rendered by a consumer to the memory pool.
+ *
+ * Only the consumer's own image format is added, and it is removed again by
+ * \p remove_pool_size, so that the pool keeps no classes for stale sizes.
+ *
+ * \private \memberof mlt_consumer_s
+ * \param self a consumer
+ */
+
+static void add_pool_size( mlt_consumer self )
+{
+	consumer_private *priv = self->local;
+	mlt_properties properties = MLT_CONSUMER_PROPERTIES( self );
+	int width = mlt_properties_get_int( properties, "width" );
+	int height = mlt_properties_get_int( properties, "height" );
+
+	if ( priv->image_format == mlt_image_movit || priv->image_format == mlt_image_opengl_texture )
+		return;
+	priv->pool_size = mlt_image_format_size( priv->image_format, width, height, NULL );
+	if ( mlt_pool_add_size( priv->pool_size ) )
+	{
+		mlt_log_debug( MLT_CONSUMER_SERVICE( self ), "no memory pool class for %d bytes\n", priv->pool_size );
+		priv->pool_size = 0;
+	}
+}
+
+/** Remove the size added to the memory pool by \p add_pool_size.
+ *
+ * \private \memberof mlt_consumer_s
+ * \param self a consumer
+ */
+
+static void remove_pool_size( mlt_consumer self )
+{
+	consumer_private *priv = self->local;
+
+	if ( priv->pool_size > 0 )
+		mlt_pool_remove_size( priv->pool_size );
+	priv->pool_size = 0;
+}
+
 /** Start the consumer.
  *
  * \public \memberof mlt_consumer_s
@@ -539,6 +585,11 @@ MLTPP_DECLSPEC int mlt_consumer_start( mlt_consumer self )
 	// The profile could have changed between a stop and a restart.
 	apply_profile_properties( self, mlt_service_profile( MLT_CONSUMER_SERVICE(self) ), properties );
 
+	// Let the pool keep blocks of exactly the size of the images rendered
+	set_image_format( self );
+	remove_pool_size( self );
+	add_pool_size( self );
+
 	// Set the frame duration in microseconds for the frame-dropping heuristic
 	int frame_rate_num = mlt_properties_get_int( properties, "frame_rate_num" );
 	int frame_rate_den = mlt_properties_get_int( properties, "frame_rate_den" );
@@ -552,6 +603,15 @@ MLTPP_DECLSPEC int mlt_consumer_start( mlt_consumer self )
 	mlt_properties_set_int( properties, "frame_duration", frame_duration );
 	mlt_properties_set_int( properties, "drop_count", 0 );
 
+	// Profile the services when requested
+	if ( !priv->profiler && ( mlt_properties_get_int( properties, "profiler" ) ||
+		( getenv( "MLT_PROFILER" ) && atoi( getenv( "MLT_PROFILER" ) ) ) ) )
+	{
+		const char *trace = mlt_properties_get( properties, "profiler.trace" );
+		mlt_profiler_start( trace ? trace : getenv( "MLT_PROFILER_TRACE" ) );
+		priv->profiler = 1;
+	}
+
 	// Check and run an ante command
 	if ( mlt_properties_get( properties, "ante" ) )
 		if ( system( mlt_properties_get( properties, "ante" ) ) == -1 )
@@ -560,8 +620,11 @@ MLTPP_DECLSPEC int mlt_consumer_start( mlt_consumer self )
 	// Set the real_time preference
 	priv->real_time = mlt_properties_get_int( properties, "real_time" );
 
+	// Audio first uses the worker threads implementation with frame dropping
+	priv->audio_first = priv->real_time > 0 && mlt_properties_get_int( properties, "audio_first" );
+
 	// For worker threads implementation, buffer must be at least # threads
-	if ( abs( priv->real_time ) > 1 && mlt_properties_get_int( properties, "buffer" ) <= abs( priv->real_time ) )
+	if ( ( abs( priv->real_time ) > 1 || priv->audio_first ) && mlt_properties_get_int( properties, "buffer" ) <= abs( priv->real_time ) )
 		mlt_properties_set_int( properties, "_buffer", abs( priv->real_time ) + 1 );
 
 	// Store the parameters for audio processing.
@@ -572,7 +635,7 @@ MLTPP_DECLSPEC int mlt_consumer_start( mlt_consumer self )
 	priv->preroll = 1;
 
 #ifdef _WIN32
-	if ( priv->real_time == 1 || priv->real_time == -1 )
+	if ( ( priv->real_time == 1 || priv->real_time == -1 ) && !priv->audio_first )
 		consumer_read_ahead_start( self );
 #endif
 
@@ -1083,6 +1146,87 @@ static void *consumer_worker_thread( void *arg )
 	return NULL;
 }
 
+/** Compute the number of frames to keep in the work queue.
+ *
+ * \private \memberof mlt_consumer_s
+ * \param self a consumer
+ * \return the size of the work queue
+ */
+
+static int worker_buffer_size( mlt_consumer self )
+{
+	consumer_private *priv = self->local;
+	mlt_properties properties = MLT_CONSUMER_PROPERTIES( self );
+	int threads = abs( priv->real_time );
+	int buffer = mlt_properties_get_int( properties, "_buffer" );
+	buffer = buffer > 0 ? buffer : mlt_properties_get_int( properties, "buffer" );
+	// This is a heuristic to determine a suitable minimum buffer size for the number of threads.
+	int headroom = (priv->real_time < 0) ? threads : (2 + threads * threads);
+	return MAX(buffer, headroom);
+}
+
+/** The thread procedure for pulling frames and their audio into the work
+ * queue ahead of the worker threads when audio_first is set.
+ *
+ * Getting the audio of a frame is cheap compared to rendering its image,
+ * so the work queue is kept full of frames whose audio is ready, and the
+ * consumer takes them at the rate it plays audio whether or not their
+ * images are done yet.
+ *
+ * \private \memberof mlt_consumer_s
+ * \param arg a consumer
+ */
+
+static void *consumer_audio_thread( void *arg )
+{
+	mlt_consumer self = arg;
+	consumer_private *priv = self->local;
+	mlt_properties properties = MLT_CONSUMER_PROPERTIES( self );
+	int audio_off = mlt_properties_get_int( properties, "audio_off" );
+	int samples = 0;
+	void *audio = NULL;
+
+	mlt_events_fire( properties, "consumer-thread-started", mlt_event_data_none() );
+
+	while ( priv->ahead )
+	{
+		// Wait for space in the work queue
+		pthread_mutex_lock( &priv->queue_mutex );
+		int buffer = priv->speed == 0 ? 1 : worker_buffer_size( self );
+		while ( priv->ahead && mlt_deque_count( priv->queue ) >= buffer )
+		{
+			pthread_cond_wait( &priv->queue_cond, &priv->queue_mutex );
+			buffer = priv->speed == 0 ? 1 : worker_buffer_size( self );
+		}
+		int purge_count = priv->purge_count;
+		pthread_mutex_unlock( &priv->queue_mutex );
+
+		if ( !priv->ahead )
+			break;
+
+		mlt_frame frame = mlt_consumer_get_frame( self );
+		if ( frame == NULL )
+			continue;
+		if ( !audio_off )
+		{
+			samples = mlt_audio_calculate_frame_samples( priv->fps, priv->frequency, priv->aud_counter++ );
+			mlt_frame_get_audio( frame, &audio, &priv->audio_format, &priv->frequency, &priv->channels, &samples );
+		}
+
+		pthread_mutex_lock( &priv->queue_mutex );
+		priv->speed = mlt_properties_get_int( MLT_FRAME_PROPERTIES( frame ), "_speed" );
+		// Discard a frame requested before a purge
+		if ( purge_count != priv->purge_count )
+			mlt_frame_close( frame );
+		else
+			mlt_deque_push_back( priv->queue, frame );
+		pthread_cond_broadcast( &priv->queue_cond );
+		pthread_mutex_unlock( &priv->queue_mutex );
+	}
+
+	return NULL;
+}
+
 /** Start the read/render thread.
  *
  * \private \memberof mlt_consumer_s
@@ -1128,7 +1272,7 @@ static void consumer_work_start( mlt_consumer self )
 	if ( priv->started )
 		return;
 
-	thread = calloc( 1, sizeof( pthread_t ) * n );
+	thread = calloc( 1, sizeof( pthread_t ) * ( n + 1 ) );
 
 	// We're running now
 	priv->ahead = 1;
@@ -1191,6 +1335,10 @@ static void consumer_work_start( mlt_consumer self )
 			thread++;
 		}
 	}
+
+	// The last slot is for the thread that fetches frames and audio
+	if ( priv->audio_first && pthread_create( thread, NULL, consumer_audio_thread, self ) == 0 )
+		mlt_deque_push_back( priv->worker_threads, thread );
 	priv->started = 1;
 }
 
@@ -1325,10 +1473,13 @@ MLTPP_DECLSPEC void mlt_consumer_purge( mlt_consumer self )
 
 		if ( priv->started && priv->real_time )
 		{
-			priv->is_purge = 1;
+			if ( priv->audio_first )
+				priv->purge_count++;
+			else
+				priv->is_purge = 1;
 			pthread_cond_broadcast( &priv->queue_cond );
 			pthread_mutex_unlock( &priv->queue_mutex );
-			if ( abs( priv->real_time ) > 1 )
+			if ( abs( priv->real_time ) > 1 || priv->audio_first )
 			{
 				pthread_mutex_lock( &priv->done_mutex );
 				pthread_cond_broadcast( &priv->done_cond );
@@ -1358,11 +1509,7 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 	int audio_off = mlt_properties_get_int( properties, "audio_off" );
 	int samples = 0;
 	void *audio = NULL;
-	int buffer = mlt_properties_get_int( properties, "_buffer" );
-	buffer = buffer > 0 ? buffer : mlt_properties_get_int( properties, "buffer" );
-	// This is a heuristic to determine a suitable minimum buffer size for the number of threads.
-	int headroom = (priv->real_time < 0) ? threads : (2 + threads * threads);
-	buffer = MAX(buffer, headroom);
+	int buffer = worker_buffer_size( self );
 
 	// Start worker threads if not already started.
 	if ( ! priv->ahead )
@@ -1375,7 +1522,7 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 		consumer_work_start( self );
 
 		// Fill the work queue.
-		int i = buffer;
+		int i = priv->audio_first ? 0 : buffer;
 		while ( priv->ahead && i-- )
 		{
 			frame = mlt_consumer_get_frame( self );
@@ -1397,7 +1544,22 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 		}
 
 		// Wait for prefill
-		while ( priv->ahead && first_unprocessed_frame( self ) < prefill )
+		if ( priv->audio_first )
+		{
+			// The queue is filled concurrently, so only look at it with the lock
+			pthread_mutex_lock( &priv->done_mutex );
+			while ( priv->ahead )
+			{
+				pthread_mutex_lock( &priv->queue_mutex );
+				int done = first_unprocessed_frame( self ) >= prefill;
+				pthread_mutex_unlock( &priv->queue_mutex );
+				if ( done )
+					break;
+				pthread_cond_wait( &priv->done_cond, &priv->done_mutex );
+			}
+			pthread_mutex_unlock( &priv->done_mutex );
+		}
+		else while ( priv->ahead && first_unprocessed_frame( self ) < prefill )
 		{
 			pthread_mutex_lock( &priv->done_mutex );
 			pthread_cond_wait( &priv->done_cond, &priv->done_mutex );
@@ -1410,7 +1572,7 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 //		threads, first_unprocessed_frame( self ), mlt_deque_count( priv->queue ), priv->process_head );
 
 	// Feed the work queue
-	while ( priv->ahead && mlt_deque_count( priv->queue ) < buffer )
+	while ( priv->ahead && !priv->audio_first && mlt_deque_count( priv->queue ) < buffer )
 	{
 		frame = mlt_consumer_get_frame( self );
 		if ( frame )
@@ -1441,7 +1603,13 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 
 	// Get the frame from the queue.
 	pthread_mutex_lock( &priv->queue_mutex );
+	while ( priv->ahead && priv->audio_first && !mlt_deque_count( priv->queue ) )
+		pthread_cond_wait( &priv->queue_cond, &priv->queue_mutex );
 	frame = mlt_deque_pop_front( priv->queue );
+	// A frame still rendering is shown by an audio first consumer if it finishes in time
+	int processing = frame && priv->audio_first && frame->is_processing;
+	if ( priv->audio_first )
+		pthread_cond_broadcast( &priv->queue_cond );
 	pthread_mutex_unlock( &priv->queue_mutex );
 	if ( ! frame ) {
 		priv->is_purge = 0;
@@ -1451,7 +1619,7 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 	// Adapt the worker process head to the runtime conditions.
 	if ( priv->real_time > 0 )
 	{
-		if ( mlt_properties_get_int( MLT_FRAME_PROPERTIES( frame ), "rendered" ) )
+		if ( processing || mlt_properties_get_int( MLT_FRAME_PROPERTIES( frame ), "rendered" ) )
 		{
 			priv->consecutive_dropped = 0;
 			if ( priv->process_head > threads && priv->consecutive_rendered >= priv->process_head )
@@ -1485,7 +1653,7 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 				mlt_properties_set_int( properties, "_buffer", buffer + threads );
 				priv->consecutive_dropped = priv->fps / 2;
 			}
-			else
+			else if ( !processing )
 			{
 				// Tell the consumer to render it
 				mlt_log_verbose( self, "forcing next frame\n" );
@@ -1493,7 +1661,7 @@ static mlt_frame worker_get_frame( mlt_consumer self, mlt_properties properties
 				priv->consecutive_dropped = 0;
 			}
 		}
-		if ( !mlt_properties_get_int( MLT_FRAME_PROPERTIES(frame), "rendered") )
+		if ( !processing && !mlt_properties_get_int( MLT_FRAME_PROPERTIES(frame), "rendered") )
 		{
 			int dropped = mlt_properties_get_int( properties, "drop_count" );
 			mlt_properties_set_int( properties, "drop_count", ++dropped );
@@ -1529,7 +1697,7 @@ mlt_frame mlt_consumer_rt_frame( mlt_consumer self )
 	consumer_private *priv = self->local;
 
 	// Check if the user has requested real time or not
-	if ( priv->real_time > 1 || priv->real_time < -1 )
+	if ( priv->real_time > 1 || priv->real_time < -1 || priv->audio_first )
 	{
 		// see above
 		return worker_get_frame( self, properties );
@@ -1645,14 +1813,25 @@ MLTPP_DECLSPEC int mlt_consumer_stop( mlt_consumer self )
 
 	// Check if the user has requested real time or not and stop if necessary
 	mlt_log( MLT_CONSUMER_SERVICE( self ), MLT_LOG_DEBUG, "stopping read_ahead\n" );
-	if ( abs( priv->real_time ) == 1 )
-		consumer_read_ahead_stop( self );
-	else if ( abs( priv->real_time ) > 1 )
+	if ( abs( priv->real_time ) > 1 || priv->audio_first )
 		consumer_work_stop( self );
+	else if ( abs( priv->real_time ) == 1 )
+		consumer_read_ahead_stop( self );
 
 	// Kill the test card
 	mlt_properties_set_data( properties, "test_card_producer", NULL, 0, NULL, NULL );
 
+	// Let the pool free the blocks of the images rendered
+	remove_pool_size( self );
+
+	// Publish the profile
+	if ( priv->profiler )
+	{
+		mlt_profiler_report( properties );
+		mlt_profiler_stop();
+		priv->profiler = 0;
+	}
+
 	// Check and run a post command
 	if ( mlt_properties_get( properties, "post" ) )
 		if (system( mlt_properties_get( properties, "post" ) ) == -1 )
@@ -1713,6 +1892,10 @@ MLTPP_DECLSPEC void mlt_consumer_close( mlt_consumer self )
 
 			pthread_mutex_destroy( &priv->position_mutex );
 
+			if ( priv->profiler )
+				mlt_profiler_stop();
+			remove_pool_size( self );
+
 			mlt_service_close( &self->parent );
 			free( priv );
 		}
@@ -47,9 +47,16 @@
  * other options include: mono, stereo, 5.1, 7.1, etc.
  * \properties \em real_time the asynchronous behavior: 1 (default) for asynchronous
  * with frame dropping, -1 for asynchronous without frame dropping, 0 to disable (synchronous)
+ * \properties \em audio_first when real_time > 0, set to 1 to fetch the frames and their
+ * audio on a thread of their own ahead of the image rendering threads so that a slow image
+ * does not hold up the audio; a frame whose image is not ready when the consumer takes it is
+ * returned with "rendered" 0 and may be finished while the consumer still holds it
  * \properties \em test_card the name of a resource to use as the test card, defaults to
  * environment variable MLT_TEST_CARD. If undefined, the hard-coded default test card is
  * white silence. A test card is what appears when nothing is produced.
+ * \properties \em profiler set to 1 to time every service while the consumer runs;
+ * when stopped, the results are set as profiler.* properties (see mlt_profiler_report)
+ * \properties \em profiler.trace the name of a Chrome trace (JSON) file to write while profiling
  * \event \em consumer-frame-show Subclass implementations fire this immediately after showing a frame
  *   or when a frame should be shown (if audio-only consumer). The event data is a frame.
  * \event \em consumer-frame-render The base class fires this immediately before rendering a frame;
@@ -46,10 +46,25 @@ static int events_destroyed = 0;
  * services.
  */
 
+typedef struct
+{
+	mlt_key id;           /**< the interned name of the event */
+	char *name;           /**< the name of the event */
+	mlt_event *listeners; /**< the connected listeners, some slots may be NULL */
+	int count;            /**< the number of slots in use */
+	int size;             /**< the allocated number of slots */
+}
+event_list;
+
 struct mlt_events_struct
 {
 	mlt_properties owner;
-	mlt_properties listeners;
+	event_list *lists;    /**< the registered events */
+	int count;
+	int size;
+	int batch;            /**< the nesting depth of mlt_events_begin_batch() */
+	mlt_properties changed; /**< the properties changed during a batch, in order */
+	pthread_mutex_t mutex; /**< protects the arrays, which grow while other threads fire */
 };
 
 typedef struct mlt_events_struct *mlt_events;
@@ -131,6 +146,54 @@ void mlt_event_close( mlt_event self )
 static mlt_events mlt_events_fetch( mlt_properties );
 static void mlt_events_close( mlt_events );
 
+static pthread_once_t keys_once = PTHREAD_ONCE_INIT;
+static mlt_key events_key = NULL;
+static mlt_key property_changed_key = NULL;
+
+static void init_keys( )
+{
+	events_key = mlt_properties_key( "_events" );
+	property_changed_key = mlt_properties_key( "property-changed" );
+}
+
+/** Find the list of listeners for an event.
+ *
+ * Events are few per object, so a linear search comparing interned keys
+ * is quicker than a hash lookup.
+ * \private \memberof mlt_events_struct
+ * \param events an events object
+ * \param id the interned name of the event
+ * \return the index of the list or -1 if the event is not registered
+ */
+
+static inline int find_list( mlt_events events, mlt_key id )
+{
+	int i;
+	for ( i = 0; i < events->count; i ++ )
+		if ( events->lists[ i ].id == id )
+			return i;
+	return -1;
+}
+
+/** Find the list of listeners for an event by name.
+ *
+ * \private \memberof mlt_events_struct
+ * \param events an events object
+ * \param id the name of the event
+ * \return the index of the list or -1 if the event is not registered
+ */
+
+static int find_list_by_name( mlt_events events, const char *id )
+{
+	int i;
+	if ( id == NULL )
+		return -1;
+	for ( i = 0; i < events->count; i ++ )
+		if ( !strcmp( events->lists[ i ].name, id ) )
+			return i;
+	return -1;
+}
+
 /** Initialise the events structure.
  *
  * \public \memberof mlt_events_struct
@@ -143,8 +206,8 @@ void mlt_events_init( mlt_properties self )
 	if (!events && self) {
 		events = calloc( 1, sizeof( struct mlt_events_struct ) );
 		if (events) {
-			events->listeners = mlt_properties_new( );
 			events->owner = self;
+			pthread_mutex_init( &events->mutex, NULL );
 			mlt_properties_set_data( self, "_events", events, 0, ( mlt_destructor )mlt_events_close, NULL );
 		}
 	}
@@ -162,17 +225,67 @@ int mlt_events_register(mlt_properties self, const char *id)
 {
 	int error = 1;
 	mlt_events events = mlt_events_fetch( self );
-	if ( events != NULL )
+	if ( events != NULL && id != NULL )
 	{
-		mlt_properties list = events->listeners;
-		char temp[ 128 ];
-		sprintf( temp, "list:%s", id );
-		if ( mlt_properties_get_data( list, temp, NULL ) == NULL )
-			mlt_properties_set_data( list, temp, mlt_properties_new( ), 0, ( mlt_destructor )mlt_properties_close, NULL );
+		pthread_mutex_lock( &events->mutex );
+		if ( find_list_by_name( events, id ) < 0 )
+		{
+			if ( events->count == events->size )
+			{
+				int size = events->size + 4;
+				event_list *lists = realloc( events->lists, size * sizeof( event_list ) );
+				if ( lists == NULL )
+				{
+					pthread_mutex_unlock( &events->mutex );
+					return error;
+				}
+				events->lists = lists;
+				events->size = size;
+			}
+			memset( &events->lists[ events->count ], 0, sizeof( event_list ) );
+			events->lists[ events->count ].id = mlt_properties_key( id );
+			events->lists[ events->count ].name = strdup( id );
+			events->count ++;
+		}
+		pthread_mutex_unlock( &events->mutex );
 	}
 	return error;
 }
 
+/** Call the listeners of an event.
+ *
+ * The mutex is held on entry and on return but not while a listener runs.
+ * A listener may connect or disconnect listeners, and another thread may
+ * grow the arrays meanwhile, so the list is indexed afresh for each call.
+ * \private \memberof mlt_events_struct
+ * \param events an events object
+ * \param index the index of the list of listeners or -1
+ * \param event_data an event data object
+ * \return the number of listeners
+ */
+
+static int fire_list( mlt_events events, int index, mlt_event_data event_data )
+{
+	int result = 0;
+	int i;
+	if ( index < 0 )
+		return 0;
+	for ( i = 0; i < events->lists[ index ].count; i ++ )
+	{
+		mlt_event event = events->lists[ index ].listeners[ i ];
+		if ( event != NULL && event->parent != NULL && event->block_count == 0 )
+		{
+			mlt_listener listener = event->listener;
+			void *listener_data = event->listener_data;
+			pthread_mutex_unlock( &events->mutex );
+			listener( events->owner, listener_data, event_data );
+			pthread_mutex_lock( &events->mutex );
+			++result;
+		}
+	}
+	return result;
+}
+
 /** Fire an event.
  *
  * \public \memberof mlt_events_struct
@@ -188,23 +301,134 @@ MLTPP_DECLSPEC int mlt_events_fire(mlt_properties self, const char *id, mlt_even
 	mlt_events events = mlt_events_fetch( self );
 	if ( events != NULL )
 	{
-		mlt_properties list = events->listeners;
-		mlt_properties listeners = NULL;
-		char temp[ 128 ];
-		sprintf( temp, "list:%s", id );
-		listeners = mlt_properties_get_data( list, temp, NULL );
+		pthread_mutex_lock( &events->mutex );
+		result = fire_list( events, find_list_by_name( events, id ), event_data );
+		pthread_mutex_unlock( &events->mutex );
+	}
+	return result;
+}
+
+/** Fire an event given its interned name.
+ *
+ * This is the same as mlt_events_fire() without comparing strings. It costs
+ * very little when nothing listens for the event.
+ * \public \memberof mlt_events_struct
+ * \param self a properties list
+ * \param id the interned name of an event
+ * \param event_data an event data object
+ * \return the number of listeners
+ */
+
+int mlt_events_fire_k( mlt_properties self, mlt_key id, mlt_event_data event_data )
+{
+	int result = 0;
+	mlt_events events = mlt_events_fetch( self );
+	if ( events != NULL )
+	{
+		pthread_mutex_lock( &events->mutex );
+		result = fire_list( events, find_list( events, id ), event_data );
+		pthread_mutex_unlock( &events->mutex );
+	}
+	return result;
+}
+
+/** Fire a "property-changed" event.
+ *
+ * Inside a batch the name is only recorded. The event fires once for each
+ * recorded name when the batch ends.
+ * \public \memberof mlt_events_struct
+ * \param self a properties list
+ * \param name the name of the property that changed
+ * \return the number of listeners
+ */
+
+int mlt_events_fire_property_changed( mlt_properties self, const char *name )
+{
+	int result = 0;
+	mlt_events events = mlt_events_fetch( self );
+	if ( events != NULL )
+	{
+		int index;
+		pthread_mutex_lock( &events->mutex );
+		index = find_list( events, property_changed_key );
+		if ( index < 0 || events->lists[ index ].count == 0 )
+		{
+			// Nothing listens
+		}
+		else if ( events->batch > 0 && name != NULL )
+		{
+			if ( events->changed == NULL )
+				events->changed = mlt_properties_new( );
+			if ( mlt_properties_get_data( events->changed, name, NULL ) == NULL )
+				mlt_properties_set_data( events->changed, name, events, 0, NULL, NULL );
+		}
+		else
+		{
+			result = fire_list( events, index, mlt_event_data_from_string( name ) );
+		}
+		pthread_mutex_unlock( &events->mutex );
+	}
+	return result;
+}
+
+/** Start collecting "property-changed" events.
+ *
+ * Until the matching mlt_events_end_batch(), the listeners of
+ * "property-changed" are not called. Each property that changes is
+ * remembered once, in the order it first changed. Other events are not
+ * affected. Batches may be nested.
+ * \public \memberof mlt_events_struct
+ * \param self a properties list
+ */
 
-		if ( listeners != NULL )
+void mlt_events_begin_batch( mlt_properties self )
+{
+	mlt_events events = mlt_events_fetch( self );
+	if ( events != NULL )
+	{
+		pthread_mutex_lock( &events->mutex );
+		events->batch ++;
+		pthread_mutex_unlock( &events->mutex );
+	}
+}
+
+/** Finish collecting "property-changed" events.
+ *
+ * When the outermost batch ends, "property-changed" fires once for each
+ * property that changed during the batch.
+ * \public \memberof mlt_events_struct
+ * \param self a properties list
+ * \return the number of listeners called
+ */
+
+int mlt_events_end_batch( mlt_properties self )
+{
+	int result = 0;
+	mlt_events events = mlt_events_fetch( self );
+	if ( events != NULL )
+	{
+		mlt_properties changed = NULL;
+		int i;
+		pthread_mutex_lock( &events->mutex );
+		if ( events->batch > 0 && -- events->batch == 0 )
 		{
-			for ( int i = 0; i < mlt_properties_count( listeners ); i ++ )
-			{
-				mlt_event event = mlt_properties_get_data_at( listeners, i, NULL );
-				if ( event != NULL && event->parent != NULL && event->block_count == 0 )
-				{
-					event->listener( event->parent->owner, event->listener_data, event_data );
-					++result;
-				}
-			}
+			// Detach the names so that listeners changing properties fire normally
+			changed = events->changed;
+			events->changed = NULL;
+		}
+		if ( changed != NULL )
+		{
+			// Keep the owner, and with it the events object, alive while listeners run
+			mlt_properties_inc_ref( self );
+			for ( i = 0; i < mlt_properties_count( changed ); i ++ )
+				result += fire_list( events, find_list( events, property_changed_key ),
+					mlt_event_data_from_string( mlt_properties_get_name( changed, i ) ) );
+		}
+		pthread_mutex_unlock( &events->mutex );
+		if ( changed != NULL )
+		{
+			mlt_properties_close( self );
+			mlt_properties_close( changed );
 		}
 	}
 	return result;
@@ -224,52 +448,73 @@ MLTPP_DECLSPEC mlt_event mlt_events_listen( mlt_properties self, void *listener_
 {
 	mlt_event event = NULL;
 	mlt_events events = mlt_events_fetch( self );
+	int index = -1;
 	if ( events != NULL )
 	{
-		mlt_properties list = events->listeners;
-		mlt_properties listeners = NULL;
-		char temp[ 128 ];
-		sprintf( temp, "list:%s", id );
-		listeners = mlt_properties_get_data( list, temp, NULL );
-		if ( listeners != NULL )
+		pthread_mutex_lock( &events->mutex );
+		index = find_list_by_name( events, id );
+	}
+	if ( index >= 0 )
+	{
+		event_list *list = &events->lists[ index ];
+		int first_null = -1;
+		int i = 0;
+		for ( i = 0; event == NULL && i < list->count; i ++ )
 		{
-			int first_null = -1;
-			int i = 0;
-			for ( i = 0; event == NULL && i < mlt_properties_count( listeners ); i ++ )
+			mlt_event entry = list->listeners[ i ];
+			if ( entry != NULL && entry->parent != NULL )
 			{
-				mlt_event entry = mlt_properties_get_data_at( listeners, i, NULL );
-				if ( entry != NULL && entry->parent != NULL )
-				{
-					if ( entry->listener_data == listener_data && entry->listener == listener )
-						event = entry;
-				}
-				else if ( ( entry == NULL || entry->parent == NULL ) && first_null == -1 )
-				{
-					first_null = i;
-				}
+				if ( entry->listener_data == listener_data && entry->listener == listener )
+					event = entry;
 			}
+			else if ( first_null == -1 )
+			{
+				first_null = i;
+			}
+		}
 
-			if ( event == NULL )
+		if ( event == NULL && first_null == -1 && list->count == list->size )
+		{
+			int size = list->size ? list->size * 2 : 4;
+			mlt_event *listeners = realloc( list->listeners, size * sizeof( mlt_event ) );
+			if ( listeners == NULL )
+			{
+				pthread_mutex_unlock( &events->mutex );
+				return NULL;
+			}
+			list->listeners = listeners;
+			list->size = size;
+		}
+
+		if ( event == NULL )
+		{
+			event = malloc( sizeof( struct mlt_event_struct ) );
+			if ( event != NULL )
 			{
-				event = malloc( sizeof( struct mlt_event_struct ) );
-				if ( event != NULL )
-				{
 #ifdef _MLT_EVENT_CHECKS_
-					events_created ++;
+				events_created ++;
 #endif
-					sprintf( temp, "%d", first_null == -1 ? mlt_properties_count( listeners ) : first_null );
-					event->parent = events;
-					event->ref_count = 0;
-					event->block_count = 0;
-					event->listener = listener;
-					event->listener_data = listener_data;
-					mlt_properties_set_data( listeners, temp, event, 0, ( mlt_destructor )mlt_event_close, NULL );
-					mlt_event_inc_ref( event );
+				event->parent = events;
+				event->ref_count = 0;
+				event->block_count = 0;
+				event->listener = listener;
+				event->listener_data = listener_data;
+				mlt_event_inc_ref( event );
+				if ( first_null == -1 )
+				{
+					list->listeners[ list->count ++ ] = event;
+				}
+				else
+				{
+					// Release the slot's previous event, which its owner already closed
+					mlt_event_close( list->listeners[ first_null ] );
+					list->listeners[ first_null ] = event;
 				}
 			}
-
 		}
 	}
+	if ( events != NULL )
+		pthread_mutex_unlock( &events->mutex );
 	return event;
 }
 
@@ -286,21 +531,18 @@ void mlt_events_block( mlt_properties self, void *listener_data )
 	if ( events != NULL )
 	{
 		int i = 0, j = 0;
-		mlt_properties list = events->listeners;
-		for ( j = 0; j < mlt_properties_count( list ); j ++ )
+		pthread_mutex_lock( &events->mutex );
+		for ( j = 0; j < events->count; j ++ )
 		{
-			char *temp = mlt_properties_get_name( list, j );
-			if ( !strncmp( temp, "list:", 5 ) )
+			event_list *list = &events->lists[ j ];
+			for ( i = 0; i < list->count; i ++ )
 			{
-				mlt_properties listeners = mlt_properties_get_data( list, temp, NULL );
-				for ( i = 0; i < mlt_properties_count( listeners ); i ++ )
-				{
-					mlt_event entry = mlt_properties_get_data_at( listeners, i, NULL );
-					if ( entry != NULL && entry->listener_data == listener_data )
-						mlt_event_block( entry );
-				}
+				mlt_event entry = list->listeners[ i ];
+				if ( entry != NULL && entry->listener_data == listener_data )
+					mlt_event_block( entry );
 			}
 		}
+		pthread_mutex_unlock( &events->mutex );
 	}
 }
 
@@ -317,21 +559,18 @@ void mlt_events_unblock( mlt_properties self, void *listener_data )
 	if ( events != NULL )
 	{
 		int i = 0, j = 0;
-		mlt_properties list = events->listeners;
-		for ( j = 0; j < mlt_properties_count( list ); j ++ )
+		pthread_mutex_lock( &events->mutex );
+		for ( j = 0; j < events->count; j ++ )
 		{
-			char *temp = mlt_properties_get_name( list, j );
-			if ( !strncmp( temp, "list:", 5 ) )
+			event_list *list = &events->lists[ j ];
+			for ( i = 0; i < list->count; i ++ )
 			{
-				mlt_properties listeners = mlt_properties_get_data( list, temp, NULL );
-				for ( i = 0; i < mlt_properties_count( listeners ); i ++ )
-				{
-					mlt_event entry = mlt_properties_get_data_at( listeners, i, NULL );
-					if ( entry != NULL && entry->listener_data == listener_data )
-						mlt_event_unblock( entry );
-				}
+				mlt_event entry = list->listeners[ i ];
+				if ( entry != NULL && entry->listener_data == listener_data )
+					mlt_event_unblock( entry );
 			}
 		}
+		pthread_mutex_unlock( &events->mutex );
 	}
 }
 
@@ -348,22 +587,24 @@ void mlt_events_disconnect( mlt_properties self, void *listener_data )
 	if ( events != NULL )
 	{
 		int i = 0, j = 0;
-		mlt_properties list = events->listeners;
-		for ( j = 0; j < mlt_properties_count( list ); j ++ )
+		pthread_mutex_lock( &events->mutex );
+		for ( j = 0; j < events->count; j ++ )
 		{
-			char *temp = mlt_properties_get_name( list, j );
-			if ( !strncmp( temp, "list:", 5 ) )
+			event_list *list = &events->lists[ j ];
+			for ( i = 0; i < list->count; i ++ )
 			{
-				mlt_properties listeners = mlt_properties_get_data( list, temp, NULL );
-				for ( i = 0; i < mlt_properties_count( listeners ); i ++ )
+				mlt_event entry = list->listeners[ i ];
+				if ( entry != NULL && entry->listener_data == listener_data )
 				{
-					mlt_event entry = mlt_properties_get_data_at( listeners, i, NULL );
-					char *name = mlt_properties_get_name( listeners, i );
-					if ( entry != NULL && entry->listener_data == listener_data )
-						mlt_properties_set_data( listeners, name, NULL, 0, NULL, NULL );
+					list->listeners[ i ] = NULL;
+					mlt_event_close( entry );
 				}
 			}
+			// Trailing empty slots cost nothing to fire
+			while ( list->count > 0 && list->listeners[ list->count - 1 ] == NULL )
+				list->count --;
 		}
+		pthread_mutex_unlock( &events->mutex );
 	}
 }
 
@@ -454,7 +695,10 @@ static mlt_events mlt_events_fetch( mlt_properties self )
 {
 	mlt_events events = NULL;
 	if ( self != NULL )
-		events = mlt_properties_get_data( self, "_events", NULL );
+	{
+		pthread_once( &keys_once, init_keys );
+		events = mlt_properties_get_data_k( self, events_key, NULL );
+	}
 	return events;
 }
 
@@ -468,7 +712,17 @@ static void mlt_events_close( mlt_events events )
 {
 	if ( events != NULL )
 	{
-		mlt_properties_close( events->listeners );
+		int i, j;
+		for ( j = 0; j < events->count; j ++ )
+		{
+			for ( i = 0; i < events->lists[ j ].count; i ++ )
+				mlt_event_close( events->lists[ j ].listeners[ i ] );
+			free( events->lists[ j ].listeners );
+			free( events->lists[ j ].name );
+		}
+		free( events->lists );
+		mlt_properties_close( events->changed );
+		pthread_mutex_destroy( &events->mutex );
 		free( events );
 	}
 }
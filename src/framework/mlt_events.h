@@ -67,6 +67,10 @@ extern int mlt_events_register( mlt_properties self, const char *id );
 extern void mlt_events_block( mlt_properties self, void *listener_data );
 extern void mlt_events_unblock( mlt_properties self, void *listener_data );
 extern void mlt_events_disconnect( mlt_properties self, void *listener_data );
+extern int mlt_events_fire_k( mlt_properties self, mlt_key id, mlt_event_data );
+extern int mlt_events_fire_property_changed( mlt_properties self, const char *name );
+extern void mlt_events_begin_batch( mlt_properties self );
+extern int mlt_events_end_batch( mlt_properties self );
 
 extern mlt_event mlt_events_setup_wait_for( mlt_properties self, const char *id );
 extern void mlt_events_wait_for( mlt_properties self, mlt_event event );
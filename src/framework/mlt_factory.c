@@ -552,6 +552,7 @@ MLTPP_DECLSPEC void mlt_factory_close( )
 		}
 		free( mlt_directory );
 		mlt_directory = NULL;
+		mlt_profiler_close( );
 		mlt_pool_close( );
 	}
 }
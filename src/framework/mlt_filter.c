@@ -23,6 +23,7 @@
 #include "mlt_filter.h"
 #include "mlt_frame.h"
 #include "mlt_producer.h"
+#include "mlt_profiler.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -322,7 +323,10 @@ mlt_frame mlt_filter_process( mlt_filter self, mlt_frame frame )
 		mlt_properties_set_data( MLT_FRAME_PROPERTIES(frame), name, self, 0,
 			(mlt_destructor) mlt_filter_close, NULL );
 
-		return self->process( self, frame );
+		mlt_profiler_span span = mlt_profiler_enter( MLT_FILTER_SERVICE( self ), mlt_profiler_get_frame );
+		frame = self->process( self, frame );
+		mlt_profiler_leave( span, frame );
+		return frame;
 	}
 }
 
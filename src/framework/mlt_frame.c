@@ -26,10 +26,25 @@
 #include "mlt_factory.h"
 #include "mlt_profile.h"
 #include "mlt_log.h"
+#include "mlt_profiler.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+
+/** interned names of the properties used on every mlt_frame_get_image() */
+static pthread_once_t keys_once = PTHREAD_ONCE_INIT;
+static mlt_key image_count_key, width_key, height_key, format_key, image_key;
+
+static void init_keys()
+{
+	image_count_key = mlt_properties_key( "image_count" );
+	width_key = mlt_properties_key( "width" );
+	height_key = mlt_properties_key( "height" );
+	format_key = mlt_properties_key( "format" );
+	image_key = mlt_properties_key( "image" );
+}
 
 /** Construct a frame object.
  *
@@ -195,6 +210,7 @@ int mlt_frame_set_position( mlt_frame self, mlt_position value )
 
 int mlt_frame_push_get_image( mlt_frame self, mlt_get_image get_image )
 {
+	mlt_profiler_push_callback( self, get_image );
 	return mlt_deque_push_back( self->stack_image, get_image );
 }
 
@@ -295,6 +311,7 @@ int mlt_frame_pop_service_int( mlt_frame self )
 
 int mlt_frame_push_audio( mlt_frame self, void *that )
 {
+	mlt_profiler_push_callback( self, that );
 	return mlt_deque_push_back( self->stack_audio, that );
 }
 
@@ -458,6 +475,81 @@ static int generate_test_image( mlt_properties properties, uint8_t **buffer,  ml
 }
 
 
+/** Share a data property of a frame or else make a copy of it.
+ *
+ * The data is shared by taking a pool reference only when it is the named
+ * property and that property releases it with \p mlt_pool_release. Anything
+ * else, including memory the property merely borrows, is copied.
+ * Either way the result must be released with \p mlt_pool_release.
+ *
+ * \public \memberof mlt_frame_s
+ * \param properties the properties of the frame that owns the data
+ * \param name the name of the data property
+ * \param data the data as obtained from the property
+ * \param size the size of the data in bytes
+ * \return a pooled block holding the data, or NULL if there is no data
+ */
+
+void *mlt_frame_share_data( mlt_properties properties, const char *name, void *data, int size )
+{
+	void *copy;
+
+	if ( !data )
+		return NULL;
+	if ( data == mlt_properties_get_data( properties, name, NULL )
+		&& mlt_properties_get_destructor( properties, name ) == mlt_pool_release
+		&& mlt_pool_retain( data ) )
+		return data;
+	copy = mlt_pool_alloc( size );
+	memcpy( copy, data, size );
+	return copy;
+}
+
+/** Give a frame its own copy of a data property that is shared with another frame.
+ *
+ * \private \memberof mlt_frame_s
+ * \param properties the properties of a frame
+ * \param name the name of the data property
+ * \param data the data as obtained from the property
+ * \param size the size of the data in bytes if the property does not know it
+ * \return the data, which is now safe to modify
+ */
+
+static void *unshare_data( mlt_properties properties, const char *name, void *data, int size )
+{
+	int length = 0;
+	if ( data && data == mlt_properties_get_data( properties, name, &length )
+		&& mlt_pool_references( data ) > 1
+		&& mlt_properties_get_destructor( properties, name ) == mlt_pool_release )
+	{
+		void *copy;
+		size = length > 0 ? length : size;
+		copy = mlt_pool_alloc( size );
+		memcpy( copy, data, size );
+		mlt_properties_set_data( properties, name, copy, size, mlt_pool_release, NULL );
+		data = copy;
+	}
+	return data;
+}
+
+/** Ensure the image and alpha of a frame are not shared before they are modified.
+ *
+ * \private \memberof mlt_frame_s
+ * \param self a frame
+ * \param[in,out] buffer the image buffer returned to the caller
+ */
+
+static void unshare_image( mlt_frame self, uint8_t **buffer )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( self );
+	int width = mlt_properties_get_int_k( properties, width_key );
+	int height = mlt_properties_get_int_k( properties, height_key );
+	int size = mlt_image_format_size( mlt_properties_get_int_k( properties, format_key ), width, height, NULL );
+
+	*buffer = unshare_data( properties, "image", *buffer, size );
+	unshare_data( properties, "alpha", mlt_properties_get_data( properties, "alpha", NULL ), width * height );
+}
+
 /** Get the image associated to the frame.
  *
  * You should express the desired format, width, and height as inputs. As long
@@ -485,34 +577,42 @@ int mlt_frame_get_image( mlt_frame self, uint8_t **buffer, mlt_image_format *for
 	mlt_image_format requested_format = *format;
 	int error = 0;
 
+	pthread_once( &keys_once, init_keys );
+
 	if ( get_image )
 	{
-		mlt_properties_set_int( properties, "image_count", mlt_properties_get_int( properties, "image_count" ) - 1 );
+		mlt_profiler_span span = mlt_profiler_enter_callback( self, get_image, mlt_profiler_get_image );
+		mlt_properties_set_int_k( properties, image_count_key, mlt_properties_get_int_k( properties, image_count_key ) - 1 );
 		error = get_image( self, buffer, format, width, height, writable );
+		mlt_profiler_leave( span, self );
 		if ( !error && buffer && *buffer )
 		{
-			mlt_properties_set_int( properties, "width", *width );
-			mlt_properties_set_int( properties, "height", *height );
+			mlt_properties_set_int_k( properties, width_key, *width );
+			mlt_properties_set_int_k( properties, height_key, *height );
 			if ( self->convert_image && requested_format != mlt_image_none )
 				self->convert_image( self, buffer, format, requested_format );
-			mlt_properties_set_int( properties, "format", *format );
+			mlt_properties_set_int_k( properties, format_key, *format );
+			if ( writable )
+				unshare_image( self, buffer );
 		}
 		else
 		{
 			error = generate_test_image( properties, buffer, format, width, height, writable );
 		}
 	}
-	else if ( mlt_properties_get_data( properties, "image", NULL ) && buffer )
+	else if ( mlt_properties_get_data_k( properties, image_key, NULL ) && buffer )
 	{
-		*format = mlt_properties_get_int( properties, "format" );
-		*buffer = mlt_properties_get_data( properties, "image", NULL );
-		*width = mlt_properties_get_int( properties, "width" );
-		*height = mlt_properties_get_int( properties, "height" );
+		*format = mlt_properties_get_int_k( properties, format_key );
+		*buffer = mlt_properties_get_data_k( properties, image_key, NULL );
+		*width = mlt_properties_get_int_k( properties, width_key );
+		*height = mlt_properties_get_int_k( properties, height_key );
 		if ( self->convert_image && *buffer && requested_format != mlt_image_none )
 		{
 			self->convert_image( self, buffer, format, requested_format );
-			mlt_properties_set_int( properties, "format", *format );
+			mlt_properties_set_int_k( properties, format_key, *format );
 		}
+		if ( writable )
+			unshare_image( self, buffer );
 	}
 	else
 	{
@@ -604,7 +704,9 @@ int mlt_frame_get_audio( mlt_frame self, void **buffer, mlt_audio_format *format
 
 	if ( hide == 0 && get_audio != NULL )
 	{
+		mlt_profiler_span span = mlt_profiler_enter_callback( self, get_audio, mlt_profiler_get_audio );
 		get_audio( self, buffer, format, frequency, channels, samples );
+		mlt_profiler_leave( span, self );
 		mlt_properties_set_int( properties, "audio_frequency", *frequency );
 		mlt_properties_set_int( properties, "audio_channels", *channels );
 		mlt_properties_set_int( properties, "audio_samples", *samples );
@@ -644,6 +746,10 @@ int mlt_frame_get_audio( mlt_frame self, void **buffer, mlt_audio_format *format
 		mlt_properties_set_int( properties, "test_audio", 1 );
 	}
 
+	// Audio is routinely modified in place, so do not hand out a shared buffer.
+	*buffer = unshare_data( properties, "audio", *buffer,
+		mlt_audio_format_size( *format, *samples, *channels ) );
+
 	// TODO: This does not belong here
 	if ( *format == mlt_audio_s16 && mlt_properties_get( properties, "meta.volume" ) && *buffer )
 	{
@@ -888,7 +994,9 @@ mlt_properties mlt_frame_get_unique_properties( mlt_frame self, mlt_service serv
  * \public \memberof mlt_frame_s
  * \param self the frame to clone
  * \param is_deep a boolean to indicate whether to make a deep copy of the audio
- * and video data chunks or to make a shallow copy by pointing to the supplied frame
+ * and video data chunks or to make a shallow copy by pointing to the supplied frame.
+ * A deep copy shares buffers from \p mlt_pool with the original and copies them
+ * only when either frame asks for them to be writable.
  * \return a almost-complete copy of the frame
  * \todo copy the processing deques
  */
@@ -911,6 +1019,7 @@ MLTPP_DECLSPEC mlt_frame mlt_frame_clone( mlt_frame self, int is_deep )
 
 	if ( is_deep )
 	{
+		// Pooled buffers are shared by reference and copied on the first write.
 		data = mlt_properties_get_data( properties, "audio", &size );
 		if ( data )
 		{
@@ -918,8 +1027,7 @@ MLTPP_DECLSPEC mlt_frame mlt_frame_clone( mlt_frame self, int is_deep )
 				size = mlt_audio_format_size( mlt_properties_get_int( properties, "audio_format" ),
 					mlt_properties_get_int( properties, "audio_samples" ),
 					mlt_properties_get_int( properties, "audio_channels" ) );
-			copy = mlt_pool_alloc( size );
-			memcpy( copy, data, size );
+			copy = mlt_frame_share_data( properties, "audio", data, size );
 			mlt_properties_set_data( new_props, "audio", copy, size, mlt_pool_release, NULL );
 		}
 		size = 0;
@@ -932,8 +1040,7 @@ MLTPP_DECLSPEC mlt_frame mlt_frame_clone( mlt_frame self, int is_deep )
 			if ( ! size )
 				size = mlt_image_format_size( mlt_properties_get_int( properties, "format" ),
 					width, height, NULL );
-			copy = mlt_pool_alloc( size );
-			memcpy( copy, data, size );
+			copy = mlt_frame_share_data( properties, "image", data, size );
 			mlt_properties_set_data( new_props, "image", copy, size, mlt_pool_release, NULL );
 
 			size = 0;
@@ -942,8 +1049,7 @@ MLTPP_DECLSPEC mlt_frame mlt_frame_clone( mlt_frame self, int is_deep )
 			{
 				if ( ! size )
 					size = width * height;
-				copy = mlt_pool_alloc( size );
-				memcpy( copy, data, size );
+				copy = mlt_frame_share_data( properties, "alpha", data, size );
 				mlt_properties_set_data( new_props, "alpha", copy, size, mlt_pool_release, NULL );
 			};
 		}
@@ -22,11 +22,16 @@
 
 #include "mlt_multitrack.h"
 #include "mlt_playlist.h"
+#include "mlt_tractor.h"
 #include "mlt_frame.h"
 #include "mlt_factory.h"
 #include "mlt_cache.h"
+#include "mlt_slices.h"
+#include "mlt_profiler.h"
 
+#include <pthread.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -582,40 +587,1070 @@ MLTPP_DECLSPEC mlt_position mlt_multitrack_clip( mlt_multitrack self, mlt_whence
  * \return true if there was an error
  */
 
+/** Get a frame from one track.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param self a multitrack
+ * \param index the 0-based track index, which must have a producer
+ * \param position the position of the multitrack
+ * \param speed the speed of the multitrack
+ * \return the frame
+ */
+
+static mlt_frame fetch_track( mlt_multitrack self, int index, mlt_position position, double speed )
+{
+	mlt_frame frame = NULL;
+
+	// Get the producer for this track
+	mlt_producer producer = self->list[ index ]->producer;
+
+	// Get the track hide property
+	int hide = mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( mlt_producer_cut_parent( producer ) ), "hide" );
+
+	// Make sure we're at the same point
+	mlt_producer_seek( producer, position );
+
+	// Get the frame from the producer
+	mlt_service_get_frame( MLT_PRODUCER_SERVICE( producer ), &frame, 0 );
+
+	// Indicate speed of this producer
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	mlt_properties_set_double( properties, "_speed", speed );
+	mlt_frame_set_position( frame, position );
+	mlt_properties_set_int( properties, "hide", hide );
+
+	return frame;
+}
+
+/** \brief A producer that a track fetches from at a position */
+
+typedef struct
+{
+	mlt_producer producer;
+	int track;
+}
+track_source;
+
+/** \brief What the services above a track asked of its frames the last time */
+
+typedef struct
+{
+	int valid;
+	int request[4];           /**< the format, and the size or the audio frequency, channels and samples */
+	int follows_position;     /**< true if the audio samples were those of the frame's position */
+	mlt_properties writes;    /**< the properties set on the frame between its fetch and the request */
+	int misses;               /**< how many times in a row rendering ahead was not used */
+	int skip;                 /**< how many frames to render in order before trying again */
+}
+render_hint;
+
+/** \brief The frames of all tracks fetched together by a parallel multitrack */
+
+typedef struct
+{
+	mlt_multitrack self;
+	mlt_position position;
+	double speed;
+	int active;      /**< true between the first track request and the last_track request */
+	int count;
+	mlt_frame *frames;
+	char *serial;    /**< per track, true to fetch the track when it is requested */
+	track_source *sources;
+	int source_count;
+	int source_size;
+	pthread_mutex_t mutex;   /**< protects the hints, which the frames of several positions use */
+	render_hint *hints;      /**< per track, the image hint followed by the audio hint */
+}
+parallel_fetch;
+
+static void parallel_fetch_release( parallel_fetch *fetch )
+{
+	int i;
+	for ( i = 0; i < fetch->count; i ++ )
+	{
+		mlt_frame_close( fetch->frames[ i ] );
+		fetch->frames[ i ] = NULL;
+	}
+	fetch->active = 0;
+}
+
+static void parallel_fetch_close( parallel_fetch *fetch )
+{
+	int i;
+	parallel_fetch_release( fetch );
+	for ( i = 0; i < fetch->count * 2; i ++ )
+		mlt_properties_close( fetch->hints[ i ].writes );
+	pthread_mutex_destroy( &fetch->mutex );
+	free( fetch->frames );
+	free( fetch->serial );
+	free( fetch->sources );
+	free( fetch->hints );
+	free( fetch );
+}
+
+/** Make room in a parallel fetch for more tracks.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param fetch a parallel fetch
+ * \param count the number of tracks
+ * \return true on error
+ */
+
+static int parallel_fetch_resize( parallel_fetch *fetch, int count )
+{
+	mlt_frame *frames = realloc( fetch->frames, count * sizeof( mlt_frame ) );
+	char *serial = frames ? realloc( fetch->serial, count ) : NULL;
+	render_hint *hints = NULL;
+
+	if ( frames )
+		fetch->frames = frames;
+	if ( serial )
+		fetch->serial = serial;
+	if ( frames == NULL || serial == NULL )
+		return 1;
+
+	pthread_mutex_lock( &fetch->mutex );
+	hints = realloc( fetch->hints, count * 2 * sizeof( render_hint ) );
+	if ( hints )
+	{
+		memset( frames + fetch->count, 0, ( count - fetch->count ) * sizeof( mlt_frame ) );
+		memset( serial + fetch->count, 0, count - fetch->count );
+		memset( hints + fetch->count * 2, 0, ( count - fetch->count ) * 2 * sizeof( render_hint ) );
+		fetch->hints = hints;
+		fetch->count = count;
+	}
+	pthread_mutex_unlock( &fetch->mutex );
+	return hints == NULL;
+}
+
+static int parallel_fetch_proc( int id, int index, int jobs, void *cookie )
+{
+	parallel_fetch *fetch = cookie;
+	if ( fetch->self->list[ index ] != NULL && !fetch->serial[ index ] )
+		fetch->frames[ index ] = fetch_track( fetch->self, index, fetch->position, fetch->speed );
+	return 0;
+}
+
+static int add_source( parallel_fetch *fetch, mlt_producer producer, int track )
+{
+	if ( fetch->source_count == fetch->source_size )
+	{
+		int size = fetch->source_size > 0 ? 2 * fetch->source_size : 64;
+		track_source *sources = realloc( fetch->sources, size * sizeof( *sources ) );
+		if ( sources == NULL )
+			return 1;
+		fetch->sources = sources;
+		fetch->source_size = size;
+	}
+	fetch->sources[ fetch->source_count ].producer = producer;
+	fetch->sources[ fetch->source_count ++ ].track = track;
+	return 0;
+}
+
+/** Collect the producers that a track seeks and fetches from at a position.
+ *
+ * Cuts lead to their parent, a playlist to the clip at the position, and a
+ * tractor or multitrack to all of its tracks.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param fetch a parallel fetch
+ * \param producer the producer of the track or of something it contains
+ * \param position the position of \p producer
+ * \param track the 0-based track index
+ * \param depth the nesting depth of \p producer
+ * \return true if the producers could not be determined
+ */
+
+static int collect_sources( parallel_fetch *fetch, mlt_producer producer, mlt_position position, int track, int depth )
+{
+	if ( producer == NULL )
+		return 0;
+	if ( depth > 16 || add_source( fetch, producer, track ) )
+		return 1;
+
+	if ( mlt_producer_is_cut( producer ) )
+		return collect_sources( fetch, mlt_producer_cut_parent( producer ), position + mlt_producer_get_in( producer ), track, depth + 1 );
+
+	switch ( mlt_service_identify( MLT_PRODUCER_SERVICE( producer ) ) )
+	{
+		case mlt_service_playlist_type:
+		{
+			mlt_playlist playlist = producer->child;
+			mlt_playlist_clip_info info;
+			int index = mlt_playlist_get_clip_index_at( playlist, position );
+			if ( !mlt_playlist_get_clip_info( playlist, &info, index ) )
+			{
+				int count = info.repeat > 1 ? info.frame_count / info.repeat : info.frame_count;
+				position -= info.start;
+				if ( count > 0 )
+					position %= count;
+				return collect_sources( fetch, info.cut, position, track, depth + 1 );
+			}
+			break;
+		}
+		case mlt_service_tractor_type:
+			return collect_sources( fetch, MLT_MULTITRACK_PRODUCER( mlt_tractor_multitrack( producer->child ) ), position, track, depth + 1 );
+		case mlt_service_multitrack_type:
+		{
+			mlt_multitrack multitrack = producer->child;
+			int i;
+			for ( i = 0; i < multitrack->count; i ++ )
+				if ( multitrack->list[ i ] != NULL && collect_sources( fetch, multitrack->list[ i ]->producer, position, track, depth + 1 ) )
+					return 1;
+			break;
+		}
+		default:
+			break;
+	}
+	return 0;
+}
+
+static int compare_sources( const void *a, const void *b )
+{
+	const track_source *x = a, *y = b;
+	if ( x->producer != y->producer )
+		return ( uintptr_t )x->producer < ( uintptr_t )y->producer ? -1 : 1;
+	return x->track - y->track;
+}
+
+/** Find the tracks that must not be fetched at the same time as other tracks.
+ *
+ * A producer reached from more than one track at this position, for example
+ * a parent whose cuts are on two tracks, is seeked by each of them. Those
+ * tracks are fetched one by one, in order, when they are requested.
+ * So is a track whose producers could not be determined.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param fetch a parallel fetch
+ * \return the number of tracks that can be fetched at the same time
+ */
+
+static int find_serial_tracks( parallel_fetch *fetch )
+{
+	mlt_multitrack self = fetch->self;
+	int i, j, parallel = 0;
+
+	fetch->source_count = 0;
+	for ( i = 0; i < self->count; i ++ )
+		fetch->serial[ i ] = self->list[ i ] != NULL
+			&& collect_sources( fetch, self->list[ i ]->producer, fetch->position, i, 0 );
+
+	qsort( fetch->sources, fetch->source_count, sizeof( *fetch->sources ), compare_sources );
+	for ( i = 0; i < fetch->source_count; i = j )
+	{
+		for ( j = i + 1; j < fetch->source_count && fetch->sources[ j ].producer == fetch->sources[ i ].producer; j ++ ) ;
+		if ( fetch->sources[ i ].track != fetch->sources[ j - 1 ].track )
+			for ( ; i < j; i ++ )
+				fetch->serial[ fetch->sources[ i ].track ] = 1;
+	}
+
+	for ( i = 0; i < self->count; i ++ )
+		parallel += self->list[ i ] != NULL && !fetch->serial[ i ];
+	return parallel;
+}
+
+/** \brief The state of one track's image or audio in a render group */
+
+typedef struct
+{
+	mlt_frame frame;          /**< the frame of the track, not owned, NULL once it is closed */
+	int base;                 /**< the stack entries of the track's own services */
+	mlt_properties fetched;   /**< the properties of the frame when it was fetched */
+	int reached;              /**< true once the frame was asked for its image or audio */
+	mlt_frame clone;          /**< the copy of the frame that was rendered ahead */
+	mlt_properties expected;  /**< the properties that clone was rendered with */
+	int request[4];           /**< the request that clone was rendered with */
+	int result[4];            /**< the format and size that clone returned */
+	void *buffer;             /**< the image or audio that clone returned */
+	int error;
+	int state;                /**< 0 until the render ahead is used (1) or rejected (2) */
+}
+render_track;
+
+/** \brief The frames of a parallel fetch, which render their images and audio together */
+
+typedef struct
+{
+	mlt_multitrack self;
+	parallel_fetch *fetch;
+	pthread_mutex_t mutex;
+	int refs;                 /**< the frames that still link to the group */
+	int count;
+	int started[2];           /**< true once an image or audio was asked for */
+	double fps;
+	render_track *tracks;     /**< per track, the image state followed by the audio state */
+}
+render_group;
+
+/** \brief The link from a track's frame to its render group */
+
+typedef struct
+{
+	render_group *group;
+	int track;
+}
+render_link;
+
+/** \brief The image or audio of the tracks of a render group that are rendered at once */
+
+typedef struct
+{
+	render_group *group;
+	int kind;                 /**< 0 for the image, 1 for the audio */
+	mlt_frame frame;          /**< the frame that was asked */
+	void **buffer;
+	int *values;
+	int error;
+	int count;
+	int *tracks;              /**< the indexes of the tracks that are rendered ahead */
+}
+render_ahead;
+
+#define RENDER_KEY "_parallel_render"
+
+static int render_get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable );
+static int render_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples );
+
+static int is_render_key( const char *name )
+{
+	return !strncmp( name, RENDER_KEY, sizeof( RENDER_KEY ) - 1 );
+}
+
+/** Determine if a property has the same value in two property lists.
+ *
+ * Data is the same only if it is the same pointer, unless it can be
+ * compared as a string (such as a rectangle).
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param a a properties list
+ * \param index the index of the property in \p a
+ * \param b another properties list
+ * \param name the name of the property
+ * \return true if the values are the same
+ */
+
+static int same_property( mlt_properties a, int index, mlt_properties b, const char *name )
+{
+	void *x = mlt_properties_get_data_at( a, index, NULL );
+	void *y = mlt_properties_get_data( b, name, NULL );
+	const char *s, *t;
+
+	if ( x && x == y )
+		return 1;
+	s = mlt_properties_get_value( a, index );
+	t = mlt_properties_get( b, name );
+	if ( ( x || y ) && ( !s || !t ) )
+		return 0;
+	return s == t || ( s && t && !strcmp( s, t ) );
+}
+
+/** Determine if two property lists hold the same values.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param a a properties list
+ * \param b another properties list
+ * \return true if they are the same, apart from the render group's own properties
+ */
+
+static int same_properties( mlt_properties a, mlt_properties b )
+{
+	int i, count = 0;
+
+	for ( i = 0; i < mlt_properties_count( a ); i ++ )
+	{
+		char *name = mlt_properties_get_name( a, i );
+		if ( is_render_key( name ) )
+			continue;
+		if ( !same_property( a, i, b, name ) )
+			return 0;
+		count ++;
+	}
+	for ( i = 0; i < mlt_properties_count( b ); i ++ )
+		count -= !is_render_key( mlt_properties_get_name( b, i ) );
+	return count == 0;
+}
+
+/** Copy a property, keeping a reference to data that cannot be copied.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param dest the properties to copy to
+ * \param src the properties to copy from
+ * \param index the index of the property in \p src
+ */
+
+static void copy_property( mlt_properties dest, mlt_properties src, int index )
+{
+	char *name = mlt_properties_get_name( src, index );
+	int size = 0;
+	void *data = mlt_properties_get_data_at( src, index, &size );
+
+	mlt_properties_pass_property( dest, src, name );
+	if ( data && !mlt_properties_get_data( dest, name, NULL ) )
+		mlt_properties_set_data( dest, name, data, size, NULL, NULL );
+}
+
+static void copy_properties( mlt_properties dest, mlt_properties src )
+{
+	int i;
+	for ( i = 0; i < mlt_properties_count( src ); i ++ )
+		if ( !is_render_key( mlt_properties_get_name( src, i ) ) )
+			copy_property( dest, src, i );
+}
+
+/** Determine if a frame holds other frames, such as the tracks of a nested tractor.
+ *
+ * Rendering such a frame also renders the frames it holds, which cannot be
+ * undone if the render ahead is not used.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param frame a frame
+ * \return true if the frame closes other frames
+ */
+
+static int holds_frames( mlt_frame frame )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	int i;
+	for ( i = 0; i < mlt_properties_count( properties ); i ++ )
+		if ( mlt_properties_get_destructor( properties, mlt_properties_get_name( properties, i ) ) == ( mlt_destructor )mlt_frame_close )
+			return 1;
+	return 0;
+}
+
+/** Run the services of a track on a frame.
+ *
+ * This pops and calls the next get_image or get_audio. When \p convert is
+ * true, it also does what mlt_frame_get_image or mlt_frame_get_audio do with
+ * the result, except for unsharing it, so that a render ahead is converted
+ * on its own thread.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param frame a frame
+ * \param kind 0 for the image, 1 for the audio
+ * \param[out] buffer the image or audio
+ * \param[in,out] values the request, and the format and size on return
+ * \param convert true to record and convert the result as the frame does
+ * \return true on error
+ */
+
+static int render_base( mlt_frame frame, int kind, void **buffer, int values[4], int convert )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	mlt_profiler_span span;
+	int error = 1;
+
+	if ( kind == 0 )
+	{
+		mlt_get_image get_image = mlt_frame_pop_get_image( frame );
+		mlt_image_format format = values[0];
+		if ( get_image == NULL )
+			return error;
+		span = mlt_profiler_enter_callback( frame, get_image, mlt_profiler_get_image );
+		error = get_image( frame, ( uint8_t ** )buffer, &format, &values[1], &values[2], values[3] );
+		mlt_profiler_leave( span, frame );
+		if ( convert && !error && *buffer )
+		{
+			mlt_properties_set_int( properties, "width", values[1] );
+			mlt_properties_set_int( properties, "height", values[2] );
+			if ( frame->convert_image && values[0] != mlt_image_none )
+				frame->convert_image( frame, ( uint8_t ** )buffer, &format, values[0] );
+			mlt_properties_set_int( properties, "format", format );
+		}
+		values[0] = format;
+	}
+	else
+	{
+		mlt_get_audio get_audio = mlt_frame_pop_audio( frame );
+		mlt_audio_format format = values[0];
+		if ( get_audio == NULL )
+			return error;
+		span = mlt_profiler_enter_callback( frame, get_audio, mlt_profiler_get_audio );
+		error = get_audio( frame, buffer, &format, &values[1], &values[2], &values[3] );
+		mlt_profiler_leave( span, frame );
+		if ( convert )
+		{
+			mlt_properties_set_int( properties, "audio_frequency", values[1] );
+			mlt_properties_set_int( properties, "audio_channels", values[2] );
+			mlt_properties_set_int( properties, "audio_samples", values[3] );
+			mlt_properties_set_int( properties, "audio_format", format );
+			if ( frame->convert_audio && *buffer && values[0] != mlt_audio_none )
+				frame->convert_audio( frame, buffer, &format, values[0] );
+		}
+		values[0] = format;
+	}
+	return error;
+}
+
+/** Stop a render ahead whose services ask for more than their own stack.
+ *
+ * In order, they would have reached the frames of other tracks or the
+ * other kind of data, so the render ahead is not used.
+ */
+
+static int render_recursed_image( mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
+{
+	mlt_properties_set_int( MLT_FRAME_PROPERTIES( frame ), RENDER_KEY ".recursed", 1 );
+	return 1;
+}
+
+static int render_recursed_audio( mlt_frame frame, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
+{
+	mlt_properties_set_int( MLT_FRAME_PROPERTIES( frame ), RENDER_KEY ".recursed", 1 );
+	*buffer = NULL;
+	return 1;
+}
+
+/** Record what the services above a track asked of its frame.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param group a render group
+ * \param index the 0-based track index
+ * \param kind 0 for the image, 1 for the audio
+ * \param request the request
+ */
+
+static void render_learn( render_group *group, int index, int kind, const int request[4] )
+{
+	render_track *track = &group->tracks[ index * 2 + kind ];
+	mlt_properties properties = MLT_FRAME_PROPERTIES( track->frame );
+	mlt_properties writes = mlt_properties_new( );
+	parallel_fetch *fetch = group->fetch;
+	int i;
+
+	// Data set since the fetch belongs to this frame, so it is not carried over
+	for ( i = 0; i < mlt_properties_count( properties ); i ++ )
+	{
+		char *name = mlt_properties_get_name( properties, i );
+		if ( !is_render_key( name ) && !mlt_properties_get_data_at( properties, i, NULL )
+			 && !same_property( properties, i, track->fetched, name ) )
+			mlt_properties_pass_property( writes, properties, name );
+	}
+
+	pthread_mutex_lock( &fetch->mutex );
+	if ( index < fetch->count )
+	{
+		render_hint *hint = &fetch->hints[ index * 2 + kind ];
+		mlt_properties_close( hint->writes );
+		hint->writes = writes;
+		writes = NULL;
+		memcpy( hint->request, request, sizeof( hint->request ) );
+		hint->follows_position = kind == 1 && request[3] ==
+			mlt_audio_calculate_frame_samples( group->fps, request[1], mlt_frame_get_position( track->frame ) );
+		hint->valid = 1;
+	}
+	pthread_mutex_unlock( &fetch->mutex );
+	mlt_properties_close( writes );
+}
+
+/** Record whether a render ahead was used, and back off from a track that misses.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param group a render group
+ * \param index the 0-based track index
+ * \param kind 0 for the image, 1 for the audio
+ * \param used true if the render ahead was used
+ */
+
+static void render_outcome( render_group *group, int index, int kind, int used )
+{
+	parallel_fetch *fetch = group->fetch;
+
+	group->tracks[ index * 2 + kind ].state = used ? 1 : 2;
+	pthread_mutex_lock( &fetch->mutex );
+	if ( index < fetch->count )
+	{
+		render_hint *hint = &fetch->hints[ index * 2 + kind ];
+		if ( used )
+		{
+			hint->misses = 0;
+		}
+		else
+		{
+			hint->misses += hint->misses < 6;
+			hint->skip = 1 << hint->misses;
+		}
+	}
+	pthread_mutex_unlock( &fetch->mutex );
+}
+
+/** Prepare a copy of a track's frame to render ahead.
+ *
+ * The copy has the properties of the frame, with the values the services
+ * above the track set the last time, and the stack entries of the track's
+ * own services.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param group a render group
+ * \param index the 0-based track index
+ * \param kind 0 for the image, 1 for the audio
+ * \return true if the track is rendered ahead
+ */
+
+static int render_prepare( render_group *group, int index, int kind )
+{
+	render_track *track = &group->tracks[ index * 2 + kind ];
+	mlt_frame frame = track->frame;
+	parallel_fetch *fetch = group->fetch;
+	mlt_deque stack, other;
+	void *marker = kind ? ( void* )render_get_audio : ( void* )render_get_image;
+	mlt_properties properties;
+	mlt_frame clone;
+	int i, top;
+
+	if ( frame == NULL || track->reached || holds_frames( frame ) )
+		return 0;
+	stack = kind ? MLT_FRAME_AUDIO_STACK( frame ) : MLT_FRAME_IMAGE_STACK( frame );
+	other = kind ? MLT_FRAME_IMAGE_STACK( frame ) : MLT_FRAME_AUDIO_STACK( frame );
+	for ( top = mlt_deque_count( stack ) - 1; top >= 0 && mlt_deque_peek( stack, top ) != marker; top -- ) ;
+	if ( top < track->base )
+		return 0;
+
+	clone = mlt_frame_init( NULL );
+	if ( clone == NULL )
+		return 0;
+	properties = MLT_FRAME_PROPERTIES( clone );
+	copy_properties( properties, MLT_FRAME_PROPERTIES( frame ) );
+
+	pthread_mutex_lock( &fetch->mutex );
+	if ( index < fetch->count && fetch->hints[ index * 2 + kind ].valid )
+	{
+		render_hint *hint = &fetch->hints[ index * 2 + kind ];
+		if ( hint->skip > 0 )
+		{
+			hint->skip --;
+		}
+		else
+		{
+			memcpy( track->request, hint->request, sizeof( track->request ) );
+			if ( hint->follows_position )
+				track->request[3] = mlt_audio_calculate_frame_samples( group->fps, track->request[1], mlt_frame_get_position( frame ) );
+			for ( i = 0; i < mlt_properties_count( hint->writes ); i ++ )
+				copy_property( properties, hint->writes, i );
+			track->clone = clone;
+		}
+	}
+	pthread_mutex_unlock( &fetch->mutex );
+
+	// Textures belong to the thread that renders them
+	if ( kind == 0 && track->clone && ( track->request[0] == mlt_image_movit || track->request[0] == mlt_image_opengl_texture ) )
+		track->clone = NULL;
+	if ( track->clone == NULL )
+	{
+		mlt_frame_close( clone );
+		return 0;
+	}
+
+	clone->convert_image = frame->convert_image;
+	clone->convert_audio = frame->convert_audio;
+	if ( kind )
+	{
+		mlt_deque_push_back( MLT_FRAME_AUDIO_STACK( clone ), render_recursed_audio );
+		if ( mlt_deque_count( other ) )
+			mlt_deque_push_back( MLT_FRAME_IMAGE_STACK( clone ), render_recursed_image );
+	}
+	else
+	{
+		mlt_deque_push_back( MLT_FRAME_IMAGE_STACK( clone ), render_recursed_image );
+		if ( mlt_deque_count( other ) )
+			mlt_deque_push_back( MLT_FRAME_AUDIO_STACK( clone ), render_recursed_audio );
+	}
+	for ( i = top - track->base; i < top; i ++ )
+		mlt_deque_push_back( kind ? MLT_FRAME_AUDIO_STACK( clone ) : MLT_FRAME_IMAGE_STACK( clone ), mlt_deque_peek( stack, i ) );
+
+	track->expected = mlt_properties_new( );
+	copy_properties( track->expected, properties );
+	return 1;
+}
+
+static int render_ahead_proc( int id, int index, int jobs, void *cookie )
+{
+	render_ahead *ahead = cookie;
+
+	if ( index == 0 )
+	{
+		ahead->error = render_base( ahead->frame, ahead->kind, ahead->buffer, ahead->values, 0 );
+	}
+	else
+	{
+		render_track *track = &ahead->group->tracks[ ahead->tracks[ index - 1 ] * 2 + ahead->kind ];
+		memcpy( track->result, track->request, sizeof( track->result ) );
+		track->error = render_base( track->clone, ahead->kind, &track->buffer, track->result, 1 );
+	}
+	return 0;
+}
+
+/** Render a track, and the other tracks of its group ahead, on the slices pool.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param group a render group
+ * \param index the 0-based index of the track that was asked
+ * \param kind 0 for the image, 1 for the audio
+ * \param frame the frame of the track
+ * \param[out] buffer the image or audio
+ * \param[in,out] values the request, and the format and size on return
+ * \return true on error
+ */
+
+static int render_fan_out( render_group *group, int index, int kind, mlt_frame frame, void **buffer, int values[4] )
+{
+	render_ahead ahead;
+	int i;
+
+	memset( &ahead, 0, sizeof( ahead ) );
+	ahead.group = group;
+	ahead.kind = kind;
+	ahead.frame = frame;
+	ahead.buffer = buffer;
+	ahead.values = values;
+	ahead.tracks = malloc( group->count * sizeof( int ) );
+	if ( ahead.tracks && !( kind == 0 && ( values[0] == mlt_image_movit || values[0] == mlt_image_opengl_texture ) ) )
+		for ( i = 0; i < group->count; i ++ )
+			if ( i != index && render_prepare( group, i, kind ) )
+				ahead.tracks[ ahead.count ++ ] = i;
+
+	if ( ahead.count > 0 )
+		mlt_slices_run_normal( ahead.count + 1, render_ahead_proc, &ahead );
+	else
+		ahead.error = render_base( frame, kind, buffer, values, 0 );
+
+	free( ahead.tracks );
+	return ahead.error;
+}
+
+/** Give a frame the result of its render ahead.
+ *
+ * The properties that the track's services changed on the copy are moved to
+ * the frame, and the stack entries of those services are dropped as if they
+ * had run on it.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param frame the frame of a track
+ * \param track the state of the track
+ * \param kind 0 for the image, 1 for the audio
+ * \param[out] buffer the image or audio
+ * \param[out] values the format and size
+ */
+
+static void render_adopt( mlt_frame frame, render_track *track, int kind, void **buffer, int values[4] )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	mlt_properties clone = MLT_FRAME_PROPERTIES( track->clone );
+	mlt_deque stack = kind ? MLT_FRAME_AUDIO_STACK( frame ) : MLT_FRAME_IMAGE_STACK( frame );
+	int i, size;
+
+	for ( i = 0; i < mlt_properties_count( clone ); i ++ )
+	{
+		char *name = mlt_properties_get_name( clone, i );
+		void *data = mlt_properties_get_data_at( clone, i, &size );
+
+		if ( is_render_key( name ) || same_property( clone, i, track->expected, name ) )
+			continue;
+		if ( data && mlt_properties_get_destructor( clone, name ) == mlt_pool_release )
+		{
+			// Hand over the pool reference so the frame owns the buffer alone
+			mlt_properties_set_data( properties, name, mlt_frame_share_data( clone, name, data, size ), size, mlt_pool_release, NULL );
+			mlt_properties_set_data( clone, name, NULL, 0, NULL, NULL );
+		}
+		else
+		{
+			// Anything else stays owned by the copy, which the group keeps
+			copy_property( properties, clone, i );
+		}
+	}
+
+	for ( i = 0; i < track->base; i ++ )
+		mlt_deque_pop_back( stack );
+	*buffer = track->buffer;
+	memcpy( values, track->result, ( kind ? 4 : 3 ) * sizeof( int ) );
+}
+
+/** Render the image or audio of a track's frame in a render group.
+ *
+ * The first track asked renders the other tracks ahead with what they were
+ * asked the last time. A track uses its render ahead only if it is asked the
+ * same and its frame has the same properties as the copy had; otherwise its
+ * services run on the frame as usual.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param frame the frame of a track
+ * \param kind 0 for the image, 1 for the audio
+ * \param[out] buffer the image or audio
+ * \param[in,out] values the request, and the format and size on return
+ * \return true on error
+ */
+
+static int render_marker( mlt_frame frame, int kind, void **buffer, int values[4] )
+{
+	render_link *link = mlt_properties_get_data( MLT_FRAME_PROPERTIES( frame ), RENDER_KEY, NULL );
+	render_group *group;
+	render_track *track;
+	int first = 0;
+
+	if ( link == NULL )
+		return render_base( frame, kind, buffer, values, 0 );
+	group = link->group;
+	track = &group->tracks[ link->track * 2 + kind ];
+	render_learn( group, link->track, kind, values );
+
+	pthread_mutex_lock( &group->mutex );
+	track->reached = 1;
+	if ( !group->started[ kind ] )
+		group->started[ kind ] = first = 1;
+	pthread_mutex_unlock( &group->mutex );
+
+	if ( first )
+		return render_fan_out( group, link->track, kind, frame, buffer, values );
+
+	if ( track->clone && !track->state )
+	{
+		int used = !mlt_properties_get_int( MLT_FRAME_PROPERTIES( track->clone ), RENDER_KEY ".recursed" )
+			&& !memcmp( track->request, values, sizeof( track->request ) )
+			&& same_properties( MLT_FRAME_PROPERTIES( frame ), track->expected );
+		render_outcome( group, link->track, kind, used );
+		if ( used )
+		{
+			render_adopt( frame, track, kind, buffer, values );
+			return track->error;
+		}
+	}
+	return render_base( frame, kind, buffer, values, 0 );
+}
+
+static int render_get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
+{
+	int values[4] = { *format, *width, *height, writable };
+	int error = render_marker( frame, 0, ( void ** )image, values );
+	*format = values[0];
+	*width = values[1];
+	*height = values[2];
+	return error;
+}
+
+static int render_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
+{
+	int values[4] = { *format, *frequency, *channels, *samples };
+	int error = render_marker( frame, 1, buffer, values );
+	*format = values[0];
+	*frequency = values[1];
+	*channels = values[2];
+	*samples = values[3];
+	return error;
+}
+
+static void render_group_close( render_group *group )
+{
+	int i;
+
+	for ( i = 0; i < group->count * 2; i ++ )
+	{
+		render_track *track = &group->tracks[ i ];
+		if ( track->clone && !track->state )
+			render_outcome( group, i / 2, i % 2, 0 );
+		mlt_frame_close( track->clone );
+		mlt_properties_close( track->expected );
+		mlt_properties_close( track->fetched );
+	}
+	pthread_mutex_destroy( &group->mutex );
+	mlt_multitrack_close( group->self );
+	free( group->tracks );
+	free( group );
+}
+
+static void render_link_close( render_link *link )
+{
+	render_group *group = link->group;
+	int last;
+
+	pthread_mutex_lock( &group->mutex );
+	group->tracks[ link->track * 2 ].frame = NULL;
+	group->tracks[ link->track * 2 + 1 ].frame = NULL;
+	last = -- group->refs == 0;
+	pthread_mutex_unlock( &group->mutex );
+	free( link );
+	if ( last )
+		render_group_close( group );
+}
+
+/** Render the tracks of a parallel fetch together.
+ *
+ * Each track's own services (its producer and filters) are put below a marker
+ * on the stacks of its frame. When the services above (transitions and the
+ * tractor) first reach a marker, the other tracks are rendered ahead on the
+ * slices pool with the format, size and properties they were given at the
+ * previous position, while the track that was asked renders as usual.
+ * A track whose request or frame properties turn out different, for example
+ * because a transition changed the size of its b frame, runs its services
+ * again in order, and waits longer before it is rendered ahead again.
+ *
+ * Frames that hold other frames (nested tractors) and effect tracks always
+ * render in order. Otherwise, a frame whose render ahead is not used runs its
+ * services twice, so filters that keep state from one frame to the next may
+ * see such a frame twice.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param fetch a parallel fetch whose frames were just fetched
+ */
+
+static void render_group_start( parallel_fetch *fetch )
+{
+	mlt_multitrack self = fetch->self;
+	render_group *group = NULL;
+	int i, kind, count = 0;
+
+	for ( i = 0; i < self->count; i ++ )
+		count += fetch->frames[ i ] != NULL && !mlt_properties_get_int( MLT_FRAME_PROPERTIES( fetch->frames[ i ] ), "fx_cut" );
+	if ( count < 2 || ( group = calloc( 1, sizeof( *group ) ) ) == NULL )
+		return;
+	group->tracks = calloc( self->count * 2, sizeof( render_track ) );
+	if ( group->tracks == NULL )
+	{
+		free( group );
+		return;
+	}
+	group->self = self;
+	group->fetch = fetch;
+	group->count = self->count;
+	group->fps = mlt_profile_fps( mlt_service_profile( MLT_MULTITRACK_SERVICE( self ) ) );
+	pthread_mutex_init( &group->mutex, NULL );
+	mlt_properties_inc_ref( MLT_MULTITRACK_PROPERTIES( self ) );
+
+	// Hold a reference while the frames are linked
+	group->refs = 1;
+	for ( i = 0; i < self->count; i ++ )
+	{
+		mlt_frame frame = fetch->frames[ i ];
+		mlt_properties properties = frame ? MLT_FRAME_PROPERTIES( frame ) : NULL;
+		mlt_properties fetched;
+		render_link *link;
+
+		if ( frame == NULL || mlt_properties_get_int( properties, "fx_cut" ) || ( link = calloc( 1, sizeof( *link ) ) ) == NULL )
+			continue;
+		link->group = group;
+		link->track = i;
+		group->refs ++;
+		mlt_properties_set_data( properties, RENDER_KEY, link, 0, ( mlt_destructor )render_link_close, NULL );
+
+		fetched = mlt_properties_new( );
+		copy_properties( fetched, properties );
+		for ( kind = 0; kind < 2; kind ++ )
+		{
+			render_track *track = &group->tracks[ i * 2 + kind ];
+			mlt_deque stack = kind ? MLT_FRAME_AUDIO_STACK( frame ) : MLT_FRAME_IMAGE_STACK( frame );
+			if ( ( kind ? mlt_frame_is_test_audio( frame ) : mlt_frame_is_test_card( frame ) ) || !mlt_deque_count( stack ) )
+				continue;
+			track->frame = frame;
+			track->base = mlt_deque_count( stack );
+			track->fetched = fetched;
+			mlt_properties_inc_ref( fetched );
+			if ( kind )
+				mlt_frame_push_audio( frame, render_get_audio );
+			else
+				mlt_frame_push_get_image( frame, render_get_image );
+		}
+		mlt_properties_close( fetched );
+	}
+
+	pthread_mutex_lock( &group->mutex );
+	i = -- group->refs == 0;
+	pthread_mutex_unlock( &group->mutex );
+	if ( i )
+		render_group_close( group );
+}
+
+/** Get a track's frame from a parallel fetch.
+ *
+ * The first track requested for a position fetches the frames of all tracks on
+ * the slices pool; the following requests hand them out. Only tracks that do
+ * not reach a producer of another track take part, so the frames are the same
+ * as if they were fetched one by one. Their images and audio are then rendered
+ * together too (see render_group_start).
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param self a multitrack
+ * \param index the 0-based track index
+ * \param position the position of the multitrack
+ * \param speed the speed of the multitrack
+ * \return the frame, or NULL to fetch it serially
+ */
+
+static mlt_frame parallel_frame( mlt_multitrack self, int index, mlt_position position, double speed )
+{
+	mlt_properties properties = MLT_MULTITRACK_PROPERTIES( self );
+	parallel_fetch *fetch = mlt_properties_get_data( properties, "_parallel_fetch", NULL );
+	mlt_frame frame = NULL;
+
+	if ( fetch == NULL )
+	{
+		fetch = calloc( 1, sizeof( *fetch ) );
+		if ( fetch == NULL )
+			return NULL;
+		fetch->self = self;
+		pthread_mutex_init( &fetch->mutex, NULL );
+		mlt_properties_set_data( properties, "_parallel_fetch", fetch, 0, ( mlt_destructor )parallel_fetch_close, NULL );
+	}
+	if ( fetch->count < self->count )
+	{
+		// Frames of earlier positions may still use the hints, so keep them
+		parallel_fetch_release( fetch );
+		if ( parallel_fetch_resize( fetch, self->count ) )
+			return NULL;
+	}
+
+	if ( !fetch->active || fetch->position != position || fetch->speed != speed )
+	{
+		parallel_fetch_release( fetch );
+		fetch->position = position;
+		fetch->speed = speed;
+		fetch->active = 1;
+		if ( find_serial_tracks( fetch ) > 1 )
+		{
+			mlt_slices_run_normal( self->count, parallel_fetch_proc, fetch );
+			render_group_start( fetch );
+		}
+		else
+			memset( fetch->serial, 1, fetch->count );
+	}
+
+	frame = fetch->frames[ index ];
+	fetch->frames[ index ] = NULL;
+	return frame;
+}
+
+/** End a parallel fetch, dropping the frames of tracks that were not requested.
+ *
+ * \private \memberof mlt_multitrack_s
+ * \param self a multitrack
+ */
+
+static void parallel_frame_done( mlt_multitrack self )
+{
+	parallel_fetch *fetch = mlt_properties_get_data( MLT_MULTITRACK_PROPERTIES( self ), "_parallel_fetch", NULL );
+	if ( fetch != NULL )
+		parallel_fetch_release( fetch );
+}
+
 static int producer_get_frame( mlt_producer parent, mlt_frame_ptr frame, int index )
 {
 	// Get the mutiltrack object
 	mlt_multitrack self = parent->child;
 
+	// Get the parent properties
+	mlt_properties producer_properties = MLT_PRODUCER_PROPERTIES( parent );
+
 	// Check if we have a track for this index
 	if ( index >= 0 && index < self->count && self->list[ index ] != NULL )
 	{
-		// Get the producer for this track
-		mlt_producer producer = self->list[ index ]->producer;
-
-		// Get the track hide property
-		int hide = mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( mlt_producer_cut_parent( producer ) ), "hide" );
-
 		// Obtain the current position
 		mlt_position position = mlt_producer_frame( parent );
 
-		// Get the parent properties
-		mlt_properties producer_properties = MLT_PRODUCER_PROPERTIES( parent );
-
 		// Get the speed
 		double speed = mlt_properties_get_double( producer_properties, "_speed" );
 
-		// Make sure we're at the same point
-		mlt_producer_seek( producer, position );
-
-		// Get the frame from the producer
-		mlt_service_get_frame( MLT_PRODUCER_SERVICE( producer ), frame, 0 );
-
-		// Indicate speed of this producer
-		mlt_properties properties = MLT_FRAME_PROPERTIES( *frame );
-		mlt_properties_set_double( properties, "_speed", speed );
-		mlt_frame_set_position( *frame, position );
-		mlt_properties_set_int( properties, "hide", hide );
+		*frame = NULL;
+		if ( self->count > 1 && mlt_properties_get_int( producer_properties, "parallel" ) )
+			*frame = parallel_frame( self, index, position, speed );
+		if ( *frame == NULL )
+			*frame = fetch_track( self, index, position, speed );
 	}
 	else
 	{
@@ -631,6 +1666,9 @@ static int producer_get_frame( mlt_producer parent, mlt_frame_ptr frame, int ind
 			// Let tractor know if we've reached the end
 			mlt_properties_set_int( MLT_FRAME_PROPERTIES( *frame ), "last_track", 1 );
 
+			// Release any tracks that were fetched but not requested
+			parallel_frame_done( self );
+
 			// Move to the next frame
 			mlt_producer_prepare_next( parent );
 		}
@@ -42,6 +42,8 @@ typedef struct mlt_track_s *mlt_track;
  *
  * \extends mlt_producer_s
  * \properties \em log_id not currently used, but sets it to "mulitrack"
+ * \properties \em parallel set to 1 to fetch and render the frames of all tracks at the same time
+ * using the slices thread pool (the output is the same as fetching them one by one)
  */
 
 struct mlt_multitrack_s
@@ -42,6 +42,7 @@ struct playlist_entry_s
 	mlt_position frame_count;
 	int repeat;
 	mlt_position producer_length;
+	mlt_producer parent;
 	mlt_event event;
 	int preservation_hack;
 };
@@ -96,7 +97,8 @@ mlt_playlist mlt_playlist_init( )
 
 		self->size = 10;
 		self->list = calloc( self->size, sizeof( playlist_entry * ) );
-		if ( self->list == NULL ) goto error2;
+		self->index = calloc( self->size + 1, sizeof( mlt_position ) );
+		if ( self->list == NULL || self->index == NULL ) goto error2;
 		
 		mlt_events_register( MLT_PLAYLIST_PROPERTIES( self ), "playlist-next" );
 	}
@@ -104,6 +106,7 @@ mlt_playlist mlt_playlist_init( )
 	return self;
 error2:
 	free( self->list );
+	free( self->index );
 error1:
 	free( self );
 	return NULL;
@@ -165,57 +168,160 @@ mlt_properties mlt_playlist_properties( mlt_playlist self )
 	return MLT_PRODUCER_PROPERTIES( &self->parent );
 }
 
-/** Refresh the playlist after a clip has been changed.
+/** Add a change in an entry's duration to the index.
  *
  * \private \memberof mlt_playlist_s
  * \param self a playlist
- * \return false
+ * \param clip the index of the playlist entry
+ * \param delta the change in duration
  */
 
-static int mlt_playlist_virtual_refresh( mlt_playlist self )
+static void mlt_playlist_index_add( mlt_playlist self, int clip, mlt_position delta )
 {
-	// Obtain the properties
-	mlt_properties properties = MLT_PLAYLIST_PROPERTIES( self );
-	int i = 0;
-	mlt_position frame_count = 0;
+	int i;
+	for ( i = clip + 1; i <= self->count; i += i & -i )
+		self->index[ i ] += delta;
+}
 
-	for ( i = 0; i < self->count; i ++ )
+/** Get the total duration of the entries before a clip from the index.
+ *
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \param clip the index of the playlist entry
+ * \return the time at which \p clip starts
+ */
+
+static mlt_position mlt_playlist_index_sum( mlt_playlist self, int clip )
+{
+	mlt_position sum = 0;
+	int i;
+	for ( i = clip; i > 0; i -= i & -i )
+		sum += self->index[ i ];
+	return sum;
+}
+
+/** Rebuild the index for the entries from a clip onwards.
+ *
+ * This is needed after entries are inserted, removed or moved. The nodes
+ * covering the earlier entries are untouched, so the cost is linear in the
+ * number of entries after \p clip.
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \param clip the index of the first playlist entry that changed
+ */
+
+static void mlt_playlist_index_rebuild( mlt_playlist self, int clip )
+{
+	int i, j;
+
+	for ( i = clip + 1; i <= self->count; i ++ )
+		self->index[ i ] = self->list[ i - 1 ]->frame_count;
+
+	// The nodes that sum the earlier entries are the children of later nodes
+	for ( i = clip; i > 0; i -= i & -i )
+		if ( ( j = i + ( i & -i ) ) <= self->count )
+			self->index[ j ] += self->index[ i ];
+
+	for ( i = clip + 1; i <= self->count; i ++ )
+		if ( ( j = i + ( i & -i ) ) <= self->count )
+			self->index[ j ] += self->index[ i ];
+}
+
+/** Find the entry at a position using the index.
+ *
+ * Entries with no duration are skipped.
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \param[in, out] position the time at which to locate the entry, returns the time relative to the entry's start
+ * \return the index of the playlist entry or the number of entries if the position is beyond the end
+ */
+
+static int mlt_playlist_index_find( mlt_playlist self, mlt_position *position )
+{
+	int clip = 0;
+	int step = 1;
+
+	while ( step * 2 <= self->count )
+		step *= 2;
+	for ( ; step > 0; step /= 2 )
 	{
-		// Get the producer
-		mlt_producer producer = self->list[ i ]->producer;
-		if ( producer )
+		if ( clip + step <= self->count && self->index[ clip + step ] <= *position )
 		{
-			int current_length = mlt_producer_get_playtime( producer );
+			clip += step;
+			*position -= self->index[ clip ];
+		}
+	}
+	return clip;
+}
+
+/** Update an entry's duration from its producer.
+ *
+ * \private \memberof mlt_playlist_s
+ * \param entry a playlist entry
+ */
 
-			// Check if the length of the producer has changed
-			if ( self->list[ i ]->frame_in != mlt_producer_get_in( producer ) ||
-				self->list[ i ]->frame_out != mlt_producer_get_out( producer ) )
+static void mlt_playlist_entry_refresh( playlist_entry *entry )
+{
+	// Get the producer
+	mlt_producer producer = entry->producer;
+	if ( producer )
+	{
+		int current_length = mlt_producer_get_playtime( producer );
+
+		// Check if the length of the producer has changed
+		if ( entry->frame_in != mlt_producer_get_in( producer ) ||
+			entry->frame_out != mlt_producer_get_out( producer ) )
+		{
+			// This clip should be removed...
+			if ( current_length < 1 )
 			{
-				// This clip should be removed...
-				if ( current_length < 1 )
-				{
-					self->list[ i ]->frame_in = 0;
-					self->list[ i ]->frame_out = -1;
-					self->list[ i ]->frame_count = 0;
-				}
-				else
-				{
-					self->list[ i ]->frame_in = mlt_producer_get_in( producer );
-					self->list[ i ]->frame_out = mlt_producer_get_out( producer );
-					self->list[ i ]->frame_count = current_length;
-				}
-
-				// Update the producer_length
-				self->list[ i ]->producer_length = current_length;
+				entry->frame_in = 0;
+				entry->frame_out = -1;
+				entry->frame_count = 0;
 			}
+			else
+			{
+				entry->frame_in = mlt_producer_get_in( producer );
+				entry->frame_out = mlt_producer_get_out( producer );
+				entry->frame_count = current_length;
+			}
+
+			// Update the producer_length
+			entry->producer_length = current_length;
 		}
+	}
 
-		// Calculate the frame_count
-		self->list[ i ]->frame_count = ( self->list[ i ]->frame_out - self->list[ i ]->frame_in + 1 ) * self->list[ i ]->repeat;
+	// Calculate the frame_count
+	entry->frame_count = ( entry->frame_out - entry->frame_in + 1 ) * entry->repeat;
+}
 
-		// Update the frame_count for self clip
-		frame_count += self->list[ i ]->frame_count;
-	}
+/** Refresh an entry and its duration in the index.
+ *
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \param clip the index of the playlist entry
+ */
+
+static void mlt_playlist_refresh_clip( mlt_playlist self, int clip )
+{
+	mlt_position indexed = mlt_playlist_index_sum( self, clip + 1 ) - mlt_playlist_index_sum( self, clip );
+	mlt_playlist_entry_refresh( self->list[ clip ] );
+	if ( self->list[ clip ]->frame_count != indexed )
+		mlt_playlist_index_add( self, clip, self->list[ clip ]->frame_count - indexed );
+}
+
+/** Set the playlist's length and out point from the index.
+ *
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \return false
+ */
+
+static int mlt_playlist_refresh_length( mlt_playlist self )
+{
+	// Obtain the properties
+	mlt_properties properties = MLT_PLAYLIST_PROPERTIES( self );
+	mlt_position frame_count = mlt_playlist_index_sum( self, self->count );
 
 	// Refresh all properties
 	mlt_events_block( properties, properties );
@@ -226,17 +332,62 @@ static int mlt_playlist_virtual_refresh( mlt_playlist self )
 	return 0;
 }
 
+/** Refresh the playlist.
+ *
+ * Every entry is updated from its producer and the index is rebuilt.
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \return false
+ */
+
+static int mlt_playlist_virtual_refresh( mlt_playlist self )
+{
+	int i = 0;
+
+	for ( i = 0; i < self->count; i ++ )
+		mlt_playlist_entry_refresh( self->list[ i ] );
+	mlt_playlist_index_rebuild( self, 0 );
+
+	return mlt_playlist_refresh_length( self );
+}
+
+/** Refresh a range of entries in the playlist.
+ *
+ * This is used after edits that only change the given entries, or that
+ * have already rebuilt the index for entries they moved.
+ * \private \memberof mlt_playlist_s
+ * \param self a playlist
+ * \param first the index of the first playlist entry to refresh
+ * \param last the index of the last playlist entry to refresh, may be less than \p first
+ * \return false
+ */
+
+static int mlt_playlist_virtual_update( mlt_playlist self, int first, int last )
+{
+	int i;
+
+	for ( i = first < 0 ? 0 : first; i <= last && i < self->count; i ++ )
+		mlt_playlist_refresh_clip( self, i );
+
+	return mlt_playlist_refresh_length( self );
+}
+
 /** Listener for producers on the playlist.
  *
- * Refreshes the playlist whenever an entry receives producer-changed.
+ * Refreshes the entries that cut the producer that received producer-changed.
  * \private \memberof mlt_playlist_s
- * \param producer a producer
+ * \param owner the properties of the parent producer
  * \param self a playlist
  */
 
-static void mlt_playlist_listener( mlt_producer producer, mlt_playlist self )
+static void mlt_playlist_listener( mlt_properties owner, mlt_playlist self )
 {
-	mlt_playlist_virtual_refresh( self );
+	int i;
+
+	for ( i = 0; i < self->count; i ++ )
+		if ( MLT_PRODUCER_PROPERTIES( self->list[ i ]->parent ) == owner )
+			mlt_playlist_refresh_clip( self, i );
+	mlt_playlist_refresh_length( self );
 }
 
 /** Append to the virtual playlist.
@@ -330,9 +481,11 @@ static int mlt_playlist_virtual_append( mlt_playlist self, mlt_producer source,
 	if ( self->count >= self->size )
 	{
 		int i;
-		self->list = realloc( self->list, ( self->size + 10 ) * sizeof( playlist_entry * ) );
-		for ( i = self->size; i < self->size + 10; i ++ ) self->list[ i ] = NULL;
-		self->size += 10;
+		int size = self->size * 2;
+		self->list = realloc( self->list, size * sizeof( playlist_entry * ) );
+		self->index = realloc( self->index, ( size + 1 ) * sizeof( mlt_position ) );
+		for ( i = self->size; i < size; i ++ ) self->list[ i ] = NULL;
+		self->size = size;
 	}
 
 	// Create the entry
@@ -345,14 +498,16 @@ static int mlt_playlist_virtual_append( mlt_playlist self, mlt_producer source,
 		self->list[ self->count ]->frame_count = out - in + 1;
 		self->list[ self->count ]->repeat = 1;
 		self->list[ self->count ]->producer_length = mlt_producer_get_playtime( producer );
+		self->list[ self->count ]->parent = mlt_producer_cut_parent( producer );
 		self->list[ self->count ]->event = mlt_events_listen( parent, self, "producer-changed", ( mlt_listener )mlt_playlist_listener );
 		mlt_event_inc_ref( self->list[ self->count ]->event );
 		mlt_properties_set( properties, "eof", "pause" );
 		mlt_producer_set_speed( producer, 0 );
 		self->count ++;
+		mlt_playlist_index_rebuild( self, self->count - 1 );
 	}
 
-	return mlt_playlist_virtual_refresh( self );
+	return mlt_playlist_virtual_update( self, self->count - 1, self->count - 1 );
 }
 
 /** Locate a producer by index.
@@ -369,26 +524,18 @@ static mlt_producer mlt_playlist_locate( mlt_playlist self, mlt_position *positi
 {
 	// Default producer to NULL
 	mlt_producer producer = NULL;
+	mlt_position original = *position;
 
-	// Loop for each producer until found
-	for ( *clip = 0; *clip < self->count; *clip += 1 )
+	// Find the clip in the index
+	// Note that 0 length clips get skipped automatically
+	*clip = mlt_playlist_index_find( self, position );
+
+	// Total the durations up to and including the clip
+	*total += original - *position;
+	if ( *clip < self->count )
 	{
-		// Increment the total
 		*total += self->list[ *clip ]->frame_count;
-
-		// Check if the position indicates that we have found the clip
-		// Note that 0 length clips get skipped automatically
-		if ( *position < self->list[ *clip ]->frame_count )
-		{
-			// Found it, now break
-			producer = self->list[ *clip ]->producer;
-			break;
-		}
-		else
-		{
-			// Decrement position by length of self entry
-			*position -= self->list[ *clip ]->frame_count;
-		}
+		producer = self->list[ *clip ]->producer;
 	}
 
 	return producer;
@@ -505,23 +652,11 @@ static mlt_producer mlt_playlist_virtual_set_out( mlt_playlist self )
 	// Map playlist position to real producer in virtual playlist
 	mlt_position position = mlt_producer_frame( &self->parent );
 
-	// Loop through the virtual playlist
-	int i = 0;
+	// Find the entry in the virtual playlist
+	int i = mlt_playlist_index_find( self, &position );
 
-	for ( i = 0; i < self->count; i ++ )
-	{
-		if ( position < self->list[ i ]->frame_count )
-		{
-			// Found it, now break
-			producer = self->list[ i ]->producer;
-			break;
-		}
-		else
-		{
-			// Decrement position by length of this entry
-			position -= self->list[ i ]->frame_count;
-		}
-	}
+	if ( i < self->count )
+		producer = self->list[ i ]->producer;
 
 	// Seek in real producer to relative position
 	if ( i < self->count && self->list[ i ]->frame_out != position )
@@ -531,7 +666,7 @@ static mlt_producer mlt_playlist_virtual_set_out( mlt_playlist self )
 		self->list[ i ]->frame_count = self->list[ i ]->frame_out - self->list[ i ]->frame_in + 1;
 
 		// Refresh the playlist
-		mlt_playlist_virtual_refresh( self );
+		mlt_playlist_virtual_update( self, i, i );
 	}
 
 	return producer;
@@ -549,24 +684,7 @@ int mlt_playlist_current_clip( mlt_playlist self )
 	// Map playlist position to real producer in virtual playlist
 	mlt_position position = mlt_producer_frame( &self->parent );
 
-	// Loop through the virtual playlist
-	int i = 0;
-
-	for ( i = 0; i < self->count; i ++ )
-	{
-		if ( position < self->list[ i ]->frame_count )
-		{
-			// Found it, now break
-			break;
-		}
-		else
-		{
-			// Decrement position by length of this entry
-			position -= self->list[ i ]->frame_count;
-		}
-	}
-
-	return i;
+	return mlt_playlist_index_find( self, &position );
 }
 
 /** Obtain the current clips producer.
@@ -597,9 +715,7 @@ mlt_producer mlt_playlist_current( mlt_playlist self )
 
 mlt_position mlt_playlist_clip( mlt_playlist self, mlt_whence whence, int index )
 {
-	mlt_position position = 0;
 	int absolute_clip = index;
-	int i = 0;
 
 	// Determine the absolute clip
 	switch ( whence )
@@ -624,10 +740,7 @@ mlt_position mlt_playlist_clip( mlt_playlist self, mlt_whence whence, int index
 		absolute_clip = self->count;
 
 	// Now determine the position
-	for ( i = 0; i < absolute_clip; i ++ )
-		position += self->list[ i ]->frame_count;
-
-	return position;
+	return mlt_playlist_index_sum( self, absolute_clip );
 }
 
 /** Get all the info about the clip specified.
@@ -786,7 +899,7 @@ int mlt_playlist_insert( mlt_playlist self, mlt_producer producer, int where, ml
 	mlt_playlist_move( self, self->count - 1, where );
 	mlt_events_unblock( MLT_PLAYLIST_PROPERTIES( self ), self );
 
-	return mlt_playlist_virtual_refresh( self );
+	return mlt_playlist_virtual_update( self, 0, -1 );
 }
 
 /** Remove an entry in the playlist.
@@ -821,6 +934,7 @@ int mlt_playlist_remove( mlt_playlist self, int where )
 		for ( i = where + 1; i < self->count; i ++ )
 			self->list[ i - 1 ] = self->list[ i ];
 		self->count --;
+		mlt_playlist_index_rebuild( self, where );
 
 		if ( entry->preservation_hack == 0 )
 		{
@@ -856,7 +970,7 @@ int mlt_playlist_remove( mlt_playlist self, int where )
 		free( entry );
 
 		// Refresh the playlist
-		mlt_playlist_virtual_refresh( self );
+		mlt_playlist_virtual_update( self, 0, -1 );
 	}
 
 	return error;
@@ -919,10 +1033,11 @@ int mlt_playlist_move( mlt_playlist self, int src, int dest )
 				self->list[ i ] = self->list[ i + 1 ];
 		}
 		self->list[ dest ] = src_entry;
+		mlt_playlist_index_rebuild( self, src < dest ? src : dest );
 
 		mlt_playlist_get_clip_info( self, &current_info, current );
 		mlt_producer_seek( MLT_PLAYLIST_PRODUCER( self ), current_info.start + position );
-		mlt_playlist_virtual_refresh( self );
+		mlt_playlist_virtual_update( self, 0, -1 );
 	}
 
 	return 0;
@@ -986,7 +1101,7 @@ int mlt_playlist_repeat_clip( mlt_playlist self, int clip, int repeat )
 	{
 		playlist_entry *entry = self->list[ clip ];
 		entry->repeat = repeat;
-		mlt_playlist_virtual_refresh( self );
+		mlt_playlist_virtual_update( self, clip, clip );
 	}
 	return error;
 }
@@ -1042,7 +1157,7 @@ int mlt_playlist_resize_clip( mlt_playlist self, int clip, mlt_position in, mlt_
 
 		mlt_producer_set_in_and_out( producer, in, out );
 		mlt_events_unblock( properties, properties );
-		mlt_playlist_virtual_refresh( self );
+		mlt_playlist_virtual_update( self, clip, clip );
 	}
 	return error;
 }
@@ -1087,7 +1202,7 @@ int mlt_playlist_split( mlt_playlist self, int clip, mlt_position position )
 				mlt_playlist_insert( self, &self->blank, clip + 1, 0, out - position - 1 );
 			}
 			mlt_events_unblock( MLT_PLAYLIST_PROPERTIES( self ), self );
-			mlt_playlist_virtual_refresh( self );
+			mlt_playlist_virtual_update( self, clip, clip + 1 );
 		}
 		else
 		{
@@ -1775,7 +1890,7 @@ mlt_producer mlt_playlist_replace_with_blank( mlt_playlist self, int clip )
 		mlt_playlist_blank( self, out - in );
 		mlt_playlist_move( self, self->count - 1, clip );
 		mlt_events_unblock( properties, properties );
-		mlt_playlist_virtual_refresh( self );
+		mlt_playlist_virtual_update( self, clip, clip );
 		mlt_producer_set_in_and_out( producer, in, out );
 	}
 	return producer;
@@ -1798,7 +1913,7 @@ void mlt_playlist_insert_blank( mlt_playlist self, int clip, int out )
 		mlt_playlist_blank( self, out );
 		mlt_playlist_move( self, self->count - 1, clip );
 		mlt_events_unblock( properties, properties );
-		mlt_playlist_virtual_refresh( self );
+		mlt_playlist_virtual_update( self, 0, -1 );
 	}
 }
 
@@ -2125,6 +2240,7 @@ void mlt_playlist_close( mlt_playlist self )
 		mlt_producer_close( &self->blank );
 		mlt_producer_close( &self->parent );
 		free( self->list );
+		free( self->index );
 		free( self );
 	}
 }
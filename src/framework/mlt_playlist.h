@@ -77,6 +77,7 @@ struct mlt_playlist_s
 	int size;
 	int count;
 	playlist_entry **list;
+	mlt_position *index; /**< a Fenwick tree of the entries' durations, 1-based */
 };
 
 #define MLT_PLAYLIST_PRODUCER( playlist )	( &( playlist )->parent )
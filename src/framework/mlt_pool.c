@@ -27,10 +27,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdatomic.h>
 
 // Not nice - memalign is defined here apparently?
 #ifdef linux
 #include <malloc.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define POOL_MMAP 1
 #endif
 
 // Macros to re-assign system functions.
@@ -59,15 +64,44 @@ void mlt_pool_init() {}
 void *mlt_pool_alloc( int size ) { return mlt_alloc( size ); }
 void *mlt_pool_realloc( void *ptr, int size ) { return mlt_realloc( ptr, size ); }
 void mlt_pool_release( void *release ) { return mlt_free( release ); }
+void *mlt_pool_retain( void *ptr ) { return NULL; }
+int mlt_pool_references( void *ptr ) { return ptr ? 1 : 0; }
 void mlt_pool_purge() {}
 void mlt_pool_close() {}
 void mlt_pool_stat() {}
+int mlt_pool_add_size( int size ) { return 0; }
+void mlt_pool_remove_size( int size ) {}
+void mlt_pool_set_limit( int64_t limit ) {}
+int64_t mlt_pool_get_limit() { return 0; }
 
 #else
 
-/** global singleton for tracking pools */
+/** the smallest block is 1 << MIN_SHIFT bytes, the largest 1 << ( MAX_SHIFT - 1 ) */
+
+#define MIN_SHIFT 8
+#define MAX_SHIFT 31
+#define POOL_COUNT ( MAX_SHIFT - MIN_SHIFT )
+
+/** the most blocks of one size a thread may keep for itself */
+
+#define MAGAZINE_MAX 32
+
+/** the bytes of one size a thread may keep for itself; large blocks are not kept */
+
+#define MAGAZINE_BYTES ( 32 << 20 )
+
+/** blocks of at least this many bytes are large: mapped, kept per NUMA node, and never in magazines */
+
+#define LARGE_MIN ( 2 << 20 )
+
+/** the most NUMA nodes told apart when reusing large blocks */
+
+#define POOL_NODES 8
+
+/** the most exact-size classes, and the granularity of their sizes */
 
-static mlt_properties pools = NULL;
+#define SLAB_MAX 32
+#define SLAB_ALIGN ( 64 << 10 )
 
 /** \brief Pool (memory) class
  */
@@ -76,11 +110,76 @@ typedef struct mlt_pool_s
 {
 	pthread_mutex_t lock; ///< lock to prevent race conditions
 	mlt_deque stack;      ///< a stack of addresses to memory blocks
-	int size;             ///< the size of the memory block as a power of 2
+	mlt_deque nodes[ POOL_NODES ]; ///< for large blocks, a stack per NUMA node; the first is stack
+	int size;             ///< the size of the memory block, a power of 2 except for slabs
+	int large;            ///< whether the blocks are large
+	size_t map_size;      ///< the number of bytes mapped for a large block
 	int count;            ///< the number of blocks in the pool
+	int index;            ///< the position of the pool in pools
+	int magazine;         ///< the number of blocks each thread may keep
+	atomic_int cached;    ///< the number of blocks kept by threads
+	atomic_llong hits;    ///< allocations served by a thread's own blocks
+	atomic_llong misses;  ///< allocations that needed the lock
+	int users;            ///< for a slab, the mlt_pool_add_size() calls not yet removed
+	int retired;          ///< for a slab, whether blocks are freed rather than kept
+	struct mlt_pool_s *next; ///< for a retired slab, the next in the list
 }
 *mlt_pool;
 
+/** global singleton for tracking pools */
+
+static mlt_pool pools[ POOL_COUNT ];
+
+/** \brief private to mlt_pool_s, the blocks of one size kept by a thread
+ */
+
+typedef struct
+{
+	int count;
+	void *blocks[ MAGAZINE_MAX ];
+}
+pool_magazine;
+
+/** \brief private to mlt_pool_s, the magazines of one thread
+ *
+ * These are listed so that mlt_pool_close can give back the blocks of every
+ * thread, not only its own.
+ */
+
+typedef struct pool_thread_s
+{
+	struct pool_thread_s *next;
+	struct pool_thread_s *prev;
+	pool_magazine magazines[ POOL_COUNT ];
+}
+pool_thread;
+
+static pthread_once_t magazines_once = PTHREAD_ONCE_INIT;
+static pthread_key_t magazines_key;
+static int magazines_key_ok = 0;
+static atomic_int magazines_enabled;
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pool_thread *threads = NULL;
+
+/** exact-size classes for the frame sizes in use, see mlt_pool_add_size() */
+
+static _Atomic( mlt_pool ) slabs[ SLAB_MAX ];
+static atomic_int slab_count;
+static pthread_mutex_t slabs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** slabs no longer in use, kept until mlt_pool_close since a reader may still hold one */
+
+static mlt_pool retired_slabs = NULL;
+
+/** how large blocks are backed: 0 normal pages, 1 transparent huge pages, 2 explicit huge pages */
+
+static int huge_pages = 0;
+
+/** the bytes of large blocks waiting for reuse, and the most of them to keep (0 for no limit) */
+
+static atomic_llong idle_bytes;
+static atomic_llong idle_limit;
+
 /** \brief private to mlt_pool_s, for tracking items to release
  *
  * Aligned to 16 byte in case we toss buffers to external assembly
@@ -90,14 +189,16 @@ typedef struct mlt_pool_s
 typedef struct __attribute__ ((aligned (16))) mlt_release_s
 {
 	mlt_pool pool;
-	int references;
+	atomic_int references;
+	int node;
 }
 *mlt_release;
 #else
 typedef struct __declspec(align(16)) mlt_release_s
 {
     mlt_pool pool;
-    int references;
+    atomic_int references;
+    int node;
 }
 *mlt_release;
 #endif
@@ -105,11 +206,12 @@ typedef struct __declspec(align(16)) mlt_release_s
 /** Create a pool.
  *
  * \private \memberof mlt_pool_s
- * \param size the size of the memory blocks to hold as some power of two
+ * \param size the size of the memory blocks to hold
+ * \param index the position of the pool in pools, or -1 for a slab
  * \return a new pool object
  */
 
-static mlt_pool pool_init( int size )
+static mlt_pool pool_init( int size, int index )
 {
 	// Create the pool
 	mlt_pool self = calloc( 1, sizeof( struct mlt_pool_s ) );
@@ -120,18 +222,285 @@ static mlt_pool pool_init( int size )
 		// Initialise the mutex
 		pthread_mutex_init( &self->lock, NULL );
 
-		// Create the stack
-		self->stack = mlt_deque_init( );
-
 		// Assign the size
 		self->size = size;
+		self->index = index;
+		self->large = size >= LARGE_MIN;
+
+		if ( self->large )
+		{
+			// Create a stack per node
+			int i;
+			size_t page = huge_pages ? LARGE_MIN : 4096;
+
+			for ( i = 0; i < POOL_NODES; i ++ )
+				self->nodes[ i ] = mlt_deque_init( );
+			self->stack = self->nodes[ 0 ];
+			self->map_size = ( size + page - 1 ) / page * page;
+		}
+		else
+		{
+			// Create the stack
+			self->stack = mlt_deque_init( );
+
+			// Decide how many blocks a thread keeps
+			self->magazine = MAGAZINE_BYTES / size;
+			if ( self->magazine > MAGAZINE_MAX )
+				self->magazine = MAGAZINE_MAX;
+		}
 	}
 
 	// Return it
 	return self;
 }
 
+/** Get the NUMA node of the CPU running the calling thread.
+ *
+ * \private \memberof mlt_pool_s
+ * \return an index into the nodes of a large pool
+ */
+
+static int pool_node( )
+{
+#if defined( POOL_MMAP ) && defined( SYS_getcpu )
+	unsigned cpu = 0, node = 0;
+	if ( !syscall( SYS_getcpu, &cpu, &node, NULL ) )
+		return node % POOL_NODES;
+#endif
+	return 0;
+}
+
+/** Get the memory for a new block.
+ *
+ * Large blocks are mapped on their own, so that they may use huge pages and
+ * so that freeing one returns it to the system. A slab is used in full, so
+ * its pages are faulted in at once by the calling thread, which places them
+ * on that thread's NUMA node.
+ *
+ * \private \memberof mlt_pool_s
+ * \param self a pool
+ * \return the memory or NULL if out of memory
+ */
+
+static mlt_release pool_alloc_block( mlt_pool self )
+{
+#ifdef POOL_MMAP
+	if ( self->large )
+	{
+		void *block = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+		if ( huge_pages == 2 )
+			block = mmap( NULL, self->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+#endif
+		// Fall back to normal pages when no huge pages are reserved
+		if ( block == MAP_FAILED )
+		{
+			block = mmap( NULL, self->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+			if ( block == MAP_FAILED )
+				return NULL;
+#ifdef MADV_HUGEPAGE
+			if ( huge_pages )
+				madvise( block, self->map_size, MADV_HUGEPAGE );
+#endif
+		}
+
+		if ( self->index < 0 )
+		{
+#ifdef MADV_POPULATE_WRITE
+			if ( madvise( block, self->size, MADV_POPULATE_WRITE ) )
+#endif
+			{
+				size_t i;
+				for ( i = 0; i < self->size; i += 4096 )
+					( ( volatile char * )block )[ i ] = 0;
+			}
+		}
+
+		return block;
+	}
+#endif
+	return mlt_alloc( self->size );
+}
+
+/** Free the memory of a block.
+ *
+ * \private \memberof mlt_pool_s
+ * \param self the pool of the block
+ * \param ptr an opaque pointer
+ */
+
+static void pool_free_block( mlt_pool self, void *ptr )
+{
+	mlt_release release = ( void * )(( char * )ptr - sizeof( struct mlt_release_s ));
+
+#ifdef POOL_MMAP
+	if ( self->large )
+	{
+		munmap( release, self->map_size );
+		return;
+	}
+#endif
+	mlt_free( release );
+}
+
+/** Allocate a new block for a pool.
+ *
+ * \private \memberof mlt_pool_s
+ * \param self a pool
+ * \return an opaque pointer or NULL if out of memory
+ */
+
+static void *pool_new_block( mlt_pool self )
+{
+	// We need to generate a release item
+	mlt_release release = pool_alloc_block( self );
+
+	// If out of memory, log it, reclaim memory, and try again.
+	if ( !release && self->size > 0 )
+	{
+		mlt_log_fatal( NULL, "[mlt_pool] out of memory\n" );
+		mlt_pool_purge();
+		release = pool_alloc_block( self );
+	}
+
+	if ( release == NULL )
+		return NULL;
+
+	// Increment the number of items allocated to this pool
+	pthread_mutex_lock( &self->lock );
+	self->count ++;
+	pthread_mutex_unlock( &self->lock );
+
+	// Assign the pool
+	release->pool = self;
+	release->node = self->large ? pool_node( ) : 0;
+	atomic_init( &release->references, 0 );
+
+	// Determine the ptr
+	return ( char * )release + sizeof( struct mlt_release_s );
+}
+
+/** Get the magazines of the calling thread.
+ *
+ * \private \memberof mlt_pool_s
+ * \return an array of POOL_COUNT magazines or NULL
+ */
+
+static pool_magazine *thread_magazines( )
+{
+	pool_thread *thread;
+
+	if ( !atomic_load_explicit( &magazines_enabled, memory_order_relaxed ) )
+		return NULL;
+	thread = pthread_getspecific( magazines_key );
+	if ( thread == NULL )
+	{
+		thread = calloc( 1, sizeof( pool_thread ) );
+		if ( thread == NULL )
+			return NULL;
+		pthread_mutex_lock( &threads_mutex );
+		thread->next = threads;
+		if ( threads != NULL )
+			threads->prev = thread;
+		threads = thread;
+		pthread_mutex_unlock( &threads_mutex );
+		pthread_setspecific( magazines_key, thread );
+	}
+	return thread->magazines;
+}
+
+/** Move blocks from a thread's magazine to the shared stack.
+ *
+ * \private \memberof mlt_pool_s
+ * \param self a pool
+ * \param magazine the magazine of the calling thread
+ * \param keep the number of blocks to leave in the magazine
+ */
+
+static void magazine_flush( mlt_pool self, pool_magazine *magazine, int keep )
+{
+	int moved = magazine->count - keep;
+
+	if ( moved <= 0 )
+		return;
+	pthread_mutex_lock( &self->lock );
+	while ( magazine->count > keep )
+		mlt_deque_push_back( self->stack, magazine->blocks[ -- magazine->count ] );
+	pthread_mutex_unlock( &self->lock );
+	atomic_fetch_sub( &self->cached, moved );
+}
+
+/** Move blocks from the shared stack to a thread's empty magazine.
+ *
+ * \private \memberof mlt_pool_s
+ * \param self a pool
+ * \param magazine the magazine of the calling thread
+ */
+
+static void magazine_refill( mlt_pool self, pool_magazine *magazine )
+{
+	int wanted = ( self->magazine + 1 ) / 2;
+
+	pthread_mutex_lock( &self->lock );
+	while ( magazine->count < wanted && mlt_deque_count( self->stack ) > 0 )
+		magazine->blocks[ magazine->count ++ ] = mlt_deque_pop_back( self->stack );
+	pthread_mutex_unlock( &self->lock );
+	atomic_fetch_add( &self->cached, magazine->count );
+}
+
+/** Return all the blocks kept by a thread to the shared stacks.
+ *
+ * \private \memberof mlt_pool_s
+ * \param magazines the magazines of a thread
+ */
+
+static void magazines_flush( pool_magazine *magazines )
+{
+	int i;
+	for ( i = 0; i < POOL_COUNT; i ++ )
+		magazine_flush( pools[ i ], &magazines[ i ], 0 );
+}
+
+/** Return the blocks kept by a thread when it exits.
+ *
+ * After mlt_pool_close the magazines are already empty and only the list
+ * entry is released.
+ * \private \memberof mlt_pool_s
+ * \param thread the magazines of the thread
+ */
+
+static void magazines_close( pool_thread *thread )
+{
+	pthread_mutex_lock( &threads_mutex );
+	if ( thread->prev != NULL )
+		thread->prev->next = thread->next;
+	else
+		threads = thread->next;
+	if ( thread->next != NULL )
+		thread->next->prev = thread->prev;
+	magazines_flush( thread->magazines );
+	pthread_mutex_unlock( &threads_mutex );
+	free( thread );
+}
+
+/** Create the key of the per thread magazines, once per process.
+ *
+ * The key is never deleted, so that a thread still running after
+ * mlt_pool_close never uses a stale key.
+ * \private \memberof mlt_pool_s
+ */
+
+static void magazines_key_create( )
+{
+	magazines_key_ok = !pthread_key_create( &magazines_key, ( void (*)( void* ) )magazines_close );
+}
+
 /** Get an item from the pool.
+ *
+ * Blocks come from the calling thread's magazine when it has one. Otherwise
+ * the magazine is refilled with a batch from the shared stack, so that the
+ * lock is taken once for many allocations.
  *
  * \private \memberof mlt_pool_s
  * \param self a pool
@@ -146,50 +515,72 @@ static void *pool_fetch( mlt_pool self )
 	// Sanity check
 	if ( self != NULL )
 	{
-		// Lock the pool
-		pthread_mutex_lock( &self->lock );
+		pool_magazine *magazines = self->magazine > 0 ? thread_magazines( ) : NULL;
 
-		// Check if the stack is empty
-		if ( mlt_deque_count( self->stack ) != 0 )
+		if ( magazines != NULL )
 		{
-			// Pop the top of the stack
-			ptr = mlt_deque_pop_back( self->stack );
+			pool_magazine *magazine = &magazines[ self->index ];
 
-			// Assign the reference
-			( ( mlt_release )ptr )->references = 1;
+			if ( magazine->count > 0 )
+			{
+				atomic_fetch_add_explicit( &self->hits, 1, memory_order_relaxed );
+			}
+			else
+			{
+				atomic_fetch_add_explicit( &self->misses, 1, memory_order_relaxed );
+				magazine_refill( self, magazine );
+			}
+			if ( magazine->count > 0 )
+			{
+				ptr = magazine->blocks[ -- magazine->count ];
+				atomic_fetch_sub( &self->cached, 1 );
+			}
 		}
-		else
+		else if ( self->large )
 		{
-			// We need to generate a release item
-			mlt_release release = mlt_alloc( self->size );
+			int node = pool_node( );
+			int i;
 
-			// If out of memory, log it, reclaim memory, and try again.
-			if ( !release && self->size > 0 )
-			{
-				mlt_log_fatal( NULL, "[mlt_pool] out of memory\n" );
-				mlt_pool_purge();
-				release = mlt_alloc( self->size );
-			}
+			// Lock the pool
+			pthread_mutex_lock( &self->lock );
 
-			// Initialise it
-			if ( release != NULL )
-			{
-				// Increment the number of items allocated to this pool
-				self->count ++;
+			// Prefer a block on the node of this thread
+			ptr = mlt_deque_pop_back( self->nodes[ node ] );
+			atomic_fetch_add_explicit( ptr ? &self->hits : &self->misses, 1, memory_order_relaxed );
+			for ( i = 1; ptr == NULL && i < POOL_NODES; i ++ )
+				ptr = mlt_deque_pop_back( self->nodes[ ( node + i ) % POOL_NODES ] );
 
-				// Assign the pool
-				release->pool = self;
+			// Unlock the pool
+			pthread_mutex_unlock( &self->lock );
 
-				// Assign the reference
-				release->references = 1;
+			if ( ptr != NULL )
+				atomic_fetch_sub( &idle_bytes, self->size );
+		}
+		else
+		{
+			atomic_fetch_add_explicit( &self->misses, 1, memory_order_relaxed );
 
-				// Determine the ptr
-				ptr = ( char * )release + sizeof( struct mlt_release_s );
-			}
+			// Lock the pool
+			pthread_mutex_lock( &self->lock );
+
+			// Pop the top of the stack
+			if ( mlt_deque_count( self->stack ) != 0 )
+				ptr = mlt_deque_pop_back( self->stack );
+
+			// Unlock the pool
+			pthread_mutex_unlock( &self->lock );
 		}
 
-		// Unlock the pool
-		pthread_mutex_unlock( &self->lock );
+		// The stacks are empty, so allocate a new block
+		if ( ptr == NULL )
+			ptr = pool_new_block( self );
+
+		// Assign the reference
+		if ( ptr != NULL )
+		{
+			mlt_release release = ( void * )(( char * )ptr - sizeof( struct mlt_release_s ));
+			atomic_store( &release->references, 1 );
+		}
 	}
 
 	// Return the generated release object
@@ -197,6 +588,11 @@ static void *pool_fetch( mlt_pool self )
 }
 
 /** Return an item to the pool.
+ *
+ * The block goes to the calling thread's magazine. A full magazine first
+ * moves half of its blocks to the shared stack in one batch. A large block
+ * goes to the stack of the node it was allocated on, unless that would keep
+ * more idle memory than the limit, in which case it is freed.
  *
  * \private \memberof mlt_pool_s
  * \param ptr an opaque pointer
@@ -213,16 +609,68 @@ static void pool_return( void *ptr )
 		// Get the pool
 		mlt_pool self = that->pool;
 
+		// Only the last reference returns the block
+		if ( atomic_fetch_sub( &that->references, 1 ) > 1 )
+			return;
+
 		if ( self != NULL )
 		{
-			// Lock the pool
-			pthread_mutex_lock( &self->lock );
+			pool_magazine *magazines = self->magazine > 0 ? thread_magazines( ) : NULL;
 
-			// Push the that back back on to the stack
-			mlt_deque_push_back( self->stack, ptr );
+			if ( magazines != NULL )
+			{
+				pool_magazine *magazine = &magazines[ self->index ];
 
-			// Unlock the pool
-			pthread_mutex_unlock( &self->lock );
+				if ( magazine->count >= self->magazine )
+					magazine_flush( self, magazine, self->magazine / 2 );
+				magazine->blocks[ magazine->count ++ ] = ptr;
+				atomic_fetch_add( &self->cached, 1 );
+			}
+			else if ( self->large )
+			{
+				int64_t limit = atomic_load( &idle_limit );
+
+				if ( limit > 0 && atomic_fetch_add( &idle_bytes, self->size ) + self->size > limit )
+				{
+					atomic_fetch_sub( &idle_bytes, self->size );
+					pthread_mutex_lock( &self->lock );
+					self->count --;
+					pthread_mutex_unlock( &self->lock );
+					pool_free_block( self, ptr );
+				}
+				else
+				{
+					int retired;
+
+					if ( limit <= 0 )
+						atomic_fetch_add( &idle_bytes, self->size );
+					pthread_mutex_lock( &self->lock );
+					retired = self->retired;
+					if ( retired )
+						self->count --;
+					else
+						mlt_deque_push_back( self->nodes[ that->node ], ptr );
+					pthread_mutex_unlock( &self->lock );
+
+					// A retired slab keeps nothing
+					if ( retired )
+					{
+						atomic_fetch_sub( &idle_bytes, self->size );
+						pool_free_block( self, ptr );
+					}
+				}
+			}
+			else
+			{
+				// Lock the pool
+				pthread_mutex_lock( &self->lock );
+
+				// Push the that back back on to the stack
+				mlt_deque_push_back( self->stack, ptr );
+
+				// Unlock the pool
+				pthread_mutex_unlock( &self->lock );
+			}
 
 			return;
 		}
@@ -232,28 +680,61 @@ static void pool_return( void *ptr )
 	}
 }
 
-/** Destroy a pool.
+/** Free the unused blocks of a pool.
  *
  * \private \memberof mlt_pool_s
  * \param self a pool
+ * \param limit stop once the idle large blocks of all pools total at most this many bytes, or -1 to free all
  */
 
-static void pool_close( mlt_pool self )
+static void pool_trim( mlt_pool self, int64_t limit )
 {
-	if ( self != NULL )
+	int i;
+
+	// Lock the pool
+	pthread_mutex_lock( &self->lock );
+
+	for ( i = 0; i < ( self->large ? POOL_NODES : 1 ); i ++ )
 	{
-		// We need to free up all items in the pool
+		mlt_deque stack = self->large ? self->nodes[ i ] : self->stack;
 		void *release = NULL;
 
-		// Iterate through the stack until depleted
-		while ( ( release = mlt_deque_pop_back( self->stack ) ) != NULL )
+		// We'll free unused items now
+		while ( ( limit < 0 || atomic_load( &idle_bytes ) > limit ) &&
+			( release = mlt_deque_pop_back( stack ) ) != NULL )
 		{
-			// We'll free this item now
-			mlt_free( ( char * )release - sizeof( struct mlt_release_s ) );
+			pool_free_block( self, release );
+			self->count--;
+			if ( self->large )
+				atomic_fetch_sub( &idle_bytes, self->size );
 		}
+	}
+
+	// Unlock the pool
+	pthread_mutex_unlock( &self->lock );
+}
+
+/** Destroy a pool.
+ *
+ * \private \memberof mlt_pool_s
+ * \param self a pool
+ */
 
-		// We can now close the stack
-		mlt_deque_close( self->stack );
+static void pool_close( mlt_pool self )
+{
+	if ( self != NULL )
+	{
+		int i;
+
+		// We need to free up all items in the pool
+		pool_trim( self, -1 );
+
+		// We can now close the stacks
+		if ( self->large )
+			for ( i = 0; i < POOL_NODES; i ++ )
+				mlt_deque_close( self->nodes[ i ] );
+		else
+			mlt_deque_close( self->stack );
 
 		// Destroy the mutex
 		pthread_mutex_destroy( &self->lock );
@@ -273,24 +754,19 @@ void mlt_pool_init( )
 	// Loop variable used to create the pools
 	int i = 0;
 
-	// Create the pools
-	pools = mlt_properties_new( );
+	// Decide how to back large blocks and how much of them to keep
+	if ( getenv( "MLT_POOL_HUGEPAGES" ) )
+		huge_pages = atoi( getenv( "MLT_POOL_HUGEPAGES" ) );
+	if ( getenv( "MLT_POOL_LIMIT" ) )
+		atomic_store( &idle_limit, ( int64_t ) atoi( getenv( "MLT_POOL_LIMIT" ) ) << 20 );
 
 	// Create the pools
-	for ( i = 8; i < 31; i ++ )
-	{
-		// Each properties item needs a name
-		char name[ 32 ];
-
-		// Construct a pool
-		mlt_pool pool = pool_init( 1 << i );
+	for ( i = 0; i < POOL_COUNT; i ++ )
+		pools[ i ] = pool_init( 1 << ( i + MIN_SHIFT ), i );
 
-		// Generate a name
-		sprintf( name, "%d", i );
-
-		// Register with properties
-		mlt_properties_set_data( pools, name, pool, 0, ( mlt_destructor )pool_close, NULL );
-	}
+	// Let each thread keep some blocks of its own
+	pthread_once( &magazines_once, magazines_key_create );
+	atomic_store( &magazines_enabled, magazines_key_ok );
 }
 
 /** Allocate size bytes from the pool.
@@ -301,22 +777,35 @@ void mlt_pool_init( )
 
 MLTPP_DECLSPEC void *mlt_pool_alloc( int size )
 {
-	// This will be used to obtain the pool to use
-	mlt_pool pool = NULL;
-
 	// Determines the index of the pool to use
-	int index = 8;
+	int index = 0;
 
 	// Minimum size pooled is 256 bytes
 	size += sizeof( struct mlt_release_s );
-	while ( ( 1 << index ) < size )
-		index ++;
 
-	// Now get the pool at the index
-	pool = mlt_properties_get_data_at( pools, index - 8, NULL );
+	// Use the closest slab if it wastes less than an eighth
+	if ( size >= LARGE_MIN )
+	{
+		int count = atomic_load( &slab_count );
+		mlt_pool slab = NULL;
+
+		for ( index = 0; index < count; index ++ )
+		{
+			mlt_pool candidate = atomic_load( &slabs[ index ] );
+			if ( candidate->size >= size && candidate->size - size <= size / 8 &&
+				 ( slab == NULL || candidate->size < slab->size ) )
+				slab = candidate;
+		}
+		if ( slab != NULL )
+			return pool_fetch( slab );
+		index = 0;
+	}
+
+	while ( index < POOL_COUNT && ( 1 << ( index + MIN_SHIFT ) ) < size )
+		index ++;
 
 	// Now get the real item
-	return pool_fetch( pool );
+	return index < POOL_COUNT ? pool_fetch( pools[ index ] ) : NULL;
 }
 
 /** Allocate size bytes from the pool.
@@ -337,14 +826,18 @@ void *mlt_pool_realloc( void *ptr, int size )
 		// Get the release pointer
 		mlt_release that = ( void * )(( char * )ptr - sizeof( struct mlt_release_s ));
 
-		// If the current pool this ptr belongs to is big enough
-		if ( size > that->pool->size - sizeof( struct mlt_release_s ) )
+		// The bytes usable in the block this ptr belongs to
+		int usable = that->pool->size - sizeof( struct mlt_release_s );
+
+		// If the current pool this ptr belongs to is big enough and nobody else shares it
+		if ( size > usable || atomic_load( &that->references ) > 1 )
 		{
 			// Allocate
 			result = mlt_pool_alloc( size );
 
-			// Copy
-			memcpy( result, ptr, that->pool->size - sizeof( struct mlt_release_s ) );
+			// Copy no more than fits, since a shared block may be shrunk
+			if ( result )
+				memcpy( result, ptr, size < usable ? size : usable );
 
 			// Release
 			mlt_pool_release( ptr );
@@ -366,36 +859,193 @@ void *mlt_pool_realloc( void *ptr, int size )
 
 /** Purge unused items in the pool.
  *
- * A form of garbage collection.
+ * A form of garbage collection. This frees the blocks kept by the calling
+ * thread and the shared stacks; other threads keep their magazines until
+ * they exit.
  * \public \memberof mlt_pool_s
  */
 
 MLTPP_DECLSPEC void mlt_pool_purge( )
 {
 	int i = 0;
+	pool_thread *thread = atomic_load( &magazines_enabled ) ? pthread_getspecific( magazines_key ) : NULL;
+
+	// Give back what this thread keeps
+	if ( thread != NULL )
+		magazines_flush( thread->magazines );
 
 	// For each pool
-	for ( i = 0; i < mlt_properties_count( pools ); i ++ )
-	{
-		// Get the pool
-		mlt_pool self = mlt_properties_get_data_at( pools, i, NULL );
+	for ( i = 0; i < POOL_COUNT; i ++ )
+		pool_trim( pools[ i ], -1 );
+	pthread_mutex_lock( &slabs_mutex );
+	for ( i = 0; i < atomic_load( &slab_count ); i ++ )
+		pool_trim( atomic_load( &slabs[ i ] ), -1 );
+	pthread_mutex_unlock( &slabs_mutex );
+}
 
-		// Pointer to unused memory
-		void *release = NULL;
+/** Round a size to that of the class of blocks that holds it.
+ *
+ * \private \memberof mlt_pool_s
+ * \param size the number of bytes
+ * \return the size of the slab, or 0 if the size is too small for one
+ */
+
+static int slab_size( int size )
+{
+	size += sizeof( struct mlt_release_s );
+	if ( size < LARGE_MIN )
+		return 0;
+	return ( size + SLAB_ALIGN - 1 ) / SLAB_ALIGN * SLAB_ALIGN;
+}
+
+/** Add a class of blocks of an exact size.
+ *
+ * Large blocks are otherwise rounded up to a power of two, which may waste
+ * nearly half of each. Call this with the sizes of the images that will be
+ * rendered; an allocation uses the smallest such class that wastes less than
+ * an eighth of it. Sizes below the large block size are ignored.
+ *
+ * The classes are counted, so call \p mlt_pool_remove_size once for each
+ * call to this when the size is no longer rendered.
+ *
+ * \public \memberof mlt_pool_s
+ * \param size the number of bytes
+ * \return true if the size could not be added
+ */
 
-		// Lock the pool
-		pthread_mutex_lock( &self->lock );
+int mlt_pool_add_size( int size )
+{
+	mlt_pool slab = NULL, *prev;
+	int error = 0;
+	int count, i;
+
+	size = slab_size( size );
+	if ( !size )
+		return 0;
+
+	pthread_mutex_lock( &slabs_mutex );
+	count = atomic_load( &slab_count );
+	for ( i = 0; i < count && atomic_load( &slabs[ i ] )->size != size; i ++ );
+	if ( i < count )
+	{
+		atomic_load( &slabs[ i ] )->users ++;
+	}
+	else if ( count < SLAB_MAX )
+	{
+		// Revive a retired slab of this size, or else create one
+		for ( prev = &retired_slabs; *prev != NULL && ( *prev )->size != size; prev = &( *prev )->next );
+		if ( *prev != NULL )
+		{
+			slab = *prev;
+			*prev = slab->next;
+			slab->next = NULL;
+			pthread_mutex_lock( &slab->lock );
+			slab->retired = 0;
+			pthread_mutex_unlock( &slab->lock );
+		}
+		else
+		{
+			slab = pool_init( size, -1 );
+		}
 
-		// We'll free all unused items now
-		while ( ( release = mlt_deque_pop_back( self->stack ) ) != NULL )
+		// Readers scan the slabs without the lock, so publish it last
+		if ( slab != NULL )
 		{
-			mlt_free( ( char * )release - sizeof( struct mlt_release_s ) );
-			self->count--;
+			slab->users = 1;
+			atomic_store( &slabs[ count ], slab );
+			atomic_store( &slab_count, count + 1 );
 		}
+		else
+		{
+			error = 1;
+		}
+	}
+	else
+	{
+		error = 1;
+	}
+	pthread_mutex_unlock( &slabs_mutex );
+
+	return error;
+}
+
+/** Remove a class of blocks added by \p mlt_pool_add_size.
+ *
+ * When the last user of a size removes it, the class is retired: its unused
+ * blocks are freed at once, and blocks still in use are freed as they are
+ * released.
+ *
+ * \public \memberof mlt_pool_s
+ * \param size the number of bytes given to \p mlt_pool_add_size
+ */
+
+void mlt_pool_remove_size( int size )
+{
+	mlt_pool slab = NULL;
+	int count, i;
+
+	size = slab_size( size );
+	if ( !size )
+		return;
+
+	pthread_mutex_lock( &slabs_mutex );
+	count = atomic_load( &slab_count );
+	for ( i = 0; i < count && atomic_load( &slabs[ i ] )->size != size; i ++ );
+	if ( i < count && -- atomic_load( &slabs[ i ] )->users == 0 )
+	{
+		slab = atomic_load( &slabs[ i ] );
+
+		// Readers may miss the last slab for a moment, but never see a hole
+		atomic_store( &slabs[ i ], atomic_load( &slabs[ count - 1 ] ) );
+		atomic_store( &slab_count, count - 1 );
+
+		pthread_mutex_lock( &slab->lock );
+		slab->retired = 1;
+		pthread_mutex_unlock( &slab->lock );
+		pool_trim( slab, -1 );
 
-		// Unlock the pool
-		pthread_mutex_unlock( &self->lock );
+		slab->next = retired_slabs;
+		retired_slabs = slab;
 	}
+	pthread_mutex_unlock( &slabs_mutex );
+}
+
+/** Set the most memory to keep in unused large blocks.
+ *
+ * Large blocks returned beyond the limit are freed at once, and a new limit
+ * frees unused blocks until it is met. This can also be set with the
+ * MLT_POOL_LIMIT environment variable in megabytes.
+ *
+ * \public \memberof mlt_pool_s
+ * \param limit the number of bytes, or 0 for no limit
+ */
+
+void mlt_pool_set_limit( int64_t limit )
+{
+	int i;
+
+	atomic_store( &idle_limit, limit );
+	if ( limit <= 0 )
+		return;
+
+	// Free the largest blocks first
+	pthread_mutex_lock( &slabs_mutex );
+	for ( i = atomic_load( &slab_count ) - 1; i >= 0; i -- )
+		pool_trim( atomic_load( &slabs[ i ] ), limit );
+	pthread_mutex_unlock( &slabs_mutex );
+	for ( i = POOL_COUNT - 1; i >= 0 && pools[ i ]->large; i -- )
+		pool_trim( pools[ i ], limit );
+}
+
+/** Get the most memory to keep in unused large blocks.
+ *
+ * \public \memberof mlt_pool_s
+ * \return the number of bytes, or 0 for no limit
+ */
+
+int64_t mlt_pool_get_limit( )
+{
+	return atomic_load( &idle_limit );
 }
 
 /** Release the allocated memory.
@@ -410,42 +1060,132 @@ MLTPP_DECLSPEC void mlt_pool_release( void *release )
 	pool_return( release );
 }
 
+/** Take an additional reference on an allocated block.
+ *
+ * The block is returned to the pool only after \p mlt_pool_release has been
+ * called once for each reference. Use this to share a buffer between several
+ * owners without copying it. A block that is shared must be treated as
+ * read-only; see \p mlt_pool_references.
+ *
+ * \public \memberof mlt_pool_s
+ * \param ptr an opaque pointer of a block in the pool
+ * \return \p ptr, or NULL if the block can not be shared
+ */
+
+void *mlt_pool_retain( void *ptr )
+{
+	if ( ptr != NULL )
+	{
+		mlt_release that = ( void * )(( char * )ptr - sizeof( struct mlt_release_s ));
+		atomic_fetch_add( &that->references, 1 );
+	}
+	return ptr;
+}
+
+/** Get the number of references held on an allocated block.
+ *
+ * \public \memberof mlt_pool_s
+ * \param ptr an opaque pointer of a block in the pool
+ * \return the number of owners; more than one means the block is shared
+ */
+
+int mlt_pool_references( void *ptr )
+{
+	if ( ptr != NULL )
+	{
+		mlt_release that = ( void * )(( char * )ptr - sizeof( struct mlt_release_s ));
+		return atomic_load( &that->references );
+	}
+	return 0;
+}
+
 /** Close the pool.
+ *
+ * The blocks kept by every thread are returned and freed with the pools. No
+ * other thread may be allocating or releasing blocks meanwhile.
  *
  * \public \memberof mlt_pool_s
  */
 
 MLTPP_DECLSPEC void mlt_pool_close( )
 {
+	pool_thread *thread;
+	int i;
+
 #ifdef _MLT_POOL_CHECKS_
 	mlt_pool_stat( );
 #endif
 
-	// Close the properties
-	mlt_properties_close( pools );
+	// Stop keeping blocks per thread and take back the blocks of every thread
+	if ( atomic_load( &magazines_enabled ) )
+	{
+		pthread_mutex_lock( &threads_mutex );
+		atomic_store( &magazines_enabled, 0 );
+		for ( thread = threads; thread != NULL; thread = thread->next )
+			magazines_flush( thread->magazines );
+		pthread_mutex_unlock( &threads_mutex );
+
+		// Other threads release their empty magazines when they exit
+		thread = pthread_getspecific( magazines_key );
+		if ( thread != NULL )
+		{
+			pthread_setspecific( magazines_key, NULL );
+			magazines_close( thread );
+		}
+	}
+
+	// Close the pools
+	for ( i = 0; i < POOL_COUNT; i ++ )
+	{
+		pool_close( pools[ i ] );
+		pools[ i ] = NULL;
+	}
+	for ( i = 0; i < atomic_load( &slab_count ); i ++ )
+	{
+		pool_close( atomic_load( &slabs[ i ] ) );
+		atomic_store( &slabs[ i ], NULL );
+	}
+	atomic_store( &slab_count, 0 );
+	while ( retired_slabs != NULL )
+	{
+		mlt_pool slab = retired_slabs;
+		retired_slabs = slab->next;
+		pool_close( slab );
+	}
 }
 
 void mlt_pool_stat( )
 {
 	// Stats dump
 	uint64_t allocated = 0, used = 0, s;
-	int i = 0, c = mlt_properties_count( pools );
+	int i = 0, j;
+	int slab_total = atomic_load( &slab_count );
 
-	mlt_log( NULL, MLT_LOG_VERBOSE, "%s: count %d\n", __FUNCTION__, c);
+	mlt_log( NULL, MLT_LOG_VERBOSE, "%s: count %d slabs %d\n", __FUNCTION__, POOL_COUNT, slab_total );
 
-	for ( i = 0; i < c; i ++ )
+	for ( i = 0; i < POOL_COUNT + slab_total; i ++ )
 	{
-		mlt_pool pool = mlt_properties_get_data_at( pools, i, NULL );
-		if ( pool->count )
-			mlt_log_verbose( NULL, "%s: size %d allocated %d returned %d %c\n", __FUNCTION__,
-				pool->size, pool->count, mlt_deque_count( pool->stack ),
-				pool->count !=  mlt_deque_count( pool->stack ) ? '*' : ' ' );
-		s = pool->size; s *= pool->count; allocated += s;
-		s = pool->count - mlt_deque_count( pool->stack ); s *= pool->size; used += s;
+		mlt_pool pool = i < POOL_COUNT ? pools[ i ] : atomic_load( &slabs[ i - POOL_COUNT ] );
+		int count, returned = 0, cached;
+
+		pthread_mutex_lock( &pool->lock );
+		count = pool->count;
+		for ( j = 0; j < ( pool->large ? POOL_NODES : 1 ); j ++ )
+			returned += mlt_deque_count( pool->large ? pool->nodes[ j ] : pool->stack );
+		pthread_mutex_unlock( &pool->lock );
+		cached = atomic_load( &pool->cached );
+
+		if ( count )
+			mlt_log_verbose( NULL, "%s: size %d allocated %d returned %d cached %d hits %" PRId64 " misses %" PRId64 " %c\n",
+				__FUNCTION__, pool->size, count, returned, cached,
+				(int64_t) atomic_load( &pool->hits ), (int64_t) atomic_load( &pool->misses ),
+				count != returned + cached ? '*' : ' ' );
+		s = pool->size; s *= count; allocated += s;
+		s = count - returned - cached; s *= pool->size; used += s;
 	}
 
-	mlt_log_verbose( NULL, "%s: allocated %"PRIu64" bytes, used %"PRIu64" bytes \n",
-		__FUNCTION__, allocated, used );
+	mlt_log_verbose( NULL, "%s: allocated %"PRIu64" bytes, used %"PRIu64" bytes, idle large %"PRId64" bytes \n",
+		__FUNCTION__, allocated, used, (int64_t) atomic_load( &idle_bytes ) );
 }
 
 #endif // NO_MLT_POOL
@@ -24,6 +24,13 @@
 #define MLT_POOL_H
 
 #include <mlt++/MltConfig.h>
+#include <stdint.h>
+
+/**
+ * \envvar \em MLT_POOL_HUGEPAGES Set to 1 to ask for transparent huge pages
+ * for large blocks, or 2 to map them from the reserved huge pages first.
+ * \envvar \em MLT_POOL_LIMIT The most megabytes to keep in unused large blocks.
+ */
 
 #ifndef WIN_PTHREADS_TIME_H
 #if defined(__cplusplus)
@@ -41,6 +48,12 @@ extern MLTPP_DECLSPEC void mlt_pool_release( void *release );
 extern void mlt_pool_init( );
 
 extern void *mlt_pool_realloc( void *ptr, int size );
+extern void *mlt_pool_retain( void *ptr );
+extern int mlt_pool_references( void *ptr );
+extern int mlt_pool_add_size( int size );
+extern void mlt_pool_remove_size( int size );
+extern void mlt_pool_set_limit( int64_t limit );
+extern int64_t mlt_pool_get_limit( );
 
 
 extern void mlt_pool_stat( );
@@ -0,0 +1,777 @@
+/**
+ * \file mlt_profiler.c
+ * \brief per-service render timing instrumentation
+ *
+ * Copyright (C) 2022 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "mlt_profiler.h"
+#include "mlt_service.h"
+#include "mlt_frame.h"
+#include "mlt_properties.h"
+#include "mlt_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/* The profiler keeps one entry per service instance in a registry keyed by the
+ * service pointer. Each thread keeps a stack of open spans so that the time a
+ * service spends waiting on the services it pulls from can be subtracted from
+ * its own ("self") time.
+ *
+ * The get_image and get_audio stacks only hold function pointers, so the
+ * service that pushed a callback is recorded on the frame at push time (the
+ * service whose span is open on the pushing thread) and looked up again when
+ * mlt_frame_get_image or mlt_frame_get_audio pops it.
+ */
+
+#define REGISTRY_SIZE 256     /**< the number of registry hash buckets */
+#define SAMPLE_COUNT 1024     /**< the self times kept per service and phase for percentiles */
+#define MAX_DEPTH 64          /**< the deepest span nesting tracked per thread */
+#define OWNERS_KEY "_profiler.owners"
+
+typedef struct
+{
+	int64_t calls;
+	int64_t wall;
+	int64_t cpu;
+	int64_t self_wall;
+	int64_t self_cpu;
+	int64_t max;
+	int64_t *samples;
+	int sample_count;
+	int sample_index;
+}
+profiler_stats;
+
+typedef struct profiler_entry_s
+{
+	struct profiler_entry_s *next;  /**< the next entry in the same bucket */
+	struct profiler_entry_s *all;   /**< the next entry in creation order */
+	mlt_service service;            /**< NULL once the service has been closed */
+	char *name;
+	pthread_mutex_t mutex;
+	profiler_stats stats[ mlt_profiler_phase_count ];
+}
+profiler_entry;
+
+struct mlt_profiler_span_s
+{
+	profiler_entry *entry;
+	profiler_entry *previous;
+	mlt_profiler_phase phase;
+	int64_t wall;
+	int64_t cpu;
+	int64_t child_wall;
+	int64_t child_cpu;
+};
+
+typedef struct
+{
+	int tid;
+	int depth;
+	profiler_entry *current;
+	struct mlt_profiler_span_s spans[ MAX_DEPTH ];
+}
+profiler_thread;
+
+typedef struct
+{
+	void *callback;
+	profiler_entry *entry;
+}
+profiler_owner;
+
+typedef struct
+{
+	int count;
+	int size;
+	profiler_owner *items;
+}
+profiler_owners;
+
+static const char *phase_names[ mlt_profiler_phase_count ] = { "get_frame", "get_image", "get_audio" };
+
+static atomic_int enabled;
+static atomic_int entry_count;
+static atomic_int thread_count;
+static int users = 0;
+static pthread_mutex_t state_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static profiler_entry *registry[ REGISTRY_SIZE ];
+static profiler_entry *first_entry = NULL;
+static profiler_entry *last_entry = NULL;
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace = NULL;
+static atomic_int tracing;
+static int64_t trace_origin = 0;
+static int trace_events = 0;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+
+#ifdef _WIN32
+
+static inline int64_t wall_now()
+{
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if ( !frequency.QuadPart )
+		QueryPerformanceFrequency( &frequency );
+	QueryPerformanceCounter( &counter );
+	return (int64_t) ( counter.QuadPart / frequency.QuadPart * 1000000000LL
+		+ counter.QuadPart % frequency.QuadPart * 1000000000LL / frequency.QuadPart );
+}
+
+static inline int64_t cpu_now()
+{
+	FILETIME creation, exit, kernel, user;
+
+	if ( !GetThreadTimes( GetCurrentThread(), &creation, &exit, &kernel, &user ) )
+		return 0;
+	// FILETIME counts 100 ns intervals
+	return (int64_t) ( ( (uint64_t) kernel.dwHighDateTime << 32 | kernel.dwLowDateTime )
+		+ ( (uint64_t) user.dwHighDateTime << 32 | user.dwLowDateTime ) ) * 100;
+}
+
+#else
+
+static int64_t clock_ns( clockid_t id )
+{
+	struct timespec ts;
+	if ( clock_gettime( id, &ts ) )
+		return 0;
+	return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline int64_t wall_now()
+{
+	return clock_ns( CLOCK_MONOTONIC );
+}
+
+static inline int64_t cpu_now()
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	return clock_ns( CLOCK_THREAD_CPUTIME_ID );
+#else
+	return 0;
+#endif
+}
+
+#endif
+
+static void create_key()
+{
+	pthread_key_create( &thread_key, free );
+}
+
+static profiler_thread *get_thread()
+{
+	pthread_once( &key_once, create_key );
+	profiler_thread *thread = pthread_getspecific( thread_key );
+	if ( !thread )
+	{
+		thread = calloc( 1, sizeof( *thread ) );
+		if ( thread )
+		{
+			thread->tid = atomic_fetch_add( &thread_count, 1 ) + 1;
+			pthread_setspecific( thread_key, thread );
+		}
+	}
+	return thread;
+}
+
+static inline unsigned int bucket_of( mlt_service service )
+{
+	uintptr_t p = (uintptr_t) service;
+	return ( p >> 4 ^ p >> 12 ) % REGISTRY_SIZE;
+}
+
+static const char *type_name( mlt_service service )
+{
+	switch ( mlt_service_identify( service ) )
+	{
+	case mlt_service_producer_type: return "producer";
+	case mlt_service_tractor_type: return "tractor";
+	case mlt_service_playlist_type: return "playlist";
+	case mlt_service_multitrack_type: return "multitrack";
+	case mlt_service_filter_type: return "filter";
+	case mlt_service_transition_type: return "transition";
+	case mlt_service_consumer_type: return "consumer";
+	case mlt_service_field_type: return "field";
+	case mlt_service_link_type: return "link";
+	case mlt_service_chain_type: return "chain";
+	default: return "service";
+	}
+}
+
+/** Build a readable and JSON safe name such as "filter:brightness#12".
+ */
+
+static char *entry_name( mlt_service service, int index )
+{
+	mlt_properties properties = MLT_SERVICE_PROPERTIES( service );
+	const char *name = mlt_properties_get( properties, "mlt_service" );
+	const char *id = mlt_properties_get( properties, "id" );
+	char buffer[ 256 ];
+	char *p;
+
+	if ( !name )
+		name = mlt_properties_get( properties, "resource" );
+	if ( id )
+		snprintf( buffer, sizeof( buffer ), "%s:%s(%s)", type_name( service ), name ? name : "unknown", id );
+	else
+		snprintf( buffer, sizeof( buffer ), "%s:%s#%d", type_name( service ), name ? name : "unknown", index );
+	for ( p = buffer; *p; p++ )
+		if ( *p == '"' || *p == '\\' || (unsigned char) *p < ' ' )
+			*p = '_';
+	return strdup( buffer );
+}
+
+static profiler_entry *get_entry( mlt_service service )
+{
+	unsigned int bucket = bucket_of( service );
+	profiler_entry *entry;
+
+	pthread_mutex_lock( &registry_mutex );
+	for ( entry = registry[ bucket ]; entry; entry = entry->next )
+		if ( entry->service == service )
+			break;
+	if ( !entry )
+	{
+		entry = calloc( 1, sizeof( *entry ) );
+		if ( entry )
+		{
+			entry->service = service;
+			entry->name = entry_name( service, atomic_fetch_add( &entry_count, 1 ) );
+			pthread_mutex_init( &entry->mutex, NULL );
+			entry->next = registry[ bucket ];
+			registry[ bucket ] = entry;
+			if ( last_entry )
+				last_entry->all = entry;
+			else
+				first_entry = entry;
+			last_entry = entry;
+		}
+	}
+	pthread_mutex_unlock( &registry_mutex );
+	return entry;
+}
+
+static mlt_profiler_span open_span( profiler_entry *entry, mlt_profiler_phase phase )
+{
+	profiler_thread *thread = get_thread();
+	mlt_profiler_span span;
+
+	if ( !thread || !entry || thread->depth >= MAX_DEPTH )
+		return NULL;
+	span = &thread->spans[ thread->depth ++ ];
+	span->entry = entry;
+	span->previous = thread->current;
+	span->phase = phase;
+	span->child_wall = 0;
+	span->child_cpu = 0;
+	thread->current = entry;
+	span->cpu = cpu_now();
+	span->wall = wall_now();
+	return span;
+}
+
+static void record( profiler_entry *entry, mlt_profiler_phase phase, int64_t wall, int64_t cpu, int64_t self_wall, int64_t self_cpu )
+{
+	profiler_stats *stats = &entry->stats[ phase ];
+
+	pthread_mutex_lock( &entry->mutex );
+	stats->calls ++;
+	stats->wall += wall;
+	stats->cpu += cpu;
+	stats->self_wall += self_wall;
+	stats->self_cpu += self_cpu;
+	if ( self_wall > stats->max )
+		stats->max = self_wall;
+	if ( !stats->samples )
+		stats->samples = malloc( SAMPLE_COUNT * sizeof( int64_t ) );
+	if ( stats->samples )
+	{
+		stats->samples[ stats->sample_index ] = self_wall;
+		stats->sample_index = ( stats->sample_index + 1 ) % SAMPLE_COUNT;
+		if ( stats->sample_count < SAMPLE_COUNT )
+			stats->sample_count ++;
+	}
+	pthread_mutex_unlock( &entry->mutex );
+}
+
+static void write_event( profiler_thread *thread, mlt_profiler_span span, int64_t end, int64_t cpu, mlt_frame frame )
+{
+	pthread_mutex_lock( &trace_mutex );
+	if ( trace )
+	{
+		fprintf( trace, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+			"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"position\":%d,\"cpu\":%.3f}}",
+			trace_events ++ ? ",\n" : "", span->entry->name, phase_names[ span->phase ], thread->tid,
+			( span->wall - trace_origin ) / 1000.0, ( end - span->wall ) / 1000.0,
+			frame ? (int) mlt_frame_get_position( frame ) : -1, cpu / 1000.0 );
+	}
+	pthread_mutex_unlock( &trace_mutex );
+}
+
+static void owners_close( profiler_owners *owners )
+{
+	free( owners->items );
+	free( owners );
+}
+
+static void disable()
+{
+	atomic_store( &enabled, 0 );
+	pthread_mutex_lock( &trace_mutex );
+	atomic_store( &tracing, 0 );
+	if ( trace )
+	{
+		fputs( "\n]\n", trace );
+		fclose( trace );
+		trace = NULL;
+	}
+	pthread_mutex_unlock( &trace_mutex );
+}
+
+/** Start profiling.
+ *
+ * Calls nest: profiling continues until mlt_profiler_stop has been called
+ * as many times as this.
+ * \public
+ * \param trace_file the name of a Chrome trace (JSON) file to write, or NULL;
+ * this is ignored if a trace is already being written
+ * \return true if the trace file could not be opened
+ */
+
+int mlt_profiler_start( const char *trace_file )
+{
+	int error = 0;
+
+	pthread_mutex_lock( &state_mutex );
+	if ( trace_file && *trace_file )
+	{
+		pthread_mutex_lock( &trace_mutex );
+		if ( !trace )
+		{
+			trace = fopen( trace_file, "w" );
+			if ( trace )
+			{
+				fputs( "[\n", trace );
+				trace_origin = wall_now();
+				trace_events = 0;
+				atomic_store( &tracing, 1 );
+			}
+			else
+			{
+				mlt_log_error( NULL, "[profiler] failed to open trace file %s\n", trace_file );
+				error = 1;
+			}
+		}
+		pthread_mutex_unlock( &trace_mutex );
+	}
+	users ++;
+	atomic_store( &enabled, 1 );
+	pthread_mutex_unlock( &state_mutex );
+	return error;
+}
+
+/** Stop profiling.
+ *
+ * The collected statistics are kept until mlt_profiler_reset. The trace file
+ * is closed when the last user stops.
+ * \public
+ */
+
+void mlt_profiler_stop( void )
+{
+	pthread_mutex_lock( &state_mutex );
+	if ( users > 0 && --users == 0 )
+		disable();
+	pthread_mutex_unlock( &state_mutex );
+}
+
+/** Determine if the profiler is collecting.
+ *
+ * \public
+ * \return true if profiling
+ */
+
+int mlt_profiler_is_enabled( void )
+{
+	return atomic_load_explicit( &enabled, memory_order_relaxed );
+}
+
+/** Clear the statistics of every service.
+ *
+ * \public
+ */
+
+void mlt_profiler_reset( void )
+{
+	profiler_entry *entry;
+	int i;
+
+	pthread_mutex_lock( &registry_mutex );
+	for ( entry = first_entry; entry; entry = entry->all )
+	{
+		pthread_mutex_lock( &entry->mutex );
+		for ( i = 0; i < mlt_profiler_phase_count; i++ )
+		{
+			int64_t *samples = entry->stats[ i ].samples;
+			memset( &entry->stats[ i ], 0, sizeof( profiler_stats ) );
+			entry->stats[ i ].samples = samples;
+		}
+		pthread_mutex_unlock( &entry->mutex );
+	}
+	pthread_mutex_unlock( &registry_mutex );
+}
+
+typedef struct
+{
+	profiler_entry *entry;
+	int64_t self_wall;
+}
+report_item;
+
+static int compare_items( const void *a, const void *b )
+{
+	int64_t x = ( (const report_item*) a )->self_wall;
+	int64_t y = ( (const report_item*) b )->self_wall;
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int compare_samples( const void *a, const void *b )
+{
+	int64_t x = *(const int64_t*) a;
+	int64_t y = *(const int64_t*) b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile( int64_t *sorted, int count, int pct )
+{
+	return count ? sorted[ ( count - 1 ) * pct / 100 ] / 1000000.0 : 0.0;
+}
+
+/** Publish the statistics as properties.
+ *
+ * Services are ordered by their total self time, slowest first. All times
+ * are in milliseconds. "self" times exclude the time spent in the services
+ * that a service pulls frames, images or audio from; the percentiles are of
+ * the self wall time of the most recent calls.
+ *
+ *   profiler.count                    the number of services reported
+ *   profiler.N.name                   type:mlt_service(id) or type:mlt_service#instance
+ *   profiler.N.self                   the total self wall time over all phases
+ *   profiler.N.PHASE.calls            PHASE is get_frame, get_image or get_audio
+ *   profiler.N.PHASE.wall, .cpu       the inclusive totals
+ *   profiler.N.PHASE.self_wall, .self_cpu
+ *   profiler.N.PHASE.p50, .p90, .p99, .max
+ *
+ * \public
+ * \param properties the properties to update, typically a consumer's
+ */
+
+void mlt_profiler_report( mlt_properties properties )
+{
+	report_item *items = NULL;
+	int64_t *sorted = malloc( SAMPLE_COUNT * sizeof( int64_t ) );
+	profiler_entry *entry;
+	char key[ 64 ];
+	int count = 0, size = 0;
+	int i, j;
+
+	if ( !properties || !sorted )
+	{
+		free( sorted );
+		return;
+	}
+
+	pthread_mutex_lock( &registry_mutex );
+	for ( entry = first_entry; entry; entry = entry->all )
+	{
+		report_item item = { entry, 0 };
+		int64_t calls = 0;
+
+		pthread_mutex_lock( &entry->mutex );
+		for ( i = 0; i < mlt_profiler_phase_count; i++ )
+		{
+			calls += entry->stats[ i ].calls;
+			item.self_wall += entry->stats[ i ].self_wall;
+		}
+		pthread_mutex_unlock( &entry->mutex );
+		if ( !calls )
+			continue;
+		if ( count == size )
+		{
+			report_item *grown = realloc( items, ( size + 64 ) * sizeof( report_item ) );
+			if ( !grown )
+				break;
+			items = grown;
+			size += 64;
+		}
+		items[ count ++ ] = item;
+	}
+	pthread_mutex_unlock( &registry_mutex );
+
+	qsort( items, count, sizeof( report_item ), compare_items );
+
+	mlt_properties_set_int( properties, "profiler.count", count );
+	for ( i = 0; i < count; i++ )
+	{
+		entry = items[ i ].entry;
+		snprintf( key, sizeof( key ), "profiler.%d.name", i );
+		mlt_properties_set( properties, key, entry->name );
+		snprintf( key, sizeof( key ), "profiler.%d.self", i );
+		mlt_properties_set_double( properties, key, items[ i ].self_wall / 1000000.0 );
+
+		for ( j = 0; j < mlt_profiler_phase_count; j++ )
+		{
+			profiler_stats stats;
+			const char *phase = phase_names[ j ];
+
+			pthread_mutex_lock( &entry->mutex );
+			stats = entry->stats[ j ];
+			if ( stats.sample_count )
+				memcpy( sorted, stats.samples, stats.sample_count * sizeof( int64_t ) );
+			pthread_mutex_unlock( &entry->mutex );
+			if ( !stats.calls )
+				continue;
+			qsort( sorted, stats.sample_count, sizeof( int64_t ), compare_samples );
+
+#define SET_MS( field, value ) \
+			snprintf( key, sizeof( key ), "profiler.%d.%s." field, i, phase ); \
+			mlt_properties_set_double( properties, key, (value) / 1000000.0 )
+
+			snprintf( key, sizeof( key ), "profiler.%d.%s.calls", i, phase );
+			mlt_properties_set_int64( properties, key, stats.calls );
+			SET_MS( "wall", stats.wall );
+			SET_MS( "cpu", stats.cpu );
+			SET_MS( "self_wall", stats.self_wall );
+			SET_MS( "self_cpu", stats.self_cpu );
+			SET_MS( "max", stats.max );
+#undef SET_MS
+			snprintf( key, sizeof( key ), "profiler.%d.%s.p50", i, phase );
+			mlt_properties_set_double( properties, key, percentile( sorted, stats.sample_count, 50 ) );
+			snprintf( key, sizeof( key ), "profiler.%d.%s.p90", i, phase );
+			mlt_properties_set_double( properties, key, percentile( sorted, stats.sample_count, 90 ) );
+			snprintf( key, sizeof( key ), "profiler.%d.%s.p99", i, phase );
+			mlt_properties_set_double( properties, key, percentile( sorted, stats.sample_count, 99 ) );
+		}
+	}
+	free( items );
+	free( sorted );
+}
+
+/** Begin measuring some work done by a service on the calling thread.
+ *
+ * \public
+ * \param service the service doing the work
+ * \param phase the kind of work
+ * \return a span to pass to mlt_profiler_leave, or NULL if not profiling
+ */
+
+mlt_profiler_span mlt_profiler_enter( mlt_service service, mlt_profiler_phase phase )
+{
+	if ( !mlt_profiler_is_enabled() || !service )
+		return NULL;
+	return open_span( get_entry( service ), phase );
+}
+
+/** Begin measuring a get_image or get_audio callback popped from a frame.
+ *
+ * The work is attributed to the service that pushed the callback.
+ * \public
+ * \param frame the frame the callback was popped from
+ * \param callback the callback
+ * \param phase the kind of work
+ * \return a span to pass to mlt_profiler_leave, or NULL if not profiling
+ * or the service that pushed the callback is not known
+ */
+
+mlt_profiler_span mlt_profiler_enter_callback( mlt_frame frame, void *callback, mlt_profiler_phase phase )
+{
+	profiler_owners *owners;
+	profiler_entry *entry = NULL;
+	int i;
+
+	if ( !mlt_profiler_is_enabled() || !frame || !callback )
+		return NULL;
+	owners = mlt_properties_get_data( MLT_FRAME_PROPERTIES( frame ), OWNERS_KEY, NULL );
+	if ( !owners )
+		return NULL;
+
+	// The stacks are last in first out, so the newest matching push is the one popped
+	for ( i = owners->count - 1; i >= 0; i-- )
+	{
+		if ( owners->items[ i ].callback == callback )
+		{
+			entry = owners->items[ i ].entry;
+			owners->items[ i ].callback = NULL;
+			break;
+		}
+	}
+	while ( owners->count > 0 && !owners->items[ owners->count - 1 ].callback )
+		owners->count --;
+
+	return open_span( entry, phase );
+}
+
+/** Finish a measurement.
+ *
+ * \public
+ * \param span a span returned by mlt_profiler_enter or mlt_profiler_enter_callback, may be NULL
+ * \param frame the frame the work was done on, used to label the trace (optional)
+ */
+
+void mlt_profiler_leave( mlt_profiler_span span, mlt_frame frame )
+{
+	profiler_thread *thread;
+	int64_t wall, cpu;
+
+	if ( !span )
+		return;
+	wall = wall_now() - span->wall;
+	cpu = cpu_now() - span->cpu;
+
+	thread = get_thread();
+	thread->depth = span - thread->spans;
+	thread->current = span->previous;
+	if ( thread->depth > 0 )
+	{
+		thread->spans[ thread->depth - 1 ].child_wall += wall;
+		thread->spans[ thread->depth - 1 ].child_cpu += cpu;
+	}
+
+	record( span->entry, span->phase, wall, cpu, wall - span->child_wall, cpu - span->child_cpu );
+	// write_event checks the trace file again under its lock
+	if ( atomic_load_explicit( &tracing, memory_order_relaxed ) )
+		write_event( thread, span, span->wall + wall, cpu, frame );
+}
+
+/** Remember which service pushed a get_image or get_audio callback.
+ *
+ * This is called by the frame stack functions and does nothing unless
+ * profiling.
+ * \public
+ * \param frame the frame
+ * \param callback the callback or other data pushed onto one of the frame's stacks
+ */
+
+void mlt_profiler_push_callback( mlt_frame frame, void *callback )
+{
+	profiler_thread *thread;
+	profiler_owners *owners;
+
+	if ( !mlt_profiler_is_enabled() || !frame || !callback )
+		return;
+	thread = get_thread();
+	if ( !thread || !thread->current )
+		return;
+
+	owners = mlt_properties_get_data( MLT_FRAME_PROPERTIES( frame ), OWNERS_KEY, NULL );
+	if ( !owners )
+	{
+		owners = calloc( 1, sizeof( *owners ) );
+		if ( !owners )
+			return;
+		mlt_properties_set_data( MLT_FRAME_PROPERTIES( frame ), OWNERS_KEY, owners, 0, (mlt_destructor) owners_close, NULL );
+	}
+	if ( owners->count == owners->size )
+	{
+		profiler_owner *grown = realloc( owners->items, ( owners->size + 16 ) * sizeof( profiler_owner ) );
+		if ( !grown )
+			return;
+		owners->items = grown;
+		owners->size += 16;
+	}
+	owners->items[ owners->count ].callback = callback;
+	owners->items[ owners->count ++ ].entry = thread->current;
+}
+
+/** Detach a service that is being closed from its statistics.
+ *
+ * The statistics remain in the report.
+ * \public
+ * \param service the service
+ */
+
+void mlt_profiler_forget( mlt_service service )
+{
+	unsigned int bucket;
+	profiler_entry **p;
+
+	if ( !atomic_load( &entry_count ) || !service )
+		return;
+	bucket = bucket_of( service );
+	pthread_mutex_lock( &registry_mutex );
+	for ( p = &registry[ bucket ]; *p; p = &( *p )->next )
+	{
+		if ( ( *p )->service == service )
+		{
+			( *p )->service = NULL;
+			*p = ( *p )->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock( &registry_mutex );
+}
+
+/** Release the statistics of every service and close the trace file.
+ *
+ * This is called by mlt_factory_close; nothing may be profiling.
+ * \public
+ */
+
+void mlt_profiler_close( void )
+{
+	profiler_entry *entry, *next;
+	int i;
+
+	pthread_mutex_lock( &state_mutex );
+	users = 0;
+	disable();
+	pthread_mutex_unlock( &state_mutex );
+
+	pthread_mutex_lock( &registry_mutex );
+	for ( entry = first_entry; entry; entry = next )
+	{
+		next = entry->all;
+		for ( i = 0; i < mlt_profiler_phase_count; i++ )
+			free( entry->stats[ i ].samples );
+		pthread_mutex_destroy( &entry->mutex );
+		free( entry->name );
+		free( entry );
+	}
+	memset( registry, 0, sizeof( registry ) );
+	first_entry = last_entry = NULL;
+	atomic_store( &entry_count, 0 );
+	pthread_mutex_unlock( &registry_mutex );
+}
@@ -0,0 +1,63 @@
+/**
+ * \file mlt_profiler.h
+ * \brief per-service render timing instrumentation
+ *
+ * Copyright (C) 2022 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef MLT_PROFILER_H
+#define MLT_PROFILER_H
+
+#include "mlt_types.h"
+
+/**
+ * \envvar \em MLT_PROFILER Set to 1 to profile every consumer that is started,
+ * as if its "profiler" property were set.
+ * \envvar \em MLT_PROFILER_TRACE The name of a Chrome trace (JSON) file to
+ * write when profiling, used when the consumer does not set "profiler.trace".
+ */
+
+/** \brief The kinds of work that the profiler measures for each service.
+ */
+
+typedef enum
+{
+	mlt_profiler_get_frame = 0, /**< mlt_service_get_frame, filter and transition process */
+	mlt_profiler_get_image,     /**< a get_image callback popped by mlt_frame_get_image */
+	mlt_profiler_get_audio,     /**< a get_audio callback popped by mlt_frame_get_audio */
+	mlt_profiler_phase_count
+}
+mlt_profiler_phase;
+
+/** An open measurement, returned by mlt_profiler_enter(). */
+
+typedef struct mlt_profiler_span_s *mlt_profiler_span;
+
+extern int mlt_profiler_start( const char *trace_file );
+extern void mlt_profiler_stop( void );
+extern int mlt_profiler_is_enabled( void );
+extern void mlt_profiler_reset( void );
+extern void mlt_profiler_report( mlt_properties properties );
+
+extern mlt_profiler_span mlt_profiler_enter( mlt_service service, mlt_profiler_phase phase );
+extern mlt_profiler_span mlt_profiler_enter_callback( mlt_frame frame, void *callback, mlt_profiler_phase phase );
+extern void mlt_profiler_leave( mlt_profiler_span span, mlt_frame frame );
+extern void mlt_profiler_push_callback( mlt_frame frame, void *callback );
+extern void mlt_profiler_forget( mlt_service service );
+extern void mlt_profiler_close( void );
+
+#endif
@@ -41,6 +41,7 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <sys/stat.h>
@@ -50,15 +51,65 @@
 
 #define MAX_LOAD_LINE_SIZE 4096
 
-/** \brief private implementation of the property list */
+/** the minimum number of slots in a hash table */
+#define MIN_TABLE_SIZE 16
+
+/** the initial number of entries in a property list */
+#define MIN_LIST_SIZE 32
+
+/** the number of buckets for interned keys */
+#define KEY_BUCKETS 256
+
+/** \brief Interned property name
+ *
+ * \see mlt_properties_key
+ */
+
+struct mlt_key_s
+{
+	char *name;               /**< the property name */
+	unsigned int hash;        /**< the precomputed hash of \p name */
+	struct mlt_key_s *next;   /**< the next key in the same bucket */
+};
+
+static pthread_mutex_t keys_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct mlt_key_s *keys[ KEY_BUCKETS ];
+static pthread_once_t profile_key_once = PTHREAD_ONCE_INIT;
+static mlt_key profile_key = NULL;
+
+/** \brief Open addressing hash table of a property list
+ *
+ * Each slot holds the index of a property + 1 or 0 when empty.
+ */
 
 typedef struct
 {
-	int hash[ 199 ];
-	char **name;
-	mlt_property *value;
+	int size;             /**< the number of slots, a power of two */
+	atomic_int slot[];    /**< the slots */
+}
+property_table;
+
+/** \brief private implementation of the property list
+ *
+ * Lookups by name do not take the mutex. Writers hold the mutex and never
+ * modify anything a concurrent reader may be looking at: the arrays and the
+ * table are replaced by new copies when they grow or a property is renamed,
+ * and the old copies are retired until the list is closed. The only element
+ * written in place is the key cache, which is atomic.
+ */
+
+typedef struct
+{
+	_Atomic( char ** ) name;
+	_Atomic( mlt_property * ) value;
+	_Atomic( unsigned int * ) hash;    /**< the hash of each name */
+	_Atomic( _Atomic( mlt_key ) * ) key; /**< the interned key last used to find each name */
+	_Atomic( property_table * ) table;
 	int count;
 	int size;
+	void **retired;       /**< memory replaced while readers may still use it */
+	int retired_count;
+	int retired_size;
 	mlt_properties mirror;
 	int ref_count;
 	pthread_mutex_t mutex;
@@ -339,12 +390,243 @@ int mlt_properties_preset( mlt_properties self, const char *name )
  * \return an integer
  */
 
-static inline int generate_hash( const char *name )
+static inline unsigned int generate_hash( const char *name )
 {
 	unsigned int hash = 5381;
 	while ( *name )
 		hash = hash * 33 + (unsigned int) ( *name ++ );
-	return hash % 199;
+	return hash;
+}
+
+/** Compute the first slot of a hash in a hash table.
+ *
+ * \private \memberof mlt_properties_s
+ * \param table a hash table
+ * \param hash a hash
+ * \return the index of the slot
+ */
+
+static inline int table_slot( property_table *table, unsigned int hash )
+{
+	return ( hash * 2654435761u ) & ( table->size - 1 );
+}
+
+/** Keep memory that concurrent readers may still be using until the list is closed.
+ *
+ * The list must be locked.
+ *
+ * \private \memberof mlt_properties_s
+ * \param list a property list
+ * \param ptr the memory to free later
+ */
+
+static void list_retire( property_list *list, void *ptr )
+{
+	if ( !ptr )
+		return;
+	if ( list->retired_count == list->retired_size )
+	{
+		list->retired_size = list->retired_size ? list->retired_size * 2 : 8;
+		list->retired = realloc( list->retired, list->retired_size * sizeof( void * ) );
+	}
+	list->retired[ list->retired_count ++ ] = ptr;
+}
+
+/** Replace an array with a larger copy.
+ *
+ * \private \memberof mlt_properties_s
+ * \param list a property list
+ * \param array the array
+ * \param element the size of an element
+ * \param count the number of elements in use
+ * \param size the new number of elements
+ * \return the new array
+ */
+
+static void *list_grow( property_list *list, void *array, size_t element, int count, int size )
+{
+	void *result = calloc( size, element );
+	if ( count )
+		memcpy( result, array, count * element );
+	list_retire( list, array );
+	return result;
+}
+
+/** Add a property index to a hash table.
+ *
+ * A later property with the same name replaces the former in the table.
+ * The new slot is published after the property has been assigned, so this may
+ * be used on a table concurrent readers are using.
+ *
+ * \private \memberof mlt_properties_s
+ * \param list a property list
+ * \param table the hash table
+ * \param index the index of the property
+ */
+
+static void table_insert( property_list *list, property_table *table, int index )
+{
+	int mask = table->size - 1;
+	int i = table_slot( table, list->hash[ index ] );
+	int j;
+
+	while ( ( j = atomic_load_explicit( &table->slot[ i ], memory_order_relaxed ) - 1 ) >= 0 )
+	{
+		if ( list->hash[ j ] == list->hash[ index ] && !strcmp( list->name[ j ], list->name[ index ] ) )
+			break;
+		i = ( i + 1 ) & mask;
+	}
+	atomic_store_explicit( &table->slot[ i ], index + 1, memory_order_release );
+}
+
+/** Build a new hash table and publish it.
+ *
+ * The table is kept at most half full.
+ * The list must be locked.
+ *
+ * \private \memberof mlt_properties_s
+ * \param list a property list
+ */
+
+static void table_rebuild( property_list *list )
+{
+	property_table *table;
+	int size = MIN_TABLE_SIZE;
+	int i;
+
+	while ( size < list->count * 2 )
+		size *= 2;
+	table = calloc( 1, sizeof( property_table ) + size * sizeof( atomic_int ) );
+	table->size = size;
+	for ( i = 0; i < list->count; i ++ )
+		table_insert( list, table, i );
+	list_retire( list, list->table );
+	atomic_store_explicit( &list->table, table, memory_order_release );
+}
+
+/** Remember the interned key that found a property.
+ *
+ * This is only a shortcut for later lookups, so it is skipped when the list
+ * is busy rather than waiting for it. The name is checked again under the lock
+ * because the property may have been renamed since it was compared.
+ *
+ * \private \memberof mlt_properties_s
+ * \param list a property list
+ * \param index the index of the property
+ * \param key the interned key that matched its name
+ */
+
+static void table_remember_key( property_list *list, int index, mlt_key key )
+{
+	if ( pthread_mutex_trylock( &list->mutex ) == 0 )
+	{
+		if ( index < list->count && list->hash[ index ] == key->hash && !strcmp( list->name[ index ], key->name ) )
+			atomic_store_explicit( &list->key[ index ], key, memory_order_relaxed );
+		pthread_mutex_unlock( &list->mutex );
+	}
+}
+
+/** Locate the index of a property.
+ *
+ * This does not need the list to be locked.
+ * The table and its slots are loaded before the arrays they index, and any
+ * array published before a slot refers to it holds the entry.
+ *
+ * \private \memberof mlt_properties_s
+ * \param list a property list
+ * \param name the property name
+ * \param hash the hash of \p name
+ * \param key the interned key for \p name (optional)
+ * \param[out] value the property if found
+ * \return the index or -1 if not found
+ */
+
+static inline int table_find( property_list *list, const char *name, unsigned int hash, mlt_key key, mlt_property *value )
+{
+	property_table *table = atomic_load_explicit( &list->table, memory_order_acquire );
+	if ( table )
+	{
+		int mask = table->size - 1;
+		int i = table_slot( table, hash );
+		int j;
+
+		while ( ( j = atomic_load_explicit( &table->slot[ i ], memory_order_acquire ) - 1 ) >= 0 )
+		{
+			if ( key && atomic_load_explicit( &atomic_load_explicit( &list->key, memory_order_acquire )[ j ], memory_order_relaxed ) == key )
+			{
+				*value = atomic_load_explicit( &list->value, memory_order_acquire )[ j ];
+				return j;
+			}
+			if ( atomic_load_explicit( &list->hash, memory_order_acquire )[ j ] == hash
+				&& !strcmp( atomic_load_explicit( &list->name, memory_order_acquire )[ j ], name ) )
+			{
+				if ( key )
+					table_remember_key( list, j, key );
+				*value = atomic_load_explicit( &list->value, memory_order_acquire )[ j ];
+				return j;
+			}
+			i = ( i + 1 ) & mask;
+		}
+	}
+	*value = NULL;
+	return -1;
+}
+
+/** Get the interned key for a property name.
+ *
+ * A key is created once per distinct name and lives until the process exits.
+ * Lookups with a key skip hashing the name and, once the key has been used
+ * with a properties list, comparing it.
+ * This is meant for property names used over and over on hot paths, typically
+ * by storing the key in a static variable.
+ *
+ * \public \memberof mlt_properties_s
+ * \param name the property name
+ * \return the key or NULL on error
+ */
+
+mlt_key mlt_properties_key( const char *name )
+{
+	if ( !name ) return NULL;
+	unsigned int hash = generate_hash( name );
+	struct mlt_key_s *key;
+
+	pthread_mutex_lock( &keys_mutex );
+	for ( key = keys[ hash % KEY_BUCKETS ]; key; key = key->next )
+		if ( key->hash == hash && !strcmp( key->name, name ) )
+			break;
+	if ( !key )
+	{
+		key = calloc( 1, sizeof( struct mlt_key_s ) );
+		if ( key )
+		{
+			key->name = strdup( name );
+			key->hash = hash;
+			key->next = keys[ hash % KEY_BUCKETS ];
+			keys[ hash % KEY_BUCKETS ] = key;
+		}
+	}
+	pthread_mutex_unlock( &keys_mutex );
+
+	return key;
+}
+
+/** Get the profile of a properties list.
+ *
+ * \private \memberof mlt_properties_s
+ * \param self a properties list
+ * \return the profile or NULL
+ */
+
+static void init_profile_key( )
+{
+	profile_key = mlt_properties_key( "_profile" );
+}
+
+static inline mlt_profile get_profile( mlt_properties self )
+{
+	pthread_once( &profile_key_once, init_profile_key );
+	return mlt_properties_get_data_k( self, profile_key, NULL );
 }
 
 /** Copy a serializable property to a properties list that is mirroring this one.
@@ -561,27 +843,24 @@ int mlt_properties_pass( mlt_properties self, mlt_properties that, const char *p
 static inline mlt_property mlt_properties_find( mlt_properties self, const char *name )
 {
 	if ( !self || !name ) return NULL;
-	property_list *list = self->local;
-	mlt_property value = NULL;
-	int key = generate_hash( name );
-
-	mlt_properties_lock( self );
-
-	int i = list->hash[ key ] - 1;
-	if ( i >= 0 )
-	{
-		// Check if we're hashed
-		if ( list->count > 0 && list->name[ i ] &&
-		 	!strcmp( list->name[ i ], name ) )
-			value = list->value[ i ];
+	mlt_property value;
+	table_find( self->local, name, generate_hash( name ), NULL, &value );
+	return value;
+}
 
-		// Locate the item
-		for ( i = list->count - 1; value == NULL && i >= 0; i -- )
-			if ( list->name[ i ] && !strcmp( list->name[ i ], name ) )
-				value = list->value[ i ];
-	}
-	mlt_properties_unlock( self );
+/** Locate a property by interned key.
+ *
+ * \private \memberof mlt_properties_s
+ * \param self a properties list
+ * \param key the interned name of the property
+ * \return the property or NULL for failure
+ */
 
+static inline mlt_property mlt_properties_find_k( mlt_properties self, mlt_key key )
+{
+	if ( !self || !key ) return NULL;
+	mlt_property value;
+	table_find( self->local, key->name, key->hash, key, &value );
 	return value;
 }
 
@@ -590,35 +869,46 @@ static inline mlt_property mlt_properties_find( mlt_properties self, const char
  * \private \memberof mlt_properties_s
  * \param self a properties list
  * \param name the name of the new property
+ * \param key the interned key for \p name (optional)
  * \return the new property
  */
 
-static mlt_property mlt_properties_add( mlt_properties self, const char *name )
+static mlt_property mlt_properties_add( mlt_properties self, const char *name, mlt_key key )
 {
 	property_list *list = self->local;
-	int key = generate_hash( name );
+	unsigned int hash = key ? key->hash : generate_hash( name );
 	mlt_property result;
 
 	mlt_properties_lock( self );
 
-	// Check that we have space and resize if necessary
+	// Check that we have space and resize if necessary, leaving the old arrays to readers
 	if ( list->count == list->size )
 	{
-		list->size += 50;
-		list->name = realloc( list->name, list->size * sizeof( const char * ) );
-		list->value = realloc( list->value, list->size * sizeof( mlt_property ) );
+		int size = list->size ? list->size * 2 : MIN_LIST_SIZE;
+		char **name = list_grow( list, list->name, sizeof( char * ), list->count, size );
+		mlt_property *value = list_grow( list, list->value, sizeof( mlt_property ), list->count, size );
+		unsigned int *hash = list_grow( list, list->hash, sizeof( unsigned int ), list->count, size );
+		_Atomic( mlt_key ) *key = list_grow( list, list->key, sizeof( *key ), list->count, size );
+		atomic_store_explicit( &list->name, name, memory_order_release );
+		atomic_store_explicit( &list->value, value, memory_order_release );
+		atomic_store_explicit( &list->hash, hash, memory_order_release );
+		atomic_store_explicit( &list->key, key, memory_order_release );
+		list->size = size;
 	}
 
 	// Assign name/value pair
+	result = mlt_property_init( );
 	list->name[ list->count ] = strdup( name );
-	list->value[ list->count ] = mlt_property_init( );
-
-	// Assign to hash table
-	if ( list->hash[ key ] == 0 )
-		list->hash[ key ] = list->count + 1;
-
-	// Return and increment count accordingly
-	result = list->value[ list->count ++ ];
+	list->value[ list->count ] = result;
+	list->hash[ list->count ] = hash;
+	atomic_store_explicit( &list->key[ list->count ], key, memory_order_relaxed );
+
+	// Increment count and assign to hash table, which publishes the entry
+	list->count ++;
+	if ( !list->table || list->count * 2 > list->table->size )
+		table_rebuild( list );
+	else
+		table_insert( list, list->table, list->count - 1 );
 
 	mlt_properties_unlock( self );
 
@@ -640,15 +930,33 @@ static mlt_property mlt_properties_fetch( mlt_properties self, const char *name
 
 	// If it wasn't found, create one
 	if ( property == NULL )
-		property = mlt_properties_add( self, name );
+		property = mlt_properties_add( self, name, NULL );
 
 	// Return the property
 	return property;
 }
 
+/** Fetch a property by interned key and add one if not found.
+ *
+ * \private \memberof mlt_properties_s
+ * \param self a properties list
+ * \param key the interned name of the property to lookup or add
+ * \return the property
+ */
+
+static mlt_property mlt_properties_fetch_k( mlt_properties self, mlt_key key )
+{
+	mlt_property property = mlt_properties_find_k( self, key );
+
+	if ( property == NULL )
+		property = mlt_properties_add( self, key->name, key );
+
+	return property;
+}
+
 static void fire_property_changed(mlt_properties self, const char *name)
 {
-	mlt_events_fire(self, "property-changed", mlt_event_data_from_string(name));
+	mlt_events_fire_property_changed( self, name );
 }
 
 /** Copy a property to another properties list.
@@ -1072,7 +1380,7 @@ MLTPP_DECLSPEC int mlt_properties_get_int( mlt_properties self, const char *name
 	mlt_property value = mlt_properties_find( self, name );
 	if ( value )
 	{
-		mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+		mlt_profile profile = get_profile( self );
 		double fps = mlt_profile_fps( profile );
 		property_list *list = self->local;
 		result = mlt_property_get_int( value, fps, list->locale );
@@ -1110,6 +1418,60 @@ MLTPP_DECLSPEC int mlt_properties_set_int( mlt_properties self, const char *name
 	return error;
 }
 
+/** Get an integer associated to an interned name.
+ *
+ * \public \memberof mlt_properties_s
+ * \param self a properties list
+ * \param key the interned name of the property to get
+ * \return The integer value, 0 if not found (which may also be a legitimate value)
+ * \see mlt_properties_key
+ */
+
+int mlt_properties_get_int_k( mlt_properties self, mlt_key key )
+{
+	int result = 0;
+	mlt_property value = mlt_properties_find_k( self, key );
+	if ( value )
+	{
+		mlt_profile profile = get_profile( self );
+		double fps = mlt_profile_fps( profile );
+		property_list *list = self->local;
+		result = mlt_property_get_int( value, fps, list->locale );
+	}
+	return result;
+}
+
+/** Set a property with an interned name to an integer value.
+ *
+ * \public \memberof mlt_properties_s
+ * \param self a properties list
+ * \param key the interned name of the property to set
+ * \param value the integer
+ * \return true if error
+ * \see mlt_properties_key
+ */
+
+int mlt_properties_set_int_k( mlt_properties self, mlt_key key, int value )
+{
+	int error = 1;
+
+	if ( !self || !key ) return error;
+
+	// Fetch the property to work with
+	mlt_property property = mlt_properties_fetch_k( self, key );
+
+	// Set it if not NULL
+	if ( property != NULL )
+	{
+		error = mlt_property_set_int( property, value );
+		mlt_properties_do_mirror( self, key->name );
+	}
+
+	fire_property_changed(self, key->name);
+
+	return error;
+}
+
 /** Get a 64-bit integer associated to the name.
  *
  * \public \memberof mlt_properties_s
@@ -1168,7 +1530,7 @@ MLTPP_DECLSPEC double mlt_properties_get_double( mlt_properties self, const char
 	mlt_property value = mlt_properties_find( self, name );
 	if ( value )
 	{
-		mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+		mlt_profile profile = get_profile( self );
 		double fps = mlt_profile_fps( profile );
 		property_list *list = self->local;
 		result = mlt_property_get_double( value, fps, list->locale );
@@ -1220,7 +1582,7 @@ mlt_position mlt_properties_get_position( mlt_properties self, const char *name
 	mlt_property value = mlt_properties_find( self, name );
 	if ( value )
 	{
-		mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+		mlt_profile profile = get_profile( self );
 		double fps = mlt_profile_fps( profile );
 		property_list *list = self->local;
 		result = mlt_property_get_position( value, fps, list->locale );
@@ -1274,6 +1636,37 @@ MLTPP_DECLSPEC void *mlt_properties_get_data( mlt_properties self, const char *n
 	return value == NULL ? NULL : mlt_property_get_data( value, length );
 }
 
+/** Get a binary data value associated to an interned name.
+ *
+ * \public \memberof mlt_properties_s
+ * \param self a properties list
+ * \param key the interned name of the property to get
+ * \param[out] length The size of the binary data in bytes, if available (often it is not, you should know)
+ * \see mlt_properties_key
+ */
+
+void *mlt_properties_get_data_k( mlt_properties self, mlt_key key, int *length )
+{
+	mlt_property value = mlt_properties_find_k( self, key );
+	return value == NULL ? NULL : mlt_property_get_data( value, length );
+}
+
+/** Get the destructor that was supplied with a binary data value.
+ *
+ * This lets a caller tell who owns the data, for example whether it came
+ * from \p mlt_pool_alloc and can be shared with \p mlt_pool_retain.
+ * \public \memberof mlt_properties_s
+ * \param self a properties list
+ * \param name the property to get
+ * \return the destructor or NULL if there is none
+ */
+
+mlt_destructor mlt_properties_get_destructor( mlt_properties self, const char *name )
+{
+	mlt_property value = mlt_properties_find( self, name );
+	return value == NULL ? NULL : mlt_property_get_destructor( value );
+}
+
 /** Store binary data as a property.
  *
  * \public \memberof mlt_properties_s
@@ -1328,9 +1721,16 @@ int mlt_properties_rename( mlt_properties self, const char *source, const char *
 		{
 			if ( list->name[ i ] && !strcmp( list->name[ i ], source ) )
 			{
-				free( list->name[ i ] );
-				list->name[ i ] = strdup( dest );
-				list->hash[ generate_hash( dest ) ] = i + 1;
+				// Readers may still be comparing the old name, so replace the arrays
+				char **name = list_grow( list, list->name, sizeof( char * ), list->count, list->size );
+				unsigned int *hash = list_grow( list, list->hash, sizeof( unsigned int ), list->count, list->size );
+				list_retire( list, name[ i ] );
+				name[ i ] = strdup( dest );
+				hash[ i ] = generate_hash( dest );
+				atomic_store_explicit( &list->key[ i ], NULL, memory_order_relaxed );
+				atomic_store_explicit( &list->name, name, memory_order_release );
+				atomic_store_explicit( &list->hash, hash, memory_order_release );
+				table_rebuild( list );
 				break;
 			}
 		}
@@ -1569,6 +1969,12 @@ MLTPP_DECLSPEC void mlt_properties_close( mlt_properties self )
 			pthread_mutex_destroy( &list->mutex );
 			free( list->name );
 			free( list->value );
+			free( list->hash );
+			free( list->key );
+			free( list->table );
+			for ( index = 0; index < list->retired_count; index ++ )
+				free( list->retired[ index ] );
+			free( list->retired );
 			free( list );
 
 			// Free self now if self has no child
@@ -2334,7 +2740,7 @@ int mlt_properties_exists( mlt_properties self, const char *name )
 
 char *mlt_properties_get_time( mlt_properties self, const char* name, mlt_time_format format )
 {
-	mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+	mlt_profile profile = get_profile( self );
 	if ( profile )
 	{
 		double fps = mlt_profile_fps( profile );
@@ -2390,49 +2796,12 @@ mlt_position mlt_properties_time_to_frames( mlt_properties self, const char *tim
 
 mlt_color mlt_properties_get_color( mlt_properties self, const char* name )
 {
-	mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+	mlt_profile profile = get_profile( self );
 	double fps = mlt_profile_fps( profile );
 	property_list *list = self->local;
 	mlt_property value = mlt_properties_find( self, name );
 	mlt_color result = { 0xff, 0xff, 0xff, 0xff };
-	if ( value )
-	{
-		const char *color = mlt_property_get_string_l( value, list->locale );
-		unsigned int color_int = mlt_property_get_int( value, fps, list->locale );
-
-		if ( !strcmp( color, "red" ) )
-		{
-			result.r = 0xff;
-			result.g = 0x00;
-			result.b = 0x00;
-		}
-		else if ( !strcmp( color, "green" ) )
-		{
-			result.r = 0x00;
-			result.g = 0xff;
-			result.b = 0x00;
-		}
-		else if ( !strcmp( color, "blue" ) )
-		{
-			result.r = 0x00;
-			result.g = 0x00;
-			result.b = 0xff;
-		}
-		else if ( !strcmp( color, "black" ) )
-		{
-			result.r = 0x00;
-			result.g = 0x00;
-			result.b = 0x00;
-		}
-		else if ( strcmp( color, "white" ) )
-		{
-			result.r = ( color_int >> 24 ) & 0xff;
-			result.g = ( color_int >> 16 ) & 0xff;
-			result.b = ( color_int >> 8 ) & 0xff;
-			result.a = ( color_int ) & 0xff;
-		}
-	}
-	return result;
+	return value == NULL ? result : mlt_property_get_color( value, fps, list->locale );
 }
 
 /** Set a property to an integer value by color.
@@ -2487,7 +2856,7 @@ int mlt_properties_set_color( mlt_properties self, const char *name, mlt_color c
 
 char* mlt_properties_anim_get( mlt_properties self, const char *name, int position, int length )
 {
-	mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+	mlt_profile profile = get_profile( self );
 	double fps = mlt_profile_fps( profile );
 	mlt_property value = mlt_properties_find( self, name );
 	property_list *list = self->local;
@@ -2521,7 +2890,7 @@ int mlt_properties_anim_set( mlt_properties self, const char *name, const char *
 	// Set it if not NULL
 	if ( property )
 	{
-		mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+		mlt_profile profile = get_profile( self );
 		double fps = mlt_profile_fps( profile );
 		property_list *list = self->local;
 		error = mlt_property_anim_set_string( property, value,
@@ -2547,7 +2916,7 @@ int mlt_properties_anim_set( mlt_properties self, const char *name, const char *
 
 int mlt_properties_anim_get_int( mlt_properties self, const char *name, int position, int length )
 {
-	mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+	mlt_profile profile = get_profile( self );
 	double fps = mlt_profile_fps( profile );
 	property_list *list = self->local;
 	mlt_property value = mlt_properties_find( self, name );
@@ -2580,7 +2949,7 @@ int mlt_properties_anim_set_int( mlt_properties self, const char *name, int valu
 	// Set it if not NULL
 	if ( property != NULL )
 	{
-		mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+		mlt_profile profile = get_profile( self );
 		double fps = mlt_profile_fps( profile );
 		property_list *list = self->local;
 		error = mlt_property_anim_set_int( property, value, fps, list->locale, position, length, keyframe_type );
@@ -2605,7 +2974,7 @@ int mlt_properties_anim_set_int( mlt_properties self, const char *name, int valu
 
 double mlt_properties_anim_get_double( mlt_properties self, const char *name, int position, int length )
 {
-	mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+	mlt_profile profile = get_profile( self );
 	double fps = mlt_profile_fps( profile );
 	property_list *list = self->local;
 	mlt_property value = mlt_properties_find( self, name );
@@ -2638,7 +3007,7 @@ int mlt_properties_anim_set_double( mlt_properties self, const char *name, doubl
 	// Set it if not NULL
 	if ( property != NULL )
 	{
-		mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+		mlt_profile profile = get_profile( self );
 		double fps = mlt_profile_fps( profile );
 		property_list *list = self->local;
 		error = mlt_property_anim_set_double( property, value, fps, list->locale, position, length, keyframe_type );
@@ -2736,7 +3105,7 @@ extern int mlt_properties_anim_set_rect( mlt_properties self, const char *name,
 	// Set it if not NULL
 	if ( property != NULL )
 	{
-		mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+		mlt_profile profile = get_profile( self );
 		double fps = mlt_profile_fps( profile );
 		property_list *list = self->local;
 		error = mlt_property_anim_set_rect( property, value, fps, list->locale, position, length, keyframe_type );
@@ -2761,7 +3130,7 @@ extern int mlt_properties_anim_set_rect( mlt_properties self, const char *name,
 
 extern mlt_rect mlt_properties_anim_get_rect( mlt_properties self, const char *name, int position, int length )
 {
-	mlt_profile profile = mlt_properties_get_data( self, "_profile", NULL );
+	mlt_profile profile = get_profile( self );
 	double fps = mlt_profile_fps( profile );
 	property_list *list = self->local;
 	mlt_property value = mlt_properties_find( self, name );
@@ -2769,6 +3138,28 @@ extern mlt_rect mlt_properties_anim_get_rect( mlt_properties self, const char *n
 	return value == NULL ? rect : mlt_property_anim_get_rect( value, fps, list->locale, position, length );
 }
 
+/** Get a color associated to the name at a frame position.
+ *
+ * \public \memberof mlt_properties_s
+ * \param self a properties list
+ * \param name the property to get
+ * \param position the frame number
+ * \param length the maximum number of frames when interpreting negative keyframe times,
+ *  <=0 if you don't care or need that
+ * \return the color, opaque white if not found
+ * \see mlt_properties_get_color
+ */
+
+mlt_color mlt_properties_anim_get_color( mlt_properties self, const char *name, int position, int length )
+{
+	mlt_profile profile = get_profile( self );
+	double fps = mlt_profile_fps( profile );
+	property_list *list = self->local;
+	mlt_property value = mlt_properties_find( self, name );
+	mlt_color result = { 0xff, 0xff, 0xff, 0xff };
+	return value == NULL ? result : mlt_property_anim_get_color( value, fps, list->locale, position, length );
+}
+
 #ifndef _WIN32
 
 // See win32/win32.c for win32 implementation.
@@ -70,6 +70,12 @@ extern MLTPP_DECLSPEC char *mlt_properties_serialise_yaml( mlt_properties self )
 
 extern int mlt_properties_init( mlt_properties, void *child );
 
+extern mlt_key mlt_properties_key( const char *name );
+extern int mlt_properties_get_int_k( mlt_properties self, mlt_key key );
+extern int mlt_properties_set_int_k( mlt_properties self, mlt_key key, int value );
+extern void *mlt_properties_get_data_k( mlt_properties self, mlt_key key, int *length );
+extern mlt_destructor mlt_properties_get_destructor( mlt_properties self, const char *name );
+
 extern int mlt_properties_set_lcnumeric( mlt_properties, const char *locale );
 extern const char* mlt_properties_get_lcnumeric( mlt_properties self );
 extern mlt_properties mlt_properties_load( const char *file );
@@ -133,6 +139,7 @@ extern int mlt_properties_set_rect( mlt_properties self, const char *name, mlt_r
 extern mlt_rect mlt_properties_get_rect( mlt_properties self, const char *name );
 extern int mlt_properties_anim_set_rect( mlt_properties self, const char *name, mlt_rect value, int position, int length, mlt_keyframe_type keyframe_type );
 extern mlt_rect mlt_properties_anim_get_rect( mlt_properties self, const char *name, int position, int length );
+extern mlt_color mlt_properties_anim_get_color( mlt_properties self, const char *name, int position, int length );
 
 extern int mlt_properties_from_utf8( mlt_properties properties, const char *name_from, const char *name_to );
 extern int mlt_properties_to_utf8( mlt_properties properties, const char *name_from, const char *name_to );
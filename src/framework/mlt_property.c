@@ -34,10 +34,14 @@
 #include <string.h>
 #include <locale.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <float.h>
 #include <math.h>
 
 
+/** the number of attempts at reading a property without locking it */
+#define READ_RETRIES 4
+
 /** Bit pattern used internally to indicated representations available.
 */
 
@@ -58,6 +62,10 @@ mlt_property_type;
  *
  * A property is like a variant or dynamic type. They are used for many things
  * in MLT, but in particular they are the parameter mechanism for the plugins.
+ *
+ * Numeric values and data pointers are read without taking the mutex. Every
+ * locked section makes the sequence number odd for its duration, and readers
+ * retry (or fall back to locking) when it changed while they were reading.
  */
 
 struct mlt_property_s
@@ -81,10 +89,29 @@ struct mlt_property_s
 	mlt_serialiser serialiser;
 
 	pthread_mutex_t mutex;
+	int lock_depth;
+	atomic_uint seq;
 	mlt_animation animation;
 	mlt_properties properties;
 };
 
+/** \brief The values of a property read without locking */
+
+typedef struct
+{
+	mlt_property_type types;
+	int prop_int;
+	mlt_position prop_position;
+	double prop_double;
+	int64_t prop_int64;
+	void *data;
+	int length;
+}
+property_snapshot;
+
+/** The types that can be converted from a snapshot */
+#define SNAPSHOT_TYPES ( mlt_prop_int | mlt_prop_position | mlt_prop_double | mlt_prop_int64 )
+
 /** Construct a property and initialize it
  * \public \memberof mlt_property_s
  */
@@ -101,6 +128,65 @@ mlt_property mlt_property_init( )
 	return self;
 }
 
+/** Lock a property for reading or writing.
+ *
+ * \private \memberof mlt_property_s
+ * \param self a property
+ */
+
+static inline void property_lock( mlt_property self )
+{
+	pthread_mutex_lock( &self->mutex );
+	if ( self->lock_depth ++ == 0 )
+	{
+		atomic_fetch_add_explicit( &self->seq, 1, memory_order_relaxed );
+		atomic_thread_fence( memory_order_release );
+	}
+}
+
+/** Unlock a property.
+ *
+ * \private \memberof mlt_property_s
+ * \param self a property
+ */
+
+static inline void property_unlock( mlt_property self )
+{
+	if ( -- self->lock_depth == 0 )
+		atomic_fetch_add_explicit( &self->seq, 1, memory_order_release );
+	pthread_mutex_unlock( &self->mutex );
+}
+
+/** Read the values of a property without locking it.
+ *
+ * \private \memberof mlt_property_s
+ * \param self a property
+ * \param[out] snapshot the values
+ * \return true if the values are consistent, false if the property is busy
+ */
+
+static inline int property_read( mlt_property self, property_snapshot *snapshot )
+{
+	int i;
+	for ( i = 0; i < READ_RETRIES; i ++ )
+	{
+		unsigned int seq = atomic_load_explicit( &self->seq, memory_order_acquire );
+		if ( seq & 1 )
+			continue;
+		snapshot->types = self->types;
+		snapshot->prop_int = self->prop_int;
+		snapshot->prop_position = self->prop_position;
+		snapshot->prop_double = self->prop_double;
+		snapshot->prop_int64 = self->prop_int64;
+		snapshot->data = self->data;
+		snapshot->length = self->length;
+		atomic_thread_fence( memory_order_acquire );
+		if ( atomic_load_explicit( &self->seq, memory_order_relaxed ) == seq )
+			return 1;
+	}
+	return 0;
+}
+
 /** Clear (0/null) a property.
  *
  * Frees up any associated resources in the process.
@@ -146,9 +232,9 @@ static void clear_property( mlt_property self )
 
 void mlt_property_clear( mlt_property self )
 {
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	clear_property( self );
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 }
 
 /** Check if a property is cleared.
@@ -163,9 +249,9 @@ int mlt_property_is_clear( mlt_property self )
 	int result = 1;
 	if ( self )
 	{
-		pthread_mutex_lock( &self->mutex );
+		property_lock( self );
 		result = self->types == 0 && self->animation == NULL && self->properties == NULL;
-		pthread_mutex_unlock( &self->mutex );
+		property_unlock( self );
 	}
 	return result;
 }
@@ -180,11 +266,11 @@ int mlt_property_is_clear( mlt_property self )
 
 int mlt_property_set_int( mlt_property self, int value )
 {
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	clear_property( self );
 	self->types = mlt_prop_int;
 	self->prop_int = value;
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	return 0;
 }
 
@@ -198,11 +284,11 @@ int mlt_property_set_int( mlt_property self, int value )
 
 int mlt_property_set_double( mlt_property self, double value )
 {
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	clear_property( self );
 	self->types = mlt_prop_double;
 	self->prop_double = value;
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	return 0;
 }
 
@@ -217,11 +303,11 @@ int mlt_property_set_double( mlt_property self, double value )
 
 int mlt_property_set_position( mlt_property self, mlt_position value )
 {
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	clear_property( self );
 	self->types = mlt_prop_position;
 	self->prop_position = value;
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	return 0;
 }
 
@@ -237,7 +323,7 @@ int mlt_property_set_position( mlt_property self, mlt_position value )
 
 int mlt_property_set_string( mlt_property self, const char *value )
 {
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	if ( value != self->prop_string )
 	{
 		clear_property( self );
@@ -249,7 +335,7 @@ int mlt_property_set_string( mlt_property self, const char *value )
 	{
 		self->types = mlt_prop_string;
 	}
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	return self->prop_string == NULL;
 }
 
@@ -263,11 +349,11 @@ int mlt_property_set_string( mlt_property self, const char *value )
 
 int mlt_property_set_int64( mlt_property self, int64_t value )
 {
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	clear_property( self );
 	self->types = mlt_prop_int64;
 	self->prop_int64 = value;
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	return 0;
 }
 
@@ -288,7 +374,7 @@ int mlt_property_set_int64( mlt_property self, int64_t value )
 
 int mlt_property_set_data( mlt_property self, void *value, int length, mlt_destructor destructor, mlt_serialiser serialiser )
 {
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	if ( self->data == value )
 		self->destructor = NULL;
 	clear_property( self );
@@ -297,7 +383,7 @@ int mlt_property_set_data( mlt_property self, void *value, int length, mlt_destr
 	self->length = length;
 	self->destructor = destructor;
 	self->serialiser = serialiser;
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	return 0;
 }
 
@@ -325,7 +411,7 @@ static int time_clock_to_frames( mlt_property self, const char *s, double fps, l
 	if ( locale )
 	{
 		// Protect damaging the global locale from a temporary locale on another thread.
-		pthread_mutex_lock( &self->mutex );
+		property_lock( self );
 
 		// Get the current locale
 		orig_localename = strdup( setlocale( LC_NUMERIC, NULL ) );
@@ -367,7 +453,7 @@ static int time_clock_to_frames( mlt_property self, const char *s, double fps, l
 		// Restore the current locale
 		setlocale( LC_NUMERIC, orig_localename );
 		free( orig_localename );
-		pthread_mutex_unlock( &self->mutex );
+		property_unlock( self );
 	}
 #endif
 
@@ -487,7 +573,20 @@ static int mlt_property_atoi( mlt_property self, double fps, locale_t locale )
 
 int mlt_property_get_int( mlt_property self, double fps, locale_t locale )
 {
-	pthread_mutex_lock( &self->mutex );
+	property_snapshot s;
+	if ( property_read( self, &s ) && ( s.types & SNAPSHOT_TYPES ) )
+	{
+		if ( s.types & mlt_prop_int )
+			return s.prop_int;
+		else if ( s.types & mlt_prop_double )
+			return ( int )s.prop_double;
+		else if ( s.types & mlt_prop_position )
+			return ( int )s.prop_position;
+		else
+			return ( int )s.prop_int64;
+	}
+
+	property_lock( self );
 	int result = 0;
 	if ( self->types & mlt_prop_int )
 		result = self->prop_int;
@@ -506,7 +605,7 @@ int mlt_property_get_int( mlt_property self, double fps, locale_t locale )
 		if ( ( self->types & mlt_prop_string ) && self->prop_string )
 			result = mlt_property_atoi( self, fps, locale );
 	}
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	return result;
 }
 
@@ -547,7 +646,7 @@ static double mlt_property_atof( mlt_property self, double fps, locale_t locale
 		char *orig_localename = NULL;
 		if ( locale ) {
 			// Protect damaging the global locale from a temporary locale on another thread.
-			pthread_mutex_lock( &self->mutex );
+			property_lock( self );
 
 			// Get the current locale
 			orig_localename = strdup( setlocale( LC_NUMERIC, NULL ) );
@@ -566,7 +665,7 @@ static double mlt_property_atof( mlt_property self, double fps, locale_t locale
 			// Restore the current locale
 			setlocale( LC_NUMERIC, orig_localename );
 			free( orig_localename );
-			pthread_mutex_unlock( &self->mutex );
+			property_unlock( self );
 		}
 #endif
 
@@ -585,8 +684,21 @@ static double mlt_property_atof( mlt_property self, double fps, locale_t locale
 
 double mlt_property_get_double( mlt_property self, double fps, locale_t locale )
 {
+	property_snapshot s;
+	if ( property_read( self, &s ) && ( s.types & SNAPSHOT_TYPES ) )
+	{
+		if ( s.types & mlt_prop_double )
+			return s.prop_double;
+		else if ( s.types & mlt_prop_int )
+			return ( double )s.prop_int;
+		else if ( s.types & mlt_prop_position )
+			return ( double )s.prop_position;
+		else
+			return ( double )s.prop_int64;
+	}
+
 	double result = 0.0;
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	if ( self->types & mlt_prop_double )
 		result = self->prop_double;
 	else if ( self->types & mlt_prop_int )
@@ -604,7 +716,7 @@ double mlt_property_get_double( mlt_property self, double fps, locale_t locale )
 		if ( ( self->types & mlt_prop_string ) && self->prop_string )
 			result = mlt_property_atof( self, fps, locale );
 	}
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	return result;
 }
 
@@ -620,8 +732,21 @@ double mlt_property_get_double( mlt_property self, double fps, locale_t locale )
 
 mlt_position mlt_property_get_position( mlt_property self, double fps, locale_t locale )
 {
+	property_snapshot s;
+	if ( property_read( self, &s ) && ( s.types & SNAPSHOT_TYPES ) )
+	{
+		if ( s.types & mlt_prop_position )
+			return s.prop_position;
+		else if ( s.types & mlt_prop_int )
+			return ( mlt_position )s.prop_int;
+		else if ( s.types & mlt_prop_double )
+			return ( mlt_position )s.prop_double;
+		else
+			return ( mlt_position )s.prop_int64;
+	}
+
 	mlt_position result = 0;
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	if ( self->types & mlt_prop_position )
 		result = self->prop_position;
 	else if ( self->types & mlt_prop_int )
@@ -639,7 +764,7 @@ mlt_position mlt_property_get_position( mlt_property self, double fps, locale_t
 		if ( ( self->types & mlt_prop_string ) && self->prop_string )
 			result = ( mlt_position )mlt_property_atoi( self, fps, locale );
 	}
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	return result;
 }
 
@@ -670,8 +795,21 @@ static inline int64_t mlt_property_atoll( const char *value )
 
 int64_t mlt_property_get_int64( mlt_property self )
 {
+	property_snapshot s;
+	if ( property_read( self, &s ) && ( s.types & SNAPSHOT_TYPES ) )
+	{
+		if ( s.types & mlt_prop_int64 )
+			return s.prop_int64;
+		else if ( s.types & mlt_prop_int )
+			return ( int64_t )s.prop_int;
+		else if ( s.types & mlt_prop_double )
+			return ( int64_t )s.prop_double;
+		else
+			return ( int64_t )s.prop_position;
+	}
+
 	int64_t result = 0;
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	if ( self->types & mlt_prop_int64 )
 		result = self->prop_int64;
 	else if ( self->types & mlt_prop_int )
@@ -689,7 +827,7 @@ int64_t mlt_property_get_int64( mlt_property self )
 		if ( ( self->types & mlt_prop_string ) && self->prop_string )
 			result = mlt_property_atoll( self->prop_string );
 	}
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	return result;
 }
 
@@ -708,7 +846,7 @@ int64_t mlt_property_get_int64( mlt_property self )
 char *mlt_property_get_string_tf( mlt_property self, mlt_time_format time_format )
 {
 	// Construct a string if need be
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	if ( self->animation && self->serialiser )
 	{
 		if ( self->prop_string )
@@ -747,7 +885,7 @@ char *mlt_property_get_string_tf( mlt_property self, mlt_time_format time_format
 			self->prop_string = self->serialiser( self->data, self->length );
 		}
 	}
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 
 	// Return the string (may be NULL)
 	return self->prop_string;
@@ -795,7 +933,7 @@ char *mlt_property_get_string_l_tf( mlt_property self, locale_t locale, mlt_time
 		return mlt_property_get_string_tf( self, time_format );
 
 	// Construct a string if need be
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	if ( self->animation && self->serialiser )
 	{
 		if ( self->prop_string )
@@ -856,7 +994,7 @@ char *mlt_property_get_string_l_tf( mlt_property self, locale_t locale, mlt_time
 		free( orig_localename );
 #endif
 	}
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 
 	// Return the string (may be NULL)
 	return self->prop_string;
@@ -895,15 +1033,38 @@ char *mlt_property_get_string_l( mlt_property self, locale_t locale )
 
 void *mlt_property_get_data( mlt_property self, int *length )
 {
+	property_snapshot s;
+	if ( !property_read( self, &s ) )
+	{
+		property_lock( self );
+		s.data = self->data;
+		s.length = self->length;
+		property_unlock( self );
+	}
+
 	// Assign length if not NULL
 	if ( length != NULL )
-		*length = self->length;
+		*length = s.length;
 
 	// Return the data (note: there is no conversion here)
-	pthread_mutex_lock( &self->mutex );
-	void* result = self->data;
-	pthread_mutex_unlock( &self->mutex );	
-	return result;
+	return s.data;
+}
+
+/** Get the destructor function of the binary data in a property.
+ *
+ * \public \memberof mlt_property_s
+ * \param self a property
+ * \return the destructor supplied with the data or NULL
+ */
+
+mlt_destructor mlt_property_get_destructor( mlt_property self )
+{
+	mlt_destructor destructor = NULL;
+	property_lock( self );
+	if ( self->types & mlt_prop_data )
+		destructor = self->destructor;
+	property_unlock( self );
+	return destructor;
 }
 
 /** Destroy a property and free all related resources.
@@ -930,7 +1091,7 @@ void mlt_property_close( mlt_property self )
  */
 void mlt_property_pass( mlt_property self, mlt_property that )
 {
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	clear_property( self );
 
 	self->types = that->types;
@@ -968,7 +1129,7 @@ void mlt_property_pass( mlt_property self, mlt_property that )
 		self->types = mlt_prop_string;
 		self->prop_string = that->serialiser( that->data, that->length );
 	}
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 }
 
 /** Convert frame count to a SMPTE timecode string.
@@ -1117,7 +1278,7 @@ char *mlt_property_get_time( mlt_property self, mlt_time_format format, double f
 #endif // _WIN32
 
 		// Protect damaging the global locale from a temporary locale on another thread.
-		pthread_mutex_lock( &self->mutex );
+		property_lock( self );
 
 		// Get the current locale
 		orig_localename = strdup( setlocale( LC_NUMERIC, NULL ) );
@@ -1129,7 +1290,7 @@ char *mlt_property_get_time( mlt_property self, mlt_time_format format, double f
 #endif // _WIN32
 	{
 		// Make sure we have a lock before accessing self->types
-		pthread_mutex_lock( &self->mutex );
+		property_lock( self );
 	}
 
 	// Convert number to string
@@ -1166,13 +1327,13 @@ char *mlt_property_get_time( mlt_property self, mlt_time_format format, double f
 	{
 		setlocale( LC_NUMERIC, orig_localename );
 		free( orig_localename );
-		pthread_mutex_unlock( &self->mutex );
+		property_unlock( self );
 	}
 	else
 #endif // _WIN32
 	{
 		// Make sure we have a lock before accessing self->types
-		pthread_mutex_unlock( &self->mutex );
+		property_unlock( self );
 	}
 
 	// Return the string (may be NULL)
@@ -1181,13 +1342,13 @@ char *mlt_property_get_time( mlt_property self, mlt_time_format format, double f
 
 /** Determine if the property holds a numeric or numeric string value.
  *
- * \private \memberof mlt_property_s
+ * \public \memberof mlt_property_s
  * \param self a property
  * \param locale the locale to use for string evaluation
  * \return true if it is numeric
  */
 
-static int is_property_numeric( mlt_property self, locale_t locale )
+int mlt_property_is_numeric( mlt_property self, locale_t locale )
 {
 	int result = ( self->types & mlt_prop_int ) ||
 			( self->types & mlt_prop_int64 ) ||
@@ -1208,7 +1369,7 @@ static int is_property_numeric( mlt_property self, locale_t locale )
 		char *orig_localename = NULL;
 		if ( locale ) {
 			// Protect damaging the global locale from a temporary locale on another thread.
-			pthread_mutex_lock( &self->mutex );
+			property_lock( self );
 
 			// Get the current locale
 			orig_localename = strdup( setlocale( LC_NUMERIC, NULL ) );
@@ -1225,7 +1386,7 @@ static int is_property_numeric( mlt_property self, locale_t locale )
 			// Restore the current locale
 			setlocale( LC_NUMERIC, orig_localename );
 			free( orig_localename );
-			pthread_mutex_unlock( &self->mutex );
+			property_unlock( self );
 		}
 #endif
 
@@ -1280,7 +1441,7 @@ int mlt_property_interpolate( mlt_property self, mlt_property p[],
 {
 	int error = 0;
 	if ( interp != mlt_keyframe_discrete &&
-		is_property_numeric( p[1], locale ) && is_property_numeric( p[2], locale ) )
+		mlt_property_is_numeric( p[1], locale ) && mlt_property_is_numeric( p[2], locale ) )
 	{
 		if ( self->types & mlt_prop_rect )
 		{
@@ -1408,22 +1569,16 @@ static void refresh_animation( mlt_property self, double fps, locale_t locale, i
 double mlt_property_anim_get_double( mlt_property self, double fps, locale_t locale, int position, int length )
 {
 	double result;
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	if (mlt_property_is_anim(self))
 	{
-		struct mlt_animation_item_s item;
-		item.property = mlt_property_init();
-
 		refresh_animation( self, fps, locale, length );
-		mlt_animation_get_item( self->animation, &item, position );
-		pthread_mutex_unlock( &self->mutex );
-		result = mlt_property_get_double( item.property, fps, locale );
-
-		mlt_property_close( item.property );
+		result = mlt_animation_get_double( self->animation, position );
+		property_unlock( self );
 	}
 	else
 	{
-		pthread_mutex_unlock( &self->mutex );
+		property_unlock( self );
 		result = mlt_property_get_double( self, fps, locale );
 	}
 	return result;
@@ -1444,22 +1599,16 @@ double mlt_property_anim_get_double( mlt_property self, double fps, locale_t loc
 int mlt_property_anim_get_int( mlt_property self, double fps, locale_t locale, int position, int length )
 {
 	int result;
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	if (mlt_property_is_anim(self))
 	{
-		struct mlt_animation_item_s item;
-		item.property = mlt_property_init();
-
 		refresh_animation( self, fps, locale, length );
-		mlt_animation_get_item( self->animation, &item, position );
-		pthread_mutex_unlock( &self->mutex );
-		result = mlt_property_get_int( item.property, fps, locale );
-
-		mlt_property_close( item.property );
+		result = mlt_animation_get_int( self->animation, position );
+		property_unlock( self );
 	}
 	else
 	{
-		pthread_mutex_unlock( &self->mutex );
+		property_unlock( self );
 		result = mlt_property_get_int( self, fps, locale );
 	}
 	return result;
@@ -1480,7 +1629,7 @@ int mlt_property_anim_get_int( mlt_property self, double fps, locale_t locale, i
 char* mlt_property_anim_get_string( mlt_property self, double fps, locale_t locale, int position, int length )
 {
 	char *result;
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	if (mlt_property_is_anim(self))
 	{
 		struct mlt_animation_item_s item;
@@ -1492,9 +1641,9 @@ char* mlt_property_anim_get_string( mlt_property self, double fps, locale_t loca
 
 		free( self->prop_string );
 
-		pthread_mutex_unlock( &self->mutex );
+		property_unlock( self );
 		self->prop_string = mlt_property_get_string_l( item.property, locale );
-		pthread_mutex_lock( &self->mutex );
+		property_lock( self );
 
 		if ( self->prop_string )
 			self->prop_string = strdup( self->prop_string );
@@ -1502,11 +1651,11 @@ char* mlt_property_anim_get_string( mlt_property self, double fps, locale_t loca
 
 		result = self->prop_string;
 		mlt_property_close( item.property );
-		pthread_mutex_unlock( &self->mutex );
+		property_unlock( self );
 	}
 	else
 	{
-		pthread_mutex_unlock( &self->mutex );
+		property_unlock( self );
 		result = mlt_property_get_string_l( self, locale );
 	}
 	return result;
@@ -1537,11 +1686,11 @@ int mlt_property_anim_set_double( mlt_property self, double value, double fps, l
 	item.keyframe_type = keyframe_type;
 	mlt_property_set_double( item.property, value );
 
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	refresh_animation( self, fps, locale, length );
 	result = mlt_animation_insert( self->animation, &item );
 	mlt_animation_interpolate( self->animation );
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	mlt_property_close( item.property );
 
 	return result;
@@ -1572,11 +1721,11 @@ int mlt_property_anim_set_int( mlt_property self, int value, double fps, locale_
 	item.keyframe_type = keyframe_type;
 	mlt_property_set_int( item.property, value );
 
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	refresh_animation( self, fps, locale, length );
 	result = mlt_animation_insert( self->animation, &item );
 	mlt_animation_interpolate( self->animation );
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	mlt_property_close( item.property );
 
 	return result;
@@ -1608,11 +1757,11 @@ int mlt_property_anim_set_string( mlt_property self, const char *value, double f
 	item.keyframe_type = mlt_keyframe_discrete;
 	mlt_property_set_string( item.property, value );
 
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	refresh_animation( self, fps, locale, length );
 	result = mlt_animation_insert( self->animation, &item );
 	mlt_animation_interpolate( self->animation );
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	mlt_property_close( item.property );
 
 	return result;
@@ -1629,9 +1778,9 @@ int mlt_property_anim_set_string( mlt_property self, const char *value, double f
 
 mlt_animation mlt_property_get_animation( mlt_property self )
 {
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	mlt_animation result = self->animation;
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	return result;
 }
 
@@ -1672,7 +1821,7 @@ static char* serialise_mlt_rect( mlt_rect *rect, int length )
 
 int mlt_property_set_rect( mlt_property self, mlt_rect value )
 {
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	clear_property( self );
 	self->types = mlt_prop_rect | mlt_prop_data;
 	self->length = sizeof(value);
@@ -1680,7 +1829,7 @@ int mlt_property_set_rect( mlt_property self, mlt_rect value )
 	memcpy( self->data, &value, self->length );
 	self->destructor = free;
 	self->serialiser = (mlt_serialiser) serialise_mlt_rect;
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	return 0;
 }
 
@@ -1718,7 +1867,7 @@ mlt_rect mlt_property_get_rect( mlt_property self, locale_t locale )
 		char *orig_localename = NULL;
 		if ( locale ) {
 			// Protect damaging the global locale from a temporary locale on another thread.
-			pthread_mutex_lock( &self->mutex );
+			property_lock( self );
 
 			// Get the current locale
 			orig_localename = strdup( setlocale( LC_NUMERIC, NULL ) );
@@ -1771,7 +1920,7 @@ mlt_rect mlt_property_get_rect( mlt_property self, locale_t locale )
 			// Restore the current locale
 			setlocale( LC_NUMERIC, orig_localename );
 			free( orig_localename );
-			pthread_mutex_unlock( &self->mutex );
+			property_unlock( self );
 		}
 #endif
     }
@@ -1803,11 +1952,11 @@ int mlt_property_anim_set_rect( mlt_property self, mlt_rect value, double fps, l
 	item.keyframe_type = keyframe_type;
 	mlt_property_set_rect( item.property, value );
 
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	refresh_animation( self, fps, locale, length );
 	result = mlt_animation_insert( self->animation, &item );
 	mlt_animation_interpolate( self->animation );
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	mlt_property_close( item.property );
 
 	return result;
@@ -1828,28 +1977,107 @@ int mlt_property_anim_set_rect( mlt_property self, mlt_rect value, double fps, l
 mlt_rect mlt_property_anim_get_rect( mlt_property self, double fps, locale_t locale, int position, int length )
 {
 	mlt_rect result;
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	if (mlt_property_is_anim(self))
 	{
-		struct mlt_animation_item_s item;
-		item.property = mlt_property_init();
-		item.property->types = mlt_prop_rect;
-
 		refresh_animation( self, fps, locale, length );
-		mlt_animation_get_item( self->animation, &item, position );
-		pthread_mutex_unlock( &self->mutex );
-		result = mlt_property_get_rect( item.property, locale );
-
-		mlt_property_close( item.property );
+		result = mlt_animation_get_rect( self->animation, position );
+		property_unlock( self );
 	}
 	else
 	{
-		pthread_mutex_unlock( &self->mutex );
+		property_unlock( self );
 		result = mlt_property_get_rect( self, locale );
 	}
 	return result;
 }
 
+/** Convert the property to a tuple of color components.
+ *
+ * If the property's string is red, green, blue, white, or black, then it
+ * is converted to the corresponding opaque color tuple. Otherwise, the property
+ * is fetched as an integer and then converted.
+ * \public \memberof mlt_property_s
+ * \param self a property
+ * \param fps the frame rate, which may be needed for converting a time string to frame units
+ * \param locale the locale to use when converting from a string
+ * \return a color structure
+ */
+
+mlt_color mlt_property_get_color( mlt_property self, double fps, locale_t locale )
+{
+	mlt_color result = { 0xff, 0xff, 0xff, 0xff };
+	const char *color = mlt_property_get_string_l( self, locale );
+	unsigned int color_int = mlt_property_get_int( self, fps, locale );
+
+	if ( !color )
+		color = "";
+	if ( !strcmp( color, "red" ) )
+	{
+		result.r = 0xff;
+		result.g = 0x00;
+		result.b = 0x00;
+	}
+	else if ( !strcmp( color, "green" ) )
+	{
+		result.r = 0x00;
+		result.g = 0xff;
+		result.b = 0x00;
+	}
+	else if ( !strcmp( color, "blue" ) )
+	{
+		result.r = 0x00;
+		result.g = 0x00;
+		result.b = 0xff;
+	}
+	else if ( !strcmp( color, "black" ) )
+	{
+		result.r = 0x00;
+		result.g = 0x00;
+		result.b = 0x00;
+	}
+	else if ( strcmp( color, "white" ) )
+	{
+		result.r = ( color_int >> 24 ) & 0xff;
+		result.g = ( color_int >> 16 ) & 0xff;
+		result.b = ( color_int >> 8 ) & 0xff;
+		result.a = ( color_int ) & 0xff;
+	}
+	return result;
+}
+
+/** Get the property as a color at a frame position.
+ *
+ * Unlike the other types, colors that are not discrete keyframes are
+ * interpolated component by component.
+ * \public \memberof mlt_property_s
+ * \param self a property
+ * \param fps the frame rate, which may be needed for converting a time string to frame units
+ * \param locale the locale, which may be needed for converting a string to a real number
+ * \param position the frame number
+ * \param length the maximum number of frames when interpreting negative keyframe times,
+ *  <=0 if you don't care or need that
+ * \return a color structure
+ */
+
+mlt_color mlt_property_anim_get_color( mlt_property self, double fps, locale_t locale, int position, int length )
+{
+	mlt_color result;
+	property_lock( self );
+	if (mlt_property_is_anim(self))
+	{
+		refresh_animation( self, fps, locale, length );
+		result = mlt_animation_get_color( self->animation, position );
+		property_unlock( self );
+	}
+	else
+	{
+		property_unlock( self );
+		result = mlt_property_get_color( self, fps, locale );
+	}
+	return result;
+}
+
 /** Set a nested properties object.
  *
  * \public \memberof mlt_property_s
@@ -1860,11 +2088,11 @@ mlt_rect mlt_property_anim_get_rect( mlt_property self, double fps, locale_t loc
 
 int mlt_property_set_properties( mlt_property self, mlt_properties properties )
 {
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	clear_property( self );
 	self->properties = properties;
 	mlt_properties_inc_ref( properties );
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	return 0;
 }
 
@@ -1878,9 +2106,9 @@ int mlt_property_set_properties( mlt_property self, mlt_properties properties )
 mlt_properties mlt_property_get_properties( mlt_property self )
 {
 	mlt_properties properties = NULL;
-	pthread_mutex_lock( &self->mutex );
+	property_lock( self );
 	properties = self->properties;
-	pthread_mutex_unlock( &self->mutex );
+	property_unlock( self );
 	return properties;
 }
 
@@ -59,10 +59,12 @@ extern char *mlt_property_get_string( mlt_property self );
 extern char *mlt_property_get_string_l_tf( mlt_property self, locale_t, mlt_time_format );
 extern char *mlt_property_get_string_l( mlt_property self, locale_t );
 extern void *mlt_property_get_data( mlt_property self, int *length );
+extern mlt_destructor mlt_property_get_destructor( mlt_property self );
 extern void mlt_property_close( mlt_property self );
 extern void mlt_property_pass( mlt_property self, mlt_property that );
 extern char *mlt_property_get_time( mlt_property self, mlt_time_format, double fps, locale_t );
 
+extern int mlt_property_is_numeric( mlt_property self, locale_t locale );
 extern int mlt_property_interpolate( mlt_property self, mlt_property points[], double progress, double fps, locale_t locale, mlt_keyframe_type interp );
 extern double mlt_property_anim_get_double( mlt_property self, double fps, locale_t locale, int position, int length );
 extern int mlt_property_anim_get_int( mlt_property self, double fps, locale_t locale, int position, int length );
@@ -77,6 +79,8 @@ extern int mlt_property_set_rect( mlt_property self, mlt_rect value );
 extern mlt_rect mlt_property_get_rect( mlt_property self, locale_t locale );
 extern int mlt_property_anim_set_rect( mlt_property self, mlt_rect value, double fps, locale_t locale, int position, int length, mlt_keyframe_type keyframe_type );
 extern mlt_rect mlt_property_anim_get_rect( mlt_property self, double fps, locale_t locale, int position, int length );
+extern mlt_color mlt_property_get_color( mlt_property self, double fps, locale_t locale );
+extern mlt_color mlt_property_anim_get_color( mlt_property self, double fps, locale_t locale, int position, int length );
 
 extern int mlt_property_set_properties( mlt_property self, mlt_properties properties );
 extern mlt_properties mlt_property_get_properties( mlt_property self );
@@ -27,6 +27,7 @@
 #include "mlt_factory.h"
 #include "mlt_log.h"
 #include "mlt_producer.h"
+#include "mlt_profiler.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -565,6 +566,7 @@ void mlt_service_apply_filters( mlt_service self, mlt_frame frame, int index )
 int mlt_service_get_frame( mlt_service self, mlt_frame_ptr frame, int index )
 {
 	int result = 0;
+	mlt_profiler_span span = NULL;
 
 	// Lock the service
 	mlt_service_lock( self );
@@ -580,6 +582,7 @@ int mlt_service_get_frame( mlt_service self, mlt_frame_ptr frame, int index )
 		mlt_position out = mlt_properties_get_position( properties, "out" );
 		mlt_position position = mlt_service_identify( self ) == mlt_service_producer_type ? mlt_producer_position( MLT_PRODUCER( self ) ) : -1;
 
+		span = mlt_profiler_enter( self, mlt_profiler_get_frame );
 		result = self->get_frame( self, frame, index );
 
 		if ( result == 0 )
@@ -629,6 +632,8 @@ int mlt_service_get_frame( mlt_service self, mlt_frame_ptr frame, int index )
 	if ( *frame == NULL )
 		*frame = mlt_frame_init( self );
 
+	mlt_profiler_leave( span, *frame );
+
 	// Unlock the service
 	mlt_service_unlock( self );
 
@@ -869,6 +874,7 @@ void mlt_service_close( mlt_service self )
 			mlt_service_base *base = self->local;
 			int i = 0;
 			int count = base->filter_count;
+			mlt_profiler_forget( self );
 			mlt_events_block( MLT_SERVICE_PROPERTIES( self ), self );
 			while( count -- )
 				mlt_service_detach( self, base->filters[ 0 ] );
@@ -33,10 +33,14 @@
 #endif
 #include <pthread.h>
 #include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #ifdef _WIN32
 #include <windows.h>
 #endif
 #define MAX_SLICES 32
+#define MAX_RUNTIMES 32
+#define SPIN_COUNT 64
 #define ENV_SLICES "MLT_SLICES_COUNT"
 
 typedef enum {
@@ -50,89 +54,203 @@ mlt_schedule_policy;
 static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
 static mlt_slices globals[mlt_policy_nb] = {NULL, NULL, NULL};
 
+/* A runtime holds one deque of job indices per worker. Each deque is a
+ * contiguous range [begin, end) packed into a single 64-bit word so that the
+ * owner can pop from the front and thieves can steal from the back with a
+ * single compare-and-swap.
+ */
+#define RANGE_PACK( begin, end ) ( ( (int_fast64_t)( begin ) << 32 ) | (int_fast64_t)(uint32_t)( end ) )
+#define RANGE_BEGIN( range ) ( (int)( (range) >> 32 ) )
+#define RANGE_END( range ) ( (int)( (range) & 0xffffffff ) )
 
 struct mlt_slices_runtime_s
 {
-	int jobs, done, curr;
+	int jobs;
+	atomic_int done;
 	mlt_slices_proc proc;
 	void* cookie;
-	struct mlt_slices_runtime_s* next;
+	atomic_int_fast64_t ranges[MAX_SLICES];
+};
+
+struct mlt_slices_slot_s
+{
+	atomic_intptr_t busy;
+	atomic_intptr_t runtime;
+	atomic_int users;
+};
+
+struct mlt_slices_worker_s
+{
+	mlt_slices ctx;
+	int id;
 };
 
 struct mlt_slices_s
 {
-	int f_exit;
+	atomic_int f_exit;
 	int count;
-	int readys;
 	int ref;
+	atomic_int sleepers;
+	atomic_int wake_seq;
 	pthread_mutex_t cond_mutex;
 	pthread_cond_t cond_var_job;
 	pthread_cond_t cond_var_ready;
 	pthread_t threads[MAX_SLICES];
-	struct mlt_slices_runtime_s *head, *tail;
+	struct mlt_slices_worker_s workers[MAX_SLICES];
+	struct mlt_slices_slot_s slots[MAX_RUNTIMES];
 	const char* name;
 };
 
-static void* mlt_slices_worker( void* p )
+/** Take the next job index of a runtime for a worker.
+ *
+ * The worker first pops from the front of its own deque. When that is empty
+ * it steals the back half of another worker's deque, keeps the first stolen
+ * index and moves the rest into its own deque.
+ *
+ * \private \memberof mlt_slices_s
+ * \param ctx context pointer
+ * \param r the runtime
+ * \param id the worker index
+ * \return the job index or -1 if there is no job left to start
+ */
+
+static int mlt_slices_take( mlt_slices ctx, struct mlt_slices_runtime_s* r, int id )
 {
-	int id, idx;
-	struct mlt_slices_runtime_s* r;
-	mlt_slices ctx = (mlt_slices)p;
+	atomic_int_fast64_t* own = &r->ranges[id];
+	int_fast64_t range = atomic_load( own );
+	int i;
 
-	mlt_log_debug( NULL, "%s:%d: ctx=[%p][%s] entering\n", __FUNCTION__, __LINE__ , ctx, ctx->name );
+	/* pop from own deque */
+	while ( RANGE_BEGIN( range ) < RANGE_END( range ) )
+	{
+		if ( atomic_compare_exchange_weak( own, &range, RANGE_PACK( RANGE_BEGIN( range ) + 1, RANGE_END( range ) ) ) )
+			return RANGE_BEGIN( range );
+	}
 
-	pthread_mutex_lock( &ctx->cond_mutex );
+	/* steal from the others */
+	for ( i = 1; i < ctx->count; i++ )
+	{
+		atomic_int_fast64_t* victim = &r->ranges[( id + i ) % ctx->count];
+		range = atomic_load( victim );
+		while ( RANGE_BEGIN( range ) < RANGE_END( range ) )
+		{
+			int begin = RANGE_BEGIN( range );
+			int end = RANGE_END( range );
+			int middle = end - ( end - begin + 1 ) / 2;
+			if ( atomic_compare_exchange_weak( victim, &range, RANGE_PACK( begin, middle ) ) )
+			{
+				/* own deque is empty, so nobody else modifies it now */
+				if ( middle + 1 < end )
+					atomic_store( own, RANGE_PACK( middle + 1, end ) );
+				return middle;
+			}
+		}
+	}
+
+	return -1;
+}
+
+/** Run jobs of a runtime until none are left to start.
+ *
+ * \private \memberof mlt_slices_s
+ * \param ctx context pointer
+ * \param r the runtime
+ * \param id the worker index
+ * \return the number of jobs run
+ */
 
-	id = ctx->readys;
-	ctx->readys++;
+static int mlt_slices_drain( mlt_slices ctx, struct mlt_slices_runtime_s* r, int id )
+{
+	int idx, n = 0;
 
-	while ( 1 )
+	while ( ( idx = mlt_slices_take( ctx, r, id ) ) >= 0 )
 	{
-		mlt_log_debug( NULL, "%s:%d: ctx=[%p][%s] waiting\n", __FUNCTION__, __LINE__ , ctx, ctx->name );
+		mlt_log_debug( NULL, "%s:%d: running job: id=%d, idx=%d/%d, pool=[%s]\n", __FUNCTION__, __LINE__,
+			id, idx, r->jobs, ctx->name );
+		r->proc( id, idx, r->jobs, r->cookie );
+		n++;
 
-		/* wait for new jobs */
-		while( !ctx->f_exit && !( r = ctx->head ) )
-			pthread_cond_wait( &ctx->cond_var_job, &ctx->cond_mutex );
+		/* notify we finished last job */
+		if ( atomic_fetch_add( &r->done, 1 ) + 1 == r->jobs )
+		{
+			pthread_mutex_lock( &ctx->cond_mutex );
+			pthread_cond_broadcast( &ctx->cond_var_ready );
+			pthread_mutex_unlock( &ctx->cond_mutex );
+		}
+	}
 
-		if ( ctx->f_exit )
-			break;
+	return n;
+}
 
-		if ( !r )
-			continue;
+/** Scan the runtime slots once and run whatever jobs can be taken.
+ *
+ * \private \memberof mlt_slices_s
+ * \param ctx context pointer
+ * \param id the worker index
+ * \return the number of jobs run
+ */
 
-		/* check if no new job */
-		if ( r->curr == r->jobs )
-		{
-			ctx->head = ctx->head->next;
-			if ( !ctx->head )
-				ctx->tail = NULL;
-			mlt_log_debug( NULL, "%s:%d: new ctx->head=%p\n", __FUNCTION__, __LINE__, ctx->head );
+static int mlt_slices_scan( mlt_slices ctx, int id )
+{
+	int i, n = 0;
+
+	for ( i = 0; i < MAX_RUNTIMES; i++ )
+	{
+		struct mlt_slices_slot_s* slot = &ctx->slots[i];
+		struct mlt_slices_runtime_s* r;
+
+		if ( !atomic_load( &slot->runtime ) )
 			continue;
-		};
 
-		/* new job id */
-		idx = r->curr;
-		r->curr++;
+		/* the submitter does not leave while we are registered as a user */
+		atomic_fetch_add( &slot->users, 1 );
+		r = (struct mlt_slices_runtime_s*) atomic_load( &slot->runtime );
+		if ( r )
+			n += mlt_slices_drain( ctx, r, id );
+		atomic_fetch_sub( &slot->users, 1 );
+	}
 
-		/* run job */
-		pthread_mutex_unlock( &ctx->cond_mutex );
-		mlt_log_debug( NULL, "%s:%d: running job: id=%d, idx=%d/%d, pool=[%s]\n", __FUNCTION__, __LINE__,
-			id, idx, r->jobs, ctx->name );
-		r->proc( id, idx, r->jobs, r->cookie );
-		pthread_mutex_lock( &ctx->cond_mutex );
+	return n;
+}
+
+static void* mlt_slices_worker( void* p )
+{
+	struct mlt_slices_worker_s* worker = (struct mlt_slices_worker_s*)p;
+	mlt_slices ctx = worker->ctx;
+	int id = worker->id;
+	int spins = 0;
+
+	mlt_log_debug( NULL, "%s:%d: ctx=[%p][%s] entering\n", __FUNCTION__, __LINE__ , ctx, ctx->name );
 
-		/* increase done jobs counter */
-		r->done++;
+	while ( !atomic_load( &ctx->f_exit ) )
+	{
+		int seq = atomic_load( &ctx->wake_seq );
 
-		/* notify we fininished last job */
-		if ( r->done == r->jobs )
+		if ( mlt_slices_scan( ctx, id ) )
 		{
-			mlt_log_debug( NULL, "%s:%d: pthread_cond_signal( &ctx->cond_var_ready )\n", __FUNCTION__, __LINE__ );
-			pthread_cond_broadcast( &ctx->cond_var_ready );
+			spins = 0;
+			continue;
 		}
-	}
 
-	pthread_mutex_unlock( &ctx->cond_mutex );
+		/* spin a little before sleeping, new jobs often follow shortly */
+		if ( spins < SPIN_COUNT )
+		{
+			spins++;
+			sched_yield();
+			continue;
+		}
+		spins = 0;
+
+		mlt_log_debug( NULL, "%s:%d: ctx=[%p][%s] waiting\n", __FUNCTION__, __LINE__ , ctx, ctx->name );
+
+		/* wait for new jobs */
+		pthread_mutex_lock( &ctx->cond_mutex );
+		atomic_fetch_add( &ctx->sleepers, 1 );
+		while ( !atomic_load( &ctx->f_exit ) && seq == atomic_load( &ctx->wake_seq ) )
+			pthread_cond_wait( &ctx->cond_var_job, &ctx->cond_mutex );
+		atomic_fetch_sub( &ctx->sleepers, 1 );
+		pthread_mutex_unlock( &ctx->cond_mutex );
+	}
 
 	return NULL;
 }
@@ -210,7 +328,9 @@ static mlt_slices mlt_slices_init( int threads, int policy, int priority )
 	/* run worker threads */
 	for ( i = 0; i < ctx->count; i++ )
 	{
-		pthread_create( &ctx->threads[i], &tattr, mlt_slices_worker, ctx );
+		ctx->workers[i].ctx = ctx;
+		ctx->workers[i].id = i;
+		pthread_create( &ctx->threads[i], &tattr, mlt_slices_worker, &ctx->workers[i] );
 		pthread_setschedparam( ctx->threads[i], policy, &param);
 	}
 
@@ -245,8 +365,8 @@ static void mlt_slices_close( mlt_slices ctx )
 	pthread_mutex_unlock( &g_lock );
 
 	/* notify to exit */
-	ctx->f_exit = 1;
 	pthread_mutex_lock( &ctx->cond_mutex );
+	atomic_store( &ctx->f_exit, 1 );
 	pthread_cond_broadcast( &ctx->cond_var_job);
 	pthread_cond_broadcast( &ctx->cond_var_ready);
 	pthread_mutex_unlock( &ctx->cond_mutex );
@@ -264,7 +384,30 @@ static void mlt_slices_close( mlt_slices ctx )
 	free ( ctx );
 }
 
+/** Get the worker index of the calling thread.
+ *
+ * \private \memberof mlt_slices_s
+ * \param ctx context pointer
+ * \return the worker index or -1 if the caller is not a worker of \p ctx
+ */
+
+static int mlt_slices_worker_id( mlt_slices ctx )
+{
+	pthread_t self = pthread_self();
+	int i;
+
+	for ( i = 0; i < ctx->count; i++ )
+		if ( pthread_equal( self, ctx->threads[i] ) )
+			return i;
+	return -1;
+}
+
 /** Run sliced execution
+ *
+ * Job indices are spread over per-worker deques that idle workers steal
+ * from, so taking a job never locks. A proc may itself run sliced
+ * execution on the same context: the calling worker then processes its
+ * own sub-jobs while it waits and cannot deadlock the pool.
  *
  * \private \memberof mlt_slices_s
  * \param ctx context pointer
@@ -281,9 +424,8 @@ static void mlt_slices_run( mlt_slices ctx, int jobs, mlt_slices_proc proc, void
 		return;
 	}
 	struct mlt_slices_runtime_s runtime, *r = &runtime;
-
-	/* lock */
-	pthread_mutex_lock( &ctx->cond_mutex);
+	struct mlt_slices_slot_s* slot = NULL;
+	int i, spins, id = mlt_slices_worker_id( ctx );
 
 	/* check jobs count */
 	if ( jobs < 0 )
@@ -293,34 +435,70 @@ static void mlt_slices_run( mlt_slices ctx, int jobs, mlt_slices_proc proc, void
 
 	/* setup runtime args */
 	r->jobs = jobs;
-	r->done = 0;
-	r->curr = 0;
+	atomic_init( &r->done, 0 );
 	r->proc = proc;
 	r->cookie = cookie;
-	r->next = NULL;
+	for ( i = 0; i < MAX_SLICES; i++ )
+	{
+		int start = 0;
+		int size = i < ctx->count ? mlt_slices_size_slice( ctx->count, i, jobs, &start ) : 0;
+		atomic_init( &r->ranges[i], RANGE_PACK( start, start + size ) );
+	}
 
 	/* attach job */
-	if ( ctx->tail )
+	while ( !slot )
 	{
-		ctx->tail->next = r;
-		ctx->tail = r;
+		for ( i = 0; i < MAX_RUNTIMES && !slot; i++ )
+		{
+			intptr_t expected = 0;
+			if ( !atomic_load( &ctx->slots[i].busy ) &&
+				 atomic_compare_exchange_strong( &ctx->slots[i].busy, &expected, 1 ) )
+				slot = &ctx->slots[i];
+		}
+		if ( !slot )
+		{
+			/* all slots busy: a worker must not wait on other workers */
+			if ( id >= 0 )
+			{
+				for ( i = 0; i < jobs; i++ )
+					proc( id, i, jobs, cookie );
+				return;
+			}
+			sched_yield();
+		}
 	}
-	else
+
+	atomic_store( &slot->runtime, (intptr_t) r );
+
+	/* notify workers */
+	atomic_fetch_add( &ctx->wake_seq, 1 );
+	if ( atomic_load( &ctx->sleepers ) )
 	{
-		ctx->head = ctx->tail = r;
+		pthread_mutex_lock( &ctx->cond_mutex );
+		pthread_cond_broadcast( &ctx->cond_var_job );
+		pthread_mutex_unlock( &ctx->cond_mutex );
 	}
 
-	/* notify workers */
-	pthread_cond_broadcast( &ctx->cond_var_job );
+	/* a nested call runs its own jobs instead of only waiting for them */
+	if ( id >= 0 )
+		mlt_slices_drain( ctx, r, id );
 
 	/* wait for end of task */
-	while( !ctx->f_exit && ( r->done < r->jobs ) )
+	for ( spins = 0; spins < SPIN_COUNT && atomic_load( &r->done ) < r->jobs; spins++ )
+		sched_yield();
+	pthread_mutex_lock( &ctx->cond_mutex );
+	while( !atomic_load( &ctx->f_exit ) && ( atomic_load( &r->done ) < r->jobs ) )
 	{
 		pthread_cond_wait( &ctx->cond_var_ready, &ctx->cond_mutex );
 		mlt_log_debug( NULL, "%s:%d: ctx=[%p][%s] signalled\n", __FUNCTION__, __LINE__ , ctx, ctx->name );
 	}
+	pthread_mutex_unlock( &ctx->cond_mutex );
 
-	pthread_mutex_unlock( &ctx->cond_mutex);
+	/* detach job and wait until no worker references it */
+	atomic_store( &slot->runtime, 0 );
+	while ( atomic_load( &slot->users ) )
+		sched_yield();
+	atomic_store( &slot->busy, 0 );
 }
 
 /** Get a global shared sliced threading context.
@@ -481,6 +481,11 @@ static int producer_get_frame( mlt_producer parent, mlt_frame_ptr frame, int tra
 			mlt_producer_seek( target, mlt_producer_frame( parent ) );
 			mlt_producer_set_speed( target, mlt_producer_get_speed( parent ) );
 
+			// Pass on the parallel track mode
+			int parallel = mlt_properties_get_int( properties, "parallel" );
+			if ( parallel != mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( target ), "parallel" ) )
+				mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( target ), "parallel", parallel );
+
 			// We will create one frame and attach everything to it
 			*frame = mlt_frame_init( MLT_PRODUCER_SERVICE( parent ) );
 
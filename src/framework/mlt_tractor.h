@@ -34,6 +34,8 @@
  * \properties \em multitrack holds a reference to the mulitrack object that a tractor manages
  * \properties \em field holds a reference to the field object that a tractor manages
  * \properties \em producer holds a reference to an encapsulated producer
+ * \properties \em parallel set to 1 to fetch and render the frames of all tracks at the same time
+ * (see mlt_multitrack_s)
  */
 
 struct mlt_tractor_s
@@ -24,6 +24,7 @@
 #include "mlt_frame.h"
 #include "mlt_log.h"
 #include "mlt_producer.h"
+#include "mlt_profiler.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -322,9 +323,16 @@ double mlt_transition_get_progress_delta( mlt_transition self, mlt_frame frame )
 mlt_frame mlt_transition_process( mlt_transition self, mlt_frame a_frame, mlt_frame b_frame )
 {
 	if ( self->process == NULL )
+	{
 		return a_frame;
+	}
 	else
-		return self->process( self, a_frame, b_frame );
+	{
+		mlt_profiler_span span = mlt_profiler_enter( MLT_TRANSITION_SERVICE( self ), mlt_profiler_get_frame );
+		mlt_frame frame = self->process( self, a_frame, b_frame );
+		mlt_profiler_leave( span, frame );
+		return frame;
+	}
 }
 
 static int get_image_a( mlt_frame a_frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
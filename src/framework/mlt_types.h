@@ -209,6 +209,7 @@ typedef struct mlt_image_s *mlt_image;                  /**< pointer to Image ob
 typedef struct mlt_frame_s *mlt_frame, **mlt_frame_ptr; /**< pointer to Frame object */
 typedef struct mlt_property_s *mlt_property;            /**< pointer to Property object */
 typedef struct mlt_properties_s *mlt_properties;        /**< pointer to Properties object */
+typedef struct mlt_key_s *mlt_key;                      /**< pointer to interned Properties key */
 typedef struct mlt_event_struct *mlt_event;             /**< pointer to Event object */
 typedef struct mlt_service_s *mlt_service;              /**< pointer to Service object */
 typedef struct mlt_producer_s *mlt_producer;            /**< pointer to Producer object */
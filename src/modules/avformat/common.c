@@ -20,9 +20,14 @@
 #include "common.h"
 
 #include <libavutil/channel_layout.h>
+#include <libavutil/opt.h>
 #include <libavutil/pixdesc.h>
 #include <libavutil/samplefmt.h>
 
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
 int mlt_get_sws_flags(int srcwidth, int srcheight, int srcformat, int dstwidth, int dstheight, int dstformat)
 {
 	// Use default flags unless there is a reason to use something different.
@@ -236,3 +241,165 @@ int mlt_set_luma_transfer( struct SwsContext *context, int src_colorspace,
 	return sws_setColorspaceDetails( context, src_coefficients, src_range, dst_coefficients, dst_range,
 		brightness, contrast, saturation );
 }
+
+struct sws_cache_slot
+{
+	mlt_sws_key key;
+	struct SwsContext *context;
+	int transfer_result;
+};
+
+struct mlt_sws_cache_s
+{
+	pthread_mutex_t mutex;
+	struct sws_cache_slot *slots;
+	int count;
+	int64_t hits;
+	int64_t misses;
+};
+
+void mlt_sws_key_init( mlt_sws_key *key, int srcwidth, int srcheight, int srcformat,
+	int dstwidth, int dstheight, int dstformat )
+{
+	memset( key, 0, sizeof( *key ) );
+	key->src_width = srcwidth;
+	key->src_height = srcheight;
+	key->src_format = srcformat;
+	key->dst_width = dstwidth;
+	key->dst_height = dstheight;
+	key->dst_format = dstformat;
+	key->flags = mlt_get_sws_flags( srcwidth, srcheight, srcformat, dstwidth, dstheight, dstformat );
+	key->src_v_chr_pos = -513;
+	key->dst_v_chr_pos = -513;
+}
+
+mlt_sws_cache mlt_sws_cache_init( void )
+{
+	mlt_sws_cache cache = calloc( 1, sizeof( struct mlt_sws_cache_s ) );
+	if ( cache )
+		pthread_mutex_init( &cache->mutex, NULL );
+	return cache;
+}
+
+static struct SwsContext *sws_context_create( const mlt_sws_key *key, int *transfer_result )
+{
+	struct SwsContext *context = sws_alloc_context();
+	int ret;
+
+	if ( !context )
+		return NULL;
+	av_opt_set_int( context, "srcw", key->src_width, 0 );
+	av_opt_set_int( context, "srch", key->src_height, 0 );
+	av_opt_set_int( context, "src_format", key->src_format, 0 );
+	av_opt_set_int( context, "dstw", key->dst_width, 0 );
+	av_opt_set_int( context, "dsth", key->dst_height, 0 );
+	av_opt_set_int( context, "dst_format", key->dst_format, 0 );
+	av_opt_set_int( context, "sws_flags", key->flags, 0 );
+	av_opt_set_int( context, "src_h_chr_pos", -513, 0 );
+	av_opt_set_int( context, "src_v_chr_pos", key->src_v_chr_pos, 0 );
+	av_opt_set_int( context, "dst_h_chr_pos", -513, 0 );
+	av_opt_set_int( context, "dst_v_chr_pos", key->dst_v_chr_pos, 0 );
+	if ( ( ret = sws_init_context( context, NULL, NULL ) ) < 0 )
+	{
+		mlt_log_error( NULL, "%s:%d: sws_init_context failed, ret=%d\n", __FUNCTION__, __LINE__, ret );
+		sws_freeContext( context );
+		return NULL;
+	}
+	*transfer_result = mlt_set_luma_transfer( context, key->src_colorspace, key->dst_colorspace,
+		key->src_full_range, key->dst_full_range );
+	return context;
+}
+
+/** Get a SwsContext for the given parameters, creating it only when they changed.
+ *
+ * Each slot holds one context, so concurrent users, such as the jobs of a sliced
+ * conversion, must use different slots. The context belongs to the cache.
+ * transfer_result receives what mlt_set_luma_transfer() returned for it.
+ */
+
+struct SwsContext *mlt_sws_cache_get( mlt_sws_cache cache, int slot, const mlt_sws_key *key, int *transfer_result )
+{
+	struct SwsContext *context = NULL;
+	struct SwsContext *stale = NULL;
+	int result = -1;
+
+	pthread_mutex_lock( &cache->mutex );
+	if ( slot >= cache->count )
+	{
+		int count = slot + 1;
+		cache->slots = realloc( cache->slots, count * sizeof( struct sws_cache_slot ) );
+		memset( cache->slots + cache->count, 0, ( count - cache->count ) * sizeof( struct sws_cache_slot ) );
+		cache->count = count;
+	}
+	if ( cache->slots[ slot ].context && !memcmp( &cache->slots[ slot ].key, key, sizeof( *key ) ) )
+	{
+		context = cache->slots[ slot ].context;
+		result = cache->slots[ slot ].transfer_result;
+		cache->hits ++;
+	}
+	else
+	{
+		stale = cache->slots[ slot ].context;
+		cache->slots[ slot ].context = NULL;
+		cache->misses ++;
+	}
+	pthread_mutex_unlock( &cache->mutex );
+
+	if ( !context )
+	{
+		// Create the context outside of the lock since this is the slow part
+		sws_freeContext( stale );
+		context = sws_context_create( key, &result );
+		pthread_mutex_lock( &cache->mutex );
+		cache->slots[ slot ].key = *key;
+		cache->slots[ slot ].context = context;
+		cache->slots[ slot ].transfer_result = result;
+		pthread_mutex_unlock( &cache->mutex );
+	}
+	if ( transfer_result )
+		*transfer_result = result;
+	return context;
+}
+
+/** Free all cached contexts. None of them may be in use. */
+
+void mlt_sws_cache_purge( mlt_sws_cache cache )
+{
+	int i;
+	if ( !cache )
+		return;
+	pthread_mutex_lock( &cache->mutex );
+	for ( i = 0; i < cache->count; i++ )
+	{
+		sws_freeContext( cache->slots[ i ].context );
+		cache->slots[ i ].context = NULL;
+	}
+	pthread_mutex_unlock( &cache->mutex );
+}
+
+void mlt_sws_cache_get_stats( mlt_sws_cache cache, mlt_properties properties )
+{
+	int64_t hits = 0, misses = 0;
+
+	if ( !properties )
+		return;
+	if ( cache )
+	{
+		pthread_mutex_lock( &cache->mutex );
+		hits = cache->hits;
+		misses = cache->misses;
+		pthread_mutex_unlock( &cache->mutex );
+	}
+	mlt_properties_set_int64( properties, "sws_cache.hits", hits );
+	mlt_properties_set_int64( properties, "sws_cache.misses", misses );
+}
+
+void mlt_sws_cache_close( mlt_sws_cache cache )
+{
+	if ( !cache )
+		return;
+	mlt_sws_cache_purge( cache );
+	pthread_mutex_destroy( &cache->mutex );
+	free( cache->slots );
+	free( cache );
+}
@@ -33,4 +33,26 @@ int mlt_set_luma_transfer( struct SwsContext *context, int src_colorspace,
 	int dst_colorspace, int src_full_range, int dst_full_range );
 int mlt_get_sws_flags(int srcwidth, int srcheight, int srcformat, int dstwidth, int dstheight, int dstformat);
 
+/** The parameters that identify a cached SwsContext */
+
+typedef struct
+{
+	int src_width, src_height, src_format;
+	int dst_width, dst_height, dst_format;
+	int flags;
+	int src_v_chr_pos, dst_v_chr_pos;
+	int src_colorspace, dst_colorspace;
+	int src_full_range, dst_full_range;
+} mlt_sws_key;
+
+typedef struct mlt_sws_cache_s *mlt_sws_cache;
+
+void mlt_sws_key_init( mlt_sws_key *key, int srcwidth, int srcheight, int srcformat,
+	int dstwidth, int dstheight, int dstformat );
+mlt_sws_cache mlt_sws_cache_init( void );
+struct SwsContext *mlt_sws_cache_get( mlt_sws_cache cache, int slot, const mlt_sws_key *key, int *transfer_result );
+void mlt_sws_cache_purge( mlt_sws_cache cache );
+void mlt_sws_cache_get_stats( mlt_sws_cache cache, mlt_properties properties );
+void mlt_sws_cache_close( mlt_sws_cache cache );
+
 #endif // COMMON_H
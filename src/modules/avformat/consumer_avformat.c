@@ -32,6 +32,7 @@
 #include <string.h>
 #include <limits.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
 #else
@@ -135,6 +136,70 @@ void sample_fifo_close( sample_fifo fifo )
 	free( fifo );
 }
 
+//
+// Bounded blocking queue connecting the stages of the encode pipeline
+//
+
+typedef struct
+{
+	mlt_deque items;
+	int capacity;
+	int closed;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+}
+*stage_queue, stage_queue_s;
+
+static stage_queue stage_queue_init( int capacity )
+{
+	stage_queue queue = calloc( 1, sizeof( stage_queue_s ) );
+	queue->items = mlt_deque_init();
+	queue->capacity = capacity;
+	pthread_mutex_init( &queue->mutex, NULL );
+	pthread_cond_init( &queue->cond, NULL );
+	return queue;
+}
+
+// Blocks while the queue is full
+static void stage_queue_push( stage_queue queue, void *item )
+{
+	pthread_mutex_lock( &queue->mutex );
+	while ( mlt_deque_count( queue->items ) >= queue->capacity )
+		pthread_cond_wait( &queue->cond, &queue->mutex );
+	mlt_deque_push_back( queue->items, item );
+	pthread_cond_broadcast( &queue->cond );
+	pthread_mutex_unlock( &queue->mutex );
+}
+
+// Blocks while the queue is empty, returns NULL once it is closed and empty
+static void *stage_queue_pop( stage_queue queue )
+{
+	void *item;
+	pthread_mutex_lock( &queue->mutex );
+	while ( !mlt_deque_count( queue->items ) && !queue->closed )
+		pthread_cond_wait( &queue->cond, &queue->mutex );
+	item = mlt_deque_pop_front( queue->items );
+	pthread_cond_broadcast( &queue->cond );
+	pthread_mutex_unlock( &queue->mutex );
+	return item;
+}
+
+static void stage_queue_close( stage_queue queue )
+{
+	pthread_mutex_lock( &queue->mutex );
+	queue->closed = 1;
+	pthread_cond_broadcast( &queue->cond );
+	pthread_mutex_unlock( &queue->mutex );
+}
+
+static void stage_queue_free( stage_queue queue )
+{
+	mlt_deque_close( queue->items );
+	pthread_mutex_destroy( &queue->mutex );
+	pthread_cond_destroy( &queue->cond );
+	free( queue );
+}
+
 #if defined(AVFILTER)
 static AVFilterGraph *vfilter_graph;
 
@@ -227,6 +292,7 @@ static int consumer_stop( mlt_consumer consumer );
 static int consumer_is_stopped( mlt_consumer consumer );
 static void *consumer_thread( void *arg );
 static void consumer_close( mlt_consumer consumer );
+static void on_sws_cache_stats( mlt_properties owner, mlt_consumer consumer );
 
 /** Initialise the consumer.
 */
@@ -276,6 +342,8 @@ mlt_consumer consumer_avformat_init( mlt_profile profile, char *arg )
 		consumer->is_stopped = consumer_is_stopped;
 		
 		mlt_events_register( properties, "consumer-fatal-error" );
+		mlt_events_register( properties, "sws-cache-stats" );
+		mlt_events_listen( properties, consumer, "sws-cache-stats", ( mlt_listener )on_sws_cache_stats );
 		mlt_event event = mlt_events_listen( properties, consumer, "property-changed", ( mlt_listener )property_changed );
 		mlt_properties_set_data( properties, "property-changed event", event, 0, NULL, NULL );
 	}
@@ -415,6 +483,15 @@ static void property_changed( mlt_properties owner, mlt_consumer self, mlt_event
 
 }
 
+/** Publish the scaler cache counters when an application asks for them.
+*/
+
+static void on_sws_cache_stats( mlt_properties owner, mlt_consumer consumer )
+{
+	mlt_sws_cache cache = mlt_properties_get_data( MLT_CONSUMER_PROPERTIES( consumer ), "_sws_cache", NULL );
+	mlt_sws_cache_get_stats( cache, owner );
+}
+
 /** Start the consumer.
 */
 
@@ -1224,8 +1301,53 @@ typedef struct encode_ctx_desc
 	mlt_properties frame_meta_properties;
 
 	AVFrame *audio_avframe;
+
+	// Video conversion
+	int width;
+	int height;
+	int img_width;
+	int img_height;
+	mlt_image_format img_fmt;
+	enum AVPixelFormat pix_fmt;
+	int dst_colorspace;
+	int dst_full_range;
+	mlt_sws_cache sws_cache;
+	AVFrame *converted_avframe;
+	AVFrame *avframe;
+	uint8_t *video_outbuf;
+	int video_outbuf_size;
+
+	// Pipelined encoding
+	stage_queue video_queue;       // rendered frames waiting to be encoded
+	stage_queue mux_queue;         // encoded packets waiting to be written
+	pthread_t video_thread;
+	pthread_t audio_thread;
+	pthread_t mux_thread;
+	int audio_running;
+	int audio_done;
+	pthread_mutex_t audio_mutex;   // protects the sample fifo and channel mapping
+	pthread_cond_t audio_cond;
+	atomic_int pipeline_error;
 } encode_ctx_t;
 
+static int write_packet( encode_ctx_t* ctx, AVPacket *pkt )
+{
+	if ( ctx->mux_queue )
+	{
+		// Hand the packet over to the mux thread
+		AVPacket *copy;
+		if ( atomic_load( &ctx->pipeline_error ) )
+			return -1;
+		copy = av_packet_clone( pkt );
+		av_packet_unref( pkt );
+		if ( !copy )
+			return AVERROR(ENOMEM);
+		stage_queue_push( ctx->mux_queue, copy );
+		return 0;
+	}
+	return av_interleaved_write_frame( ctx->oc, pkt );
+}
+
 static int encode_audio(encode_ctx_t* ctx)
 {
 	char key[27];
@@ -1387,7 +1509,7 @@ receive_audio_packet:
 			// Write the compressed frame in the media file
 			av_packet_rescale_ts( &pkt, codec->time_base, stream->time_base );
 			pkt.stream_index = stream->index;
-			if ( av_interleaved_write_frame( ctx->oc, &pkt ) )
+			if ( write_packet( ctx, &pkt ) )
 			{
 				mlt_log_fatal( MLT_CONSUMER_SERVICE( ctx->consumer ), "error writing audio frame\n" );
 				mlt_events_fire( ctx->properties, "consumer-fatal-error", mlt_event_data_none() );
@@ -1409,7 +1531,7 @@ receive_audio_packet:
 		{
 			pkt.stream_index = stream->index;
 			av_packet_rescale_ts( &pkt, codec->time_base, stream->time_base );
-			av_interleaved_write_frame(ctx->oc, &pkt);
+			write_packet( ctx, &pkt );
 		}
 
 		if ( i == 0 )
@@ -1421,6 +1543,337 @@ receive_audio_packet:
 	return 0;
 }
 
+/** Convert and encode one video frame.
+*/
+
+static int encode_video( encode_ctx_t* ctx, mlt_frame frame )
+{
+	mlt_properties frame_properties = MLT_FRAME_PROPERTIES( frame );
+	uint8_t *image;
+	int i;
+	int ret = 0;
+	AVCodecContext *c = ctx->vcodec_ctx;
+
+	if ( mlt_properties_get_int( frame_properties, "rendered" ) )
+	{
+		AVFrame video_avframe;
+		mlt_frame_get_image( frame, &image, &ctx->img_fmt, &ctx->img_width, &ctx->img_height, 0 );
+
+		mlt_image_format_planes( ctx->img_fmt, ctx->width, ctx->height, image, video_avframe.data, video_avframe.linesize );
+
+		// Do the colour space conversion
+		mlt_sws_key key;
+		mlt_sws_key_init( &key, ctx->width, ctx->height, pick_pix_fmt( ctx->img_fmt ), ctx->width, ctx->height, ctx->pix_fmt );
+		key.src_colorspace = mlt_properties_get_int( frame_properties, "colorspace" );
+		key.dst_colorspace = ctx->dst_colorspace;
+		key.src_full_range = mlt_properties_get_int( frame_properties, "full_range" );
+		key.dst_full_range = ctx->dst_full_range;
+		struct SwsContext *context = mlt_sws_cache_get( ctx->sws_cache, 0, &key, NULL );
+		if ( context )
+			sws_scale( context, (const uint8_t* const*) video_avframe.data, video_avframe.linesize, 0, ctx->height,
+				ctx->converted_avframe->data, ctx->converted_avframe->linesize);
+
+		mlt_events_fire( ctx->properties, "consumer-frame-show", mlt_event_data_from_frame(frame) );
+
+		// Apply the alpha if applicable
+		if ( !mlt_properties_get( ctx->properties, "mlt_image_format" ) ||
+		     strcmp( mlt_properties_get( ctx->properties, "mlt_image_format" ), "rgba" ) )
+		if ( c->pix_fmt == AV_PIX_FMT_RGBA ||
+		     c->pix_fmt == AV_PIX_FMT_ARGB ||
+		     c->pix_fmt == AV_PIX_FMT_BGRA )
+		{
+			uint8_t *p;
+			uint8_t *alpha = mlt_frame_get_alpha( frame );
+			if ( alpha )
+			{
+				register int n;
+
+				for ( i = 0; i < ctx->height; i ++ )
+				{
+					n = ( ctx->width + 7 ) / 8;
+					p = ctx->converted_avframe->data[ 0 ] + i * ctx->converted_avframe->linesize[ 0 ] + 3;
+
+					switch( ctx->width % 8 )
+					{
+						case 0:	do { *p = *alpha++; p += 4;
+						case 7:		 *p = *alpha++; p += 4;
+						case 6:		 *p = *alpha++; p += 4;
+						case 5:		 *p = *alpha++; p += 4;
+						case 4:		 *p = *alpha++; p += 4;
+						case 3:		 *p = *alpha++; p += 4;
+						case 2:		 *p = *alpha++; p += 4;
+						case 1:		 *p = *alpha++; p += 4;
+								}
+								while( --n );
+					}
+				}
+			}
+			else
+			{
+				for ( i = 0; i < ctx->height; i ++ )
+				{
+					int n = ctx->width;
+					uint8_t* p = ctx->converted_avframe->data[ 0 ] + i * ctx->converted_avframe->linesize[ 0 ] + 3;
+					while ( n )
+					{
+						*p = 255;
+						p += 4;
+						n--;
+					}
+				}
+			}
+		}
+#if defined(AVFILTER)
+		if (AV_PIX_FMT_VAAPI == c->pix_fmt) {
+			AVFilterContext *vfilter_in = mlt_properties_get_data(ctx->properties, "vfilter_in", NULL);
+			AVFilterContext *vfilter_out = mlt_properties_get_data(ctx->properties, "vfilter_out", NULL);
+			if (vfilter_in && vfilter_out) {
+				if (!ctx->avframe)
+					ctx->avframe = av_frame_alloc();									
+				ret = av_buffersrc_add_frame(vfilter_in, ctx->converted_avframe);
+				ret = av_buffersink_get_frame(vfilter_out, ctx->avframe);
+				if (ret < 0) {
+					mlt_log_warning(MLT_CONSUMER_SERVICE( ctx->consumer ), "error with hwupload: %d (frame %d)\n", ret, ctx->frame_count);
+					if (++ctx->error_count > 2)
+						return -1;
+					ret = 0;
+				}
+			}
+		} else {
+			ctx->avframe = ctx->converted_avframe;
+		}
+#else
+		ctx->avframe = ctx->converted_avframe;
+#endif
+	}
+
+#ifdef AVFMT_RAWPICTURE
+	if (ctx->oc->oformat->flags & AVFMT_RAWPICTURE)
+	{
+		// raw video case. The API will change slightly in the near future for that
+		AVPacket pkt;
+		av_init_packet(&pkt);
+
+		// Set frame interlace hints
+		if ( mlt_properties_get_int( frame_properties, "progressive" ) )
+			c->field_order = AV_FIELD_PROGRESSIVE;
+		else
+			c->field_order = (mlt_properties_get_int( frame_properties, "top_field_first" )) ? AV_FIELD_TB : AV_FIELD_BT;
+		pkt.flags |= AV_PKT_FLAG_KEY;
+		pkt.stream_index = ctx->video_st->index;
+		pkt.data = (uint8_t*) ctx->avframe;
+		pkt.size = sizeof(AVPicture);
+
+		ret = av_write_frame(ctx->oc, &pkt);
+	} 
+	else 
+#endif
+	{
+		AVPacket pkt;
+		av_init_packet( &pkt );
+		if ( c->codec->id == AV_CODEC_ID_RAWVIDEO ) {
+			pkt.data = NULL;
+			pkt.size = 0;
+		} else {
+			pkt.data = ctx->video_outbuf;
+			pkt.size = ctx->video_outbuf_size;
+		}
+
+		// Set the quality
+		ctx->avframe->quality = c->global_quality;
+		ctx->avframe->pts = ctx->frame_count;
+
+		// Set frame interlace hints
+		ctx->avframe->interlaced_frame = !mlt_properties_get_int( frame_properties, "progressive" );
+		ctx->avframe->top_field_first = mlt_properties_get_int( frame_properties, "top_field_first" );
+		if ( mlt_properties_get_int( frame_properties, "progressive" ) )
+			c->field_order = AV_FIELD_PROGRESSIVE;
+		else if ( c->codec_id == AV_CODEC_ID_MJPEG )
+			c->field_order = (mlt_properties_get_int( frame_properties, "top_field_first" )) ? AV_FIELD_TT : AV_FIELD_BB;
+		else
+			c->field_order = (mlt_properties_get_int( frame_properties, "top_field_first" )) ? AV_FIELD_TB : AV_FIELD_BT;
+
+		// Encode the image
+		ret = avcodec_send_frame( c, ctx->avframe );
+		if ( ret < 0 ) {
+			pkt.size = ret;
+		} else {
+receive_video_packet:
+			ret = avcodec_receive_packet( c, &pkt );
+			if ( ret == AVERROR(EAGAIN) || ret == AVERROR_EOF )
+				pkt.size = ret = 0;
+			else if ( ret < 0 )
+				pkt.size = ret;
+		}
+
+		// If zero size, it means the image was buffered
+		if ( pkt.size > 0 )
+		{
+			av_packet_rescale_ts( &pkt, c->time_base, ctx->video_st->time_base );
+			pkt.stream_index = ctx->video_st->index;
+
+			// write the compressed frame in the media file
+			ret = write_packet( ctx, &pkt );
+			mlt_log_debug( MLT_CONSUMER_SERVICE( ctx->consumer ), " frame_size %d\n", c->frame_size );
+			
+			// Dual pass logging
+			if ( mlt_properties_get_data( ctx->properties, "_logfile", NULL ) && c->stats_out )
+				fprintf( mlt_properties_get_data( ctx->properties, "_logfile", NULL ), "%s", c->stats_out );
+
+			ctx->error_count = 0;
+
+			if ( !ret )
+				goto receive_video_packet;
+		}
+		else if ( pkt.size < 0 )
+		{
+			mlt_log_warning( MLT_CONSUMER_SERVICE( ctx->consumer ), "error with video encode: %d (frame %d)\n", pkt.size, ctx->frame_count );
+			if ( ++ctx->error_count > 2 )
+				return -1;
+			ret = 0;
+		}
+	}
+	ctx->frame_count++;
+	ctx->video_pts = (double) ctx->frame_count * av_q2d( ctx->vcodec_ctx->time_base );
+	if ( ret )
+	{
+		mlt_log_fatal( MLT_CONSUMER_SERVICE( ctx->consumer ), "error writing video frame: %d\n", ret );
+		mlt_events_fire( ctx->properties, "consumer-fatal-error", mlt_event_data_none() );
+		return -1;
+	}
+#if defined(AVFILTER)
+	if (AV_PIX_FMT_VAAPI == c->pix_fmt)
+		av_frame_unref( ctx->avframe );
+#endif
+	return 0;
+}
+
+/** The video stage of the pipeline: convert and encode rendered frames.
+*/
+
+static void *pipeline_video_thread( void *arg )
+{
+	encode_ctx_t* ctx = arg;
+	mlt_frame frame;
+
+	while ( ( frame = stage_queue_pop( ctx->video_queue ) ) )
+	{
+		if ( !atomic_load( &ctx->pipeline_error ) && encode_video( ctx, frame ) < 0 )
+			atomic_store( &ctx->pipeline_error, 1 );
+		mlt_frame_close( frame );
+	}
+	return NULL;
+}
+
+/** The audio stage of the pipeline: encode whole audio frames as the fifo fills.
+*/
+
+static void *pipeline_audio_thread( void *arg )
+{
+	encode_ctx_t* ctx = arg;
+
+	pthread_mutex_lock( &ctx->audio_mutex );
+	while ( 1 )
+	{
+		int frame_length = ctx->audio_input_frame_size * ctx->channels * ctx->sample_bytes;
+		if ( ctx->fifo && frame_length > 0 && sample_fifo_used( ctx->fifo ) >= frame_length &&
+		     !atomic_load( &ctx->pipeline_error ) )
+		{
+			if ( encode_audio( ctx ) < 0 )
+				atomic_store( &ctx->pipeline_error, 1 );
+		}
+		else if ( ctx->audio_done )
+		{
+			break;
+		}
+		else
+		{
+			pthread_cond_wait( &ctx->audio_cond, &ctx->audio_mutex );
+		}
+	}
+	pthread_mutex_unlock( &ctx->audio_mutex );
+	return NULL;
+}
+
+/** The mux stage of the pipeline: write the packets of all streams.
+*
+* Each stream has a single producer, so its packets arrive in order, and
+* av_interleaved_write_frame() takes care of interleaving the streams.
+*/
+
+static void *pipeline_mux_thread( void *arg )
+{
+	encode_ctx_t* ctx = arg;
+	AVPacket *pkt;
+
+	while ( ( pkt = stage_queue_pop( ctx->mux_queue ) ) )
+	{
+		if ( !atomic_load( &ctx->pipeline_error ) && av_interleaved_write_frame( ctx->oc, pkt ) )
+		{
+			mlt_log_fatal( MLT_CONSUMER_SERVICE( ctx->consumer ), "error writing packet to stream %d\n", pkt->stream_index );
+			mlt_events_fire( ctx->properties, "consumer-fatal-error", mlt_event_data_none() );
+			atomic_store( &ctx->pipeline_error, 1 );
+		}
+		av_packet_free( &pkt );
+	}
+	return NULL;
+}
+
+static void pipeline_start( encode_ctx_t* ctx, int depth )
+{
+	ctx->mux_queue = stage_queue_init( depth * 16 );
+	pthread_create( &ctx->mux_thread, NULL, pipeline_mux_thread, ctx );
+	if ( ctx->video_st )
+	{
+		ctx->video_queue = stage_queue_init( depth );
+		pthread_create( &ctx->video_thread, NULL, pipeline_video_thread, ctx );
+	}
+	if ( ctx->audio_st[0] )
+	{
+		ctx->audio_running = 1;
+		ctx->audio_done = 0;
+		pthread_create( &ctx->audio_thread, NULL, pipeline_audio_thread, ctx );
+	}
+	mlt_log_verbose( MLT_CONSUMER_SERVICE( ctx->consumer ), "pipelined encoding with %d frames in flight\n", depth );
+}
+
+/** Wait for the encoder stages to finish what has been queued.
+*
+* Packets still go through the mux thread until pipeline_close().
+*/
+
+static void pipeline_stop( encode_ctx_t* ctx )
+{
+	if ( ctx->video_queue )
+	{
+		stage_queue_close( ctx->video_queue );
+		pthread_join( ctx->video_thread, NULL );
+		stage_queue_free( ctx->video_queue );
+		ctx->video_queue = NULL;
+	}
+	if ( ctx->audio_running )
+	{
+		pthread_mutex_lock( &ctx->audio_mutex );
+		ctx->audio_done = 1;
+		pthread_cond_signal( &ctx->audio_cond );
+		pthread_mutex_unlock( &ctx->audio_mutex );
+		pthread_join( ctx->audio_thread, NULL );
+		ctx->audio_running = 0;
+	}
+}
+
+static void pipeline_close( encode_ctx_t* ctx )
+{
+	pipeline_stop( ctx );
+	if ( ctx->mux_queue )
+	{
+		stage_queue_close( ctx->mux_queue );
+		pthread_join( ctx->mux_thread, NULL );
+		stage_queue_free( ctx->mux_queue );
+		ctx->mux_queue = NULL;
+	}
+}
+
 /** The main thread - the argument is simply the consumer.
 */
 
@@ -1431,6 +1884,8 @@ static void *consumer_thread( void *arg )
 	// Encoding content
 	encode_ctx_t* enc_ctx = mlt_pool_alloc(sizeof(encode_ctx_t));
 	memset(enc_ctx, 0, sizeof(encode_ctx_t));
+	pthread_mutex_init( &enc_ctx->audio_mutex, NULL );
+	pthread_cond_init( &enc_ctx->audio_cond, NULL );
 
 	// Map the argument to the object
 	mlt_consumer consumer = enc_ctx->consumer = arg;
@@ -1441,6 +1896,14 @@ static void *consumer_thread( void *arg )
 	// Get the terminate on pause property
 	enc_ctx->terminate_on_pause = mlt_properties_get_int( enc_ctx->properties, "terminate_on_pause" );
 
+	// The colour space conversion contexts persist for the lifetime of the consumer
+	enc_ctx->sws_cache = mlt_properties_get_data( properties, "_sws_cache", NULL );
+	if ( !enc_ctx->sws_cache )
+	{
+		enc_ctx->sws_cache = mlt_sws_cache_init();
+		mlt_properties_set_data( properties, "_sws_cache", enc_ctx->sws_cache, 0, ( mlt_destructor )mlt_sws_cache_close, NULL );
+	}
+
 	// Determine if feed is slow (for realtime stuff)
 	int real_time_output = mlt_properties_get_int( properties, "real_time" );
 
@@ -1453,8 +1916,8 @@ static void *consumer_thread( void *arg )
 	// Get width and height
 	int width = mlt_properties_get_int( properties, "width" );
 	int height = mlt_properties_get_int( properties, "height" );
-	int img_width = width;
-	int img_height = height;
+	enc_ctx->width = enc_ctx->img_width = width;
+	enc_ctx->height = enc_ctx->img_height = height;
 
 	// Get default audio properties
 	enc_ctx->total_channels = enc_ctx->channels = mlt_properties_get_int( properties, "channels" );
@@ -1466,8 +1929,8 @@ static void *consumer_thread( void *arg )
 	enc_ctx->audio_outbuf_size = AUDIO_BUFFER_SIZE;
 
 	// AVFormat video buffer and frame count
-	int video_outbuf_size = VIDEO_BUFFER_SIZE;
-	uint8_t *video_outbuf = av_malloc( video_outbuf_size );
+	enc_ctx->video_outbuf_size = VIDEO_BUFFER_SIZE;
+	enc_ctx->video_outbuf = av_malloc( enc_ctx->video_outbuf_size );
 
 	// Used for the frame properties
 	mlt_frame frame = NULL;
@@ -1479,11 +1942,7 @@ static void *consumer_thread( void *arg )
 
 	// For receiving images from an mlt_frame
 	uint8_t *image;
-	mlt_image_format img_fmt = mlt_image_yuv422;
-
-	// Need two av pictures for converting
-	AVFrame *converted_avframe = NULL;
-	AVFrame *avframe = NULL;
+	enc_ctx->img_fmt = mlt_image_yuv422;
 
 	// For receiving audio samples back from the fifo
 	int count = 0;
@@ -1505,9 +1964,9 @@ static void *consumer_thread( void *arg )
 	char key[27];
 	enc_ctx->frame_meta_properties = mlt_properties_new();
 	int header_written = 0;
-	int dst_colorspace = mlt_properties_get_int( properties, "colorspace" );
+	enc_ctx->dst_colorspace = mlt_properties_get_int( properties, "colorspace" );
 	const char* color_range = mlt_properties_get( properties, "color_range" );
-	int dst_full_range = color_range && (!strcmp("pc", color_range) || !strcmp("jpeg", color_range));
+	enc_ctx->dst_full_range = color_range && (!strcmp("pc", color_range) || !strcmp("jpeg", color_range));
 
 	// Check for user selected format first
 	if ( format != NULL )
@@ -1612,7 +2071,7 @@ static void *consumer_thread( void *arg )
 				// Set the mlt_image_format from explicit property.
 				mlt_image_format f = mlt_image_format_id( img_fmt_name );
 				if ( mlt_image_invalid != f )
-					img_fmt = f;
+					enc_ctx->img_fmt = f;
 			}
 			else
 			{
@@ -1622,11 +2081,11 @@ static void *consumer_thread( void *arg )
 					 !strcmp( pix_fmt_name, "argb" ) ||
 					 !strcmp( pix_fmt_name, "bgra" ) ) {
 					mlt_properties_set( properties, "mlt_image_format", "rgba" );
-					img_fmt = mlt_image_rgba;
+					enc_ctx->img_fmt = mlt_image_rgba;
 				} else if ( strstr( pix_fmt_name, "rgb" ) ||
 							strstr( pix_fmt_name, "bgr" ) ) {
 					mlt_properties_set( properties, "mlt_image_format", "rgb" );
-					img_fmt = mlt_image_rgb;
+					enc_ctx->img_fmt = mlt_image_rgb;
 				}
 			}
 		}
@@ -1751,16 +2210,15 @@ static void *consumer_thread( void *arg )
 	}
 
 	// Allocate picture
-	enum AVPixelFormat pix_fmt;
 	if ( enc_ctx->video_st ) {
 #if defined(AVFILTER)
-		pix_fmt = enc_ctx->vcodec_ctx->pix_fmt == AV_PIX_FMT_VAAPI ?
+		enc_ctx->pix_fmt = enc_ctx->vcodec_ctx->pix_fmt == AV_PIX_FMT_VAAPI ?
 				   AV_PIX_FMT_NV12 : enc_ctx->vcodec_ctx->pix_fmt;
 #else
-		pix_fmt = enc_ctx->vcodec_ctx->pix_fmt;
+		enc_ctx->pix_fmt = enc_ctx->vcodec_ctx->pix_fmt;
 #endif
-		converted_avframe = alloc_picture( pix_fmt, width, height );
-		if ( !converted_avframe ) {
+		enc_ctx->converted_avframe = alloc_picture( enc_ctx->pix_fmt, width, height );
+		if ( !enc_ctx->converted_avframe ) {
 			mlt_log_error( MLT_CONSUMER_SERVICE( consumer ), "failed to allocate video AVFrame\n" );
 			mlt_events_fire( properties, "consumer-fatal-error", mlt_event_data_none() );
 			goto on_fatal_error;
@@ -1784,6 +2242,14 @@ static void *consumer_thread( void *arg )
 		}
 	}
 
+	// Optionally run conversion, encoding and muxing on their own threads
+	int pipeline_depth = mlt_properties_get_int( properties, "pipeline" );
+#ifdef AVFMT_RAWPICTURE
+	if ( enc_ctx->oc->oformat->flags & AVFMT_RAWPICTURE )
+		pipeline_depth = 0;
+#endif
+	mlt_image_format render_fmt = enc_ctx->img_fmt;
+
 	// Get the starting time (can ignore the times above)
 	gettimeofday( &ante, NULL );
 
@@ -1825,6 +2291,9 @@ static void *consumer_thread( void *arg )
 				}
 
 				header_written = 1;
+
+				if ( pipeline_depth > 0 )
+					pipeline_start( enc_ctx, pipeline_depth );
 			}
 
 			// Increment frames dispatched
@@ -1836,9 +2305,15 @@ static void *consumer_thread( void *arg )
 			// Get audio and append to the fifo
 			if ( !enc_ctx->terminated && enc_ctx->audio_st[0] )
 			{
-				samples = mlt_audio_calculate_frame_samples( fps, enc_ctx->frequency, count ++ );
-				enc_ctx->channels = enc_ctx->total_channels;
-				mlt_frame_get_audio( frame, &pcm, &aud_fmt, &enc_ctx->frequency, &enc_ctx->channels, &samples );
+				int frequency = enc_ctx->frequency;
+				int channels = enc_ctx->total_channels;
+				samples = mlt_audio_calculate_frame_samples( fps, frequency, count ++ );
+				mlt_frame_get_audio( frame, &pcm, &aud_fmt, &frequency, &channels, &samples );
+
+				// The audio encoder thread may be reading these
+				pthread_mutex_lock( &enc_ctx->audio_mutex );
+				enc_ctx->frequency = frequency;
+				enc_ctx->channels = channels;
 
 				// Save the audio channel remap properties for later
 				mlt_properties_pass( enc_ctx->frame_meta_properties, frame_properties, "meta.map.audio." );
@@ -1859,21 +2334,37 @@ static void *consumer_thread( void *arg )
 					sample_fifo_append( enc_ctx->fifo, pcm, samples * enc_ctx->channels * enc_ctx->sample_bytes );
 					total_time += ( samples * 1000000 ) / enc_ctx->frequency;
 				}
+				pthread_cond_signal( &enc_ctx->audio_cond );
+				pthread_mutex_unlock( &enc_ctx->audio_mutex );
 				if ( !enc_ctx->video_st ) {
 					mlt_events_fire( properties, "consumer-frame-show", mlt_event_data_from_frame(frame) );
 				}
 			}
 
 			// Encode the image
-			if ( !enc_ctx->terminated && enc_ctx->video_st )
+			if ( !enc_ctx->terminated && enc_ctx->video_queue )
+			{
+				// Render here so the video thread only converts and encodes
+				if ( mlt_properties_get_int( frame_properties, "rendered" ) )
+				{
+					mlt_image_format img_fmt = render_fmt;
+					int img_width = width, img_height = height;
+					mlt_frame_get_image( frame, &image, &img_fmt, &img_width, &img_height, 0 );
+				}
+				stage_queue_push( enc_ctx->video_queue, frame );
+			}
+			else if ( !enc_ctx->terminated && enc_ctx->video_st )
 				mlt_deque_push_back( queue, frame );
 			else
 				mlt_frame_close( frame );
 			frame = NULL;
 		}
 
-		// While we have stuff to process, process...
-		while ( 1 )
+		if ( atomic_load( &enc_ctx->pipeline_error ) )
+			goto on_fatal_error;
+
+		// While we have stuff to process, process (the pipeline threads do this when enabled)
+		while ( !enc_ctx->mux_queue )
 		{
 			// Write interleaved audio and video frames
 			if ( !enc_ctx->video_st || ( enc_ctx->video_st && enc_ctx->audio_st[0] && enc_ctx->audio_pts < enc_ctx->video_pts ) )
@@ -1900,205 +2391,12 @@ static void *consumer_thread( void *arg )
 				// Write video
 				if ( mlt_deque_count( queue ) )
 				{
-					int ret = 0;
-					AVCodecContext *c = enc_ctx->vcodec_ctx;
-
 					frame = mlt_deque_pop_front( queue );
-					frame_properties = MLT_FRAME_PROPERTIES( frame );
-
-					if ( mlt_properties_get_int( frame_properties, "rendered" ) )
-					{
-						AVFrame video_avframe;
-						mlt_frame_get_image( frame, &image, &img_fmt, &img_width, &img_height, 0 );
-
-						mlt_image_format_planes( img_fmt, width, height, image, video_avframe.data, video_avframe.linesize );
-
-						// Do the colour space conversion
-						int srcfmt = pick_pix_fmt( img_fmt );
-						int flags = mlt_get_sws_flags( width, height, srcfmt, width, height, pix_fmt);
-						struct SwsContext *context = sws_getContext( width, height, srcfmt,
-							width, height, pix_fmt, flags, NULL, NULL, NULL);
-						int src_colorspace = mlt_properties_get_int( frame_properties, "colorspace" );
-						int src_full_range = mlt_properties_get_int( frame_properties, "full_range" );
-						mlt_set_luma_transfer( context, src_colorspace, dst_colorspace, src_full_range, dst_full_range );
-						sws_scale( context, (const uint8_t* const*) video_avframe.data, video_avframe.linesize, 0, height,
-							converted_avframe->data, converted_avframe->linesize);
-						sws_freeContext( context );
-
-						mlt_events_fire( properties, "consumer-frame-show", mlt_event_data_from_frame(frame) );
-
-						// Apply the alpha if applicable
-						if ( !mlt_properties_get( properties, "mlt_image_format" ) ||
-						     strcmp( mlt_properties_get( properties, "mlt_image_format" ), "rgba" ) )
-						if ( c->pix_fmt == AV_PIX_FMT_RGBA ||
-						     c->pix_fmt == AV_PIX_FMT_ARGB ||
-						     c->pix_fmt == AV_PIX_FMT_BGRA )
-						{
-							uint8_t *p;
-							uint8_t *alpha = mlt_frame_get_alpha( frame );
-							if ( alpha )
-							{
-								register int n;
-
-								for ( i = 0; i < height; i ++ )
-								{
-									n = ( width + 7 ) / 8;
-									p = converted_avframe->data[ 0 ] + i * converted_avframe->linesize[ 0 ] + 3;
-
-									switch( width % 8 )
-									{
-										case 0:	do { *p = *alpha++; p += 4;
-										case 7:		 *p = *alpha++; p += 4;
-										case 6:		 *p = *alpha++; p += 4;
-										case 5:		 *p = *alpha++; p += 4;
-										case 4:		 *p = *alpha++; p += 4;
-										case 3:		 *p = *alpha++; p += 4;
-										case 2:		 *p = *alpha++; p += 4;
-										case 1:		 *p = *alpha++; p += 4;
-												}
-												while( --n );
-									}
-								}
-							}
-							else
-							{
-								for ( i = 0; i < height; i ++ )
-								{
-									int n = width;
-									uint8_t* p = converted_avframe->data[ 0 ] + i * converted_avframe->linesize[ 0 ] + 3;
-									while ( n )
-									{
-										*p = 255;
-										p += 4;
-										n--;
-									}
-								}
-							}
-						}
-#if defined(AVFILTER)
-						if (AV_PIX_FMT_VAAPI == c->pix_fmt) {
-							AVFilterContext *vfilter_in = mlt_properties_get_data(properties, "vfilter_in", NULL);
-							AVFilterContext *vfilter_out = mlt_properties_get_data(properties, "vfilter_out", NULL);
-							if (vfilter_in && vfilter_out) {
-								if (!avframe)
-									avframe = av_frame_alloc();									
-								ret = av_buffersrc_add_frame(vfilter_in, converted_avframe);
-								ret = av_buffersink_get_frame(vfilter_out, avframe);
-								if (ret < 0) {
-									mlt_log_warning(MLT_CONSUMER_SERVICE(consumer), "error with hwupload: %d (frame %d)\n", ret, enc_ctx->frame_count);
-									if (++enc_ctx->error_count > 2)
-										goto on_fatal_error;
-									ret = 0;
-								}
-							}
-						} else {
-							avframe = converted_avframe;
-						}
-#else
-						avframe = converted_avframe;
-#endif
-					}
-
-#ifdef AVFMT_RAWPICTURE
-					if (enc_ctx->oc->oformat->flags & AVFMT_RAWPICTURE)
-					{
-	 					// raw video case. The API will change slightly in the near future for that
-						AVPacket pkt;
-						av_init_packet(&pkt);
-
-						// Set frame interlace hints
-						if ( mlt_properties_get_int( frame_properties, "progressive" ) )
-							c->field_order = AV_FIELD_PROGRESSIVE;
-						else
-							c->field_order = (mlt_properties_get_int( frame_properties, "top_field_first" )) ? AV_FIELD_TB : AV_FIELD_BT;
-						pkt.flags |= AV_PKT_FLAG_KEY;
-						pkt.stream_index = enc_ctx->video_st->index;
-						pkt.data = (uint8_t*) avframe;
-						pkt.size = sizeof(AVPicture);
-
-						ret = av_write_frame(enc_ctx->oc, &pkt);
-					} 
-					else 
-#endif
-					{
-						AVPacket pkt;
-						av_init_packet( &pkt );
-						if ( c->codec->id == AV_CODEC_ID_RAWVIDEO ) {
-							pkt.data = NULL;
-							pkt.size = 0;
-						} else {
-							pkt.data = video_outbuf;
-							pkt.size = video_outbuf_size;
-						}
-
-						// Set the quality
-						avframe->quality = c->global_quality;
-						avframe->pts = enc_ctx->frame_count;
-
-						// Set frame interlace hints
-						avframe->interlaced_frame = !mlt_properties_get_int( frame_properties, "progressive" );
-						avframe->top_field_first = mlt_properties_get_int( frame_properties, "top_field_first" );
-						if ( mlt_properties_get_int( frame_properties, "progressive" ) )
-							c->field_order = AV_FIELD_PROGRESSIVE;
-						else if ( c->codec_id == AV_CODEC_ID_MJPEG )
-							c->field_order = (mlt_properties_get_int( frame_properties, "top_field_first" )) ? AV_FIELD_TT : AV_FIELD_BB;
-						else
-							c->field_order = (mlt_properties_get_int( frame_properties, "top_field_first" )) ? AV_FIELD_TB : AV_FIELD_BT;
-
-	 					// Encode the image
-						ret = avcodec_send_frame( c, avframe );
-						if ( ret < 0 ) {
-							pkt.size = ret;
-						} else {
-receive_video_packet:
-							ret = avcodec_receive_packet( c, &pkt );
-							if ( ret == AVERROR(EAGAIN) || ret == AVERROR_EOF )
-								pkt.size = ret = 0;
-							else if ( ret < 0 )
-								pkt.size = ret;
-						}
-
-	 					// If zero size, it means the image was buffered
-						if ( pkt.size > 0 )
-						{
-							av_packet_rescale_ts( &pkt, c->time_base, enc_ctx->video_st->time_base );
-							pkt.stream_index = enc_ctx->video_st->index;
-
-							// write the compressed frame in the media file
-							ret = av_interleaved_write_frame(enc_ctx->oc, &pkt);
-							mlt_log_debug( MLT_CONSUMER_SERVICE( consumer ), " frame_size %d\n", c->frame_size );
-							
-							// Dual pass logging
-							if ( mlt_properties_get_data( properties, "_logfile", NULL ) && c->stats_out )
-								fprintf( mlt_properties_get_data( properties, "_logfile", NULL ), "%s", c->stats_out );
-
-							enc_ctx->error_count = 0;
-
-							if ( !ret )
-								goto receive_video_packet;
-						}
-						else if ( pkt.size < 0 )
-						{
-							mlt_log_warning( MLT_CONSUMER_SERVICE(consumer), "error with video encode: %d (frame %d)\n", pkt.size, enc_ctx->frame_count );
-							if ( ++enc_ctx->error_count > 2 )
-								goto on_fatal_error;
-							ret = 0;
-						}
- 					}
-					enc_ctx->frame_count++;
-					enc_ctx->video_pts = (double) enc_ctx->frame_count * av_q2d( enc_ctx->vcodec_ctx->time_base );
-					if ( ret )
-					{
-						mlt_log_fatal( MLT_CONSUMER_SERVICE(consumer), "error writing video frame: %d\n", ret );
-						mlt_events_fire( properties, "consumer-fatal-error", mlt_event_data_none() );
-						goto on_fatal_error;
-					}
+					int r = encode_video( enc_ctx, frame );
 					mlt_frame_close( frame );
 					frame = NULL;
-#if defined(AVFILTER)
-					if (AV_PIX_FMT_VAAPI == c->pix_fmt)
-						av_frame_unref( avframe );
-#endif
+					if ( r < 0 )
+						goto on_fatal_error;
 				}
 				else
 				{
@@ -2129,6 +2427,9 @@ receive_video_packet:
 		}
 	}
 
+	// Let the pipeline finish the queued frames before flushing
+	pipeline_stop( enc_ctx );
+
 	// Flush the encoder buffers
 	if ( real_time_output <= 0 )
 	{
@@ -2159,8 +2460,8 @@ receive_video_packet:
 				pkt.data = NULL;
 				pkt.size = 0;
 			} else {
-				pkt.data = video_outbuf;
-				pkt.size = video_outbuf_size;
+				pkt.data = enc_ctx->video_outbuf;
+				pkt.size = enc_ctx->video_outbuf_size;
 			}
 
 			// Encode the image
@@ -2185,7 +2486,7 @@ receive_video_packet:
 			pkt.stream_index = enc_ctx->video_st->index;
 
 			// write the compressed frame in the media file
-			if ( av_interleaved_write_frame( enc_ctx->oc, &pkt ) != 0 )
+			if ( write_packet( enc_ctx, &pkt ) != 0 )
 			{
 				mlt_log_fatal( MLT_CONSUMER_SERVICE(consumer), "error writing flushed video frame\n" );
 				mlt_events_fire( properties, "consumer-fatal-error", mlt_event_data_none() );
@@ -2199,19 +2500,22 @@ on_fatal_error:
 	if ( frame )
 		mlt_frame_close( frame );
 
+	// Drain and stop the pipeline threads
+	pipeline_close( enc_ctx );
+
 	// Write the trailer, if any
 	if ( frames )
 		av_write_trailer( enc_ctx->oc );
 
 	// Clean up input and output frames
-	if ( converted_avframe )
-		av_free( converted_avframe->data[0] );
-	av_free( converted_avframe );
+	if ( enc_ctx->converted_avframe )
+		av_free( enc_ctx->converted_avframe->data[0] );
+	av_free( enc_ctx->converted_avframe );
 #if defined(AVFILTER)
 	if (enc_ctx->video_st && enc_ctx->vcodec_ctx && AV_PIX_FMT_VAAPI == enc_ctx->vcodec_ctx->pix_fmt)
-		av_frame_free(&avframe);
+		av_frame_free(&enc_ctx->avframe);
 #endif
-	av_free( video_outbuf );
+	av_free( enc_ctx->video_outbuf );
 	av_free( enc_ctx->audio_avframe );
 
 	// close each codec
@@ -2280,6 +2584,8 @@ on_fatal_error:
 	while ( ( frame = mlt_deque_pop_back( queue ) ) )
 		mlt_frame_close( frame );
 
+	pthread_mutex_destroy( &enc_ctx->audio_mutex );
+	pthread_cond_destroy( &enc_ctx->audio_cond );
 	mlt_pool_release( enc_ctx );
 
 	return NULL;
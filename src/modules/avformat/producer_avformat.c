@@ -69,6 +69,8 @@
 #include <math.h>
 #include <wchar.h>
 #include <stdatomic.h>
+#include <stdio.h>
+#include <sys/stat.h>
 
 #define POSITION_INITIAL (-2)
 #define POSITION_INVALID (-1)
@@ -77,6 +79,21 @@
 #define MAX_AUDIO_FRAME_SIZE (192000) // 1 second of 48khz 32bit audio
 #define IMAGE_ALIGN (1)
 #define VFR_THRESHOLD (3) // The minimum number of video frames with differing durations to be considered VFR.
+#define SEEK_INDEX_VERSION (1)
+
+/** A video stream's keyframes, read from or written to a sidecar file next to the media.
+*/
+
+typedef struct
+{
+	int stream;
+	int64_t first_pts;
+	int vfr;
+	int count;
+	int64_t *pts; // the keyframes' timestamps in the stream time base, ascending
+	int64_t *pos; // their byte positions in the file, or -1
+}
+seek_index_s, *seek_index;
 
 struct producer_avformat_s
 {
@@ -112,6 +129,7 @@ struct producer_avformat_s
 	unsigned int invalid_pts_counter;
 	unsigned int invalid_dts_counter;
 	mlt_cache image_cache;
+	mlt_sws_cache sws_cache;
 	int yuv_colorspace, color_primaries, color_trc;
 	int full_range;
 	pthread_mutex_t video_mutex;
@@ -132,6 +150,27 @@ struct producer_avformat_s
 	int autorotate;
 	int is_audio_synchronizing;
 	int video_send_result;
+	int lowres; // the lowres to open the video codec with
+	int video_frame_lowres; // the lowres of the codec when it decoded video_frame
+	// decode read-ahead
+	pthread_t readahead_thread;
+	pthread_mutex_t readahead_mutex;
+	pthread_cond_t readahead_cond;
+	int readahead_started;
+	int readahead_stop;
+	atomic_int readahead_generation;
+	mlt_position readahead_last;  // the last position requested by the consumer
+	mlt_position readahead_next;  // the next position for the thread to decode
+	mlt_position readahead_end;   // the thread decodes up to but not including this
+	mlt_image_format readahead_format;
+	int readahead_full_range;
+	int readahead_width, readahead_height;
+	int readahead_rescale_width, readahead_rescale_height;
+	// keyframe index scan
+	pthread_t index_thread;
+	int index_started;
+	atomic_int index_stop;
+	char *index_filename;
 #if USE_HWACCEL
 	struct {
 		int pix_fmt;
@@ -151,11 +190,15 @@ static void producer_avformat_close( producer_avformat );
 static void producer_close( mlt_producer parent );
 static void producer_set_up_video( producer_avformat self, mlt_frame frame );
 static void producer_set_up_audio( producer_avformat self, mlt_frame frame );
+static seek_index seek_index_get( producer_avformat self, const char *filename );
+static void seek_index_scan( producer_avformat self, const char *filename );
 static void apply_properties( void *obj, mlt_properties properties, int flags );
 static int video_codec_init( producer_avformat self, int index, mlt_properties properties );
 static void get_audio_streams_info( producer_avformat self );
 static mlt_audio_format pick_audio_format( int sample_fmt );
 static int pick_av_pixel_format( int *pix_fmt );
+static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_format *format, int *width, int *height, int writable );
+static void on_sws_cache_stats( mlt_properties owner, mlt_producer producer );
 
 /** Constructor for libavformat.
 */
@@ -223,12 +266,25 @@ mlt_producer producer_avformat_init( mlt_profile profile, const char *service, c
 				mlt_properties_set_int( properties, "video_index",  self->video_index );
 				mlt_service_cache_put( MLT_PRODUCER_SERVICE(producer), "producer_avformat", self, 0, (mlt_destructor) producer_avformat_close );
 				mlt_properties_set_int( properties, "mute_on_pause",  1 );
+				mlt_events_register( properties, "sws-cache-stats" );
+				mlt_events_listen( properties, producer, "sws-cache-stats", ( mlt_listener )on_sws_cache_stats );
 			}
 		}
 	}
 	return producer;
 }
 
+/** Publish the scaler cache counters when an application asks for them.
+*/
+
+static void on_sws_cache_stats( mlt_properties owner, mlt_producer producer )
+{
+	mlt_cache_item item = mlt_service_cache_get( MLT_PRODUCER_SERVICE( producer ), "producer_avformat" );
+	producer_avformat self = mlt_cache_item_data( item, NULL );
+	mlt_sws_cache_get_stats( self ? self->sws_cache : NULL, owner );
+	mlt_cache_item_close( item );
+}
+
 int list_components( char* file )
 {
 	int skip = 0;
@@ -644,7 +700,7 @@ static enum AVPixelFormat pick_pix_fmt( enum AVPixelFormat pix_fmt )
 	}
 }
 
-static int get_basic_info( producer_avformat self, mlt_profile profile, const char *filename )
+static int get_basic_info( producer_avformat self, mlt_profile profile, const char *filename, seek_index index )
 {
 	int error = 0;
 
@@ -693,7 +749,12 @@ static int get_basic_info( producer_avformat self, mlt_profile profile, const ch
 		// protocols can indicate if they support seeking
 		self->seekable = format->pb->seekable;
 	}
-	if ( self->seekable )
+	if ( self->seekable && index )
+	{
+		// The index was built by scanning the file, which was seekable then
+		mlt_properties_set_int( properties, "seekable", self->seekable );
+	}
+	else if ( self->seekable )
 	{
 		// Do a more rigorous test of seekable on a disposable context
 		if ( format->nb_streams > 0 && format->streams[0]->codecpar && format->streams[0]->codecpar->codec_id != AV_CODEC_ID_WEBP )
@@ -876,11 +937,23 @@ static int producer_open(producer_avformat self, mlt_profile profile, const char
 		{
 			// Find default audio and video streams
 			find_default_streams( self );
-			error = get_basic_info( self, profile, filename );
+			seek_index index = seek_index_get( self, filename );
+			error = get_basic_info( self, profile, filename, index );
 
 			// Initialize position info
 			self->first_pts = AV_NOPTS_VALUE;
 			self->last_position = POSITION_INITIAL;
+			if ( index && index->stream == self->video_index )
+			{
+				// The index already knows what find_first_pts() would probe for
+				self->first_pts = index->first_pts;
+				if ( index->vfr )
+					mlt_properties_set_int( properties, "meta.media.variable_frame_rate", 1 );
+			}
+			else if ( !error && self->seekable && self->video_index != -1 && mlt_properties_get_int( properties, "seek_index" ) )
+			{
+				seek_index_scan( self, filename );
+			}
 
 #if USE_HWACCEL
 			AVDictionaryEntry *hwaccel = av_dict_get( params, "hwaccel", NULL, 0 );
@@ -1129,6 +1202,271 @@ static void find_first_pts( producer_avformat self, int video_index )
 	av_seek_frame( context, -1, 0, AVSEEK_FLAG_BACKWARD );
 }
 
+static void seek_index_close( seek_index index )
+{
+	if ( index )
+	{
+		free( index->pts );
+		free( index->pos );
+		free( index );
+	}
+}
+
+/** Get the name of the sidecar file and the size and modification time it must match.
+*/
+
+static char *seek_index_filename( const char *filename, struct stat *st )
+{
+	char *result = NULL;
+	if ( filename && !stat( filename, st ) && S_ISREG( st->st_mode ) )
+	{
+		result = malloc( strlen( filename ) + 10 );
+		sprintf( result, "%s.mltindex", filename );
+	}
+	return result;
+}
+
+static seek_index seek_index_read( const char *filename )
+{
+	struct stat st;
+	char *index_filename = seek_index_filename( filename, &st );
+	FILE *file = index_filename ? fopen( index_filename, "r" ) : NULL;
+	seek_index index = NULL;
+	int version = 0;
+	long long size = 0, mtime = 0, first_pts = 0;
+	int stream = -1, vfr = 0, count = -1, i;
+
+	if ( file
+		 && fscanf( file, "mlt_seek_index %d\n", &version ) == 1 && version == SEEK_INDEX_VERSION
+		 && fscanf( file, "size %lld\nmtime %lld\n", &size, &mtime ) == 2
+		 && size == (long long) st.st_size && mtime == (long long) st.st_mtime
+		 && fscanf( file, "stream %d\nfirst_pts %lld\nvfr %d\ncount %d\n", &stream, &first_pts, &vfr, &count ) == 4
+		 && count > 0 )
+	{
+		index = calloc( 1, sizeof( *index ) );
+		index->stream = stream;
+		index->first_pts = first_pts;
+		index->vfr = vfr;
+		index->pts = malloc( count * sizeof( int64_t ) );
+		index->pos = malloc( count * sizeof( int64_t ) );
+		for ( i = 0; i < count; i++ )
+		{
+			long long pts, pos;
+			if ( fscanf( file, "%lld %lld\n", &pts, &pos ) != 2 )
+				break;
+			index->pts[ i ] = pts;
+			index->pos[ i ] = pos;
+		}
+		index->count = i;
+		if ( i != count )
+		{
+			seek_index_close( index );
+			index = NULL;
+		}
+	}
+	if ( file )
+		fclose( file );
+	free( index_filename );
+	return index;
+}
+
+static void seek_index_write( seek_index index, const char *filename, mlt_service service )
+{
+	struct stat st;
+	char *index_filename = seek_index_filename( filename, &st );
+	char *temp = index_filename ? malloc( strlen( index_filename ) + 5 ) : NULL;
+	FILE *file = NULL;
+	int i, error = 1;
+
+	if ( temp )
+	{
+		// Write to a temporary file and rename it so readers never see a partial index
+		sprintf( temp, "%s.tmp", index_filename );
+		file = fopen( temp, "w" );
+	}
+	if ( file )
+	{
+		fprintf( file, "mlt_seek_index %d\nsize %lld\nmtime %lld\n", SEEK_INDEX_VERSION,
+			(long long) st.st_size, (long long) st.st_mtime );
+		fprintf( file, "stream %d\nfirst_pts %lld\nvfr %d\ncount %d\n", index->stream,
+			(long long) index->first_pts, index->vfr, index->count );
+		for ( i = 0; i < index->count; i++ )
+			fprintf( file, "%lld %lld\n", (long long) index->pts[ i ], (long long) index->pos[ i ] );
+		error = fclose( file ) || rename( temp, index_filename );
+		if ( error )
+			remove( temp );
+	}
+	if ( error )
+		mlt_log_verbose( service, "unable to write the seek index %s\n", index_filename ? index_filename : filename );
+	free( temp );
+	free( index_filename );
+}
+
+/** Get the keyframe index for the producer, reading the sidecar file the first time.
+*/
+
+static seek_index seek_index_get( producer_avformat self, const char *filename )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( self->parent );
+	seek_index index = NULL;
+
+	if ( !mlt_properties_get_int( properties, "seek_index" ) )
+		return NULL;
+	index = mlt_properties_get_data( properties, "_seek_index", NULL );
+	if ( !index && !mlt_properties_get_int( properties, "_seek_index_read" ) )
+	{
+		// Only look for the file once per producer
+		mlt_properties_set_int( properties, "_seek_index_read", 1 );
+		index = seek_index_read( filename );
+		if ( index )
+			mlt_properties_set_data( properties, "_seek_index", index, 0, (mlt_destructor) seek_index_close, NULL );
+	}
+	return index;
+}
+
+static int compare_keyframes( const void *a, const void *b )
+{
+	const int64_t *x = a;
+	const int64_t *y = b;
+	return x[0] < y[0] ? -1 : x[0] > y[0];
+}
+
+/** Read all of the video stream's packets, without decoding, to build the keyframe index.
+*/
+
+static void *seek_index_thread( void *arg )
+{
+	producer_avformat self = arg;
+	mlt_service service = MLT_PRODUCER_SERVICE( self->parent );
+	AVFormatContext *context = NULL;
+	AVPacket pkt;
+	int64_t *keyframes = NULL;
+	int64_t prev_pkt_duration = AV_NOPTS_VALUE;
+	int count = 0, size = 0, vfr_countdown = 20, vfr_counter = 0;
+	int stream = self->video_index;
+	int64_t first_pts = AV_NOPTS_VALUE;
+	unsigned int i;
+
+	if ( avformat_open_input( &context, self->index_filename, NULL, NULL ) < 0 )
+		return NULL;
+	if ( avformat_find_stream_info( context, NULL ) < 0 || stream >= (int) context->nb_streams )
+	{
+		avformat_close_input( &context );
+		return NULL;
+	}
+	for ( i = 0; i < context->nb_streams; i++ )
+		if ( (int) i != stream )
+			context->streams[ i ]->discard = AVDISCARD_ALL;
+
+	av_init_packet( &pkt );
+	while ( !atomic_load( &self->index_stop ) && av_read_frame( context, &pkt ) >= 0 )
+	{
+		if ( pkt.stream_index == stream )
+		{
+			// Variable frame rate check as in find_first_pts()
+			if ( vfr_countdown > 0 )
+			{
+				if ( pkt.duration != AV_NOPTS_VALUE && pkt.duration != prev_pkt_duration && prev_pkt_duration != AV_NOPTS_VALUE )
+					++vfr_counter;
+				prev_pkt_duration = pkt.duration;
+				vfr_countdown--;
+			}
+			if ( pkt.flags & AV_PKT_FLAG_KEY )
+			{
+				int64_t pts = pkt.pts != AV_NOPTS_VALUE ? pkt.pts : pkt.dts;
+				if ( first_pts == AV_NOPTS_VALUE )
+					first_pts = ( pkt.dts != AV_NOPTS_VALUE && pkt.dts < 0 ) ? 0 : pts;
+				if ( pts != AV_NOPTS_VALUE )
+				{
+					if ( count == size )
+					{
+						size = size ? size * 2 : 1024;
+						keyframes = realloc( keyframes, size * 2 * sizeof( int64_t ) );
+					}
+					keyframes[ count * 2 ] = pts;
+					keyframes[ count * 2 + 1 ] = pkt.pos;
+					count++;
+				}
+			}
+		}
+		av_packet_unref( &pkt );
+	}
+	avformat_close_input( &context );
+
+	if ( !atomic_load( &self->index_stop ) && count > 0 )
+	{
+		mlt_properties properties = MLT_PRODUCER_PROPERTIES( self->parent );
+		seek_index index = calloc( 1, sizeof( *index ) );
+		int j;
+
+		qsort( keyframes, count, 2 * sizeof( int64_t ), compare_keyframes );
+		index->stream = stream;
+		index->first_pts = first_pts;
+		index->vfr = vfr_counter >= VFR_THRESHOLD;
+		index->count = count;
+		index->pts = malloc( count * sizeof( int64_t ) );
+		index->pos = malloc( count * sizeof( int64_t ) );
+		for ( j = 0; j < count; j++ )
+		{
+			index->pts[ j ] = keyframes[ j * 2 ];
+			index->pos[ j ] = keyframes[ j * 2 + 1 ];
+		}
+		seek_index_write( index, self->index_filename, service );
+		mlt_log_verbose( service, "indexed %d keyframes in %s\n", count, self->index_filename );
+
+		// The index is only published once since seek_video() uses it without a lock
+		if ( !mlt_properties_get_data( properties, "_seek_index", NULL ) )
+			mlt_properties_set_data( properties, "_seek_index", index, 0, (mlt_destructor) seek_index_close, NULL );
+		else
+			seek_index_close( index );
+	}
+	free( keyframes );
+	return NULL;
+}
+
+/** Start building the keyframe index on a background thread.
+*/
+
+static void seek_index_scan( producer_avformat self, const char *filename )
+{
+	struct stat st;
+	if ( self->index_started || stat( filename, &st ) || !S_ISREG( st.st_mode ) )
+		return;
+	self->index_filename = strdup( filename );
+	atomic_init( &self->index_stop, 0 );
+	if ( pthread_create( &self->index_thread, NULL, seek_index_thread, self ) == 0 )
+		self->index_started = 1;
+}
+
+static void seek_index_stop( producer_avformat self )
+{
+	if ( self->index_started )
+	{
+		atomic_store( &self->index_stop, 1 );
+		pthread_join( self->index_thread, NULL );
+		self->index_started = 0;
+	}
+	free( self->index_filename );
+	self->index_filename = NULL;
+}
+
+/** Find the last keyframe at or before a timestamp, or 0 if there is none.
+*/
+
+static int seek_index_find( seek_index index, int64_t timestamp )
+{
+	int low = 0, high = index->count - 1;
+	while ( low < high )
+	{
+		int middle = ( low + high + 1 ) / 2;
+		if ( index->pts[ middle ] <= timestamp )
+			low = middle;
+		else
+			high = middle - 1;
+	}
+	return low;
+}
+
 static int seek_video( producer_avformat self, mlt_position position,
 	int64_t req_position, int preseek )
 {
@@ -1153,23 +1491,62 @@ static int seek_video( producer_avformat self, mlt_position position,
 		if ( self->first_pts == AV_NOPTS_VALUE && self->last_position == POSITION_INITIAL )
 			find_first_pts( self, self->video_index );
 
+		// The keyframe index only applies to the stream it was built for in its own time base
+		seek_index index = mlt_properties_get_data( properties, "_seek_index", NULL );
+		if ( index && ( index->stream != self->video_index
+			|| av_cmp_q( self->video_time_base, context->streams[ self->video_index ]->time_base ) ) )
+			index = NULL;
+
+		// Calculate the timestamp for the requested frame
+		int64_t timestamp = req_position / ( av_q2d( self->video_time_base ) * source_fps );
+		int64_t offset = 0;
+		if ( self->first_pts != AV_NOPTS_VALUE )
+			offset = self->first_pts;
+		else if ( context->start_time != AV_NOPTS_VALUE )
+			offset = context->start_time;
+		timestamp = req_position <= 0 ? 0 : timestamp + offset;
+
+		// With an index, seek forward only when there is a keyframe between here and there
+		int keyframe = index ? seek_index_find( index, timestamp ) : -1;
+		int must_seek = position < self->video_expected || self->last_position < 0;
+		if ( index && !must_seek )
+		{
+			int64_t expected = ( int64_t )( self->video_expected / mlt_producer_get_fps( producer ) * source_fps + 0.5 );
+			expected = expected / ( av_q2d( self->video_time_base ) * source_fps ) + offset;
+			must_seek = keyframe > seek_index_find( index, expected ) && index->pts[ keyframe ] > expected;
+		}
+		else if ( !index )
+		{
+			must_seek = must_seek || position - self->video_expected >= seek_threshold;
+		}
+
 		if ( self->video_frame && position + 1 == self->video_expected )
 		{
 			// We're paused - use last image
 			paused = 1;
 		}
-		else if ( position < self->video_expected || position - self->video_expected >= seek_threshold || self->last_position < 0 )
+		else if ( must_seek )
 		{
-			// Calculate the timestamp for the requested frame
-			int64_t timestamp = req_position / ( av_q2d( self->video_time_base ) * source_fps );
-			if ( req_position <= 0 )
-				timestamp = 0;
-			else if ( self->first_pts != AV_NOPTS_VALUE )
-				timestamp += self->first_pts;
-			else if ( context->start_time != AV_NOPTS_VALUE )
-				timestamp += context->start_time;
-			if ( preseek && av_q2d( self->video_time_base ) != 0 )
+			int flags = AVSEEK_FLAG_BACKWARD;
+			if ( index )
+			{
+				// Go straight to the keyframe, by position where timestamp seeks have to search
+				const AVInputFormat *iformat = context->iformat;
+				if ( index->pts[ keyframe ] <= timestamp )
+					timestamp = index->pts[ keyframe ];
+				else
+					timestamp = 0;
+				if ( timestamp && index->pos[ keyframe ] >= 0 && iformat
+					 && ( iformat->flags & AVFMT_TS_DISCONT ) && !( iformat->flags & AVFMT_NO_BYTE_SEEK ) )
+				{
+					timestamp = index->pos[ keyframe ];
+					flags = AVSEEK_FLAG_BYTE;
+				}
+			}
+			else if ( preseek && av_q2d( self->video_time_base ) != 0 )
+			{
 				timestamp -= 2 / av_q2d( self->video_time_base );
+			}
 			if ( timestamp < 0 )
 				timestamp = 0;
 			mlt_log_debug( MLT_PRODUCER_SERVICE(producer), "seeking timestamp %"PRId64" position " MLT_POSITION_FMT " expected "MLT_POSITION_FMT" last_pos %"PRId64"\n",
@@ -1177,7 +1554,7 @@ static int seek_video( producer_avformat self, mlt_position position,
 
 			// Seek to the timestamp
 			self->video_codec->skip_loop_filter = AVDISCARD_NONREF;
-			av_seek_frame( context, self->video_index, timestamp, AVSEEK_FLAG_BACKWARD );
+			av_seek_frame( context, self->video_index, timestamp, flags );
 
 			// flush any pictures still in decode buffer
 			avcodec_flush_buffers( self->video_codec );
@@ -1342,6 +1719,7 @@ struct sliced_pix_fmt_conv_t
 	enum AVPixelFormat src_format, dst_format;
 	const AVPixFmtDescriptor *src_desc, *dst_desc;
 	int flags, src_colorspace, dst_colorspace, src_full_range, dst_full_range;
+	mlt_sws_cache sws_cache;
 };
 
 static int sliced_h_pix_fmt_conv_proc( int id, int idx, int jobs, void* cookie )
@@ -1349,10 +1727,11 @@ static int sliced_h_pix_fmt_conv_proc( int id, int idx, int jobs, void* cookie )
 	uint8_t *out[4];
 	const uint8_t *in[4];
 	int in_stride[4], out_stride[4];
-	int src_v_chr_pos = -513, dst_v_chr_pos = -513, ret, i, slice_x, slice_w, h, mul, field, slices, interlaced = 0;
+	int src_v_chr_pos = -513, dst_v_chr_pos = -513, i, slot = idx, slice_x, slice_w, h, mul, field, slices, interlaced = 0;
 
 	struct SwsContext *sws;
 	struct sliced_pix_fmt_conv_t* ctx = ( struct sliced_pix_fmt_conv_t* )cookie;
+	mlt_sws_key key;
 
 	interlaced = ctx->frame->interlaced_frame;
 	field = ( interlaced ) ? ( idx & 1 ) : 0;
@@ -1376,29 +1755,18 @@ static int sliced_h_pix_fmt_conv_proc( int id, int idx, int jobs, void* cookie )
 	if ( slice_w <= 0 )
 		return 0;
 
-	sws = sws_alloc_context();
-
-	av_opt_set_int( sws, "srcw", slice_w, 0 );
-	av_opt_set_int( sws, "srch", h, 0 );
-	av_opt_set_int( sws, "src_format", ctx->src_format, 0 );
-	av_opt_set_int( sws, "dstw", slice_w, 0 );
-	av_opt_set_int( sws, "dsth", h, 0 );
-	av_opt_set_int( sws, "dst_format", ctx->dst_format, 0 );
-	av_opt_set_int( sws, "sws_flags", ctx->flags, 0 );
-
-	av_opt_set_int( sws, "src_h_chr_pos", -513, 0 );
-	av_opt_set_int( sws, "src_v_chr_pos", src_v_chr_pos, 0 );
-	av_opt_set_int( sws, "dst_h_chr_pos", -513, 0 );
-	av_opt_set_int( sws, "dst_v_chr_pos", dst_v_chr_pos, 0 );
-
-	if ( ( ret = sws_init_context( sws, NULL, NULL ) ) < 0 )
-	{
-		mlt_log_error( NULL, "%s:%d: sws_init_context failed, ret=%d\n", __FUNCTION__, __LINE__, ret );
-		sws_freeContext( sws );
+	// Every job has its own slot in the cache, so the contexts persist per slice
+	mlt_sws_key_init( &key, slice_w, h, ctx->src_format, slice_w, h, ctx->dst_format );
+	key.flags = ctx->flags;
+	key.src_v_chr_pos = src_v_chr_pos;
+	key.dst_v_chr_pos = dst_v_chr_pos;
+	key.src_colorspace = ctx->src_colorspace;
+	key.dst_colorspace = ctx->dst_colorspace;
+	key.src_full_range = ctx->src_full_range;
+	key.dst_full_range = ctx->dst_full_range;
+	sws = mlt_sws_cache_get( ctx->sws_cache, slot, &key, NULL );
+	if ( !sws )
 		return 0;
-	}
-
-	mlt_set_luma_transfer( sws, ctx->src_colorspace, ctx->dst_colorspace, ctx->src_full_range, ctx->dst_full_range );
 
 #define PIX_DESC_BPP(DESC) (DESC.step)
 
@@ -1424,23 +1792,22 @@ static int sliced_h_pix_fmt_conv_proc( int id, int idx, int jobs, void* cookie )
 
 	sws_scale( sws, in, in_stride, 0, h, out, out_stride );
 
-	sws_freeContext( sws );
-
 	return 0;
 }
 
 // returns resulting YUV colorspace
+// width and height are of the decoded picture, out_width and out_height of the buffer
 static int convert_image( producer_avformat self, AVFrame *frame, uint8_t *buffer, int pix_fmt,
-	mlt_image_format *format, int width, int height, uint8_t **alpha, int dst_full_range )
+	mlt_image_format *format, int width, int height, int out_width, int out_height, uint8_t **alpha, int dst_full_range )
 {
 	mlt_profile profile = mlt_service_profile( MLT_PRODUCER_SERVICE( self->parent ) );
 	int result = self->yuv_colorspace;
 
 	mlt_log_timings_begin();
 
-	mlt_log_debug( MLT_PRODUCER_SERVICE(self->parent), "%s @ %dx%d space %d->%d\n",
+	mlt_log_debug( MLT_PRODUCER_SERVICE(self->parent), "%s @ %dx%d -> %dx%d space %d->%d\n",
 		mlt_image_format_name( *format ),
-		width, height, self->yuv_colorspace, profile->colorspace );
+		width, height, out_width, out_height, self->yuv_colorspace, profile->colorspace );
 
 	// extract alpha from planar formats
 	if ( ( pix_fmt == AV_PIX_FMT_YUVA420P || pix_fmt == AV_PIX_FMT_YUVA444P)
@@ -1459,56 +1826,69 @@ static int convert_image( producer_avformat self, AVFrame *frame, uint8_t *buffe
 
 	int src_pix_fmt = pix_fmt;
 	pick_av_pixel_format( &src_pix_fmt );
+	if ( !self->sws_cache )
+		self->sws_cache = mlt_sws_cache_init();
 	if ( *format == mlt_image_yuv420p )
 	{
 		// This is a special case. Movit wants the full range, if available.
 		// Thankfully, there is not much other use of yuv420p except consumer
 		// avformat with no filters and explicitly requested.
-		int flags = mlt_get_sws_flags(width, height, src_pix_fmt, width, height, AV_PIX_FMT_YUV420P);
-		struct SwsContext *context = sws_getContext(width, height, src_pix_fmt,
-			width, height, AV_PIX_FMT_YUV420P, flags, NULL, NULL, NULL);
+		mlt_sws_key key;
+		int transfer_result;
+		mlt_sws_key_init( &key, width, height, src_pix_fmt, out_width, out_height, AV_PIX_FMT_YUV420P );
+		key.src_colorspace = self->yuv_colorspace;
+		key.dst_colorspace = profile->colorspace;
+		key.src_full_range = self->full_range;
+		key.dst_full_range = dst_full_range;
+		struct SwsContext *context = mlt_sws_cache_get( self->sws_cache, 0, &key, &transfer_result );
 
 		uint8_t *out_data[4];
 		int out_stride[4];
 		out_data[0] = buffer;
-		out_data[1] = buffer + width * height;
-		out_data[2] = buffer + ( 5 * width * height ) / 4;
-		out_stride[0] = width;
-		out_stride[1] = width >> 1;
-		out_stride[2] = width >> 1;
-		if ( !mlt_set_luma_transfer( context, self->yuv_colorspace, profile->colorspace, self->full_range, dst_full_range ) )
+		out_data[1] = buffer + out_width * out_height;
+		out_data[2] = buffer + ( 5 * out_width * out_height ) / 4;
+		out_stride[0] = out_width;
+		out_stride[1] = out_width >> 1;
+		out_stride[2] = out_width >> 1;
+		if ( !transfer_result )
 			result = profile->colorspace;
-		sws_scale( context, (const uint8_t* const*) frame->data, frame->linesize, 0, height,
-			out_data, out_stride);
-		sws_freeContext( context );
+		if ( context )
+			sws_scale( context, (const uint8_t* const*) frame->data, frame->linesize, 0, height,
+				out_data, out_stride);
 	}
 	else if ( *format == mlt_image_rgb )
 	{
-		int flags = mlt_get_sws_flags(width, height, src_pix_fmt, width, height, AV_PIX_FMT_RGB24);
-		struct SwsContext *context = sws_getContext( width, height, src_pix_fmt,
-			width, height, AV_PIX_FMT_RGB24, flags, NULL, NULL, NULL);
+		mlt_sws_key key;
+		mlt_sws_key_init( &key, width, height, src_pix_fmt, out_width, out_height, AV_PIX_FMT_RGB24 );
+		// libswscale wants the RGB colorspace to be SWS_CS_DEFAULT, which is = SWS_CS_ITU601.
+		key.src_colorspace = self->yuv_colorspace;
+		key.dst_colorspace = 601;
+		key.src_full_range = self->full_range;
+		key.dst_full_range = 1;
+		struct SwsContext *context = mlt_sws_cache_get( self->sws_cache, 0, &key, NULL );
 		uint8_t *out_data[4];
 		int out_stride[4];
-		av_image_fill_arrays(out_data, out_stride, buffer, AV_PIX_FMT_RGB24, width, height, IMAGE_ALIGN);
-		// libswscale wants the RGB colorspace to be SWS_CS_DEFAULT, which is = SWS_CS_ITU601.
-		mlt_set_luma_transfer( context, self->yuv_colorspace, 601, self->full_range, 1 );
-		sws_scale( context, (const uint8_t* const*) frame->data, frame->linesize, 0, height,
-			out_data, out_stride);
-		sws_freeContext( context );
+		av_image_fill_arrays(out_data, out_stride, buffer, AV_PIX_FMT_RGB24, out_width, out_height, IMAGE_ALIGN);
+		if ( context )
+			sws_scale( context, (const uint8_t* const*) frame->data, frame->linesize, 0, height,
+				out_data, out_stride);
 	}
 	else if ( *format == mlt_image_rgba )
 	{
-		int flags = mlt_get_sws_flags(width, height, src_pix_fmt, width, height, AV_PIX_FMT_RGBA);
-		struct SwsContext *context = sws_getContext( width, height, src_pix_fmt,
-			width, height, AV_PIX_FMT_RGBA, flags, NULL, NULL, NULL);
+		mlt_sws_key key;
+		mlt_sws_key_init( &key, width, height, src_pix_fmt, out_width, out_height, AV_PIX_FMT_RGBA );
+		// libswscale wants the RGB colorspace to be SWS_CS_DEFAULT, which is = SWS_CS_ITU601.
+		key.src_colorspace = self->yuv_colorspace;
+		key.dst_colorspace = 601;
+		key.src_full_range = self->full_range;
+		key.dst_full_range = 1;
+		struct SwsContext *context = mlt_sws_cache_get( self->sws_cache, 0, &key, NULL );
 		uint8_t *out_data[4];
 		int out_stride[4];
-		av_image_fill_arrays(out_data, out_stride, buffer, AV_PIX_FMT_RGBA, width, height, IMAGE_ALIGN);
-		// libswscale wants the RGB colorspace to be SWS_CS_DEFAULT, which is = SWS_CS_ITU601.
-		mlt_set_luma_transfer( context, self->yuv_colorspace, 601, self->full_range, 1 );
-		sws_scale( context, (const uint8_t* const*) frame->data, frame->linesize, 0, height,
-			out_data, out_stride);
-		sws_freeContext( context );
+		av_image_fill_arrays(out_data, out_stride, buffer, AV_PIX_FMT_RGBA, out_width, out_height, IMAGE_ALIGN);
+		if ( context )
+			sws_scale( context, (const uint8_t* const*) frame->data, frame->linesize, 0, height,
+				out_data, out_stride);
 	}
 	else
 	{
@@ -1523,34 +1903,56 @@ static int convert_image( producer_avformat self, AVFrame *frame, uint8_t *buffe
 			.dst_colorspace = profile->colorspace,
 			.src_full_range = self->full_range,
 			.dst_full_range = dst_full_range,
+			.sws_cache = self->sws_cache,
 		};
 		ctx.src_format = (self->full_range && src_pix_fmt == AV_PIX_FMT_YUV422P) ? AV_PIX_FMT_YUVJ422P : src_pix_fmt;
 		ctx.src_desc = av_pix_fmt_desc_get( ctx.src_format );
 		ctx.dst_desc = av_pix_fmt_desc_get( ctx.dst_format );
-		ctx.flags = mlt_get_sws_flags(width, height, ctx.src_format, width, height, ctx.dst_format);
+		ctx.flags = mlt_get_sws_flags(width, height, ctx.src_format, out_width, out_height, ctx.dst_format);
 
-		av_image_fill_arrays(ctx.out_data, ctx.out_stride, buffer, ctx.dst_format, width, height, IMAGE_ALIGN);
+		av_image_fill_arrays(ctx.out_data, ctx.out_stride, buffer, ctx.dst_format, out_width, out_height, IMAGE_ALIGN);
 
-		int sliced = !getenv("MLT_AVFORMAT_SLICED_PIXFMT_DISABLE") && src_pix_fmt != ctx.dst_format;
-		if ( sliced ) {
-			ctx.slice_w = ( width < 1000 )
-				? ( 256 >> frame->interlaced_frame )
-				: ( 512 >> frame->interlaced_frame );
-		} else {
-			ctx.slice_w = width;
+		if ( out_width != width || out_height != height )
+		{
+			// Scale a preview in one pass. Slices of columns would each be
+			// scaled by a slightly different factor, which shows as seams.
+			// Only progressive frames are reduced for a preview.
+			mlt_sws_key key;
+			mlt_sws_key_init( &key, width, height, ctx.src_format, out_width, out_height, ctx.dst_format );
+			if ( AV_PIX_FMT_YUV420P == ctx.src_format )
+				key.src_v_chr_pos = 128;
+			key.src_colorspace = ctx.src_colorspace;
+			key.dst_colorspace = ctx.dst_colorspace;
+			key.src_full_range = ctx.src_full_range;
+			key.dst_full_range = ctx.dst_full_range;
+			struct SwsContext *context = mlt_sws_cache_get( self->sws_cache, 0, &key, NULL );
+			if ( context )
+				sws_scale( context, (const uint8_t* const*) frame->data, frame->linesize, 0, height,
+					ctx.out_data, ctx.out_stride );
 		}
+		else
+		{
+			int sliced = !getenv("MLT_AVFORMAT_SLICED_PIXFMT_DISABLE") && src_pix_fmt != ctx.dst_format;
+			if ( sliced ) {
+				ctx.slice_w = ( width < 1000 )
+					? ( 256 >> frame->interlaced_frame )
+					: ( 512 >> frame->interlaced_frame );
+			} else {
+				ctx.slice_w = width;
+			}
 
-		c = ( width + ctx.slice_w - 1 ) / ctx.slice_w;
-		int last_slice_w = width - ctx.slice_w * (c - 1);
+			c = ( width + ctx.slice_w - 1 ) / ctx.slice_w;
+			int last_slice_w = width - ctx.slice_w * (c - 1);
 
-		if ( sliced && (last_slice_w % 8) == 0 && !(ctx.src_format == AV_PIX_FMT_YUV422P && last_slice_w % 16) ) {
-			c *= frame->interlaced_frame ? 2 : 1;
-			mlt_slices_run_normal( c, sliced_h_pix_fmt_conv_proc, &ctx );
-		} else {
-			c = frame->interlaced_frame ? 2 : 1;
-			ctx.slice_w = width;
-			for ( i = 0 ; i < c; i++ )
-				sliced_h_pix_fmt_conv_proc( i, i, c, &ctx );
+			if ( sliced && (last_slice_w % 8) == 0 && !(ctx.src_format == AV_PIX_FMT_YUV422P && last_slice_w % 16) ) {
+				c *= frame->interlaced_frame ? 2 : 1;
+				mlt_slices_run_normal( c, sliced_h_pix_fmt_conv_proc, &ctx );
+			} else {
+				c = frame->interlaced_frame ? 2 : 1;
+				ctx.slice_w = width;
+				for ( i = 0 ; i < c; i++ )
+					sliced_h_pix_fmt_conv_proc( i, i, c, &ctx );
+			}
 		}
 
 		result = profile->colorspace;
@@ -1560,28 +1962,172 @@ static int convert_image( producer_avformat self, AVFrame *frame, uint8_t *buffe
 	return result;
 }
 
+/** Get the size of the pictures the codec decodes, before any lowres reduction.
+*/
+
+static void get_codec_size( producer_avformat self, int *width, int *height )
+{
+	// The decoder keeps the full size in coded_width/height and reduces width/height.
+	*width = self->video_codec->lowres ? self->video_codec->coded_width : self->video_codec->width;
+	*height = self->video_codec->lowres ? self->video_codec->coded_height : self->video_codec->height;
+}
+
 static void set_image_size( producer_avformat self, int *width, int *height )
 {
 	double dar = mlt_profile_dar( mlt_service_profile( MLT_PRODUCER_SERVICE(self->parent) ) );
 	double theta  = self->autorotate? get_rotation( MLT_PRODUCER_PROPERTIES(self->parent), self->video_format->streams[self->video_index] ) : 0.0;
+	int codec_width, codec_height;
+	get_codec_size( self, &codec_width, &codec_height );
 	if ( fabs(theta - 90.0) < 1.0 || fabs(theta - 270.0) < 1.0 )
 	{
-		*height = self->video_codec->width;
+		*height = codec_width;
 		// Workaround 1088 encodings missing cropping info.
-		if ( self->video_codec->height == 1088 && dar == 16.0/9.0 )
+		if ( codec_height == 1088 && dar == 16.0/9.0 )
 			*width = 1080;
 		else
-			*width = self->video_codec->height;
+			*width = codec_height;
 	} else {
-		*width = self->video_codec->width;
+		*width = codec_width;
 		// Workaround 1088 encodings missing cropping info.
-		if ( self->video_codec->height == 1088 && dar == 16.0/9.0 )
+		if ( codec_height == 1088 && dar == 16.0/9.0 )
 			*height = 1080;
 		else
-			*height = self->video_codec->height;
+			*height = codec_height;
 	}
 }
 
+/** Get the size to which a preview scale lets the image be decoded and converted.
+ *
+ * A consumer previews at a reduced scale by requesting less than the size of
+ * the profile. The rescale filter then tells the producer the size it is going
+ * to scale the image to, and when that is smaller than the source there is no
+ * need to produce the full size.
+ * \return true if the image may be reduced to \p width x \p height
+ */
+
+static int get_preview_size( producer_avformat self, mlt_properties frame_properties, int request_width, int request_height, int *width, int *height )
+{
+	mlt_profile profile = mlt_service_profile( MLT_PRODUCER_SERVICE( self->parent ) );
+	AVCodecParameters *codec_params = self->video_format->streams[ self->video_index ]->codecpar;
+	int rescale_width = mlt_properties_get_int( frame_properties, "rescale_width" );
+	int rescale_height = mlt_properties_get_int( frame_properties, "rescale_height" );
+	int source_width, source_height;
+
+	if ( !request_width || !request_height || rescale_width <= 0 || rescale_height <= 0 )
+		return 0;
+	if ( mlt_profile_scale_width( profile, request_width ) >= 1.0 && mlt_profile_scale_height( profile, request_height ) >= 1.0 )
+		return 0;
+
+	// The fields of interlaced video must be deinterlaced before scaling.
+	if ( codec_params->field_order != AV_FIELD_PROGRESSIVE && codec_params->field_order != AV_FIELD_UNKNOWN
+		 && !mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( self->parent ), "force_progressive" ) )
+		return 0;
+
+	// The alpha plane is extracted at the source size.
+	if ( codec_params->format == AV_PIX_FMT_YUVA420P || codec_params->format == AV_PIX_FMT_YUVA444P )
+		return 0;
+
+	set_image_size( self, &source_width, &source_height );
+	rescale_width += rescale_width & 1;
+	if ( rescale_width > source_width || rescale_height > source_height
+		 || ( rescale_width == source_width && rescale_height == source_height ) )
+		return 0;
+
+	*width = rescale_width;
+	*height = rescale_height;
+	return 1;
+}
+
+/** Reopen the video codec to decode at a reduced resolution for a preview.
+ *
+ * Only intra-only codecs that support lowres (such as JPEG) are reopened
+ * because the decoder loses its references.
+ * \return false if the codec failed to reopen
+ */
+
+static int set_lowres( producer_avformat self, mlt_properties properties, int preview, int width, int height )
+{
+	AVCodecParameters *codec_params = self->video_format->streams[ self->video_index ]->codecpar;
+	const AVCodecDescriptor *descriptor = avcodec_descriptor_get( codec_params->codec_id );
+	const AVCodec *codec = self->video_codec->codec;
+	double theta = self->autorotate? get_rotation( properties, self->video_format->streams[self->video_index] ) : 0.0;
+	int lowres = 0;
+
+	// Leave it alone if the user set it.
+	if ( mlt_properties_get( properties, "lowres" ) )
+		return 1;
+#if USE_HWACCEL
+	if ( self->hwaccel.device_ctx )
+		preview = 0;
+#endif
+	// The autorotate filters are configured for the full size.
+	if ( fabs( theta ) >= 1.0 && fabs( theta - 360.0 ) >= 1.0 )
+		preview = 0;
+
+	if ( preview && codec && codec->max_lowres > 0 && descriptor && ( descriptor->props & AV_CODEC_PROP_INTRA_ONLY ) )
+	{
+		int source_width, source_height;
+		set_image_size( self, &source_width, &source_height );
+		while ( lowres < codec->max_lowres
+				&& AV_CEIL_RSHIFT( source_width, lowres + 1 ) >= width
+				&& AV_CEIL_RSHIFT( source_height, lowres + 1 ) >= height )
+			lowres++;
+	}
+	if ( lowres != self->video_codec->lowres )
+	{
+		mlt_log_verbose( MLT_PRODUCER_SERVICE( self->parent ), "reopening the video codec with lowres %d\n", lowres );
+		pthread_mutex_lock( &self->open_mutex );
+		avcodec_free_context( &self->video_codec );
+		pthread_mutex_unlock( &self->open_mutex );
+		self->lowres = lowres;
+		self->video_send_result = 0;
+
+		// Seek to decode the picture again with the new decoder
+		if ( self->video_frame )
+			av_frame_unref( self->video_frame );
+		self->video_expected = POSITION_INVALID;
+		self->current_position = POSITION_INVALID;
+		self->last_position = POSITION_INVALID;
+		return video_codec_init( self, self->video_index, properties );
+	}
+	return 1;
+}
+
+/** Get the size of the decoded picture and the size to convert it to.
+*/
+
+static void get_conversion_size( producer_avformat self, int preview, int preview_width, int preview_height,
+	int *src_width, int *src_height, int *width, int *height )
+{
+	int interlaced = self->video_frame->interlaced_frame
+		&& !mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( self->parent ), "force_progressive" );
+
+	set_image_size( self, src_width, src_height );
+	*src_width = AV_CEIL_RSHIFT( *src_width, self->video_frame_lowres );
+	*src_height = AV_CEIL_RSHIFT( *src_height, self->video_frame_lowres );
+	if ( preview && !interlaced )
+	{
+		*width = preview_width;
+		*height = preview_height;
+	}
+	else
+	{
+		*width = *src_width;
+		*height = *src_height;
+	}
+}
+
+/** Get the size of an image decoded earlier, which is smaller than the source for a preview.
+*/
+
+static void get_decoded_size( producer_avformat self, mlt_frame frame, int *width, int *height )
+{
+	*width = mlt_properties_get_int( MLT_FRAME_PROPERTIES( frame ), "avformat.width" );
+	*height = mlt_properties_get_int( MLT_FRAME_PROPERTIES( frame ), "avformat.height" );
+	if ( *width <= 0 || *height <= 0 )
+		set_image_size( self, width, height );
+}
+
 /** Allocate the image buffer and set it on the frame.
 */
 
@@ -1602,11 +2148,201 @@ static int allocate_buffer( mlt_frame frame, AVCodecParameters *codec_params, ui
 	return size;
 }
 
+/** Set the image and alpha of another frame on the frame.
+ *
+ * The buffers of a cached frame are shared with the cache when they are
+ * pooled and copied otherwise; mlt_frame_get_image() then copies a shared
+ * buffer before anyone is allowed to write.
+*/
+
+static void share_image( mlt_frame frame, mlt_frame original, uint8_t **buffer )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( original );
+	int size = 0;
+
+	*buffer = mlt_frame_get_alpha_size( original, &size );
+	if ( *buffer && size > 0 )
+		mlt_frame_set_alpha( frame, mlt_frame_share_data( properties, "alpha", *buffer, size ), size, mlt_pool_release );
+	size = 0;
+	*buffer = mlt_properties_get_data( properties, "image", &size );
+	if ( *buffer )
+	{
+		if ( size <= 0 )
+			size = mlt_image_format_size( mlt_properties_get_int( properties, "format" ),
+				mlt_properties_get_int( properties, "width" ), mlt_properties_get_int( properties, "height" ), NULL );
+		*buffer = mlt_frame_share_data( properties, "image", *buffer, size );
+		mlt_frame_set_image( frame, *buffer, size, mlt_pool_release );
+	}
+}
+
 static int ignore_send_packet_result(int result)
 {
 	return result >= 0 || result == AVERROR(EAGAIN) || result == AVERROR_EOF || result == AVERROR_INVALIDDATA || result == AVERROR(EINVAL);
 }
 
+/** Decode one frame ahead of the consumer into the image cache.
+*/
+
+static void readahead_decode( producer_avformat self, mlt_position position, mlt_image_format format, int full_range,
+	int width, int height, int rescale_width, int rescale_height, int generation )
+{
+	mlt_frame frame = mlt_frame_init( MLT_PRODUCER_SERVICE( self->parent ) );
+	if ( frame )
+	{
+		mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+		uint8_t *buffer = NULL;
+
+		mlt_properties_set_position( properties, "original_position", position );
+		mlt_properties_set_int( properties, "avformat.readahead", generation );
+		if ( rescale_width > 0 && rescale_height > 0 )
+		{
+			// Decode at the same preview size as the consumer
+			mlt_properties_set_int( properties, "rescale_width", rescale_width );
+			mlt_properties_set_int( properties, "rescale_height", rescale_height );
+		}
+		if ( full_range )
+			mlt_properties_set( properties, "consumer.color_range", "pc" );
+		mlt_frame_push_service( frame, self );
+		producer_get_image( frame, &buffer, &format, &width, &height, 0 );
+		mlt_frame_close( frame );
+	}
+}
+
+/** The read-ahead thread keeps decoding frames until it reaches the end of its window.
+*/
+
+static void *readahead_thread( void *arg )
+{
+	producer_avformat self = arg;
+
+	pthread_mutex_lock( &self->readahead_mutex );
+	while ( !self->readahead_stop )
+	{
+		if ( self->readahead_next >= self->readahead_end )
+		{
+			pthread_cond_wait( &self->readahead_cond, &self->readahead_mutex );
+			continue;
+		}
+		mlt_position position = self->readahead_next++;
+		mlt_image_format format = self->readahead_format;
+		int full_range = self->readahead_full_range;
+		int width = self->readahead_width;
+		int height = self->readahead_height;
+		int rescale_width = self->readahead_rescale_width;
+		int rescale_height = self->readahead_rescale_height;
+		int generation = atomic_load( &self->readahead_generation );
+		pthread_mutex_unlock( &self->readahead_mutex );
+
+		readahead_decode( self, position, format, full_range, width, height, rescale_width, rescale_height, generation );
+
+		pthread_mutex_lock( &self->readahead_mutex );
+	}
+	pthread_mutex_unlock( &self->readahead_mutex );
+
+	return NULL;
+}
+
+/** Abandon the read-ahead when the consumer seeks away from it.
+ *
+ * Moving back or jumping further forward than seek_threshold makes the
+ * frames in flight useless; anything already queued is dropped and a read
+ * that is waiting for the decoder gives up (see producer_get_image).
+*/
+
+static void readahead_cancel( producer_avformat self, mlt_position position )
+{
+	if ( !self->readahead_started )
+		return;
+
+	int seek_threshold = mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( self->parent ), "seek_threshold" );
+	if ( seek_threshold <= 0 ) seek_threshold = 12;
+
+	pthread_mutex_lock( &self->readahead_mutex );
+	if ( position < self->readahead_last || position > self->readahead_last + seek_threshold )
+	{
+		atomic_fetch_add( &self->readahead_generation, 1 );
+		self->readahead_next = self->readahead_end = position + 1;
+	}
+	pthread_mutex_unlock( &self->readahead_mutex );
+}
+
+/** Extend the read-ahead window past the position the consumer just got.
+*/
+
+static void readahead_schedule( producer_avformat self, mlt_position position, mlt_image_format format, int full_range,
+	int width, int height, int rescale_width, int rescale_height )
+{
+	mlt_producer producer = self->parent;
+	int frames = mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( producer ), "readahead" );
+
+	if ( frames <= 0 || !self->image_cache || !self->video_seekable || mlt_producer_get_speed( producer ) <= 0.0 )
+		return;
+
+	if ( !self->readahead_started )
+	{
+		pthread_mutex_init( &self->readahead_mutex, NULL );
+		pthread_cond_init( &self->readahead_cond, NULL );
+		atomic_init( &self->readahead_generation, 1 );
+		self->readahead_stop = 0;
+		self->readahead_last = position;
+		self->readahead_next = self->readahead_end = position + 1;
+		if ( pthread_create( &self->readahead_thread, NULL, readahead_thread, self ) )
+		{
+			pthread_cond_destroy( &self->readahead_cond );
+			pthread_mutex_destroy( &self->readahead_mutex );
+			return;
+		}
+		self->readahead_started = 1;
+	}
+
+	// The cache must hold the whole window or it evicts frames before they are used.
+	if ( mlt_cache_get_size( self->image_cache ) < frames + 2 )
+		mlt_cache_set_size( self->image_cache, frames + 2 );
+
+	pthread_mutex_lock( &self->readahead_mutex );
+
+	// Frames queued for another size would make the decoder switch its lowres
+	// back and forth with the consumer, so start the window again.
+	if ( format != self->readahead_format || full_range != self->readahead_full_range
+		 || width != self->readahead_width || height != self->readahead_height
+		 || rescale_width != self->readahead_rescale_width || rescale_height != self->readahead_rescale_height )
+	{
+		atomic_fetch_add( &self->readahead_generation, 1 );
+		self->readahead_next = position + 1;
+	}
+	self->readahead_last = position;
+	if ( self->readahead_next <= position )
+		self->readahead_next = position + 1;
+	self->readahead_end = position + 1 + frames;
+	self->readahead_format = format;
+	self->readahead_full_range = full_range;
+	self->readahead_width = width;
+	self->readahead_height = height;
+	self->readahead_rescale_width = rescale_width;
+	self->readahead_rescale_height = rescale_height;
+	pthread_cond_signal( &self->readahead_cond );
+	pthread_mutex_unlock( &self->readahead_mutex );
+}
+
+/** Stop the read-ahead thread.
+*/
+
+static void readahead_close( producer_avformat self )
+{
+	if ( self->readahead_started )
+	{
+		pthread_mutex_lock( &self->readahead_mutex );
+		self->readahead_stop = 1;
+		atomic_fetch_add( &self->readahead_generation, 1 );
+		pthread_cond_signal( &self->readahead_cond );
+		pthread_mutex_unlock( &self->readahead_mutex );
+		pthread_join( self->readahead_thread, NULL );
+		pthread_cond_destroy( &self->readahead_cond );
+		pthread_mutex_destroy( &self->readahead_mutex );
+		self->readahead_started = 0;
+	}
+}
+
 /** Get an image from a frame.
 */
 
@@ -1631,6 +2367,15 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	int image_size = 0;
 	const char* dst_color_range = mlt_properties_get(frame_properties, "consumer.color_range");
 	int dst_full_range = dst_color_range && (!strcmp("pc", dst_color_range) || !strcmp("jpeg", dst_color_range));
+	int readahead = mlt_properties_get_int( frame_properties, "avformat.readahead" );
+	mlt_image_format requested_format = *format;
+	int request_width = *width;
+	int request_height = *height;
+	int preview = 0, preview_width = 0, preview_height = 0;
+	int is_album_art = 0;
+
+	if ( !readahead )
+		readahead_cancel( self, position );
 
 	pthread_mutex_lock( &self->video_mutex );
 	mlt_service_lock( MLT_PRODUCER_SERVICE( producer ) );
@@ -1642,12 +2387,19 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	if ( !context )
 		goto exit_get_image;
 
+	// Drop a read-ahead decode that a seek has made obsolete.
+	if ( readahead && readahead != atomic_load( &self->readahead_generation ) )
+		goto exit_get_image;
+
 	// Get the video stream
 	AVStream *stream = context->streams[ self->video_index ];
 	codec_params = stream->codecpar;
 
+	// A preview can be decoded and converted straight to the size it is scaled to
+	preview = get_preview_size( self, frame_properties, request_width, request_height, &preview_width, &preview_height );
+
 	// Always use the image cache for album art.
-	int is_album_art = stream->disposition & AV_DISPOSITION_ATTACHED_PIC;
+	is_album_art = stream->disposition & AV_DISPOSITION_ATTACHED_PIC;
 	if (is_album_art)
 		position = 0;
 
@@ -1675,23 +2427,40 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 		// set cache size if supplied
 		if ( self->image_cache && cache_supplied )
 			mlt_cache_set_size( self->image_cache, cache_size );
+		// set cache memory limit if supplied
+		if ( self->image_cache )
+		{
+			int64_t cache_memory = getenv( "MLT_AVFORMAT_CACHE_MEMORY" ) ? strtoll( getenv( "MLT_AVFORMAT_CACHE_MEMORY" ), NULL, 10 ) : 0;
+			if ( mlt_properties_get( properties, "cache_memory" ) )
+				cache_memory = mlt_properties_get_int64( properties, "cache_memory" );
+			if ( cache_memory > 0 )
+				mlt_cache_set_memory_limit( self->image_cache, cache_memory );
+		}
 	}
 	if ( self->image_cache )
 	{
 		mlt_frame original = mlt_cache_get_frame( self->image_cache, position );
 		if ( original )
+		{
+			// An image decoded for a preview is too small for a larger request
+			int wanted_width = preview_width;
+			int wanted_height = preview_height;
+			get_decoded_size( self, original, width, height );
+			if ( !preview )
+				set_image_size( self, &wanted_width, &wanted_height );
+			if ( *width < wanted_width || *height < wanted_height )
+			{
+				mlt_frame_close( original );
+				original = NULL;
+			}
+		}
+		if ( original )
 		{
 			mlt_properties orig_props = MLT_FRAME_PROPERTIES( original );
-			int size = 0;
 
-			*buffer = mlt_frame_get_alpha_size(original, &size);
-			if (*buffer)
-				mlt_frame_set_alpha( frame, *buffer, size, NULL );
-			*buffer = mlt_properties_get_data( orig_props, "image", &size );
-			mlt_frame_set_image( frame, *buffer, size, NULL );
+			share_image( frame, original, buffer );
 			mlt_properties_set_data( frame_properties, "avformat.image_cache", original, 0, (mlt_destructor) mlt_frame_close, NULL );
 			*format = mlt_properties_get_int( orig_props, "format" );
-			set_image_size( self, width, height );
 			mlt_properties_pass_property(frame_properties, orig_props, "colorspace");
 			mlt_properties_set_int(frame_properties, "full_range", dst_full_range);
 			got_picture = 1;
@@ -1700,6 +2469,10 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	}
 	// Cache miss
 
+	// Decode a preview at a reduced resolution if the codec can
+	if ( !set_lowres( self, properties, preview, preview_width, preview_height ) )
+		goto exit_get_image;
+
 	// We may want to use the source fps if available
 	double source_fps = mlt_properties_get_double( properties, "meta.media.frame_rate_num" ) /
 		mlt_properties_get_double( properties, "meta.media.frame_rate_den" );
@@ -1746,19 +2519,22 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 		 && ( paused || self->current_position >= req_position ) )
 	{
 		// Duplicate it
-		set_image_size( self, width, height );
+		int src_width, src_height;
+		get_conversion_size( self, preview, preview_width, preview_height, &src_width, &src_height, width, height );
 		if ( ( image_size = allocate_buffer( frame, codec_params, buffer, *format, *width, *height ) ) )
 		{
 			int yuv_colorspace;
 #if USE_HWACCEL
 			yuv_colorspace = convert_image( self, self->video_frame, *buffer, self->video_frame->format,
-				format, *width, *height, &alpha, dst_full_range );
+				format, src_width, src_height, *width, *height, &alpha, dst_full_range );
 #else
 			yuv_colorspace = convert_image( self, self->video_frame, *buffer, codec_params->format,
-				format, *width, *height, &alpha, dst_full_range );
+				format, src_width, src_height, *width, *height, &alpha, dst_full_range );
 #endif
 			mlt_properties_set_int( frame_properties, "colorspace", yuv_colorspace );
 			mlt_properties_set_int( frame_properties, "full_range", dst_full_range );
+			mlt_properties_set_int( frame_properties, "avformat.width", *width );
+			mlt_properties_set_int( frame_properties, "avformat.height", *height );
 			got_picture = 1;
 		}
 	}
@@ -1864,7 +2640,10 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 				{
 					self->video_codec->reordered_opaque = int_position;
 					if ( int_position >= req_position )
-						self->video_codec->skip_loop_filter = AVDISCARD_NONE;
+						self->video_codec->skip_loop_filter = preview ? AVDISCARD_ALL : AVDISCARD_NONE;
+					// A preview need not decode the frames before a seek point that nothing references.
+					if ( !mlt_properties_get( properties, "skip_frame" ) )
+						self->video_codec->skip_frame = ( preview && int_position < req_position ) ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
 					self->video_send_result = avcodec_send_packet( self->video_codec, &self->pkt );
 					mlt_log_debug( MLT_PRODUCER_SERVICE( producer ), "decoded video packet with size %d => %d\n", self->pkt.size, self->video_send_result );
 					// Note: decode may fail at the beginning of MPEGfile (B-frames referencing before first I-frame), so allow a few errors.
@@ -1934,7 +2713,7 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 					if ( int_position < req_position )
 						got_picture = 0;
 					else if ( int_position >= req_position )
-						self->video_codec->skip_loop_filter = AVDISCARD_NONE;
+						self->video_codec->skip_loop_filter = preview ? AVDISCARD_ALL : AVDISCARD_NONE;
 				}
 				else if ( !self->pkt.data ) // draining decoder with null packets
 				{
@@ -1963,20 +2742,24 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 					}
 				}
 #endif
-				set_image_size( self, width, height );
+				int src_width, src_height;
+				self->video_frame_lowres = self->video_codec->lowres;
+				get_conversion_size( self, preview, preview_width, preview_height, &src_width, &src_height, width, height );
 				if ( ( image_size = allocate_buffer( frame, codec_params, buffer, *format, *width, *height ) ) )
 				{
 					int yuv_colorspace;
 #if USE_HWACCEL
 					// not sure why this is really needed, but doesn't seem to work otherwise
 					yuv_colorspace = convert_image( self, self->video_frame, *buffer, self->video_frame->format,
-						format, *width, *height, &alpha, dst_full_range );
+						format, src_width, src_height, *width, *height, &alpha, dst_full_range );
 #else
 					yuv_colorspace = convert_image( self, self->video_frame, *buffer, codec_params->format,
-						format, *width, *height, &alpha, dst_full_range );
+						format, src_width, src_height, *width, *height, &alpha, dst_full_range );
 #endif
 					mlt_properties_set_int( frame_properties, "colorspace", yuv_colorspace );
 					mlt_properties_set_int( frame_properties, "full_range", dst_full_range );
+					mlt_properties_set_int( frame_properties, "avformat.width", *width );
+					mlt_properties_set_int( frame_properties, "avformat.height", *height );
 					self->top_field_first |= self->video_frame->top_field_first;
 					self->top_field_first |= codec_params->field_order == AV_FIELD_TT;
 					self->top_field_first |= codec_params->field_order == AV_FIELD_TB;
@@ -2026,16 +2809,11 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 		// Use last known good frame if there was a decoding failure.
 		mlt_frame original = mlt_frame_clone( self->last_good_frame, 1 );
 		mlt_properties orig_props = MLT_FRAME_PROPERTIES( original );
-		int size = 0;
 
-		*buffer = mlt_frame_get_alpha_size(original, &size);
-		if (*buffer)
-			mlt_frame_set_alpha( frame, *buffer, size, NULL );
-		*buffer = mlt_properties_get_data( orig_props, "image", &size );
-		mlt_frame_set_image( frame, *buffer, size, NULL );
+		share_image( frame, original, buffer );
 		mlt_properties_set_data( frame_properties, "avformat.conceal_error", original, 0, (mlt_destructor) mlt_frame_close, NULL );
 		*format = mlt_properties_get_int( orig_props, "format" );
-		set_image_size( self, width, height );
+		get_decoded_size( self, original, width, height );
 		got_picture = 1;
 	}
 
@@ -2066,6 +2844,10 @@ exit_get_image:
 	mlt_properties_set_int( properties, "meta.media.progressive", mlt_properties_get_int( frame_properties, "progressive" ) );
 	mlt_service_unlock( MLT_PRODUCER_SERVICE( producer ) );
 
+	if ( !readahead && got_picture && !is_album_art )
+		readahead_schedule( self, position, requested_format, dst_full_range, request_width, request_height,
+			mlt_properties_get_int( frame_properties, "rescale_width" ), mlt_properties_get_int( frame_properties, "rescale_height" ) );
+
 	mlt_log_timings_end( NULL, __FUNCTION__ );
 
 	return !got_picture;
@@ -2139,6 +2921,9 @@ static int video_codec_init( producer_avformat self, int index, mlt_properties p
 		if ( thread_count >= 0 )
 			codec_context->thread_count = thread_count;
 
+		// Decode at a reduced resolution for a preview
+		codec_context->lowres = self->lowres;
+
 #if USE_HWACCEL
 		if ( self->hwaccel.device_type == AV_HWDEVICE_TYPE_NONE || self->hwaccel.pix_fmt == AV_PIX_FMT_NONE ) 
 		{
@@ -2311,10 +3096,14 @@ static int video_codec_init( producer_avformat self, int index, mlt_properties p
 				self->yuv_colorspace = 709;
 				break;
 			default:
+			{
 				// This is a heuristic Charles Poynton suggests in "Digital Video and HDTV"
-				self->yuv_colorspace = self->video_codec->width * self->video_codec->height > 750000 ? 709 : 601;
+				int codec_width, codec_height;
+				get_codec_size( self, &codec_width, &codec_height );
+				self->yuv_colorspace = codec_width * codec_height > 750000 ? 709 : 601;
 				break;
 			}
+			}
 		}
 		// Let apps get chosen colorspace
 		mlt_properties_set_int( properties, "meta.media.colorspace", self->yuv_colorspace );
@@ -2425,30 +3214,32 @@ static void producer_set_up_video( producer_avformat self, mlt_frame frame )
 		// Set the width and height
 		double dar = mlt_profile_dar( mlt_service_profile( MLT_PRODUCER_SERVICE( producer ) ) );
 		double theta  = self->autorotate? get_rotation( properties, self->video_format->streams[index] ) : 0.0;
+		int codec_width, codec_height;
+		get_codec_size( self, &codec_width, &codec_height );
 		if ( fabs(theta - 90.0) < 1.0 || fabs(theta - 270.0) < 1.0 )
 		{
 			// Workaround 1088 encodings missing cropping info.
-			if ( self->video_codec->height == 1088 && dar == 16.0/9.0 ) {
+			if ( codec_height == 1088 && dar == 16.0/9.0 ) {
 				mlt_properties_set_int( frame_properties, "width", 1080 );
 				mlt_properties_set_int( properties, "meta.media.width", 1080 );
 			} else {
-				mlt_properties_set_int( frame_properties, "width", self->video_codec->height );
-				mlt_properties_set_int( properties, "meta.media.width", self->video_codec->height );
+				mlt_properties_set_int( frame_properties, "width", codec_height );
+				mlt_properties_set_int( properties, "meta.media.width", codec_height );
 			}
-			mlt_properties_set_int( frame_properties, "height", self->video_codec->width );
-			mlt_properties_set_int( properties, "meta.media.height", self->video_codec->width );
+			mlt_properties_set_int( frame_properties, "height", codec_width );
+			mlt_properties_set_int( properties, "meta.media.height", codec_width );
 			aspect_ratio = ( force_aspect_ratio > 0.0 ) ? force_aspect_ratio : 1.0 / aspect_ratio;
 			mlt_properties_set_double( frame_properties, "aspect_ratio", 1.0/aspect_ratio );
 		} else {
-			mlt_properties_set_int( frame_properties, "width", self->video_codec->width );
-			mlt_properties_set_int( properties, "meta.media.width", self->video_codec->width );
+			mlt_properties_set_int( frame_properties, "width", codec_width );
+			mlt_properties_set_int( properties, "meta.media.width", codec_width );
 			// Workaround 1088 encodings missing cropping info.
-			if ( self->video_codec->height == 1088 && dar == 16.0/9.0 ) {
+			if ( codec_height == 1088 && dar == 16.0/9.0 ) {
 				mlt_properties_set_int( frame_properties, "height", 1080 );
 				mlt_properties_set_int( properties, "meta.media.height", 1080 );
 			} else {
-				mlt_properties_set_int( frame_properties, "height", self->video_codec->height );
-				mlt_properties_set_int( properties, "meta.media.height", self->video_codec->height );
+				mlt_properties_set_int( frame_properties, "height", codec_height );
+				mlt_properties_set_int( properties, "meta.media.height", codec_height );
 			}
 			mlt_properties_set_double( frame_properties, "aspect_ratio", aspect_ratio );
 		}
@@ -3135,6 +3926,10 @@ static void producer_avformat_close( producer_avformat self )
 {
 	mlt_log_debug( NULL, "producer_avformat_close\n" );
 
+	// Stop decoding ahead before anything it uses goes away
+	readahead_close( self );
+	seek_index_stop( self );
+
 	// Cleanup av contexts
 	av_packet_unref( &self->pkt );
 	av_frame_free( &self->video_frame );
@@ -3173,6 +3968,7 @@ static void producer_avformat_close( producer_avformat self )
 
 	// Cleanup caches.
 	mlt_cache_close( self->image_cache );
+	mlt_sws_cache_close( self->sws_cache );
 	if ( self->last_good_frame )
 		mlt_frame_close( self->last_good_frame );
 
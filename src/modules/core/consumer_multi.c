@@ -349,27 +349,35 @@ static void foreach_consumer_put( mlt_consumer consumer, mlt_frame frame )
 	char key[30];
 	int index = 0;
 
+	// get the audio for the current frame once for all nested consumers
+	uint8_t *audio = NULL;
+	mlt_audio_format format = mlt_audio_s16;
+	double self_fps = mlt_properties_get_double( properties, "fps" );
+	mlt_position self_pos = mlt_frame_get_position( frame );
+	int channels = mlt_properties_get_int( properties, "channels" );
+	int frequency = mlt_properties_get_int( properties, "frequency" );
+	int audio_samples = mlt_audio_calculate_frame_samples( self_fps, frequency, self_pos );
+	mlt_frame_get_audio( frame, (void**) &audio, &format, &frequency, &channels, &audio_samples );
+	int audio_size = mlt_audio_format_size( format, audio_samples, channels );
+
+	// a pooled frame buffer can be handed to a nested frame without a copy
+	int audio_pooled = audio && audio == mlt_properties_get_data( MLT_FRAME_PROPERTIES(frame), "audio", NULL )
+		&& mlt_properties_get_destructor( MLT_FRAME_PROPERTIES(frame), "audio" ) == mlt_pool_release;
+
 	do {
 		snprintf( key, sizeof(key), "%d.consumer", index++ );
 		nested = mlt_properties_get_data( properties, key, NULL );
 		if ( nested )
 		{
 			mlt_properties nested_props = MLT_CONSUMER_PROPERTIES(nested);
-			double self_fps = mlt_properties_get_double( properties, "fps" );
 			double nested_fps = mlt_properties_get_double( nested_props, "fps" );
 			mlt_position nested_pos = mlt_properties_get_position( nested_props, "_multi_position" );
-			mlt_position self_pos = mlt_frame_get_position( frame );
 			double self_time = self_pos / self_fps;
 			double nested_time = nested_pos / nested_fps;
 
-			// get the audio for the current frame
-			uint8_t *buffer = NULL;
-			mlt_audio_format format = mlt_audio_s16;
-			int channels = mlt_properties_get_int( properties, "channels" );
-			int frequency = mlt_properties_get_int( properties, "frequency" );
-			int current_samples = mlt_audio_calculate_frame_samples( self_fps, frequency, self_pos );
-			mlt_frame_get_audio( frame, (void**) &buffer, &format, &frequency, &channels, &current_samples );
-			int current_size = mlt_audio_format_size( format, current_samples, channels );
+			uint8_t *buffer = audio;
+			int current_samples = audio_samples;
+			int current_size = audio_size;
 
 			// get any leftover audio
 			int prev_size = 0;
@@ -397,8 +405,15 @@ static void foreach_consumer_put( mlt_consumer consumer, mlt_frame frame )
 				int nested_size = mlt_audio_format_size( format, nested_samples, channels );
 				if ( nested_size > 0 )
 				{
-					prev_buffer = mlt_pool_alloc( nested_size );
-					memcpy( prev_buffer, buffer, nested_size );
+					// share the audio if the nested frame takes all of it
+					prev_buffer = NULL;
+					if ( audio_pooled && buffer == audio && nested_size == audio_size )
+						prev_buffer = mlt_pool_retain( buffer );
+					if ( !prev_buffer )
+					{
+						prev_buffer = mlt_pool_alloc( nested_size );
+						memcpy( prev_buffer, buffer, nested_size );
+					}
 				}
 				else
 				{
@@ -59,6 +59,7 @@ extern mlt_producer producer_loader_init( mlt_profile profile, mlt_service_type
 extern mlt_producer producer_melt_file_init( mlt_profile profile, mlt_service_type type, const char *id, char *arg );
 extern mlt_producer producer_melt_init( mlt_profile profile, mlt_service_type type, const char *id, char **argv );
 extern mlt_producer producer_noise_init( mlt_profile profile, mlt_service_type type, const char *id, char *arg );
+extern mlt_producer producer_prerender_init( mlt_profile profile, mlt_service_type type, const char *id, char *arg );
 extern mlt_producer producer_timewarp_init( mlt_profile profile, mlt_service_type type, const char *id, char *arg );
 extern mlt_producer producer_tone_init( mlt_profile profile, mlt_service_type type, const char *id, char *arg );
 #include "transition_composite.h"
@@ -117,6 +118,7 @@ void mlt_register_core( mlt_repository repository )
 	MLT_REGISTER( mlt_service_producer_type, "melt", producer_melt_init );
 	MLT_REGISTER( mlt_service_producer_type, "melt_file", producer_melt_file_init );
 	MLT_REGISTER( mlt_service_producer_type, "noise", producer_noise_init );
+	MLT_REGISTER( mlt_service_producer_type, "prerender", producer_prerender_init );
 	MLT_REGISTER( mlt_service_producer_type, "timewarp", producer_timewarp_init );
 	MLT_REGISTER( mlt_service_producer_type, "tone", producer_tone_init );
 	MLT_REGISTER( mlt_service_transition_type, "composite", transition_composite_init );
@@ -165,6 +167,7 @@ void mlt_register_core( mlt_repository repository )
 	MLT_REGISTER_METADATA( mlt_service_producer_type, "melt", metadata, "producer_melt.yml" );
 	MLT_REGISTER_METADATA( mlt_service_producer_type, "melt_file", metadata, "producer_melt_file.yml" );
 	MLT_REGISTER_METADATA( mlt_service_producer_type, "noise", metadata, "producer_noise.yml" );
+	MLT_REGISTER_METADATA( mlt_service_producer_type, "prerender", metadata, "producer_prerender.yml" );
 	MLT_REGISTER_METADATA( mlt_service_producer_type, "timewarp", metadata, "producer_timewarp.yml" );
 	MLT_REGISTER_METADATA( mlt_service_producer_type, "tone", metadata, "producer_tone.yml" );
 	MLT_REGISTER_METADATA( mlt_service_transition_type, "composite", metadata, "transition_composite.yml" );
@@ -20,6 +20,7 @@
 #include <framework/mlt_filter.h>
 #include <framework/mlt_frame.h>
 #include <framework/mlt_log.h>
+#include <framework/mlt_audio_dsp.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -95,14 +96,7 @@ static int convert_audio( mlt_frame frame, void **audio, mlt_audio_format *forma
 			case mlt_audio_f32le:
 			{
 				float *buffer = mlt_pool_alloc( size );
-				float *p = buffer;
-				int16_t *q = (int16_t*) *audio;
-				int i = samples * channels + 1;
-				while ( --i )
-				{
-					float f = (float)( *q++ ) / 32768.0;
-					*p++ = CLAMP( f, -1.0f, 1.0f );
-				}
+				mlt_audio_dsp_s16_to_float( buffer, (int16_t*) *audio, samples * channels );
 				*audio = buffer;
 				error = 0;
 				break;
@@ -255,12 +249,7 @@ static int convert_audio( mlt_frame frame, void **audio, mlt_audio_format *forma
 			case mlt_audio_f32le:
 			{
 				float *buffer = mlt_pool_alloc( size );
-				float *p = buffer;
-				float *q = (float*) *audio;
-				int s, c;
-				for ( s = 0; s < samples; s++ )
-					for ( c = 0; c < channels; c++ )
-						*p++ = *( q + c * samples + s );
+				mlt_audio_dsp_interleave( buffer, (float*) *audio, channels, samples );
 				*audio = buffer;
 				error = 0;
 				break;
@@ -373,15 +362,7 @@ static int convert_audio( mlt_frame frame, void **audio, mlt_audio_format *forma
 			case mlt_audio_s16:
 			{
 				int16_t *buffer = mlt_pool_alloc( size );
-				int16_t *p = buffer;
-				float *q = (float*) *audio;
-				int i = samples * channels + 1;
-				while ( --i )
-				{
-					float f = *q++;
-					f = CLAMP( f, -1.0f , 1.0f );
-					*p++ = 32767 * f;
-				}
+				mlt_audio_dsp_float_to_s16( buffer, (float*) *audio, samples * channels );
 				*audio = buffer;
 				error = 0;
 				break;
@@ -389,18 +370,7 @@ static int convert_audio( mlt_frame frame, void **audio, mlt_audio_format *forma
 			case mlt_audio_float:
 			{
 				float *buffer = mlt_pool_alloc( size );
-				float *p = buffer;
-				int c;
-				for ( c = 0; c < channels; c++ )
-				{
-					float *q = (float*) *audio + c;
-					int i = samples + 1;
-					while ( --i )
-					{
-						*p++ = *q;
-						q += channels;
-					}
-				}
+				mlt_audio_dsp_deinterleave( buffer, (float*) *audio, channels, samples );
 				*audio = buffer;
 				error = 0;
 				break;
@@ -17,58 +17,117 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include "image_proc.h"
+
 #include <framework/mlt_filter.h>
 #include <framework/mlt_frame.h>
 #include <framework/mlt_image.h>
 #include <framework/mlt_log.h>
 #include <framework/mlt_pool.h>
+#include <framework/mlt_slices.h>
 
 #include <stdlib.h>
+#include <pthread.h>
 
-/** This macro converts a YUV value to the RGB color space. */
-#define RGB2YUV_601_UNSCALED(r, g, b, y, u, v)\
-  y = (299*r + 587*g + 114*b) >> 10;\
-  u = ((-169*r - 331*g + 500*b) >> 10) + 128;\
-  v = ((500*r - 419*g - 81*b) >> 10) + 128;\
-  y = y < 16 ? 16 : y;\
-  u = u < 16 ? 16 : u;\
-  v = v < 16 ? 16 : v;\
-  y = y > 235 ? 235 : y;\
-  u = u > 240 ? 240 : u;\
-  v = v > 240 ? 240 : v
+/** Images smaller than this many pixels are converted without slicing. */
+#define SLICED_MIN_PIXELS ( 320 * 240 )
+
+static const yuv_to_rgb_matrix yuv_to_rgb_601 = { 16, 1192, 1634, 401, 832, 2066 };
+static const yuv_to_rgb_matrix yuv_to_rgb_601_full = { 0, 1024, 1436, 352, 731, 1815 };
+static const yuv_to_rgb_matrix yuv_to_rgb_709 = { 16, 1192, 1836, 218, 546, 2163 };
+static const yuv_to_rgb_matrix yuv_to_rgb_709_full = { 0, 1024, 1613, 192, 479, 1900 };
+
+static const rgb_to_yuv_matrix rgb_to_yuv_601 = { 16, 263, 516, 100, -152, -300, 450, 450, -377, -73 };
+static const rgb_to_yuv_matrix rgb_to_yuv_601_full = { 0, 306, 601, 117, -173, -339, 512, 512, -429, -83 };
+static const rgb_to_yuv_matrix rgb_to_yuv_709 = { 16, 187, 629, 63, -103, -347, 450, 450, -409, -41 };
+static const rgb_to_yuv_matrix rgb_to_yuv_709_full = { 0, 218, 732, 74, -117, -395, 512, 512, -465, -47 };
+
+/** This macro converts a RGB value to the YUV color space. */
+#define RGB2YUV( m, r, g, b, y, u, v )\
+  y = ( ( m->r_y * r + m->g_y * g + m->b_y * b ) >> 10 ) + m->y_offset;\
+  u = ( ( m->r_u * r + m->g_u * g + m->b_u * b ) >> 10 ) + 128;\
+  v = ( ( m->r_v * r + m->g_v * g + m->b_v * b ) >> 10 ) + 128;
 
 /** This macro converts a YUV value to the RGB color space. */
-#define YUV2RGB_601_UNSCALED( y, u, v, r, g, b ) \
-  r = ((1024 * y + 1404 * ( v - 128 ) ) >> 10 ); \
-  g = ((1024 * y - 715 * ( v - 128 ) - 345 * ( u - 128 ) ) >> 10 ); \
-  b = ((1024 * y + 1774 * ( u - 128 ) ) >> 10 ); \
+#define YUV2RGB( m, y, u, v, r, g, b ) \
+  r = ( ( m->y_scale * ( y - m->y_offset ) + m->v_r * ( v - 128 ) ) >> 10 ); \
+  g = ( ( m->y_scale * ( y - m->y_offset ) - m->v_g * ( v - 128 ) - m->u_g * ( u - 128 ) ) >> 10 ); \
+  b = ( ( m->y_scale * ( y - m->y_offset ) + m->u_b * ( u - 128 ) ) >> 10 ); \
   r = r < 0 ? 0 : r > 255 ? 255 : r; \
   g = g < 0 ? 0 : g > 255 ? 255 : g; \
   b = b < 0 ? 0 : b > 255 ? 255 : b;
 
-#define SCALED 1
-#if SCALED
-#define RGB2YUV_601 RGB2YUV_601_SCALED
-#define YUV2RGB_601 YUV2RGB_601_SCALED
-#else
-#define RGB2YUV_601 RGB2YUV_601_UNSCALED
-#define YUV2RGB_601 YUV2RGB_601_UNSCALED
+#if defined(USE_SSE) && defined(ARCH_X86_64)
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+static int ( *yuv422_to_rgba_line )( uint8_t *dst, const uint8_t *src, const uint8_t *alpha, int width, const yuv_to_rgb_matrix *m ) = convert_line_yuv422_to_rgba_sse2;
+static int ( *rgba_to_yuv422_line )( uint8_t *dst, uint8_t *alpha, const uint8_t *src, int width, const rgb_to_yuv_matrix *m ) = convert_line_rgba_to_yuv422_sse2;
+
+static void init_simd()
+{
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports( "avx2" ) )
+	{
+		yuv422_to_rgba_line = convert_line_yuv422_to_rgba_avx2;
+		rgba_to_yuv422_line = convert_line_rgba_to_yuv422_avx2;
+	}
+}
 #endif
 
-static void convert_yuv422_to_rgba( mlt_image src, mlt_image dst )
+typedef struct convert_desc_s
 {
+	mlt_image src;
+	mlt_image dst;
+	const yuv_to_rgb_matrix *yuv_to_rgb;
+	const rgb_to_yuv_matrix *rgb_to_yuv;
+	void ( *lines )( struct convert_desc_s *desc, int start, int end );
+} convert_desc;
+
+typedef void ( *conversion_lines )( convert_desc *desc, int start, int end );
+
+static int convert_slice_proc( int id, int index, int jobs, void *data )
+{
+	(void) id; // unused
+	convert_desc *desc = data;
+	int start = 0;
+	int height = mlt_slices_size_slice( jobs, index, desc->src->height, &start );
+	desc->lines( desc, start, start + height );
+	return 0;
+}
+
+/** Run a conversion over all lines of the image, sliced across threads if it is large enough.
+*/
+
+static void convert_lines( convert_desc *desc, conversion_lines lines )
+{
+	desc->lines = lines;
+	if ( desc->src->width * desc->src->height < SLICED_MIN_PIXELS )
+		lines( desc, 0, desc->src->height );
+	else
+		mlt_slices_run_normal( 0, convert_slice_proc, desc );
+}
+
+static void yuv422_to_rgba_lines( convert_desc *desc, int start, int end )
+{
+	mlt_image src = desc->src;
+	mlt_image dst = desc->dst;
+	const yuv_to_rgb_matrix *m = desc->yuv_to_rgb;
 	int yy, uu, vv;
 	int r,g,b;
 
-	mlt_image_set_values( dst, NULL, mlt_image_rgba, src->width, src->height );
-	mlt_image_alloc_data( dst );
-
-	for ( int line = 0; line < src->height; line++ )
+	for ( int line = start; line < end; line++ )
 	{
 		uint8_t* pSrc = src->planes[0] + src->strides[0] * line;
 		uint8_t* pAlpha = src->planes[3] + src->strides[3] * line;
 		uint8_t* pDst = dst->planes[0] + dst->strides[0] * line;
-		int total = src->width / 2 + 1;
+		int done = 0;
+#if defined(USE_SSE) && defined(ARCH_X86_64)
+		done = yuv422_to_rgba_line( pDst, pSrc, pAlpha, src->width, m );
+		pSrc += done * 2;
+		pDst += done * 4;
+		if ( pAlpha )
+			pAlpha += done;
+#endif
+		int total = ( src->width - done ) / 2 + 1;
 
 		if ( pAlpha )
 			while ( --total )
@@ -76,13 +135,13 @@ static void convert_yuv422_to_rgba( mlt_image src, mlt_image dst )
 				yy = pSrc[0];
 				uu = pSrc[1];
 				vv = pSrc[3];
-				YUV2RGB_601( yy, uu, vv, r, g, b );
+				YUV2RGB( m, yy, uu, vv, r, g, b );
 				pDst[0] = r;
 				pDst[1] = g;
 				pDst[2] = b;
 				pDst[3] = *pAlpha++;
 				yy = pSrc[2];
-				YUV2RGB_601( yy, uu, vv, r, g, b );
+				YUV2RGB( m, yy, uu, vv, r, g, b );
 				pDst[4] = r;
 				pDst[5] = g;
 				pDst[6] = b;
@@ -96,13 +155,13 @@ static void convert_yuv422_to_rgba( mlt_image src, mlt_image dst )
 				yy = pSrc[0];
 				uu = pSrc[1];
 				vv = pSrc[3];
-				YUV2RGB_601( yy, uu, vv, r, g, b );
+				YUV2RGB( m, yy, uu, vv, r, g, b );
 				pDst[0] = r;
 				pDst[1] = g;
 				pDst[2] = b;
 				pDst[3] = 0xff;
 				yy = pSrc[2];
-				YUV2RGB_601( yy, uu, vv, r, g, b );
+				YUV2RGB( m, yy, uu, vv, r, g, b );
 				pDst[4] = r;
 				pDst[5] = g;
 				pDst[6] = b;
@@ -113,15 +172,22 @@ static void convert_yuv422_to_rgba( mlt_image src, mlt_image dst )
 	}
 }
 
-static void convert_yuv422_to_rgb( mlt_image src, mlt_image dst )
+static void convert_yuv422_to_rgba( convert_desc *desc )
 {
+	mlt_image_set_values( desc->dst, NULL, mlt_image_rgba, desc->src->width, desc->src->height );
+	mlt_image_alloc_data( desc->dst );
+	convert_lines( desc, yuv422_to_rgba_lines );
+}
+
+static void yuv422_to_rgb_lines( convert_desc *desc, int start, int end )
+{
+	mlt_image src = desc->src;
+	mlt_image dst = desc->dst;
+	const yuv_to_rgb_matrix *m = desc->yuv_to_rgb;
 	int yy, uu, vv;
 	int r,g,b;
 
-	mlt_image_set_values( dst, NULL, mlt_image_rgb, src->width, src->height );
-	mlt_image_alloc_data( dst );
-
-	for ( int line = 0; line < src->height; line++ )
+	for ( int line = start; line < end; line++ )
 	{
 		uint8_t* pSrc = src->planes[0] + src->strides[0] * line;
 		uint8_t* pDst = dst->planes[0] + dst->strides[0] * line;
@@ -131,12 +197,12 @@ static void convert_yuv422_to_rgb( mlt_image src, mlt_image dst )
 			yy = pSrc[0];
 			uu = pSrc[1];
 			vv = pSrc[3];
-			YUV2RGB_601( yy, uu, vv, r, g, b );
+			YUV2RGB( m, yy, uu, vv, r, g, b );
 			pDst[0] = r;
 			pDst[1] = g;
 			pDst[2] = b;
 			yy = pSrc[2];
-			YUV2RGB_601( yy, uu, vv, r, g, b );
+			YUV2RGB( m, yy, uu, vv, r, g, b );
 			pDst[3] = r;
 			pDst[4] = g;
 			pDst[5] = b;
@@ -146,33 +212,46 @@ static void convert_yuv422_to_rgb( mlt_image src, mlt_image dst )
 	}
 }
 
-static void convert_rgba_to_yuv422( mlt_image src, mlt_image dst )
+static void convert_yuv422_to_rgb( convert_desc *desc )
 {
+	mlt_image_set_values( desc->dst, NULL, mlt_image_rgb, desc->src->width, desc->src->height );
+	mlt_image_alloc_data( desc->dst );
+	convert_lines( desc, yuv422_to_rgb_lines );
+}
+
+static void rgba_to_yuv422_lines( convert_desc *desc, int start, int end )
+{
+	mlt_image src = desc->src;
+	mlt_image dst = desc->dst;
+	const rgb_to_yuv_matrix *m = desc->rgb_to_yuv;
 	int y0, y1, u0, u1, v0, v1;
 	int r, g, b;
 
-	mlt_image_set_values( dst, NULL, mlt_image_yuv422, src->width, src->height );
-	mlt_image_alloc_data( dst );
-	mlt_image_alloc_alpha( dst );
-
-	for ( int line = 0; line < src->height; line++ )
+	for ( int line = start; line < end; line++ )
 	{
 		uint8_t* pSrc = src->planes[0] + src->strides[0] * line;
 		uint8_t* pDst = dst->planes[0] + dst->strides[0] * line;
 		uint8_t* pAlpha = dst->planes[3] + dst->strides[3] * line;
-		int j = src->width / 2 + 1;
+		int done = 0;
+#if defined(USE_SSE) && defined(ARCH_X86_64)
+		done = rgba_to_yuv422_line( pDst, pAlpha, pSrc, src->width, m );
+		pSrc += done * 4;
+		pDst += done * 2;
+		pAlpha += done;
+#endif
+		int j = ( src->width - done ) / 2 + 1;
 		while ( --j )
 		{
 			r = *pSrc++;
 			g = *pSrc++;
 			b = *pSrc++;
 			*pAlpha++ = *pSrc++;
-			RGB2YUV_601( r, g, b, y0, u0 , v0 );
+			RGB2YUV( m, r, g, b, y0, u0 , v0 );
 			r = *pSrc++;
 			g = *pSrc++;
 			b = *pSrc++;
 			*pAlpha++ = *pSrc++;
-			RGB2YUV_601( r, g, b, y1, u1 , v1 );
+			RGB2YUV( m, r, g, b, y1, u1 , v1 );
 			*pDst++ = y0;
 			*pDst++ = (u0+u1) >> 1;
 			*pDst++ = y1;
@@ -184,22 +263,30 @@ static void convert_rgba_to_yuv422( mlt_image src, mlt_image dst )
 			g = *pSrc++;
 			b = *pSrc++;
 			*pAlpha++ = *pSrc++;
-			RGB2YUV_601( r, g, b, y0, u0 , v0 );
+			RGB2YUV( m, r, g, b, y0, u0 , v0 );
 			*pDst++ = y0;
 			*pDst++ = u0;
 		}
 	}
 }
 
-static void convert_rgb_to_yuv422( mlt_image src, mlt_image dst )
+static void convert_rgba_to_yuv422( convert_desc *desc )
 {
+	mlt_image_set_values( desc->dst, NULL, mlt_image_yuv422, desc->src->width, desc->src->height );
+	mlt_image_alloc_data( desc->dst );
+	mlt_image_alloc_alpha( desc->dst );
+	convert_lines( desc, rgba_to_yuv422_lines );
+}
+
+static void rgb_to_yuv422_lines( convert_desc *desc, int start, int end )
+{
+	mlt_image src = desc->src;
+	mlt_image dst = desc->dst;
+	const rgb_to_yuv_matrix *m = desc->rgb_to_yuv;
 	int y0, y1, u0, u1, v0, v1;
 	int r, g, b;
 
-	mlt_image_set_values( dst, NULL, mlt_image_yuv422, src->width, src->height );
-	mlt_image_alloc_data( dst );
-
-	for ( int line = 0; line < src->height; line++ )
+	for ( int line = start; line < end; line++ )
 	{
 		uint8_t* pSrc = src->planes[0] + src->strides[0] * line;
 		uint8_t* pDst = dst->planes[0] + dst->strides[0] * line;
@@ -209,11 +296,11 @@ static void convert_rgb_to_yuv422( mlt_image src, mlt_image dst )
 			r = *pSrc++;
 			g = *pSrc++;
 			b = *pSrc++;
-			RGB2YUV_601( r, g, b, y0, u0 , v0 );
+			RGB2YUV( m, r, g, b, y0, u0 , v0 );
 			r = *pSrc++;
 			g = *pSrc++;
 			b = *pSrc++;
-			RGB2YUV_601( r, g, b, y1, u1 , v1 );
+			RGB2YUV( m, r, g, b, y1, u1 , v1 );
 			*pDst++ = y0;
 			*pDst++ = (u0+u1) >> 1;
 			*pDst++ = y1;
@@ -224,19 +311,27 @@ static void convert_rgb_to_yuv422( mlt_image src, mlt_image dst )
 			r = *pSrc++;
 			g = *pSrc++;
 			b = *pSrc++;
-			RGB2YUV_601( r, g, b, y0, u0 , v0 );
+			RGB2YUV( m, r, g, b, y0, u0 , v0 );
 			*pDst++ = y0;
 			*pDst++ = u0;
 		}
 	}
 }
 
-static void convert_yuv420p_to_yuv422( mlt_image src, mlt_image dst )
+static void convert_rgb_to_yuv422( convert_desc *desc )
 {
-	mlt_image_set_values( dst, NULL, mlt_image_yuv422, src->width, src->height );
-	mlt_image_alloc_data( dst );
+	mlt_image_set_values( desc->dst, NULL, mlt_image_yuv422, desc->src->width, desc->src->height );
+	mlt_image_alloc_data( desc->dst );
+	convert_lines( desc, rgb_to_yuv422_lines );
+}
+
+static void yuv420p_to_yuv422_lines( convert_desc *desc, int start, int end )
+{
+	mlt_image src = desc->src;
+	mlt_image dst = desc->dst;
 
-	for ( int line = 0; line < src->height; line++ )
+
+	for ( int line = start; line < end; line++ )
 	{
 		uint8_t* pSrcY = src->planes[0] + src->strides[0] * line;
 		uint8_t* pSrcU = src->planes[1] + src->strides[1] * line / 2;
@@ -253,15 +348,22 @@ static void convert_yuv420p_to_yuv422( mlt_image src, mlt_image dst )
 	}
 }
 
-static void convert_yuv420p_to_rgb( mlt_image src, mlt_image dst )
+static void convert_yuv420p_to_yuv422( convert_desc *desc )
+{
+	mlt_image_set_values( desc->dst, NULL, mlt_image_yuv422, desc->src->width, desc->src->height );
+	mlt_image_alloc_data( desc->dst );
+	convert_lines( desc, yuv420p_to_yuv422_lines );
+}
+
+static void yuv420p_to_rgb_lines( convert_desc *desc, int start, int end )
 {
+	mlt_image src = desc->src;
+	mlt_image dst = desc->dst;
+	const yuv_to_rgb_matrix *m = desc->yuv_to_rgb;
 	int yy, uu, vv;
 	int r,g,b;
 
-	mlt_image_set_values( dst, NULL, mlt_image_rgb, src->width, src->height );
-	mlt_image_alloc_data( dst );
-
-	for ( int line = 0; line < src->height; line++ )
+	for ( int line = start; line < end; line++ )
 	{
 		uint8_t* pSrcY = src->planes[0] + src->strides[0] * line;
 		uint8_t* pSrcU = src->planes[1] + src->strides[1] * line / 2;
@@ -273,12 +375,12 @@ static void convert_yuv420p_to_rgb( mlt_image src, mlt_image dst )
 			yy = *pSrcY++;
 			uu = *pSrcU++;
 			vv = *pSrcV++;
-			YUV2RGB_601( yy, uu, vv, r, g, b );
+			YUV2RGB( m, yy, uu, vv, r, g, b );
 			pDst[0] = r;
 			pDst[1] = g;
 			pDst[2] = b;
 			yy = *pSrcY++;
-			YUV2RGB_601( yy, uu, vv, r, g, b );
+			YUV2RGB( m, yy, uu, vv, r, g, b );
 			pDst[3] = r;
 			pDst[4] = g;
 			pDst[5] = b;
@@ -287,15 +389,22 @@ static void convert_yuv420p_to_rgb( mlt_image src, mlt_image dst )
 	}
 }
 
-static void convert_yuv420p_to_rgba( mlt_image src, mlt_image dst )
+static void convert_yuv420p_to_rgb( convert_desc *desc )
 {
+	mlt_image_set_values( desc->dst, NULL, mlt_image_rgb, desc->src->width, desc->src->height );
+	mlt_image_alloc_data( desc->dst );
+	convert_lines( desc, yuv420p_to_rgb_lines );
+}
+
+static void yuv420p_to_rgba_lines( convert_desc *desc, int start, int end )
+{
+	mlt_image src = desc->src;
+	mlt_image dst = desc->dst;
+	const yuv_to_rgb_matrix *m = desc->yuv_to_rgb;
 	int yy, uu, vv;
 	int r,g,b;
 
-	mlt_image_set_values( dst, NULL, mlt_image_rgba, src->width, src->height );
-	mlt_image_alloc_data( dst );
-
-	for ( int line = 0; line < src->height; line++ )
+	for ( int line = start; line < end; line++ )
 	{
 		uint8_t* pSrcY = src->planes[0] + src->strides[0] * line;
 		uint8_t* pSrcU = src->planes[1] + src->strides[1] * line / 2;
@@ -309,13 +418,13 @@ static void convert_yuv420p_to_rgba( mlt_image src, mlt_image dst )
 				yy = *pSrcY++;
 				uu = *pSrcU++;
 				vv = *pSrcV++;
-				YUV2RGB_601( yy, uu, vv, r, g, b );
+				YUV2RGB( m, yy, uu, vv, r, g, b );
 				pDst[0] = r;
 				pDst[1] = g;
 				pDst[2] = b;
 				pDst[3] = *pSrcA++;
 				yy = *pSrcY++;
-				YUV2RGB_601( yy, uu, vv, r, g, b );
+				YUV2RGB( m, yy, uu, vv, r, g, b );
 				pDst[4] = r;
 				pDst[5] = g;
 				pDst[6] = b;
@@ -328,13 +437,13 @@ static void convert_yuv420p_to_rgba( mlt_image src, mlt_image dst )
 				yy = *pSrcY++;
 				uu = *pSrcU++;
 				vv = *pSrcV++;
-				YUV2RGB_601( yy, uu, vv, r, g, b );
+				YUV2RGB( m, yy, uu, vv, r, g, b );
 				pDst[0] = r;
 				pDst[1] = g;
 				pDst[2] = b;
 				pDst[3] = 0xff;
 				yy = *pSrcY++;
-				YUV2RGB_601( yy, uu, vv, r, g, b );
+				YUV2RGB( m, yy, uu, vv, r, g, b );
 				pDst[4] = r;
 				pDst[5] = g;
 				pDst[6] = b;
@@ -344,17 +453,24 @@ static void convert_yuv420p_to_rgba( mlt_image src, mlt_image dst )
 	}
 }
 
-static void convert_yuv422_to_yuv420p( mlt_image src, mlt_image dst )
+static void convert_yuv420p_to_rgba( convert_desc *desc )
 {
-	int lines = src->height;
-	int pixels = src->width;
+	mlt_image_set_values( desc->dst, NULL, mlt_image_rgba, desc->src->width, desc->src->height );
+	mlt_image_alloc_data( desc->dst );
+	convert_lines( desc, yuv420p_to_rgba_lines );
+}
 
-	mlt_image_set_values( dst, NULL, mlt_image_yuv420p, src->width, src->height );
-	mlt_image_alloc_data( dst );
+static void yuv422_to_yuv420p_lines( convert_desc *desc, int start, int end )
+{
+	mlt_image src = desc->src;
+	mlt_image dst = desc->dst;
+	int pixels = src->width;
+	int chroma_lines = src->height / 2;
+	int chroma_pixels = src->width / 2;
 
-	// Y
-	for ( int line = 0; line < lines; line++ )
+	for ( int line = start; line < end; line++ )
 	{
+		// Y
 		uint8_t* pSrc = src->planes[0] + src->strides[0] * line;
 		uint8_t* pDst = dst->planes[0] + dst->strides[0] * line;
 		for ( int pixel = 0; pixel < pixels; pixel++ )
@@ -362,29 +478,22 @@ static void convert_yuv422_to_yuv420p( mlt_image src, mlt_image dst )
 			*pDst++ = *pSrc;
 			pSrc += 2;
 		}
-	}
 
-	lines = src->height / 2;
-	pixels = src->width / 2;
+		// U and V come from the even lines
+		if ( line % 2 || line / 2 >= chroma_lines )
+			continue;
 
-	// U
-	for ( int line = 0; line < lines; line++ )
-	{
-		uint8_t* pSrc = src->planes[0] + src->strides[0] * line * 2 + 1;
-		uint8_t* pDst = dst->planes[1] + dst->strides[1] * line;
-		for ( int pixel = 0; pixel < pixels; pixel++ )
+		pSrc = src->planes[0] + src->strides[0] * line + 1;
+		pDst = dst->planes[1] + dst->strides[1] * line / 2;
+		for ( int pixel = 0; pixel < chroma_pixels; pixel++ )
 		{
 			*pDst++ = *pSrc;
 			pSrc += 4;
 		}
-	}
 
-	// V
-	for ( int line = 0; line < lines; line++ )
-	{
-		uint8_t* pSrc = src->planes[0] + src->strides[0] * line * 2 + 3;
-		uint8_t* pDst = dst->planes[2] + dst->strides[2] * line;
-		for ( int pixel = 0; pixel < pixels; pixel++ )
+		pSrc = src->planes[0] + src->strides[0] * line + 3;
+		pDst = dst->planes[2] + dst->strides[2] * line / 2;
+		for ( int pixel = 0; pixel < chroma_pixels; pixel++ )
 		{
 			*pDst++ = *pSrc;
 			pSrc += 4;
@@ -392,12 +501,20 @@ static void convert_yuv422_to_yuv420p( mlt_image src, mlt_image dst )
 	}
 }
 
-static void convert_rgb_to_rgba( mlt_image src, mlt_image dst )
+static void convert_yuv422_to_yuv420p( convert_desc *desc )
+{
+	mlt_image_set_values( desc->dst, NULL, mlt_image_yuv420p, desc->src->width, desc->src->height );
+	mlt_image_alloc_data( desc->dst );
+	convert_lines( desc, yuv422_to_yuv420p_lines );
+}
+
+static void rgb_to_rgba_lines( convert_desc *desc, int start, int end )
 {
-	mlt_image_set_values( dst, NULL, mlt_image_rgba, src->width, src->height );
-	mlt_image_alloc_data( dst );
+	mlt_image src = desc->src;
+	mlt_image dst = desc->dst;
+
 
-	for ( int line = 0; line < src->height; line++ )
+	for ( int line = start; line < end; line++ )
 	{
 		uint8_t* pSrc = src->planes[0] + src->strides[0] * line;
 		uint8_t* pAlpha = src->planes[3] + src->strides[3] * line;
@@ -424,13 +541,20 @@ static void convert_rgb_to_rgba( mlt_image src, mlt_image dst )
 	}
 }
 
-static void convert_rgba_to_rgb( mlt_image src, mlt_image dst )
+static void convert_rgb_to_rgba( convert_desc *desc )
+{
+	mlt_image_set_values( desc->dst, NULL, mlt_image_rgba, desc->src->width, desc->src->height );
+	mlt_image_alloc_data( desc->dst );
+	convert_lines( desc, rgb_to_rgba_lines );
+}
+
+static void rgba_to_rgb_lines( convert_desc *desc, int start, int end )
 {
-	mlt_image_set_values( dst, NULL, mlt_image_rgb, src->width, src->height );
-	mlt_image_alloc_data( dst );
-	mlt_image_alloc_alpha( dst );
+	mlt_image src = desc->src;
+	mlt_image dst = desc->dst;
 
-	for ( int line = 0; line < src->height; line++ )
+
+	for ( int line = start; line < end; line++ )
 	{
 		uint8_t* pSrc = src->planes[0] + src->strides[0] * line;
 		uint8_t* pDst = dst->planes[0] + dst->strides[0] * line;
@@ -447,7 +571,15 @@ static void convert_rgba_to_rgb( mlt_image src, mlt_image dst )
 	}
 }
 
-typedef void ( *conversion_function )( mlt_image src, mlt_image dst );
+static void convert_rgba_to_rgb( convert_desc *desc )
+{
+	mlt_image_set_values( desc->dst, NULL, mlt_image_rgb, desc->src->width, desc->src->height );
+	mlt_image_alloc_data( desc->dst );
+	mlt_image_alloc_alpha( desc->dst );
+	convert_lines( desc, rgba_to_rgb_lines );
+}
+
+typedef void ( *conversion_function )( convert_desc *desc );
 
 static conversion_function conversion_matrix[ mlt_image_invalid - 1 ][ mlt_image_invalid - 1 ] = {
 	{ NULL, convert_rgb_to_rgba, convert_rgb_to_yuv422, NULL, NULL, NULL, NULL },
@@ -477,6 +609,19 @@ static int convert_image( mlt_frame frame, uint8_t **buffer, mlt_image_format *f
 		{
 			struct mlt_image_s src;
 			struct mlt_image_s dst;
+			int colorspace = mlt_properties_get_int( properties, "colorspace" );
+			int full_range = mlt_properties_get_int( properties, "full_range" );
+			convert_desc desc = { &src, &dst, NULL, NULL, NULL };
+			if ( colorspace == 709 )
+			{
+				desc.yuv_to_rgb = full_range ? &yuv_to_rgb_709_full : &yuv_to_rgb_709;
+				desc.rgb_to_yuv = full_range ? &rgb_to_yuv_709_full : &rgb_to_yuv_709;
+			}
+			else
+			{
+				desc.yuv_to_rgb = full_range ? &yuv_to_rgb_601_full : &yuv_to_rgb_601;
+				desc.rgb_to_yuv = full_range ? &rgb_to_yuv_601_full : &rgb_to_yuv_601;
+			}
 			mlt_image_set_values( &src, *buffer, *format, width, height );
 			if ( requested_format == mlt_image_rgba && mlt_frame_get_alpha( frame ) )
 			{
@@ -486,7 +631,7 @@ static int convert_image( mlt_frame frame, uint8_t **buffer, mlt_image_format *f
 				src.planes[3] = mlt_frame_get_alpha( frame );
 				src.strides[3] = src.width;
 			}
-			converter( &src, &dst );
+			converter( &desc );
 			mlt_frame_set_image( frame, dst.data, 0, dst.release_data );
 			if ( requested_format == mlt_image_rgba )
 			{
@@ -526,6 +671,9 @@ static mlt_frame filter_process( mlt_filter filter, mlt_frame frame )
 mlt_filter filter_imageconvert_init( mlt_profile profile, mlt_service_type type, const char *id, char *arg )
 {
 	mlt_filter filter = calloc( 1, sizeof( struct mlt_filter_s ) );
+#if defined(USE_SSE) && defined(ARCH_X86_64)
+	pthread_once( &simd_once, init_simd );
+#endif
 	if ( mlt_filter_init( filter, filter ) == 0 )
 	{
 		filter->process = filter_process;
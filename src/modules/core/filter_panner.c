@@ -20,6 +20,7 @@
 #include <framework/mlt_filter.h>
 #include <framework/mlt_frame.h>
 #include <framework/mlt_log.h>
+#include <framework/mlt_audio_dsp.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,14 +28,138 @@
 #include <math.h>
 
 
+/** Compute the mixing weights [in][out] for one pan or balance position.
+*/
+
+static void pan_factors( double weight, int active_channel, int gang, double factors[6][6] )
+{
+	int i, out;
+
+	for ( i = 0; i < 6; i++ )
+		for ( out = 0; out < 6; out++ )
+			factors[i][out] = 0.0;
+
+	switch ( active_channel )
+	{
+		case -1: // Front L/R balance
+		case -2: // Rear L/R balance
+		{
+			// Gang front/rear balance if requested
+			int g, active = active_channel;
+			for ( g = 0; g < gang; g++, active-- )
+			{
+				int left = active == -1 ? 0 : 2;
+				int right = left + 1;
+				if ( weight < 0.0 )
+				{
+					factors[left][left] = 1.0;
+					factors[right][right] = weight + 1.0 < 0.0 ? 0.0 : weight + 1.0;
+				}
+				else
+				{
+					factors[left][left] = 1.0 - weight < 0.0 ? 0.0 : 1.0 - weight;
+					factors[right][right] = 1.0;
+				}
+			}
+			break;
+		}
+		case -3: // Left fade
+		case -4: // right fade
+		{
+			// Gang left/right fade if requested
+			int g, active = active_channel;
+			for ( g = 0; g < gang; g++, active-- )
+			{
+				int front = active == -3 ? 0 : 1;
+				int rear = front + 2;
+				if ( weight < 0.0 )
+				{
+					factors[front][front] = 1.0;
+					factors[rear][rear] = weight + 1.0 < 0.0 ? 0.0 : weight + 1.0;
+				}
+				else
+				{
+					factors[front][front] = 1.0 - weight < 0.0 ? 0.0 : 1.0 - weight;
+					factors[rear][rear] = 1.0;
+				}
+			}
+			break;
+		}
+		case 0: // left
+		case 2:
+		{
+			int left = active_channel;
+			int right = left + 1;
+			factors[right][right] = 1.0;
+			if ( weight < 0.0 ) // output left toward left
+			{
+				factors[left][left] = 0.5 - weight * 0.5;
+				factors[left][right] = ( 1.0 + weight ) * 0.5;
+			}
+			else // output left toward right
+			{
+				factors[left][left] = ( 1.0 - weight ) * 0.5;
+				factors[left][right] = 0.5 + weight * 0.5;
+			}
+			break;
+		}
+		case 1: // right
+		case 3:
+		{
+			int right = active_channel;
+			int left = right - 1;
+			factors[left][left] = 1.0;
+			if ( weight < 0.0 ) // output right toward left
+			{
+				factors[right][left] = 0.5 - weight * 0.5;
+				factors[right][right] = ( 1.0 + weight ) * 0.5;
+			}
+			else // output right toward right
+			{
+				factors[right][left] = ( 1.0 - weight ) * 0.5;
+				factors[right][right] = 0.5 + weight * 0.5;
+			}
+			break;
+		}
+	}
+}
+
+/** Classify a weight by the piece of pan_factors() that applies to it.
+ *
+ * Within one piece every factor is linear in the weight.
+ */
+
+static int pan_piece( double weight )
+{
+	return weight < -1.0 ? 0 : weight < 0.0 ? 1 : weight <= 1.0 ? 2 : 3;
+}
+
+/** Find the end of the run of samples, starting at first, whose weights are in one piece.
+*/
+
+static int pan_piece_end( double weight, double weight_step, int first, int samples )
+{
+	int piece = pan_piece( weight + first * weight_step );
+	int lo = first, hi = samples - 1;
+
+	// The weight ramps linearly, so the pieces are in order
+	while ( lo < hi )
+	{
+		int mid = lo + ( hi - lo + 1 ) / 2;
+		if ( pan_piece( weight + mid * weight_step ) == piece )
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo + 1;
+}
+
 /** Get the audio.
 */
 
 static int filter_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
 {
 	mlt_properties properties = mlt_frame_pop_audio( frame );
-	mlt_filter filter = mlt_frame_pop_audio( frame );
-	mlt_properties filter_props = MLT_FILTER_PROPERTIES( filter );
 	mlt_properties frame_props = MLT_FRAME_PROPERTIES( frame );
 
 	// We can only mix interleaved 32-bit float.
@@ -47,139 +172,55 @@ static int filter_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *f
 	if ( silent )
 		memset( *buffer, 0, *samples * *channels * sizeof( float ) );
 
-	int src_size = 0;
-	float *src = mlt_properties_get_data( filter_props, "scratch_buffer", &src_size );
 	float *dest = *buffer;
-	double v; // sample accumulator
-	int i, out, in;
-	double factors[6][6]; // mixing weights [in][out]
+	int i, end, out, in;
+	double first[6][6], last[6][6]; // mixing weights [in][out]
 	double mix_start = 0.5, mix_end = 0.5;
 	if ( mlt_properties_get( properties, "previous_mix" ) != NULL )
 		mix_start = mlt_properties_get_double( properties, "previous_mix" );
 	if ( mlt_properties_get( properties, "mix" ) != NULL )
 		mix_end = mlt_properties_get_double( properties, "mix" );
-	double weight = mix_start;
 	double weight_step = ( mix_end - mix_start ) / *samples;
 	int active_channel = mlt_properties_get_int( properties, "channel" );
 	int gang = mlt_properties_get_int( properties, "gang" ) ? 2 : 1;
+	int size = *channels * *channels;
+	float *matrix = mlt_pool_alloc( 2 * size * sizeof( *matrix ) );
+	float *matrix_step = matrix + size;
 
-	// Setup or resize a scratch buffer
-	if ( !src || src_size < *samples * *channels * sizeof(*src) )
-	{
-		// We allocate 4 more samples than we need to deal with jitter in the sample count per frame.
-		src_size = ( *samples + 4 ) * *channels * sizeof(*src);
-		src = mlt_pool_alloc( src_size );
-		if ( !src )
-			return 0;
-		mlt_properties_set_data( filter_props, "scratch_buffer", src, src_size, mlt_pool_release, NULL );
-	}
-
-	// We must use a pristine copy as the source
-	memcpy( src, *buffer, *samples * *channels * sizeof(*src) );
+	if ( !matrix )
+		return 0;
 
-	// Initialize the mix factors
-	for ( i = 0; i < 6; i++ )
-		for ( out = 0; out < 6; out++ )
-			factors[i][out] = 0.0;
-
-	for ( i = 0; i < *samples; i++ )
+	// The weights ramp linearly between the pieces of pan_factors(), so mix
+	// each piece with a ramped matrix. Channels beyond the sixth pass through.
+	for ( i = 0; i < *samples; i = end )
 	{
-		// Recompute the mix factors
-		switch ( active_channel )
+		end = pan_piece_end( mix_start, weight_step, i, *samples );
+		pan_factors( mix_start + i * weight_step, active_channel, gang, first );
+		pan_factors( mix_start + ( end - 1 ) * weight_step, active_channel, gang, last );
+
+		for ( in = 0; in < *channels; in++ )
 		{
-			case -1: // Front L/R balance
-			case -2: // Rear L/R balance
-			{
-				// Gang front/rear balance if requested
-				int g, active = active_channel;
-				for ( g = 0; g < gang; g++, active-- )
-				{
-					int left = active == -1 ? 0 : 2;
-					int right = left + 1;
-					if ( weight < 0.0 )
-					{
-						factors[left][left] = 1.0;
-						factors[right][right] = weight + 1.0 < 0.0 ? 0.0 : weight + 1.0;
-					}
-					else
-					{
-						factors[left][left] = 1.0 - weight < 0.0 ? 0.0 : 1.0 - weight;
-						factors[right][right] = 1.0;
-					}
-				}
-				break;
-			}
-			case -3: // Left fade
-			case -4: // right fade
-			{
-				// Gang left/right fade if requested
-				int g, active = active_channel;
-				for ( g = 0; g < gang; g++, active-- )
-				{
-					int front = active == -3 ? 0 : 1;
-					int rear = front + 2;
-					if ( weight < 0.0 )
-					{
-						factors[front][front] = 1.0;
-						factors[rear][rear] = weight + 1.0 < 0.0 ? 0.0 : weight + 1.0;
-					}
-					else
-					{
-						factors[front][front] = 1.0 - weight < 0.0 ? 0.0 : 1.0 - weight;
-						factors[rear][rear] = 1.0;
-					}
-				}
-				break;
-			}
-			case 0: // left
-			case 2:
+			for ( out = 0; out < *channels; out++ )
 			{
-				int left = active_channel;
-				int right = left + 1;
-				factors[right][right] = 1.0;
-				if ( weight < 0.0 ) // output left toward left
-				{
-					factors[left][left] = 0.5 - weight * 0.5;
-					factors[left][right] = ( 1.0 + weight ) * 0.5;
-				}
-				else // output left toward right
-				{
-					factors[left][left] = ( 1.0 - weight ) * 0.5;
-					factors[left][right] = 0.5 + weight * 0.5;
-				}
-				break;
-			}
-			case 1: // right
-			case 3:
-			{
-				int right = active_channel;
-				int left = right - 1;
-				factors[left][left] = 1.0;
-				if ( weight < 0.0 ) // output right toward left
+				int k = in * *channels + out;
+				if ( in < 6 && out < 6 )
 				{
-					factors[right][left] = 0.5 - weight * 0.5;
-					factors[right][right] = ( 1.0 + weight ) * 0.5;
+					matrix[ k ] = first[in][out];
+					matrix_step[ k ] = end - 1 > i ? ( last[in][out] - first[in][out] ) / ( end - 1 - i ) : 0.0;
 				}
-				else // output right toward right
+				else
 				{
-					factors[right][left] = ( 1.0 - weight ) * 0.5;
-					factors[right][right] = 0.5 + weight * 0.5;
+					matrix[ k ] = in == out;
+					matrix_step[ k ] = 0.0;
 				}
-				break;
 			}
 		}
 
-		// Do the mixing
-		for ( out = 0; out < *channels && out < 6; out++ )
-		{
-			v = 0;
-			for ( in = 0; in < *channels && in < 6; in++ )
-				v += factors[in][out] * src[ i * *channels + in ];
-			dest[ i * *channels + out ] = v;
-		}
-		weight += weight_step;
+		mlt_audio_dsp_pan( dest + i * *channels, dest + i * *channels, *channels, end - i, matrix, matrix_step );
 	}
 
+	mlt_pool_release( matrix );
+
 	return 0;
 }
 
@@ -280,7 +321,6 @@ static mlt_frame filter_process( mlt_filter filter, mlt_frame frame )
 		instance_props, 0, (mlt_destructor) mlt_properties_close, NULL );
 
 	// Override the get_audio method
-	mlt_frame_push_audio( frame, filter );
 	mlt_frame_push_audio( frame, instance_props );
 	mlt_frame_push_audio( frame, filter_get_audio );
 
@@ -0,0 +1,276 @@
+/*
+ * image_convert_simd.c -- SSE2 and AVX2 line kernels for filter_imageconvert
+ * Copyright (C) 2024 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "image_proc.h"
+
+#if defined(USE_SSE) && defined(ARCH_X86_64)
+
+#include <immintrin.h>
+
+// The kernels use the same integer arithmetic as the scalar macros in
+// filter_imageconvert.c, so their results are bit-exact: products are summed
+// in 32 bits with _mm_madd_epi16 and clamping is done by the saturating packs.
+
+/** Pack two 16 bit coefficients for _mm_madd_epi16.
+*/
+
+static inline int pair16( int lo, int hi )
+{
+	return (int) ( ( (unsigned) hi << 16 ) | ( lo & 0xffff ) );
+}
+
+/** Convert 8 pixels of yuv422 to rgba.
+*/
+
+static inline void yuv422_to_rgba_8( uint8_t *dst, __m128i s, __m128i a, const yuv_to_rgb_matrix *m )
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i low16 = _mm_set1_epi32( 0xffff );
+	const __m128i yr = _mm_set1_epi32( pair16( m->y_scale, m->v_r ) );
+	const __m128i yg = _mm_set1_epi32( pair16( m->y_scale, -m->u_g ) );
+	const __m128i yb = _mm_set1_epi32( pair16( m->y_scale, m->u_b ) );
+	const __m128i vg = _mm_set1_epi32( pair16( -m->v_g, 0 ) );
+
+	__m128i y = _mm_and_si128( s, _mm_set1_epi16( 0xff ) );
+	__m128i c = _mm_srli_epi16( s, 8 );
+	__m128i u = _mm_and_si128( c, low16 );
+	__m128i v = _mm_srli_epi32( c, 16 );
+	u = _mm_or_si128( u, _mm_slli_epi32( u, 16 ) );
+	v = _mm_or_si128( v, _mm_slli_epi32( v, 16 ) );
+	y = _mm_sub_epi16( y, _mm_set1_epi16( m->y_offset ) );
+	u = _mm_sub_epi16( u, _mm_set1_epi16( 128 ) );
+	v = _mm_sub_epi16( v, _mm_set1_epi16( 128 ) );
+
+	__m128i yv = _mm_unpacklo_epi16( y, v );
+	__m128i yu = _mm_unpacklo_epi16( y, u );
+	__m128i v0 = _mm_unpacklo_epi16( v, zero );
+	__m128i r_lo = _mm_srai_epi32( _mm_madd_epi16( yv, yr ), 10 );
+	__m128i g_lo = _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( yu, yg ), _mm_madd_epi16( v0, vg ) ), 10 );
+	__m128i b_lo = _mm_srai_epi32( _mm_madd_epi16( yu, yb ), 10 );
+	yv = _mm_unpackhi_epi16( y, v );
+	yu = _mm_unpackhi_epi16( y, u );
+	v0 = _mm_unpackhi_epi16( v, zero );
+	__m128i r_hi = _mm_srai_epi32( _mm_madd_epi16( yv, yr ), 10 );
+	__m128i g_hi = _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( yu, yg ), _mm_madd_epi16( v0, vg ) ), 10 );
+	__m128i b_hi = _mm_srai_epi32( _mm_madd_epi16( yu, yb ), 10 );
+
+	__m128i r = _mm_packs_epi32( r_lo, r_hi );
+	__m128i g = _mm_packs_epi32( g_lo, g_hi );
+	__m128i b = _mm_packs_epi32( b_lo, b_hi );
+	r = _mm_packus_epi16( r, r );
+	g = _mm_packus_epi16( g, g );
+	b = _mm_packus_epi16( b, b );
+
+	__m128i rg = _mm_unpacklo_epi8( r, g );
+	__m128i ba = _mm_unpacklo_epi8( b, a );
+	_mm_storeu_si128( (__m128i*) dst, _mm_unpacklo_epi16( rg, ba ) );
+	_mm_storeu_si128( (__m128i*) ( dst + 16 ), _mm_unpackhi_epi16( rg, ba ) );
+}
+
+int convert_line_yuv422_to_rgba_sse2( uint8_t *dst, const uint8_t *src, const uint8_t *alpha, int width, const yuv_to_rgb_matrix *m )
+{
+	int i;
+	for ( i = 0; i + 8 <= width; i += 8 )
+	{
+		__m128i s = _mm_loadu_si128( (const __m128i*) ( src + i * 2 ) );
+		__m128i a = alpha ? _mm_loadl_epi64( (const __m128i*) ( alpha + i ) ) : _mm_set1_epi8( -1 );
+		yuv422_to_rgba_8( dst + i * 4, s, a, m );
+	}
+	return i;
+}
+
+/** Convert 8 pixels of rgba to yuv422.
+*/
+
+static inline void rgba_to_yuv422_8( uint8_t *dst, uint8_t *alpha, __m128i p0, __m128i p1, const rgb_to_yuv_matrix *m )
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mask = _mm_set1_epi32( 0xff );
+	const __m128i ry = _mm_set1_epi32( pair16( m->r_y, m->g_y ) );
+	const __m128i ru = _mm_set1_epi32( pair16( m->r_u, m->g_u ) );
+	const __m128i rv = _mm_set1_epi32( pair16( m->r_v, m->g_v ) );
+	const __m128i by = _mm_set1_epi32( pair16( m->b_y, 0 ) );
+	const __m128i bu = _mm_set1_epi32( pair16( m->b_u, 0 ) );
+	const __m128i bv = _mm_set1_epi32( pair16( m->b_v, 0 ) );
+	const __m128i offset = _mm_set1_epi32( 128 );
+
+	// Planar 16 bit R, G, B and A
+	__m128i r = _mm_packs_epi32( _mm_and_si128( p0, mask ), _mm_and_si128( p1, mask ) );
+	__m128i g = _mm_packs_epi32( _mm_and_si128( _mm_srli_epi32( p0, 8 ), mask ), _mm_and_si128( _mm_srli_epi32( p1, 8 ), mask ) );
+	__m128i b = _mm_packs_epi32( _mm_and_si128( _mm_srli_epi32( p0, 16 ), mask ), _mm_and_si128( _mm_srli_epi32( p1, 16 ), mask ) );
+	__m128i a = _mm_packs_epi32( _mm_srli_epi32( p0, 24 ), _mm_srli_epi32( p1, 24 ) );
+
+	__m128i rg = _mm_unpacklo_epi16( r, g );
+	__m128i b0 = _mm_unpacklo_epi16( b, zero );
+	__m128i y_lo = _mm_add_epi32( _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( rg, ry ), _mm_madd_epi16( b0, by ) ), 10 ), _mm_set1_epi32( m->y_offset ) );
+	__m128i u_lo = _mm_add_epi32( _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( rg, ru ), _mm_madd_epi16( b0, bu ) ), 10 ), offset );
+	__m128i v_lo = _mm_add_epi32( _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( rg, rv ), _mm_madd_epi16( b0, bv ) ), 10 ), offset );
+	rg = _mm_unpackhi_epi16( r, g );
+	b0 = _mm_unpackhi_epi16( b, zero );
+	__m128i y_hi = _mm_add_epi32( _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( rg, ry ), _mm_madd_epi16( b0, by ) ), 10 ), _mm_set1_epi32( m->y_offset ) );
+	__m128i u_hi = _mm_add_epi32( _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( rg, ru ), _mm_madd_epi16( b0, bu ) ), 10 ), offset );
+	__m128i v_hi = _mm_add_epi32( _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( rg, rv ), _mm_madd_epi16( b0, bv ) ), 10 ), offset );
+
+	// Average the chroma of each pair of pixels
+	u_lo = _mm_add_epi32( u_lo, _mm_srli_epi64( u_lo, 32 ) );
+	u_hi = _mm_add_epi32( u_hi, _mm_srli_epi64( u_hi, 32 ) );
+	v_lo = _mm_add_epi32( v_lo, _mm_srli_epi64( v_lo, 32 ) );
+	v_hi = _mm_add_epi32( v_hi, _mm_srli_epi64( v_hi, 32 ) );
+	__m128i u = _mm_castps_si128( _mm_shuffle_ps( _mm_castsi128_ps( u_lo ), _mm_castsi128_ps( u_hi ), _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+	__m128i v = _mm_castps_si128( _mm_shuffle_ps( _mm_castsi128_ps( v_lo ), _mm_castsi128_ps( v_hi ), _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+	u = _mm_srai_epi32( u, 1 );
+	v = _mm_srai_epi32( v, 1 );
+
+	__m128i y = _mm_packs_epi32( y_lo, y_hi );
+	__m128i c = _mm_or_si128( _mm_and_si128( u, _mm_set1_epi32( 0xffff ) ), _mm_slli_epi32( v, 16 ) );
+	_mm_storeu_si128( (__m128i*) dst, _mm_packus_epi16( _mm_unpacklo_epi16( y, c ), _mm_unpackhi_epi16( y, c ) ) );
+	_mm_storel_epi64( (__m128i*) alpha, _mm_packus_epi16( a, a ) );
+}
+
+int convert_line_rgba_to_yuv422_sse2( uint8_t *dst, uint8_t *alpha, const uint8_t *src, int width, const rgb_to_yuv_matrix *m )
+{
+	int i;
+	for ( i = 0; i + 8 <= width; i += 8 )
+	{
+		__m128i p0 = _mm_loadu_si128( (const __m128i*) ( src + i * 4 ) );
+		__m128i p1 = _mm_loadu_si128( (const __m128i*) ( src + i * 4 + 16 ) );
+		rgba_to_yuv422_8( dst + i * 2, alpha + i, p0, p1, m );
+	}
+	return i;
+}
+
+// The AVX2 versions run the same steps on two 128 bit lanes at once and fix
+// the order of the lanes when storing.
+
+__attribute__((target("avx2")))
+int convert_line_yuv422_to_rgba_avx2( uint8_t *dst, const uint8_t *src, const uint8_t *alpha, int width, const yuv_to_rgb_matrix *m )
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i low16 = _mm256_set1_epi32( 0xffff );
+	const __m256i yr = _mm256_set1_epi32( pair16( m->y_scale, m->v_r ) );
+	const __m256i yg = _mm256_set1_epi32( pair16( m->y_scale, -m->u_g ) );
+	const __m256i yb = _mm256_set1_epi32( pair16( m->y_scale, m->u_b ) );
+	const __m256i vg = _mm256_set1_epi32( pair16( -m->v_g, 0 ) );
+	int i;
+
+	for ( i = 0; i + 16 <= width; i += 16 )
+	{
+		__m256i s = _mm256_loadu_si256( (const __m256i*) ( src + i * 2 ) );
+		__m256i a = alpha ? _mm256_inserti128_si256( _mm256_castsi128_si256(
+				_mm_loadl_epi64( (const __m128i*) ( alpha + i ) ) ),
+				_mm_loadl_epi64( (const __m128i*) ( alpha + i + 8 ) ), 1 )
+			: _mm256_set1_epi8( -1 );
+
+		__m256i y = _mm256_and_si256( s, _mm256_set1_epi16( 0xff ) );
+		__m256i c = _mm256_srli_epi16( s, 8 );
+		__m256i u = _mm256_and_si256( c, low16 );
+		__m256i v = _mm256_srli_epi32( c, 16 );
+		u = _mm256_or_si256( u, _mm256_slli_epi32( u, 16 ) );
+		v = _mm256_or_si256( v, _mm256_slli_epi32( v, 16 ) );
+		y = _mm256_sub_epi16( y, _mm256_set1_epi16( m->y_offset ) );
+		u = _mm256_sub_epi16( u, _mm256_set1_epi16( 128 ) );
+		v = _mm256_sub_epi16( v, _mm256_set1_epi16( 128 ) );
+
+		__m256i yv = _mm256_unpacklo_epi16( y, v );
+		__m256i yu = _mm256_unpacklo_epi16( y, u );
+		__m256i v0 = _mm256_unpacklo_epi16( v, zero );
+		__m256i r_lo = _mm256_srai_epi32( _mm256_madd_epi16( yv, yr ), 10 );
+		__m256i g_lo = _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( yu, yg ), _mm256_madd_epi16( v0, vg ) ), 10 );
+		__m256i b_lo = _mm256_srai_epi32( _mm256_madd_epi16( yu, yb ), 10 );
+		yv = _mm256_unpackhi_epi16( y, v );
+		yu = _mm256_unpackhi_epi16( y, u );
+		v0 = _mm256_unpackhi_epi16( v, zero );
+		__m256i r_hi = _mm256_srai_epi32( _mm256_madd_epi16( yv, yr ), 10 );
+		__m256i g_hi = _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( yu, yg ), _mm256_madd_epi16( v0, vg ) ), 10 );
+		__m256i b_hi = _mm256_srai_epi32( _mm256_madd_epi16( yu, yb ), 10 );
+
+		__m256i r = _mm256_packs_epi32( r_lo, r_hi );
+		__m256i g = _mm256_packs_epi32( g_lo, g_hi );
+		__m256i b = _mm256_packs_epi32( b_lo, b_hi );
+		r = _mm256_packus_epi16( r, r );
+		g = _mm256_packus_epi16( g, g );
+		b = _mm256_packus_epi16( b, b );
+
+		__m256i rg = _mm256_unpacklo_epi8( r, g );
+		__m256i ba = _mm256_unpacklo_epi8( b, a );
+		__m256i out0 = _mm256_unpacklo_epi16( rg, ba );
+		__m256i out1 = _mm256_unpackhi_epi16( rg, ba );
+		_mm256_storeu_si256( (__m256i*) ( dst + i * 4 ), _mm256_permute2x128_si256( out0, out1, 0x20 ) );
+		_mm256_storeu_si256( (__m256i*) ( dst + i * 4 + 32 ), _mm256_permute2x128_si256( out0, out1, 0x31 ) );
+	}
+	return i + convert_line_yuv422_to_rgba_sse2( dst + i * 4, src + i * 2, alpha ? alpha + i : NULL, width - i, m );
+}
+
+__attribute__((target("avx2")))
+int convert_line_rgba_to_yuv422_avx2( uint8_t *dst, uint8_t *alpha, const uint8_t *src, int width, const rgb_to_yuv_matrix *m )
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i mask = _mm256_set1_epi32( 0xff );
+	const __m256i ry = _mm256_set1_epi32( pair16( m->r_y, m->g_y ) );
+	const __m256i ru = _mm256_set1_epi32( pair16( m->r_u, m->g_u ) );
+	const __m256i rv = _mm256_set1_epi32( pair16( m->r_v, m->g_v ) );
+	const __m256i by = _mm256_set1_epi32( pair16( m->b_y, 0 ) );
+	const __m256i bu = _mm256_set1_epi32( pair16( m->b_u, 0 ) );
+	const __m256i bv = _mm256_set1_epi32( pair16( m->b_v, 0 ) );
+	const __m256i offset = _mm256_set1_epi32( 128 );
+	const __m256i y_offset = _mm256_set1_epi32( m->y_offset );
+	const __m256i alpha_order = _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 );
+	int i;
+
+	for ( i = 0; i + 16 <= width; i += 16 )
+	{
+		__m256i p0 = _mm256_loadu_si256( (const __m256i*) ( src + i * 4 ) );
+		__m256i p1 = _mm256_loadu_si256( (const __m256i*) ( src + i * 4 + 32 ) );
+
+		__m256i r = _mm256_packs_epi32( _mm256_and_si256( p0, mask ), _mm256_and_si256( p1, mask ) );
+		__m256i g = _mm256_packs_epi32( _mm256_and_si256( _mm256_srli_epi32( p0, 8 ), mask ), _mm256_and_si256( _mm256_srli_epi32( p1, 8 ), mask ) );
+		__m256i b = _mm256_packs_epi32( _mm256_and_si256( _mm256_srli_epi32( p0, 16 ), mask ), _mm256_and_si256( _mm256_srli_epi32( p1, 16 ), mask ) );
+		__m256i a = _mm256_packs_epi32( _mm256_srli_epi32( p0, 24 ), _mm256_srli_epi32( p1, 24 ) );
+
+		__m256i rg = _mm256_unpacklo_epi16( r, g );
+		__m256i b0 = _mm256_unpacklo_epi16( b, zero );
+		__m256i y_lo = _mm256_add_epi32( _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( rg, ry ), _mm256_madd_epi16( b0, by ) ), 10 ), y_offset );
+		__m256i u_lo = _mm256_add_epi32( _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( rg, ru ), _mm256_madd_epi16( b0, bu ) ), 10 ), offset );
+		__m256i v_lo = _mm256_add_epi32( _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( rg, rv ), _mm256_madd_epi16( b0, bv ) ), 10 ), offset );
+		rg = _mm256_unpackhi_epi16( r, g );
+		b0 = _mm256_unpackhi_epi16( b, zero );
+		__m256i y_hi = _mm256_add_epi32( _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( rg, ry ), _mm256_madd_epi16( b0, by ) ), 10 ), y_offset );
+		__m256i u_hi = _mm256_add_epi32( _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( rg, ru ), _mm256_madd_epi16( b0, bu ) ), 10 ), offset );
+		__m256i v_hi = _mm256_add_epi32( _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( rg, rv ), _mm256_madd_epi16( b0, bv ) ), 10 ), offset );
+
+		u_lo = _mm256_add_epi32( u_lo, _mm256_srli_epi64( u_lo, 32 ) );
+		u_hi = _mm256_add_epi32( u_hi, _mm256_srli_epi64( u_hi, 32 ) );
+		v_lo = _mm256_add_epi32( v_lo, _mm256_srli_epi64( v_lo, 32 ) );
+		v_hi = _mm256_add_epi32( v_hi, _mm256_srli_epi64( v_hi, 32 ) );
+		__m256i u = _mm256_castps_si256( _mm256_shuffle_ps( _mm256_castsi256_ps( u_lo ), _mm256_castsi256_ps( u_hi ), _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+		__m256i v = _mm256_castps_si256( _mm256_shuffle_ps( _mm256_castsi256_ps( v_lo ), _mm256_castsi256_ps( v_hi ), _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+		u = _mm256_srai_epi32( u, 1 );
+		v = _mm256_srai_epi32( v, 1 );
+
+		__m256i y = _mm256_packs_epi32( y_lo, y_hi );
+		__m256i c = _mm256_or_si256( _mm256_and_si256( u, _mm256_set1_epi32( 0xffff ) ), _mm256_slli_epi32( v, 16 ) );
+		__m256i out = _mm256_packus_epi16( _mm256_unpacklo_epi16( y, c ), _mm256_unpackhi_epi16( y, c ) );
+		_mm256_storeu_si256( (__m256i*) ( dst + i * 2 ), _mm256_permute4x64_epi64( out, _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+		a = _mm256_permutevar8x32_epi32( _mm256_packus_epi16( a, a ), alpha_order );
+		_mm_storeu_si128( (__m128i*) ( alpha + i ), _mm256_castsi256_si128( a ) );
+	}
+	return i + convert_line_rgba_to_yuv422_sse2( dst + i * 2, alpha + i, src + i * 4, width - i, m );
+}
+
+#endif
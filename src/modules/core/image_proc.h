@@ -24,4 +24,42 @@
 
 void mlt_image_box_blur( mlt_image self, int hradius, int vradius );
 
+/** Fixed point coefficients (scaled by 1024) to convert Y'CbCr to R'G'B'.
+ *
+ * r = ( y_scale * ( Y - y_offset ) + v_r * ( V - 128 ) ) >> 10
+ * g = ( y_scale * ( Y - y_offset ) - u_g * ( U - 128 ) - v_g * ( V - 128 ) ) >> 10
+ * b = ( y_scale * ( Y - y_offset ) + u_b * ( U - 128 ) ) >> 10
+ */
+typedef struct
+{
+	int y_offset;
+	int y_scale;
+	int v_r;
+	int u_g;
+	int v_g;
+	int u_b;
+} yuv_to_rgb_matrix;
+
+/** Fixed point coefficients (scaled by 1024) to convert R'G'B' to Y'CbCr.
+ *
+ * Y = ( ( r_y * R + g_y * G + b_y * B ) >> 10 ) + y_offset
+ * U = ( ( r_u * R + g_u * G + b_u * B ) >> 10 ) + 128
+ * V = ( ( r_v * R + g_v * G + b_v * B ) >> 10 ) + 128
+ */
+typedef struct
+{
+	int y_offset;
+	int r_y, g_y, b_y;
+	int r_u, g_u, b_u;
+	int r_v, g_v, b_v;
+} rgb_to_yuv_matrix;
+
+#if defined(USE_SSE) && defined(ARCH_X86_64)
+// These convert as many whole groups of pixels as they can and return how many pixels they did.
+int convert_line_yuv422_to_rgba_sse2( uint8_t *dst, const uint8_t *src, const uint8_t *alpha, int width, const yuv_to_rgb_matrix *m );
+int convert_line_yuv422_to_rgba_avx2( uint8_t *dst, const uint8_t *src, const uint8_t *alpha, int width, const yuv_to_rgb_matrix *m );
+int convert_line_rgba_to_yuv422_sse2( uint8_t *dst, uint8_t *alpha, const uint8_t *src, int width, const rgb_to_yuv_matrix *m );
+int convert_line_rgba_to_yuv422_avx2( uint8_t *dst, uint8_t *alpha, const uint8_t *src, int width, const rgb_to_yuv_matrix *m );
+#endif
+
 #endif // IMAGE_PROC_H
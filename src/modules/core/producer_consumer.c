@@ -37,7 +37,6 @@ struct context_s {
 };
 typedef struct context_s *context; 
 
-
 static int get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
 {
 	context cx = mlt_frame_pop_service( frame );
@@ -48,14 +47,14 @@ static int get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format
 
 	int result = mlt_frame_get_image( nested_frame, image, format, width, height, writable );
 
-	// Allocate the image
+	// Share the image; it is copied by mlt_frame_get_image if it must be writable
+	mlt_properties nested_props = MLT_FRAME_PROPERTIES( nested_frame );
 	int size = mlt_image_format_size( *format, *width, *height, NULL );
-	uint8_t *new_image = mlt_pool_alloc( size );
+	uint8_t *new_image = mlt_frame_share_data( nested_props, "image", *image, size );
 
 	// Update the frame
 	mlt_properties properties = mlt_frame_properties( frame );
 	mlt_frame_set_image( frame, new_image, size, mlt_pool_release );
-	memcpy( new_image, *image, size );
 	mlt_properties_set( properties, "progressive", mlt_properties_get( MLT_FRAME_PROPERTIES(nested_frame), "progressive" ) );
 	*image = new_image;
 	
@@ -63,8 +62,7 @@ static int get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format
 	uint8_t *alpha = mlt_frame_get_alpha_size(nested_frame, &size);
 	if ( alpha && size > 0 )
 	{
-		new_image = mlt_pool_alloc( size );
-		memcpy( new_image, alpha, size );
+		new_image = mlt_frame_share_data( nested_props, "alpha", alpha, size );
 		mlt_frame_set_alpha( frame, new_image, size, mlt_pool_release );
 	}
 
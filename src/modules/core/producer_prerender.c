@@ -0,0 +1,932 @@
+/*
+ * producer_prerender.c -- cache the rendered frames of a producer on disk
+ * Copyright (C) 2022 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <framework/mlt.h>
+
+#define PRODUCER_PROPERTIES_PREFIX "producer."
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <utime.h>
+#include <sys/mman.h>
+#define make_dir( path ) mkdir( path, 0755 )
+#else
+#include <windows.h>
+#include <io.h>
+#include <process.h>
+#include <direct.h>
+#include <sys/utime.h>
+#define make_dir( path ) mkdir( path )
+#endif
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/** Every cache file is a fixed, page sized header followed by the image
+    (and alpha) or audio samples, so that a hit is a single mapping of the
+    file and the payload can be handed to the frame without a copy.
+*/
+
+#define CACHE_MAGIC "MLTPRE\0\0"
+#define CACHE_VERSION 1
+#define CACHE_DATA_OFFSET 4096
+#define MAX_DEPTH 64
+#define DEFAULT_CACHE_SIZE 10240
+
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t map_size;
+	uint64_t key;
+	int64_t position;
+	int32_t format;
+	int32_t size;
+	int32_t width;
+	int32_t height;
+	int32_t alpha_size;
+	int32_t progressive;
+	int32_t top_field_first;
+	int32_t frequency;
+	int32_t channels;
+	int32_t samples;
+	double aspect_ratio;
+} cache_header;
+
+struct context_s {
+	mlt_producer self;
+	mlt_producer producer;
+	mlt_properties watched;
+	pthread_mutex_t mutex;
+	atomic_int dirty;
+	uint64_t key;
+	int warned;
+	pthread_mutex_t trim_mutex;
+	int64_t written;
+	int trimmed;
+};
+typedef struct context_s *context;
+
+static uint64_t hash_bytes( uint64_t hash, const void *data, size_t size )
+{
+	const uint8_t *p = data;
+	while ( size-- )
+	{
+		hash ^= *p++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static uint64_t hash_string( uint64_t hash, const char *s )
+{
+	return hash_bytes( hash, s, strlen( s ) + 1 );
+}
+
+/** Properties that every service may have in addition to its parameters.
+*/
+
+static const char *common_properties[] =
+{
+	"mlt_service", "resource", "in", "out", "length", "disable", "track", "a_track", "b_track", NULL
+};
+
+/** Get the metadata of a service from the repository, which caches it.
+*/
+
+static mlt_properties service_metadata( mlt_properties properties )
+{
+	const char *type = mlt_properties_get( properties, "mlt_type" );
+	const char *id = mlt_properties_get( properties, "mlt_service" );
+	mlt_service_type service_type;
+	char name[ 256 ];
+	char *novalidate;
+
+	if ( !type || !id )
+		return NULL;
+	if ( !strcmp( type, "producer" ) || !strcmp( type, "mlt_producer" ) )
+		service_type = mlt_service_producer_type;
+	else if ( !strcmp( type, "filter" ) )
+		service_type = mlt_service_filter_type;
+	else if ( !strcmp( type, "transition" ) )
+		service_type = mlt_service_transition_type;
+	else if ( !strcmp( type, "link" ) )
+		service_type = mlt_service_link_type;
+	else
+		return NULL;
+
+	// "avformat-novalidate" is described by the metadata of "avformat"
+	snprintf( name, sizeof( name ), "%s", id );
+	novalidate = strstr( name, "-novalidate" );
+	if ( novalidate )
+		*novalidate = '\0';
+	return mlt_repository_metadata( mlt_factory_repository( ), service_type, name );
+}
+
+/** Determine whether a property contributes to the key.
+
+    Only the parameters that the metadata of a service documents are used,
+    less the read-only ones through which it reports what it measured while
+    rendering, so that neither those nor the properties that consumers and
+    applications attach to a service change the key. A service without
+    metadata contributes every property that does not begin with an
+    underscore or "meta.".
+*/
+
+static int is_key_property( mlt_properties properties, const char *name )
+{
+	mlt_properties metadata, parameters;
+	int i;
+
+	if ( !name || name[0] == '_' || !strncmp( name, "meta.", 5 ) )
+		return 0;
+	for ( i = 0; common_properties[ i ]; i++ )
+		if ( !strcmp( name, common_properties[ i ] ) )
+			return 1;
+
+	metadata = service_metadata( properties );
+	parameters = metadata ? mlt_properties_get_data( metadata, "parameters", NULL ) : NULL;
+	if ( !parameters )
+		return 1;
+
+	for ( i = 0; i < mlt_properties_count( parameters ); i++ )
+	{
+		mlt_properties parameter = mlt_properties_get_data_at( parameters, i, NULL );
+		const char *identifier = parameter ? mlt_properties_get( parameter, "identifier" ) : NULL;
+		const char *readonly = parameter ? mlt_properties_get( parameter, "readonly" ) : NULL;
+		size_t length;
+
+		if ( !identifier || ( readonly && ( !strcmp( readonly, "yes" ) || !strcmp( readonly, "true" ) ) ) )
+			continue;
+		// Identifiers may be followed by a note, as in "gain (*DEPRECATED*)",
+		// and "producer.*" stands for every property with that prefix
+		length = strcspn( identifier, " " );
+		if ( length > 0 && identifier[ length - 1 ] == '*' )
+		{
+			if ( !strncmp( name, identifier, length - 1 ) )
+				return 1;
+		}
+		else if ( strlen( name ) == length && !strncmp( name, identifier, length ) )
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void nested_changed( mlt_properties owner, mlt_producer self, mlt_event_data event_data )
+{
+	context cx = self->child;
+	const char *name = mlt_event_data_to_string( event_data );
+
+	// service-changed has no name: a filter was attached, detached or moved
+	if ( !name || is_key_property( owner, name ) )
+		atomic_store( &cx->dirty, 1 );
+}
+
+static void watch( context cx, mlt_properties properties )
+{
+	char key[ 32 ];
+	snprintf( key, sizeof( key ), "%p", properties );
+	if ( !mlt_properties_get_data( cx->watched, key, NULL ) )
+	{
+		mlt_properties_inc_ref( properties );
+		mlt_properties_set_data( cx->watched, key, properties, 0, ( mlt_destructor )mlt_properties_close, NULL );
+		mlt_events_listen( properties, cx->self, "property-changed", ( mlt_listener )nested_changed );
+		mlt_events_listen( properties, cx->self, "service-changed", ( mlt_listener )nested_changed );
+	}
+}
+
+static void unwatch_all( context cx )
+{
+	int i;
+	for ( i = 0; i < mlt_properties_count( cx->watched ); i++ )
+	{
+		mlt_properties properties = mlt_properties_get_data_at( cx->watched, i, NULL );
+		mlt_events_disconnect( properties, cx->self );
+	}
+	mlt_properties_close( cx->watched );
+	cx->watched = mlt_properties_new( );
+}
+
+/** Serialize the properties of a service and everything it draws frames
+    from into the hash, subscribing to the property-changed events of each
+    service on the way.
+*/
+
+static uint64_t hash_service( context cx, mlt_service service, uint64_t hash, int depth )
+{
+	mlt_properties properties;
+	struct stat st;
+	const char *resource;
+	int i;
+
+	if ( !service || depth > MAX_DEPTH )
+		return hash;
+	properties = MLT_SERVICE_PROPERTIES( service );
+	watch( cx, properties );
+
+	for ( i = 0; i < mlt_properties_count( properties ); i++ )
+	{
+		const char *name = mlt_properties_get_name( properties, i );
+		const char *value = mlt_properties_get_value( properties, i );
+		if ( value && is_key_property( properties, name ) )
+		{
+			hash = hash_string( hash, name );
+			hash = hash_string( hash, value );
+		}
+	}
+
+	// A file that is edited in place invalidates its frames too
+	resource = mlt_properties_get( properties, "resource" );
+	if ( resource && !stat( resource, &st ) )
+	{
+		int64_t stamp[ 2 ] = { st.st_size, st.st_mtime };
+		hash = hash_bytes( hash, stamp, sizeof( stamp ) );
+	}
+
+	for ( i = 0; i < mlt_service_filter_count( service ); i++ )
+		hash = hash_service( cx, MLT_FILTER_SERVICE( mlt_service_filter( service, i ) ), hash, depth + 1 );
+
+	switch ( mlt_service_identify( service ) )
+	{
+	case mlt_service_playlist_type:
+	{
+		mlt_playlist playlist = ( mlt_playlist )service;
+		for ( i = 0; i < mlt_playlist_count( playlist ); i++ )
+			hash = hash_service( cx, MLT_PRODUCER_SERVICE( mlt_playlist_get_clip( playlist, i ) ), hash, depth + 1 );
+		break;
+	}
+	case mlt_service_multitrack_type:
+	{
+		mlt_multitrack multitrack = ( mlt_multitrack )service;
+		for ( i = 0; i < mlt_multitrack_count( multitrack ); i++ )
+			hash = hash_service( cx, MLT_PRODUCER_SERVICE( mlt_multitrack_track( multitrack, i ) ), hash, depth + 1 );
+		break;
+	}
+	case mlt_service_chain_type:
+	{
+		mlt_chain chain = ( mlt_chain )service;
+		for ( i = 0; i < mlt_chain_link_count( chain ); i++ )
+			hash = hash_service( cx, MLT_LINK_SERVICE( mlt_chain_link( chain, i ) ), hash, depth + 1 );
+		hash = hash_service( cx, MLT_PRODUCER_SERVICE( mlt_chain_get_source( chain ) ), hash, depth + 1 );
+		break;
+	}
+	case mlt_service_producer_type:
+		if ( mlt_producer_is_cut( ( mlt_producer )service ) )
+			hash = hash_service( cx, MLT_PRODUCER_SERVICE( mlt_producer_cut_parent( ( mlt_producer )service ) ), hash, depth + 1 );
+		break;
+	default:
+		// Tractors and the transitions and filters planted in their fields
+		// are connected to the service that feeds them
+		hash = hash_service( cx, mlt_service_producer( service ), hash, depth + 1 );
+		break;
+	}
+
+	return hash;
+}
+
+/** Get the cache key of the nested producer, recomputing it if any of the
+    services it is made of reported a change since the last frame.
+*/
+
+static uint64_t get_key( context cx )
+{
+	pthread_mutex_lock( &cx->mutex );
+	if ( atomic_exchange( &cx->dirty, 0 ) )
+	{
+		mlt_profile profile = mlt_service_profile( MLT_PRODUCER_SERVICE( cx->self ) );
+		int32_t values[ 8 ] = { profile->width, profile->height, profile->frame_rate_num, profile->frame_rate_den,
+			profile->sample_aspect_num, profile->sample_aspect_den, profile->progressive, profile->colorspace };
+		char hex[ 17 ];
+
+		unwatch_all( cx );
+		cx->key = hash_bytes( 0xcbf29ce484222325ULL, values, sizeof( values ) );
+		cx->key = hash_service( cx, MLT_PRODUCER_SERVICE( cx->producer ), cx->key, 0 );
+		snprintf( hex, sizeof( hex ), "%016llx", ( unsigned long long )cx->key );
+		mlt_properties_set( MLT_PRODUCER_PROPERTIES( cx->self ), "cache_key", hex );
+	}
+	pthread_mutex_unlock( &cx->mutex );
+	return cx->key;
+}
+
+static int make_path( char *path )
+{
+	struct stat st;
+	char *slash = strrchr( path, '/' );
+	int error = 0;
+
+	if ( !stat( path, &st ) )
+		return 0;
+	if ( slash && slash != path )
+	{
+		*slash = '\0';
+		error = make_path( path );
+		*slash = '/';
+	}
+	if ( !error && make_dir( path ) && errno != EEXIST )
+		error = 1;
+	return error;
+}
+
+/** Get the cache directory, which defaults to $XDG_CACHE_HOME/mlt/prerender.
+*/
+
+static int cache_directory( context cx, char *path )
+{
+	const char *dir = mlt_properties_get( MLT_PRODUCER_PROPERTIES( cx->self ), "cache_dir" );
+
+	if ( dir )
+		snprintf( path, PATH_MAX, "%s", dir );
+	else if ( getenv( "XDG_CACHE_HOME" ) )
+		snprintf( path, PATH_MAX, "%s/mlt/prerender", getenv( "XDG_CACHE_HOME" ) );
+#ifdef _WIN32
+	else if ( getenv( "LOCALAPPDATA" ) )
+		snprintf( path, PATH_MAX, "%s/mlt/prerender", getenv( "LOCALAPPDATA" ) );
+#endif
+	else if ( getenv( "HOME" ) )
+		snprintf( path, PATH_MAX, "%s/.cache/mlt/prerender", getenv( "HOME" ) );
+	else
+		return 1;
+	return 0;
+}
+
+/** Build the name of a cache file, creating its directory if \p create.
+    Entries live in a directory per key under the cache directory.
+*/
+
+static int cache_filename( context cx, char *path, uint64_t key, const char *name, int create )
+{
+	int error = 0;
+
+	if ( cache_directory( cx, path ) )
+		return 1;
+
+	snprintf( path + strlen( path ), PATH_MAX - strlen( path ), "/%016llx", ( unsigned long long )key );
+	if ( create && make_path( path ) )
+	{
+		if ( !cx->warned )
+			mlt_log_warning( MLT_PRODUCER_SERVICE( cx->self ), "cannot create %s\n", path );
+		cx->warned = 1;
+		error = 1;
+	}
+	snprintf( path + strlen( path ), PATH_MAX - strlen( path ), "/%s", name );
+	return error;
+}
+
+/** Release a payload returned by cache_read.
+*/
+
+static void cache_release( void *data )
+{
+	uint8_t *base = ( uint8_t* )data - CACHE_DATA_OFFSET;
+#ifndef _WIN32
+	munmap( base, ( ( cache_header* )base )->map_size );
+#else
+	free( base );
+#endif
+}
+
+/** Map a cache file and return a pointer to its payload.
+
+    The mapping is private and writable, so a consumer that modifies the
+    image gets copy-on-write pages rather than changing the file. A hit
+    refreshes the modification time that cache_trim orders entries by, at
+    most once a minute so that playback does not write to the disk.
+*/
+
+static uint8_t *cache_read( const char *path, cache_header *header )
+{
+	uint8_t *base = NULL;
+	struct stat st;
+	int fd = open( path, O_RDONLY | O_BINARY );
+
+	if ( fd < 0 )
+		return NULL;
+	if ( !fstat( fd, &st ) && st.st_size > CACHE_DATA_OFFSET )
+	{
+		if ( time( NULL ) - st.st_mtime > 60 )
+			utime( path, NULL );
+#ifndef _WIN32
+		base = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+		if ( base == MAP_FAILED )
+			base = NULL;
+#else
+		base = malloc( st.st_size );
+		if ( base && read( fd, base, st.st_size ) != st.st_size )
+		{
+			free( base );
+			base = NULL;
+		}
+#endif
+	}
+	close( fd );
+
+	if ( base )
+	{
+		memcpy( header, base, sizeof( *header ) );
+		if ( memcmp( header->magic, CACHE_MAGIC, sizeof( header->magic ) ) || header->version != CACHE_VERSION
+			|| header->map_size != ( uint64_t )st.st_size || header->size < 0 || header->alpha_size < 0
+			|| CACHE_DATA_OFFSET + ( uint64_t )header->size + header->alpha_size > header->map_size )
+		{
+#ifndef _WIN32
+			munmap( base, st.st_size );
+#else
+			free( base );
+#endif
+			return NULL;
+		}
+		return base + CACHE_DATA_OFFSET;
+	}
+	return NULL;
+}
+
+/** Move a file over another, which rename does not do on Windows.
+*/
+
+static int replace_file( const char *from, const char *to )
+{
+#ifndef _WIN32
+	return rename( from, to );
+#else
+	return !MoveFileExA( from, to, MOVEFILE_REPLACE_EXISTING );
+#endif
+}
+
+typedef struct
+{
+	char *path;
+	time_t time;
+	int64_t size;
+}
+cache_entry;
+
+static int compare_entries( const void *a, const void *b )
+{
+	const cache_entry *x = a, *y = b;
+	return x->time < y->time ? -1 : x->time > y->time;
+}
+
+// The directory of a key is named by its 16 lower case hexadecimal digits.
+
+static int is_key_directory( const char *path )
+{
+	const char *name = strrchr( path, '/' );
+	name = name ? name + 1 : path;
+	return strlen( name ) == 16 && strspn( name, "0123456789abcdef" ) == 16;
+}
+
+/** Remove the least recently used files of the cache directory until it
+    is below seven eighths of \p limit bytes, along with the directories of
+    keys left empty. Every producer that shares the directory enforces its
+    own limit on all of it.
+*/
+
+static void cache_trim( context cx, int64_t limit )
+{
+	mlt_properties keys = mlt_properties_new( );
+	cache_entry *entries = NULL;
+	int count = 0, allocated = 0;
+	int64_t total = 0;
+	char dir[ PATH_MAX ];
+	int i, j;
+
+	if ( cache_directory( cx, dir ) )
+	{
+		mlt_properties_close( keys );
+		return;
+	}
+
+	// Leave alone anything that is not ours in a directory the user chose
+	mlt_properties_dir_list( keys, dir, "????????????????", 0 );
+	for ( i = 0; i < mlt_properties_count( keys ); i++ )
+	{
+		mlt_properties files;
+		if ( !is_key_directory( mlt_properties_get_value( keys, i ) ) )
+			continue;
+		files = mlt_properties_new( );
+		mlt_properties_dir_list( files, mlt_properties_get_value( keys, i ), "*.image", 0 );
+		mlt_properties_dir_list( files, mlt_properties_get_value( keys, i ), "*.audio", 0 );
+		mlt_properties_dir_list( files, mlt_properties_get_value( keys, i ), "*.tmp", 0 );
+		for ( j = 0; j < mlt_properties_count( files ); j++ )
+		{
+			const char *file = mlt_properties_get_value( files, j );
+			struct stat st;
+			if ( stat( file, &st ) || !S_ISREG( st.st_mode ) )
+				continue;
+			if ( count == allocated )
+			{
+				allocated = allocated ? allocated * 2 : 1024;
+				entries = realloc( entries, allocated * sizeof( *entries ) );
+			}
+			entries[ count ].path = strdup( file );
+			entries[ count ].time = st.st_mtime;
+			entries[ count ].size = st.st_size;
+			total += st.st_size;
+			count++;
+		}
+		mlt_properties_close( files );
+	}
+
+	if ( total > limit )
+	{
+		qsort( entries, count, sizeof( *entries ), compare_entries );
+		for ( i = 0; i < count && total > limit / 8 * 7; i++ )
+			if ( !remove( entries[ i ].path ) )
+				total -= entries[ i ].size;
+		mlt_log_verbose( MLT_PRODUCER_SERVICE( cx->self ), "removed %d files from %s\n", i, dir );
+
+		// Only empty directories are removed
+		for ( i = 0; i < mlt_properties_count( keys ); i++ )
+			if ( is_key_directory( mlt_properties_get_value( keys, i ) ) )
+				rmdir( mlt_properties_get_value( keys, i ) );
+	}
+
+	for ( i = 0; i < count; i++ )
+		free( entries[ i ].path );
+	free( entries );
+	mlt_properties_close( keys );
+}
+
+/** Account for a file added to the cache, trimming the cache directory on
+    the first write and then whenever a sixteenth of its limit was written.
+*/
+
+static void cache_written( context cx, int64_t size )
+{
+	int64_t limit = mlt_properties_get_int64( MLT_PRODUCER_PROPERTIES( cx->self ), "cache_size" ) * 1024 * 1024;
+	int trim;
+
+	if ( limit <= 0 )
+		return;
+	pthread_mutex_lock( &cx->trim_mutex );
+	cx->written += size;
+	trim = !cx->trimmed || cx->written > limit / 16;
+	if ( trim )
+	{
+		cx->written = 0;
+		cx->trimmed = 1;
+	}
+	pthread_mutex_unlock( &cx->trim_mutex );
+	if ( trim )
+		cache_trim( cx, limit );
+}
+
+/** Write a cache file through a temporary so that readers in this or
+    another process never map a partial entry.
+*/
+
+static void cache_write( context cx, const char *path, cache_header *header, const void *data, const void *alpha, void *unique )
+{
+	char temp[ PATH_MAX + 64 ];
+	char pad[ CACHE_DATA_OFFSET ] = { 0 };
+	FILE *file;
+
+	memcpy( header->magic, CACHE_MAGIC, sizeof( header->magic ) );
+	header->version = CACHE_VERSION;
+	header->map_size = CACHE_DATA_OFFSET + ( uint64_t )header->size + header->alpha_size;
+	memcpy( pad, header, sizeof( *header ) );
+
+	snprintf( temp, sizeof( temp ), "%s.%d.%p.tmp", path, ( int )getpid(), unique );
+	file = fopen( temp, "wb" );
+	if ( file )
+	{
+		int error = fwrite( pad, CACHE_DATA_OFFSET, 1, file ) != 1
+			|| fwrite( data, header->size, 1, file ) != 1
+			|| ( header->alpha_size && fwrite( alpha, header->alpha_size, 1, file ) != 1 );
+		error = fclose( file ) || error;
+		if ( error || replace_file( temp, path ) )
+			remove( temp );
+		else
+			cache_written( cx, header->map_size );
+	}
+}
+
+/** Get the frame of the nested producer on a cache miss.
+*/
+
+static mlt_frame get_nested_frame( context cx, mlt_frame frame )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	mlt_frame nested_frame;
+
+	pthread_mutex_lock( &cx->mutex );
+	nested_frame = mlt_properties_get_data( properties, "_prerender.frame", NULL );
+	if ( !nested_frame )
+	{
+		mlt_producer_seek( cx->producer, mlt_properties_get_position( properties, "_prerender.position" ) );
+		if ( !mlt_service_get_frame( MLT_PRODUCER_SERVICE( cx->producer ), &nested_frame, 0 ) )
+			mlt_properties_set_data( properties, "_prerender.frame", nested_frame, 0, ( mlt_destructor )mlt_frame_close, NULL );
+	}
+	pthread_mutex_unlock( &cx->mutex );
+	return nested_frame;
+}
+
+static int get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
+{
+	context cx = mlt_frame_pop_service( frame );
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	mlt_position position = mlt_properties_get_position( properties, "_prerender.position" );
+	uint64_t key = mlt_properties_get_int64( properties, "_prerender.key" );
+	char path[ PATH_MAX ], name[ 64 ];
+	cache_header header;
+	uint8_t *data;
+	int result = 0;
+
+	if ( *width <= 0 || *height <= 0 )
+	{
+		mlt_profile profile = mlt_service_profile( MLT_PRODUCER_SERVICE( cx->self ) );
+		*width = profile->width;
+		*height = profile->height;
+	}
+
+	snprintf( name, sizeof( name ), "%d-%dx%d-%s.image", position, *width, *height, mlt_image_format_name( *format ) );
+	if ( !cache_filename( cx, path, key, name, 0 )
+		&& ( data = cache_read( path, &header ) ) )
+	{
+		if ( header.position == position && header.key == key )
+		{
+			mlt_frame_set_image( frame, data, header.size, cache_release );
+			if ( header.alpha_size > 0 )
+			{
+				uint8_t *alpha = mlt_pool_alloc( header.alpha_size );
+				memcpy( alpha, data + header.size, header.alpha_size );
+				mlt_frame_set_alpha( frame, alpha, header.alpha_size, mlt_pool_release );
+			}
+			mlt_properties_set_int( properties, "progressive", header.progressive );
+			mlt_properties_set_int( properties, "top_field_first", header.top_field_first );
+			mlt_properties_set_double( properties, "aspect_ratio", header.aspect_ratio );
+			*image = data;
+			*format = header.format;
+			*width = header.width;
+			*height = header.height;
+			return 0;
+		}
+		cache_release( data );
+	}
+
+	mlt_frame nested_frame = get_nested_frame( cx, frame );
+	if ( !nested_frame )
+		return 1;
+
+	memset( &header, 0, sizeof( header ) );
+	header.key = key;
+	header.position = position;
+	header.width = *width;
+	header.height = *height;
+	result = mlt_frame_get_image( nested_frame, image, format, &header.width, &header.height, writable );
+	if ( result || !*image )
+		return 1;
+
+	// Share the image; it is copied by mlt_frame_get_image if it must be writable
+	mlt_properties nested_props = MLT_FRAME_PROPERTIES( nested_frame );
+	uint8_t *alpha = mlt_frame_get_alpha_size( nested_frame, &header.alpha_size );
+	header.format = *format;
+	header.size = mlt_image_format_size( *format, header.width, header.height, NULL );
+	header.progressive = mlt_properties_get_int( nested_props, "progressive" );
+	header.top_field_first = mlt_properties_get_int( nested_props, "top_field_first" );
+	header.aspect_ratio = mlt_frame_get_aspect_ratio( nested_frame );
+	if ( !alpha || header.alpha_size != header.width * header.height )
+		header.alpha_size = 0;
+
+	if ( !cache_filename( cx, path, key, name, 1 ) )
+		cache_write( cx, path, &header, *image, alpha, frame );
+
+	data = mlt_frame_share_data( nested_props, "image", *image, header.size );
+	mlt_frame_set_image( frame, data, header.size, mlt_pool_release );
+	if ( header.alpha_size )
+		mlt_frame_set_alpha( frame, mlt_frame_share_data( nested_props, "alpha", alpha, header.alpha_size ), header.alpha_size, mlt_pool_release );
+	mlt_properties_set_int( properties, "progressive", header.progressive );
+	mlt_properties_set_int( properties, "top_field_first", header.top_field_first );
+	mlt_properties_set_double( properties, "aspect_ratio", header.aspect_ratio );
+	*image = data;
+	*width = header.width;
+	*height = header.height;
+
+	return 0;
+}
+
+static int get_audio( mlt_frame frame, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
+{
+	context cx = mlt_frame_pop_audio( frame );
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	mlt_position position = mlt_properties_get_position( properties, "_prerender.position" );
+	uint64_t key = mlt_properties_get_int64( properties, "_prerender.key" );
+	char path[ PATH_MAX ], name[ 64 ];
+	cache_header header;
+	uint8_t *data;
+	int result;
+
+	snprintf( name, sizeof( name ), "%d-%s.audio", position, mlt_audio_format_name( *format ) );
+	if ( !cache_filename( cx, path, key, name, 0 )
+		&& ( data = cache_read( path, &header ) ) )
+	{
+		// The sample count of a frame depends on where playback started
+		if ( header.position == position && header.key == key && header.frequency == *frequency
+			&& header.channels == *channels && header.samples == *samples )
+		{
+			mlt_frame_set_audio( frame, data, header.format, header.size, cache_release );
+			*buffer = data;
+			*format = header.format;
+			return 0;
+		}
+		cache_release( data );
+	}
+
+	mlt_frame nested_frame = get_nested_frame( cx, frame );
+	if ( !nested_frame )
+		return 1;
+
+	memset( &header, 0, sizeof( header ) );
+	header.key = key;
+	header.position = position;
+	header.frequency = *frequency;
+	header.channels = *channels;
+	header.samples = *samples;
+	result = mlt_frame_get_audio( nested_frame, buffer, format, frequency, channels, samples );
+	if ( result || !*buffer )
+		return 1;
+
+	header.format = *format;
+	header.size = mlt_audio_format_size( *format, *samples, *channels );
+	if ( header.frequency == *frequency && header.channels == *channels && header.samples == *samples
+		&& !cache_filename( cx, path, key, name, 1 ) )
+		cache_write( cx, path, &header, *buffer, NULL, frame );
+
+	data = mlt_pool_alloc( header.size );
+	memcpy( data, *buffer, header.size );
+	mlt_frame_set_audio( frame, data, *format, header.size, mlt_pool_release );
+	*buffer = data;
+
+	return 0;
+}
+
+/** Adopt the producer whose frames are cached.
+*/
+
+static void set_producer( context cx, mlt_producer producer )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( cx->self );
+
+	pthread_mutex_lock( &cx->mutex );
+	unwatch_all( cx );
+	mlt_producer_close( cx->producer );
+	cx->producer = producer;
+	atomic_store( &cx->dirty, 1 );
+	pthread_mutex_unlock( &cx->mutex );
+
+	if ( producer )
+	{
+		mlt_properties_pass_list( properties, MLT_PRODUCER_PROPERTIES( producer ), "out, length" );
+		mlt_properties_pass( MLT_PRODUCER_PROPERTIES( producer ), properties, PRODUCER_PROPERTIES_PREFIX );
+	}
+}
+
+static void property_changed( mlt_properties owner, mlt_producer self, mlt_event_data event_data )
+{
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( self );
+	context cx = self->child;
+	const char *name = mlt_event_data_to_string( event_data );
+
+	if ( !name )
+		return;
+
+	if ( !strcmp( name, "producer" ) )
+	{
+		mlt_producer producer = mlt_properties_get_data( properties, name, NULL );
+		if ( producer != cx->producer )
+		{
+			if ( producer )
+				mlt_properties_inc_ref( MLT_PRODUCER_PROPERTIES( producer ) );
+			set_producer( cx, producer );
+		}
+	}
+	else if ( cx->producer && name == strstr( name, PRODUCER_PROPERTIES_PREFIX ) )
+	{
+		mlt_properties_set( MLT_PRODUCER_PROPERTIES( cx->producer ), name + strlen( PRODUCER_PROPERTIES_PREFIX ),
+			mlt_properties_get( properties, name ) );
+	}
+}
+
+static int get_frame( mlt_producer self, mlt_frame_ptr frame, int index )
+{
+	context cx = self->child;
+
+	*frame = mlt_frame_init( MLT_PRODUCER_SERVICE( self ) );
+	if ( *frame )
+	{
+		mlt_properties frame_props = MLT_FRAME_PROPERTIES( *frame );
+		mlt_profile profile = mlt_service_profile( MLT_PRODUCER_SERVICE( self ) );
+
+		mlt_frame_set_position( *frame, mlt_producer_position( self ) );
+
+		if ( cx->producer )
+		{
+			// The nested frame is only requested on a cache miss
+			mlt_properties_set_position( frame_props, "_prerender.position", mlt_producer_frame( self ) );
+			mlt_properties_set_int64( frame_props, "_prerender.key", get_key( cx ) );
+			mlt_frame_push_service( *frame, cx );
+			mlt_frame_push_get_image( *frame, get_image );
+			mlt_frame_push_audio( *frame, cx );
+			mlt_frame_push_audio( *frame, get_audio );
+		}
+
+		mlt_properties_set_double( frame_props, "aspect_ratio", mlt_profile_sar( profile ) );
+		mlt_properties_set_int( frame_props, "width", profile->width );
+		mlt_properties_set_int( frame_props, "height", profile->height );
+		mlt_properties_set_int( frame_props, "meta.media.width", profile->width );
+		mlt_properties_set_int( frame_props, "meta.media.height", profile->height );
+		mlt_properties_set_int( frame_props, "progressive", profile->progressive );
+	}
+
+	mlt_producer_prepare_next( self );
+
+	return 0;
+}
+
+static void producer_close( mlt_producer self )
+{
+	context cx = self->child;
+
+	mlt_events_disconnect( MLT_PRODUCER_PROPERTIES( self ), self );
+	unwatch_all( cx );
+	mlt_properties_close( cx->watched );
+	mlt_producer_close( cx->producer );
+	pthread_mutex_destroy( &cx->mutex );
+	pthread_mutex_destroy( &cx->trim_mutex );
+	free( cx );
+
+	self->close = NULL;
+	mlt_producer_close( self );
+	free( self );
+}
+
+mlt_producer producer_prerender_init( mlt_profile profile, mlt_service_type type, const char *id, char *arg )
+{
+	mlt_producer self = mlt_producer_new( profile );
+	context cx = calloc( 1, sizeof( struct context_s ) );
+	mlt_producer producer = arg ? mlt_factory_producer( profile, NULL, arg ) : NULL;
+
+	if ( self && cx && ( producer || !arg ) )
+	{
+		mlt_properties properties = MLT_PRODUCER_PROPERTIES( self );
+
+		cx->self = self;
+		cx->watched = mlt_properties_new( );
+		pthread_mutex_init( &cx->mutex, NULL );
+		pthread_mutex_init( &cx->trim_mutex, NULL );
+		self->child = cx;
+		self->close = ( mlt_destructor )producer_close;
+		self->get_frame = get_frame;
+
+		mlt_properties_set( properties, "resource", arg );
+		mlt_properties_set_int( properties, "cache_size", DEFAULT_CACHE_SIZE );
+		if ( producer )
+		{
+			// cx->producer holds the reference; the property only exposes it
+			mlt_properties_set_data( properties, "producer", producer, 0, NULL, NULL );
+			set_producer( cx, producer );
+		}
+
+		// Without a resource the application supplies the "producer" to cache
+		mlt_events_listen( properties, self, "property-changed", ( mlt_listener )property_changed );
+	}
+	else
+	{
+		if ( self )
+			mlt_producer_close( self );
+		if ( producer )
+			mlt_producer_close( producer );
+		free( cx );
+		self = NULL;
+	}
+	return self;
+}
@@ -20,6 +20,7 @@
 #include <framework/mlt_transition.h>
 #include <framework/mlt_frame.h>
 #include <framework/mlt_log.h>
+#include <framework/mlt_audio_dsp.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -54,6 +55,12 @@ static void mix_audio( double weight_start, double weight_end, float *buffer_a,
 	double mix = weight_start;
 	double mix_step = ( weight_end - weight_start ) / samples;
 
+	if ( channels_a == channels_out && channels_b == channels_out )
+	{
+		mlt_audio_dsp_mix( buffer_a, buffer_b, channels_out, samples, mix, mix_step );
+		return;
+	}
+
 	for ( i = 0; i < samples; i++ )
 	{
 		for ( j = 0; j < channels_out; j++ )
@@ -77,6 +84,12 @@ static void sum_audio( double weight_start, double weight_end, float *buffer_a,
 	double mix = weight_start;
 	double mix_step = ( weight_end - weight_start ) / samples;
 
+	if ( channels_a == channels_out && channels_b == channels_out )
+	{
+		mlt_audio_dsp_sum( buffer_a, buffer_b, channels_out, samples, mix, mix_step );
+		return;
+	}
+
 	for ( i = 0; i < samples; i++ )
 	{
 		for ( j = 0; j < channels_out; j++ )
@@ -19,12 +19,21 @@
 
 #include <framework/mlt_filter.h>
 #include <framework/mlt_frame.h>
+#include <framework/mlt_audio_dsp.h>
+#include <framework/mlt_factory.h>
+#include <framework/mlt_producer.h>
+#include <framework/mlt_log.h>
+#include <framework/mlt_slices.h>
+#include "loudness_meter.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <ctype.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #define EPSILON 0.00001
 
@@ -154,6 +163,495 @@ double signal_max_power( int16_t *buffer, int channels, int samples, int16_t *pe
 
 /* ------ End normalize functions --------------------------------------- */
 
+// Seconds of audio decoded ahead of each chunk to settle the K-weighting
+#define LOUDNESS_PREROLL 1
+// Minimum seconds of audio per analysis chunk
+#define LOUDNESS_CHUNK 60
+#define LOUDNESS_HASH_BYTES (1 << 20)
+
+typedef struct
+{
+	mlt_producer *producers;
+	int frequency;
+	int channels;
+	double fps;
+	mlt_position length;
+	int64_t samples;
+	int blocks;
+	int block_size;
+	double *energy;
+	int *count;
+	double *true_peak;
+	double *sample_peak;
+	atomic_int *cancel;
+	int error;
+} loudness_analysis;
+
+/** The analysis of the producer that the filter is attached to.
+
+    It runs on its own thread, so get_audio only waits for the result and
+    never holds the filter's lock meanwhile. It is redone only when the
+    producer, its in and out points or the audio layout change.
+*/
+
+typedef struct
+{
+	pthread_mutex_t control;  /* serialises starting and stopping the thread */
+	pthread_mutex_t mutex;    /* protects done and result */
+	pthread_cond_t cond;
+	pthread_t thread;
+	int running;              /* the thread needs to be joined */
+	int started;              /* the fields below describe the current measurement */
+	int done;
+	atomic_int cancel;
+	mlt_filter filter;
+	mlt_producer parent;      /* only compared, never used by the thread */
+	mlt_properties properties; /* a copy of the parent's properties for the thread */
+	mlt_position in;
+	mlt_position out;
+	int frequency;
+	int channels;
+	loudness_result result;
+} loudness_job;
+
+/** Hash the size and the first and last megabyte of a file.
+
+    This identifies the media well enough to reuse an analysis without
+    reading all of it again.
+*/
+
+static int loudness_file_hash( const char *filename, char *hash, size_t size )
+{
+	struct stat st;
+	FILE *file;
+	uint64_t h = 14695981039346656037ULL;
+	unsigned char *buffer;
+	size_t n, i;
+	int pass;
+
+	if ( stat( filename, &st ) != 0 || !S_ISREG( st.st_mode ) )
+		return 1;
+	file = fopen( filename, "rb" );
+	if ( !file )
+		return 1;
+	buffer = malloc( LOUDNESS_HASH_BYTES );
+	for ( i = 0; i < sizeof( st.st_size ); i++ )
+		h = ( h ^ ( ( (uint64_t) st.st_size >> ( i * 8 ) ) & 0xff ) ) * 1099511628211ULL;
+	for ( pass = 0; pass < 2 && buffer; pass++ )
+	{
+		if ( pass == 1 )
+		{
+			if ( st.st_size <= LOUDNESS_HASH_BYTES )
+				break;
+			fseek( file, -LOUDNESS_HASH_BYTES, SEEK_END );
+		}
+		n = fread( buffer, 1, LOUDNESS_HASH_BYTES, file );
+		for ( i = 0; i < n; i++ )
+			h = ( h ^ buffer[ i ] ) * 1099511628211ULL;
+	}
+	free( buffer );
+	fclose( file );
+	snprintf( hash, size, "%016llx", (unsigned long long) h );
+	return 0;
+}
+
+/** Open a copy of a producer that plays from in to out.
+
+    Like mlt_producer_clone, this opens the same service and resource with
+    the same properties, but through the loader so that its audio is
+    converted like the original's. The properties are a copy of the
+    producer's, taken on the rendering thread, and the copy has none of the
+    producer's own filters.
+*/
+
+static mlt_producer loudness_clone( mlt_profile profile, mlt_properties properties, mlt_position in, mlt_position out )
+{
+	char *resource = mlt_properties_get( properties, "resource" );
+	char *service = mlt_properties_get( properties, "mlt_service" );
+	mlt_producer clone = NULL;
+
+	mlt_events_block( mlt_factory_event_object( ), mlt_factory_event_object( ) );
+	if ( service && resource )
+	{
+		char *name = malloc( strlen( service ) + strlen( resource ) + 2 );
+		sprintf( name, "%s:%s", service, resource );
+		clone = mlt_factory_producer( profile, "loader", name );
+		free( name );
+	}
+	if ( !clone && resource )
+		clone = mlt_factory_producer( profile, NULL, resource );
+	if ( clone )
+	{
+		mlt_properties_inherit( MLT_PRODUCER_PROPERTIES( clone ), properties );
+		mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( clone ), "video_index", -1 );
+		mlt_producer_set_in_and_out( clone, in, out );
+	}
+	mlt_events_unblock( mlt_factory_event_object( ), mlt_factory_event_object( ) );
+	return clone;
+}
+
+/** Measure one chunk of the programme with its own producer.
+*/
+
+static int loudness_analyse_slice( int id, int index, int jobs, void *cookie )
+{
+	loudness_analysis *analysis = cookie;
+	mlt_producer producer = analysis->producers[ index ];
+	loudness_meter meter = loudness_meter_new( analysis->frequency, analysis->channels );
+	int first_block = 0;
+	int blocks = mlt_slices_size_slice( jobs, index, analysis->blocks, &first_block );
+	int64_t start = (int64_t) first_block * analysis->block_size;
+	int64_t end = (int64_t) ( first_block + blocks ) * analysis->block_size;
+	int64_t preroll = start - analysis->frequency * LOUDNESS_PREROLL;
+	mlt_position position;
+	int64_t sample_position;
+
+	if ( !meter || !producer )
+	{
+		analysis->error = 1;
+		loudness_meter_close( meter );
+		return 0;
+	}
+	if ( end > analysis->samples )
+		end = analysis->samples;
+	loudness_meter_set_range( meter, start, end, analysis->energy, analysis->count );
+
+	// Find the frame that contains the first sample of the preroll
+	position = preroll > 0 ? preroll * analysis->fps / analysis->frequency : 0;
+	while ( position > 0 && mlt_audio_calculate_samples_to_position( analysis->fps, analysis->frequency, position ) > preroll )
+		position--;
+	sample_position = mlt_audio_calculate_samples_to_position( analysis->fps, analysis->frequency, position );
+	mlt_producer_seek( producer, position );
+
+	while ( sample_position < end && position < analysis->length && !analysis->error )
+	{
+		mlt_frame frame = NULL;
+		void *buffer = NULL;
+		mlt_audio_format format = mlt_audio_f32le;
+		int frequency = analysis->frequency;
+		int channels = analysis->channels;
+		int samples = mlt_audio_calculate_frame_samples( analysis->fps, frequency, position );
+
+		if ( atomic_load( analysis->cancel ) )
+		{
+			analysis->error = 1;
+			break;
+		}
+		if ( mlt_service_get_frame( MLT_PRODUCER_SERVICE( producer ), &frame, 0 ) || !frame )
+			break;
+		if ( mlt_frame_get_audio( frame, &buffer, &format, &frequency, &channels, &samples ) || !buffer
+		     || format != mlt_audio_f32le || frequency != analysis->frequency || channels != analysis->channels )
+		{
+			mlt_log_warning( MLT_PRODUCER_SERVICE( producer ), "unable to get %d channel audio at %d Hz for loudness analysis\n",
+				analysis->channels, analysis->frequency );
+			analysis->error = 1;
+		}
+		else
+		{
+			loudness_meter_process( meter, buffer, samples, sample_position );
+		}
+		mlt_frame_close( frame );
+		sample_position += samples;
+		position++;
+	}
+
+	analysis->true_peak[ index ] = loudness_meter_true_peak( meter );
+	analysis->sample_peak[ index ] = loudness_meter_sample_peak( meter );
+	loudness_meter_close( meter );
+	return 0;
+}
+
+/** Scan all of the audio that the job's producer plays, split into chunks
+    that are decoded and measured in parallel, and compute its loudness.
+*/
+
+static int loudness_analyse( loudness_job *job, loudness_result *result )
+{
+	mlt_filter filter = job->filter;
+	mlt_profile profile = mlt_service_profile( MLT_FILTER_SERVICE( filter ) );
+	loudness_analysis analysis;
+	loudness_meter meter = loudness_meter_new( job->frequency, job->channels );
+	mlt_position length = job->out - job->in + 1;
+	int jobs, i;
+
+	if ( !meter || length <= 0 )
+	{
+		loudness_meter_close( meter );
+		return 1;
+	}
+	memset( &analysis, 0, sizeof( analysis ) );
+	analysis.frequency = job->frequency;
+	analysis.channels = job->channels;
+	analysis.fps = mlt_profile_fps( profile );
+	analysis.length = length;
+	analysis.samples = mlt_audio_calculate_samples_to_position( analysis.fps, job->frequency, length );
+	analysis.block_size = loudness_meter_block_size( meter );
+	analysis.blocks = ( analysis.samples + analysis.block_size - 1 ) / analysis.block_size;
+	analysis.cancel = &job->cancel;
+	loudness_meter_close( meter );
+
+	jobs = analysis.blocks / ( LOUDNESS_CHUNK * 10 );
+	if ( jobs > mlt_slices_count_normal() )
+		jobs = mlt_slices_count_normal();
+	if ( jobs < 1 )
+		jobs = 1;
+
+	analysis.energy = calloc( analysis.blocks, sizeof( double ) );
+	analysis.count = calloc( analysis.blocks, sizeof( int ) );
+	analysis.true_peak = calloc( jobs, sizeof( double ) );
+	analysis.sample_peak = calloc( jobs, sizeof( double ) );
+	analysis.producers = calloc( jobs, sizeof( mlt_producer ) );
+
+	// Open the producers up front since not all of them are safe to open concurrently
+	for ( i = 0; i < jobs; i++ )
+	{
+		analysis.producers[ i ] = loudness_clone( profile, job->properties, job->in, job->out );
+		if ( !analysis.producers[ i ] )
+			analysis.error = 1;
+	}
+	if ( analysis.error )
+		mlt_log_error( MLT_FILTER_SERVICE( filter ), "unable to open a copy of %s for loudness analysis\n",
+			mlt_properties_get( job->properties, "resource" ) );
+
+	mlt_log_info( MLT_FILTER_SERVICE( filter ), "analysing loudness of %s in %d chunks\n",
+		mlt_properties_get( job->properties, "resource" ), jobs );
+	if ( !analysis.error )
+	{
+		if ( jobs > 1 )
+			mlt_slices_run_normal( jobs, loudness_analyse_slice, &analysis );
+		else
+			loudness_analyse_slice( 0, 0, 1, &analysis );
+	}
+
+	if ( !analysis.error )
+	{
+		loudness_compute( analysis.energy, analysis.count, analysis.blocks, result );
+		result->true_peak = result->sample_peak = -HUGE_VAL;
+		for ( i = 0; i < jobs; i++ )
+		{
+			if ( analysis.true_peak[ i ] > result->true_peak )
+				result->true_peak = analysis.true_peak[ i ];
+			if ( analysis.sample_peak[ i ] > result->sample_peak )
+				result->sample_peak = analysis.sample_peak[ i ];
+		}
+	}
+
+	for ( i = 0; i < jobs; i++ )
+		mlt_producer_close( analysis.producers[ i ] );
+	free( analysis.producers );
+	free( analysis.energy );
+	free( analysis.count );
+	free( analysis.true_peak );
+	free( analysis.sample_peak );
+	return analysis.error;
+}
+
+/** Get the loudness of the job's producer from the cache file next to its
+    media, when "loudness_cache" allows it, or else by analysing it.
+*/
+
+static void loudness_measure( loudness_job *job, loudness_result *result )
+{
+	mlt_filter filter = job->filter;
+	mlt_properties filter_props = MLT_FILTER_PROPERTIES( filter );
+	const char *resource = mlt_properties_get( job->properties, "resource" );
+	mlt_properties cache = NULL;
+	char *cache_name = NULL;
+	char hash[ 20 ] = "";
+
+	result->integrated = -HUGE_VAL;
+	if ( resource && mlt_properties_get_int( filter_props, "loudness_cache" )
+	     && !loudness_file_hash( resource, hash, sizeof( hash ) ) )
+	{
+		cache_name = malloc( strlen( resource ) + 10 );
+		sprintf( cache_name, "%s.loudness", resource );
+		cache = mlt_properties_load( cache_name );
+		if ( cache && mlt_properties_get( cache, "hash" )
+		     && !strcmp( mlt_properties_get( cache, "hash" ), hash )
+		     && mlt_properties_get_position( cache, "in" ) == job->in
+		     && mlt_properties_get_position( cache, "out" ) == job->out
+		     && mlt_properties_get_int( cache, "frequency" ) == job->frequency
+		     && mlt_properties_get_int( cache, "channels" ) == job->channels )
+		{
+			result->integrated = mlt_properties_get( cache, "integrated" ) ? mlt_properties_get_double( cache, "integrated" ) : -HUGE_VAL;
+			result->range = mlt_properties_get_double( cache, "range" );
+			result->true_peak = mlt_properties_get_double( cache, "true_peak" );
+			result->sample_peak = mlt_properties_get_double( cache, "sample_peak" );
+			mlt_properties_close( cache );
+			free( cache_name );
+			return;
+		}
+		mlt_properties_close( cache );
+		cache = NULL;
+	}
+
+	if ( loudness_analyse( job, result ) )
+	{
+		if ( !atomic_load( &job->cancel ) )
+			mlt_log_error( MLT_FILTER_SERVICE( filter ), "loudness analysis of %s failed\n", resource );
+		result->integrated = -HUGE_VAL;
+	}
+	else if ( cache_name )
+	{
+		cache = mlt_properties_new();
+		mlt_properties_set( cache, "hash", hash );
+		mlt_properties_set_position( cache, "in", job->in );
+		mlt_properties_set_position( cache, "out", job->out );
+		mlt_properties_set_int( cache, "frequency", job->frequency );
+		mlt_properties_set_int( cache, "channels", job->channels );
+		if ( isfinite( result->integrated ) )
+			mlt_properties_set_double( cache, "integrated", result->integrated );
+		mlt_properties_set_double( cache, "range", result->range );
+		mlt_properties_set_double( cache, "true_peak", result->true_peak );
+		mlt_properties_set_double( cache, "sample_peak", result->sample_peak );
+		if ( mlt_properties_save( cache, cache_name ) )
+			mlt_log_warning( MLT_FILTER_SERVICE( filter ), "unable to save %s\n", cache_name );
+		mlt_properties_close( cache );
+	}
+	free( cache_name );
+}
+
+/** Publish the result of a job, or reset it when done is 0, and wake the
+    threads waiting for it.
+*/
+
+static void loudness_job_publish( loudness_job *job, loudness_result *result, int done )
+{
+	pthread_mutex_lock( &job->mutex );
+	job->result = *result;
+	job->done = done;
+	pthread_cond_broadcast( &job->cond );
+	pthread_mutex_unlock( &job->mutex );
+}
+
+/** The thread that measures the job's producer and publishes the result.
+*/
+
+static void *loudness_job_run( void *arg )
+{
+	loudness_job *job = arg;
+	mlt_properties filter_props = MLT_FILTER_PROPERTIES( job->filter );
+	loudness_result result;
+
+	loudness_measure( job, &result );
+	if ( isfinite( result.integrated ) )
+	{
+		mlt_properties_set_double( filter_props, "loudness.integrated", result.integrated );
+		mlt_properties_set_double( filter_props, "loudness.range", result.range );
+		mlt_properties_set_double( filter_props, "loudness.true_peak", result.true_peak );
+	}
+	loudness_job_publish( job, &result, 1 );
+	return NULL;
+}
+
+/** Stop the job's thread, if any, and wait for it.
+
+    The caller holds the job's control mutex.
+*/
+
+static void loudness_job_stop( loudness_job *job )
+{
+	if ( job->running )
+	{
+		atomic_store( &job->cancel, 1 );
+		pthread_join( job->thread, NULL );
+		job->running = 0;
+	}
+	mlt_properties_close( job->properties );
+	job->properties = NULL;
+}
+
+/** Start measuring the producer that the filter is attached to, unless it
+    is already measured or being measured with this audio layout.
+*/
+
+static void loudness_start( mlt_filter filter, int frequency, int channels )
+{
+	loudness_job *job = filter->child;
+	mlt_service service = mlt_properties_get_data( MLT_FILTER_PROPERTIES( filter ), "service", NULL );
+	mlt_producer parent = NULL;
+	mlt_position in = 0, out = -1;
+	loudness_result none = { -HUGE_VAL, 0, -HUGE_VAL, -HUGE_VAL };
+
+	switch ( service ? mlt_service_identify( service ) : mlt_service_invalid_type )
+	{
+	case mlt_service_producer_type:
+	case mlt_service_chain_type:
+	case mlt_service_playlist_type:
+	case mlt_service_tractor_type:
+		parent = mlt_producer_cut_parent( MLT_PRODUCER( service ) );
+		in = mlt_producer_get_in( MLT_PRODUCER( service ) );
+		out = mlt_producer_get_out( MLT_PRODUCER( service ) );
+		break;
+	default:
+		break;
+	}
+
+	pthread_mutex_lock( &job->control );
+	if ( !job->started || job->parent != parent || job->in != in || job->out != out
+	     || job->frequency != frequency || job->channels != channels )
+	{
+		loudness_job_stop( job );
+		job->started = 1;
+		job->parent = parent;
+		job->in = in;
+		job->out = out;
+		job->frequency = frequency;
+		job->channels = channels;
+		atomic_store( &job->cancel, 0 );
+		loudness_job_publish( job, &none, 0 );
+		if ( parent )
+		{
+			job->properties = mlt_properties_new( );
+			mlt_properties_inherit( job->properties, MLT_PRODUCER_PROPERTIES( parent ) );
+			if ( pthread_create( &job->thread, NULL, loudness_job_run, job ) == 0 )
+				job->running = 1;
+			else
+				loudness_job_publish( job, &none, 1 );
+		}
+		else
+		{
+			mlt_log_warning( MLT_FILTER_SERVICE( filter ), "loudness needs the filter to be attached to a producer\n" );
+			loudness_job_publish( job, &none, 1 );
+		}
+	}
+	pthread_mutex_unlock( &job->control );
+}
+
+/** Wait for the measurement of the producer and get it.
+*/
+
+static void loudness_wait( mlt_filter filter, loudness_result *result )
+{
+	loudness_job *job = filter->child;
+
+	pthread_mutex_lock( &job->mutex );
+	while ( !job->done )
+		pthread_cond_wait( &job->cond, &job->mutex );
+	*result = job->result;
+	pthread_mutex_unlock( &job->mutex );
+}
+
+/** Get the gain that brings the measured loudness to the target without
+    the true peak exceeding its ceiling.
+*/
+
+static double loudness_gain( mlt_filter filter, loudness_result *result )
+{
+	mlt_properties filter_props = MLT_FILTER_PROPERTIES( filter );
+	double gain_db, ceiling;
+
+	// Silence and failed analyses are left alone
+	if ( !isfinite( result->integrated ) )
+		return 1.0;
+	gain_db = mlt_properties_get_double( filter_props, "loudness" ) - result->integrated;
+	ceiling = mlt_properties_get_double( filter_props, "true_peak" );
+	if ( isfinite( result->true_peak ) && result->true_peak + gain_db > ceiling )
+		gain_db = ceiling - result->true_peak;
+	mlt_properties_set_double( filter_props, "loudness.gain", gain_db );
+	return DBFSTOAMP( gain_db );
+}
+
 /** Get the audio.
 */
 
@@ -173,6 +671,8 @@ static int filter_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *f
 	double max_gain = mlt_properties_get_double( instance_props, "max_gain" );
 	double limiter_level = 0.5; /* -6 dBFS */
 	int normalise =  mlt_properties_get_int( instance_props, "normalise" );
+	int loudness = mlt_properties_get( filter_props, "loudness" ) != NULL;
+	loudness_result measured;
 	double amplitude =  mlt_properties_get_double( instance_props, "amplitude" );
 	int i, j;
 	double sample;
@@ -191,13 +691,28 @@ static int filter_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *f
 	if ( mlt_properties_get( instance_props, "limiter" ) != NULL )
 		limiter_level = mlt_properties_get_double( instance_props, "limiter" );
 	
+	// The measured loudness replaces the on the fly normalisation
+	if ( loudness )
+		normalise = 0;
+
+	// Measure the producer in the layout requested while this frame's audio is fetched
+	if ( loudness )
+		loudness_start( filter, *frequency, *channels );
+
 	// Get the producer's audio
 	*format = normalise? mlt_audio_s16 : mlt_audio_f32le;
 	mlt_frame_get_audio( frame, buffer, format, frequency, channels, samples );
 
+	if ( loudness )
+		loudness_wait( filter, &measured );
+
 	mlt_service_lock( MLT_FILTER_SERVICE( filter ) );
 
-	if ( normalise )
+	if ( loudness )
+	{
+		gain *= loudness_gain( filter, &measured );
+	}
+	else if ( normalise )
 	{
 		int window = mlt_properties_get_int( filter_props, "window" );
 		double *smooth_buffer = mlt_properties_get_data( filter_props, "smooth_buffer", NULL );
@@ -270,12 +785,7 @@ static int filter_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *f
 	}
 	else
 	{
-		float *p = *buffer;
-		for ( i = 0; i < *samples; i++, gain += gain_step ) {
-			for ( j = 0; j < *channels; j++, p++ ) {
-				p[0] *= gain;
-			}
-		}
+		mlt_audio_dsp_gain( *buffer, *channels, *samples, gain, gain_step );
 	}
 	return 0;
 }
@@ -438,23 +948,54 @@ static mlt_frame filter_process( mlt_filter filter, mlt_frame frame )
 	return frame;
 }
 
+/** Destructor for the filter.
+*/
+
+static void filter_close( mlt_filter filter )
+{
+	loudness_job *job = filter->child;
+
+	pthread_mutex_lock( &job->control );
+	loudness_job_stop( job );
+	pthread_mutex_unlock( &job->control );
+	pthread_mutex_destroy( &job->control );
+	pthread_mutex_destroy( &job->mutex );
+	pthread_cond_destroy( &job->cond );
+	free( job );
+	filter->child = NULL;
+	filter->close = NULL;
+	filter->parent.close = NULL;
+	mlt_service_close( &filter->parent );
+}
+
 /** Constructor for the filter.
 */
 
 mlt_filter filter_volume_init( mlt_profile profile, mlt_service_type type, const char *id, char *arg )
 {
 	mlt_filter filter = calloc( 1, sizeof( struct mlt_filter_s ) );
-	if ( filter != NULL && mlt_filter_init( filter, NULL ) == 0 )
+	loudness_job *job = calloc( 1, sizeof( loudness_job ) );
+	if ( filter != NULL && job != NULL && mlt_filter_init( filter, job ) == 0 )
 	{
 		mlt_properties properties = MLT_FILTER_PROPERTIES( filter );
+		pthread_mutex_init( &job->control, NULL );
+		pthread_mutex_init( &job->mutex, NULL );
+		pthread_cond_init( &job->cond, NULL );
+		job->filter = filter;
+		filter->close = filter_close;
 		filter->process = filter_process;
 		if ( arg != NULL )
 			mlt_properties_set( properties, "gain", arg );
 
 		mlt_properties_set_int( properties, "window", 75 );
 		mlt_properties_set( properties, "max_gain", "20dB" );
+		mlt_properties_set_double( properties, "true_peak", -1.0 );
 
 		mlt_properties_set( properties, "level", NULL );
 	}
+	else
+	{
+		free( job );
+	}
 	return filter;
 }
@@ -0,0 +1,347 @@
+/*
+ * loudness_meter.c -- ITU-R BS.1770 / EBU R128 loudness measurement
+ * Copyright (C) 2022 Meltytech, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "loudness_meter.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MAX_CHANNELS 8
+#define PEAK_PHASES 4
+#define PEAK_TAPS 12
+#define ABSOLUTE_GATE -70.0
+#define RELATIVE_GATE -10.0
+#define RANGE_GATE -20.0
+
+struct loudness_meter_s
+{
+	int channels;
+	int block_size;
+	double weight[ MAX_CHANNELS ];
+	double b[ 2 ][ 3 ];
+	double a[ 2 ][ 3 ];
+	double z[ MAX_CHANNELS ][ 2 ][ 2 ];
+	int oversample;
+	float fir[ PEAK_PHASES ][ PEAK_TAPS ];
+	float history[ MAX_CHANNELS ][ PEAK_TAPS * 2 ];
+	int history_index;
+	int64_t start;
+	int64_t end;
+	double *energy;
+	int *count;
+	double true_peak;
+	double sample_peak;
+};
+
+static double block_loudness( double energy )
+{
+	return energy > 0 ? -0.691 + 10.0 * log10( energy ) : -HUGE_VAL;
+}
+
+/** Compute the two K-weighting stages for the sample rate.
+
+    These are the BS.1770 pre-filter (a high shelf) and RLB filter (a high
+    pass), derived from their analogue prototypes so that any rate gives the
+    published 48kHz coefficients' response.
+*/
+
+static void init_k_weighting( loudness_meter self, int frequency )
+{
+	double f0 = 1681.974450955533;
+	double G = 3.999843853973347;
+	double Q = 0.7071752369554196;
+	double K = tan( M_PI * f0 / frequency );
+	double Vh = pow( 10.0, G / 20.0 );
+	double Vb = pow( Vh, 0.4996667741545416 );
+	double a0 = 1.0 + K / Q + K * K;
+
+	self->b[0][0] = ( Vh + Vb * K / Q + K * K ) / a0;
+	self->b[0][1] = 2.0 * ( K * K - Vh ) / a0;
+	self->b[0][2] = ( Vh - Vb * K / Q + K * K ) / a0;
+	self->a[0][1] = 2.0 * ( K * K - 1.0 ) / a0;
+	self->a[0][2] = ( 1.0 - K / Q + K * K ) / a0;
+
+	f0 = 38.13547087602444;
+	Q = 0.5003270373238773;
+	K = tan( M_PI * f0 / frequency );
+	a0 = 1.0 + K / Q + K * K;
+
+	self->b[1][0] = 1.0;
+	self->b[1][1] = -2.0;
+	self->b[1][2] = 1.0;
+	self->a[1][1] = 2.0 * ( K * K - 1.0 ) / a0;
+	self->a[1][2] = ( 1.0 - K / Q + K * K ) / a0;
+}
+
+/** Build a 4x polyphase interpolator (a Blackman windowed sinc) for the
+    true peak estimate, each phase normalised to unity gain.
+*/
+
+static void init_true_peak( loudness_meter self, int frequency )
+{
+	int taps = PEAK_PHASES * PEAK_TAPS;
+	int p, k;
+
+	// At 96kHz and above the sample peak is already within the tolerance
+	self->oversample = frequency < 96000;
+	for ( p = 0; p < PEAK_PHASES; p++ )
+	{
+		double sum = 0;
+		for ( k = 0; k < PEAK_TAPS; k++ )
+		{
+			int n = k * PEAK_PHASES + p;
+			double x = ( n - ( taps - 1 ) / 2.0 ) / PEAK_PHASES;
+			double w = 0.42 - 0.5 * cos( 2 * M_PI * ( n + 0.5 ) / taps ) + 0.08 * cos( 4 * M_PI * ( n + 0.5 ) / taps );
+			double h = x == 0 ? 1.0 : sin( M_PI * x ) / ( M_PI * x );
+			self->fir[p][k] = h * w;
+			sum += h * w;
+		}
+		for ( k = 0; k < PEAK_TAPS; k++ )
+			self->fir[p][k] /= sum;
+	}
+}
+
+loudness_meter loudness_meter_new( int frequency, int channels )
+{
+	loudness_meter self = NULL;
+	int c;
+
+	if ( frequency <= 0 || channels <= 0 || channels > MAX_CHANNELS )
+		return NULL;
+
+	self = calloc( 1, sizeof( struct loudness_meter_s ) );
+	if ( self != NULL )
+	{
+		self->channels = channels;
+		self->block_size = frequency / 10;
+		for ( c = 0; c < channels; c++ )
+			self->weight[ c ] = 1.0;
+		// BS.1770 weights the surrounds up and leaves out the LFE
+		if ( channels == 6 )
+		{
+			self->weight[ 3 ] = 0.0;
+			self->weight[ 4 ] = 1.41;
+			self->weight[ 5 ] = 1.41;
+		}
+		init_k_weighting( self, frequency );
+		init_true_peak( self, frequency );
+	}
+	return self;
+}
+
+int loudness_meter_block_size( loudness_meter self )
+{
+	return self->block_size;
+}
+
+/** Set the absolute sample range that is measured.
+
+    Samples given to loudness_meter_process before \p start only prime the
+    filters. The energy and count arrays are indexed by absolute block
+    number (position / block size) and each meter must own its blocks.
+*/
+
+void loudness_meter_set_range( loudness_meter self, int64_t start, int64_t end, double *energy, int *count )
+{
+	self->start = start;
+	self->end = end;
+	self->energy = energy;
+	self->count = count;
+}
+
+/** Filter and measure interleaved float samples beginning at an absolute
+    sample position.
+*/
+
+void loudness_meter_process( loudness_meter self, const float *buffer, int samples, int64_t position )
+{
+	int channels = self->channels;
+	int i = 0, c, p, k;
+
+	if ( position + samples > self->end )
+		samples = self->end > position ? self->end - position : 0;
+
+	while ( i < samples )
+	{
+		int64_t pos = position + i;
+		int measure = pos >= self->start;
+		int64_t block = pos / self->block_size;
+		int64_t n = measure ? ( block + 1 ) * self->block_size - pos : self->start - pos;
+		int first = i;
+		double energy = 0;
+
+		if ( n > samples - i )
+			n = samples - i;
+
+		for ( ; n > 0; n--, i++ )
+		{
+			const float *in = buffer + i * channels;
+			int h = self->history_index;
+
+			for ( c = 0; c < channels; c++ )
+			{
+				double x = in[ c ];
+				double *z = self->z[ c ][ 0 ];
+				double y = self->b[0][0] * x + z[ 0 ];
+				z[ 0 ] = self->b[0][1] * x - self->a[0][1] * y + z[ 1 ];
+				z[ 1 ] = self->b[0][2] * x - self->a[0][2] * y;
+				x = y;
+				z = self->z[ c ][ 1 ];
+				y = x + z[ 0 ];
+				z[ 0 ] = -2.0 * x - self->a[1][1] * y + z[ 1 ];
+				z[ 1 ] = x - self->a[1][2] * y;
+				energy += self->weight[ c ] * y * y;
+
+				self->history[ c ][ h ] = self->history[ c ][ h + PEAK_TAPS ] = in[ c ];
+				if ( measure )
+				{
+					double peak = fabs( in[ c ] );
+					if ( peak > self->sample_peak )
+						self->sample_peak = peak;
+					if ( self->oversample )
+					{
+						const float *x = &self->history[ c ][ h ];
+						for ( p = 0; p < PEAK_PHASES; p++ )
+						{
+							float sum = 0;
+							for ( k = 0; k < PEAK_TAPS; k++ )
+								sum += self->fir[ p ][ k ] * x[ k ];
+							if ( fabsf( sum ) > peak )
+								peak = fabsf( sum );
+						}
+					}
+					if ( peak > self->true_peak )
+						self->true_peak = peak;
+				}
+			}
+			self->history_index = h == 0 ? PEAK_TAPS - 1 : h - 1;
+		}
+
+		if ( measure && self->energy != NULL )
+		{
+			self->energy[ block ] += energy;
+			self->count[ block ] += i - first;
+		}
+	}
+}
+
+double loudness_meter_true_peak( loudness_meter self )
+{
+	return self->true_peak > 0 ? 20.0 * log10( self->true_peak ) : -HUGE_VAL;
+}
+
+double loudness_meter_sample_peak( loudness_meter self )
+{
+	return self->sample_peak > 0 ? 20.0 * log10( self->sample_peak ) : -HUGE_VAL;
+}
+
+void loudness_meter_close( loudness_meter self )
+{
+	free( self );
+}
+
+static int compare_double( const void *a, const void *b )
+{
+	double x = *(const double*) a;
+	double y = *(const double*) b;
+	return x < y ? -1 : x > y;
+}
+
+/** Mean energy of the windows of \p size blocks, stepping one block at a
+    time, that pass the absolute gate and then the relative gate.
+    Optionally return the loudness of each window that passes both.
+*/
+
+static double gated_energy( const double *energy, const int *count, int blocks, int size, double relative, double *loudness, int *passed )
+{
+	int n = blocks >= size ? blocks - size + 1 : 1;
+	double *window = malloc( n * sizeof( double ) );
+	double sum = 0, total = 0, gate;
+	int64_t samples = 0;
+	int i, used = 0;
+
+	for ( i = 0; i < blocks; i++ )
+	{
+		sum += energy[ i ];
+		samples += count[ i ];
+		if ( i >= size )
+		{
+			sum -= energy[ i - size ];
+			samples -= count[ i - size ];
+		}
+		if ( i >= size - 1 || ( blocks < size && i == blocks - 1 ) )
+			window[ i < size - 1 ? 0 : i - size + 1 ] = samples > 0 ? sum / samples : 0;
+	}
+	if ( blocks == 0 )
+		n = 0;
+
+	for ( i = 0; i < n; i++ )
+	{
+		if ( block_loudness( window[ i ] ) > ABSOLUTE_GATE )
+		{
+			total += window[ i ];
+			used++;
+		}
+	}
+	gate = used ? block_loudness( total / used ) + relative : HUGE_VAL;
+
+	total = 0;
+	used = 0;
+	for ( i = 0; i < n; i++ )
+	{
+		double l = block_loudness( window[ i ] );
+		if ( l > ABSOLUTE_GATE && l > gate )
+		{
+			total += window[ i ];
+			if ( loudness )
+				loudness[ used ] = l;
+			used++;
+		}
+	}
+	free( window );
+	if ( passed )
+		*passed = used;
+	return used ? total / used : 0;
+}
+
+/** Compute the integrated loudness (400ms blocks) and loudness range (3s
+    blocks, EBU Tech 3342) from the 100ms block energies of a programme.
+*/
+
+void loudness_compute( const double *energy, const int *count, int blocks, loudness_result *result )
+{
+	int n = 0;
+	double *loudness = NULL;
+
+	result->integrated = block_loudness( gated_energy( energy, count, blocks, 4, RELATIVE_GATE, NULL, NULL ) );
+	result->range = 0;
+
+	if ( blocks >= 30 )
+	{
+		loudness = malloc( ( blocks - 29 ) * sizeof( double ) );
+		gated_energy( energy, count, blocks, 30, RANGE_GATE, loudness, &n );
+		if ( n > 0 )
+		{
+			qsort( loudness, n, sizeof( double ), compare_double );
+			result->range = loudness[ lrint( 0.95 * ( n - 1 ) ) ] - loudness[ lrint( 0.10 * ( n - 1 ) ) ];
+		}
+		free( loudness );
+	}
+}
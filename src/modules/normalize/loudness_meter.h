@@ -0,0 +1,51 @@
+/*
+ * loudness_meter.h -- ITU-R BS.1770 / EBU R128 loudness measurement
+ * Copyright (C) 2022 Meltytech, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef LOUDNESS_METER_H
+#define LOUDNESS_METER_H
+
+#include <stdint.h>
+
+/** The meter splits the programme into 100ms blocks and records the
+    K-weighted, channel-weighted energy of each one. The 400ms gating
+    blocks and 3s short-term blocks are both built from these, which lets
+    several meters measure adjacent ranges of a programme independently
+    and have their results combined afterwards.
+*/
+
+typedef struct loudness_meter_s *loudness_meter;
+
+typedef struct
+{
+	double integrated;  /* LUFS, -HUGE_VAL when the programme is silent */
+	double range;       /* LU */
+	double true_peak;   /* dBTP */
+	double sample_peak; /* dBFS */
+} loudness_result;
+
+extern loudness_meter loudness_meter_new( int frequency, int channels );
+extern int loudness_meter_block_size( loudness_meter self );
+extern void loudness_meter_set_range( loudness_meter self, int64_t start, int64_t end, double *energy, int *count );
+extern void loudness_meter_process( loudness_meter self, const float *buffer, int samples, int64_t position );
+extern double loudness_meter_true_peak( loudness_meter self );
+extern double loudness_meter_sample_peak( loudness_meter self );
+extern void loudness_meter_close( loudness_meter self );
+extern void loudness_compute( const double *energy, const int *count, int blocks, loudness_result *result );
+
+#endif
@@ -143,6 +143,34 @@ bool QWebpHandler::read(QImage *image)
         return false;
 
     QImage::Format format = m_features.has_alpha ? QImage::Format_ARGB32 : QImage::Format_RGB32;
+
+    if (!m_features.has_animation && !m_scaledSize.isEmpty()
+            && m_scaledSize != QSize(m_iter.width, m_iter.height)) {
+        // Single image that the decoder scales, which is cheaper than scaling it after
+        WebPDecoderConfig config;
+        if (!WebPInitDecoderConfig(&config))
+            return false;
+
+        QImage frame(m_scaledSize, format);
+        config.options.use_scaling = 1;
+        config.options.scaled_width = frame.width();
+        config.options.scaled_height = frame.height();
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        config.output.colorspace = MODE_BGRA;
+#else
+        config.output.colorspace = MODE_ARGB;
+#endif
+        config.output.is_external_memory = 1;
+        config.output.u.RGBA.rgba = frame.bits();
+        config.output.u.RGBA.stride = frame.bytesPerLine();
+        config.output.u.RGBA.size = frame.sizeInBytes();
+        if (WebPDecode(m_iter.fragment.bytes, m_iter.fragment.size, &config) != VP8_STATUS_OK)
+            return false;
+
+        *image = frame;
+        return true;
+    }
+
     QImage frame(m_iter.width, m_iter.height, format);
     uint8_t *output = frame.bits();
     size_t output_size = frame.sizeInBytes();
@@ -254,6 +282,8 @@ QVariant QWebpHandler::option(ImageOption option) const
         return m_features.has_animation;
     case BackgroundColor:
         return m_bgColor;
+    case ScaledSize:
+        return m_scaledSize;
     default:
         return QVariant();
     }
@@ -265,6 +295,10 @@ void QWebpHandler::setOption(ImageOption option, const QVariant &value)
     case Quality:
         m_quality = value.toInt();
         return;
+    case ScaledSize:
+        // Animation frames are composited at the full size
+        m_scaledSize = value.toSize();
+        return;
     default:
         break;
     }
@@ -276,7 +310,8 @@ bool QWebpHandler::supportsOption(ImageOption option) const
     return option == Quality
         || option == Size
         || option == Animation
-        || option == BackgroundColor;
+        || option == BackgroundColor
+        || option == ScaledSize;
 }
 
 QByteArray QWebpHandler::name() const
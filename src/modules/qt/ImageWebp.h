@@ -57,6 +57,7 @@ private:
     WebPDemuxer *m_demuxer;
     WebPIterator m_iter;
     QImage *m_composited;   // For animation frames composition
+    QSize m_scaledSize;     // For decoding a single image scaled
 };
 
 #endif // IMAGEWEBP_H
@@ -82,6 +82,8 @@ mlt_producer producer_qimage_init( mlt_profile profile, mlt_service_type type, c
 		mlt_properties_set_int( properties, "aspect_ratio", 1 );
 		mlt_properties_set_int( properties, "progressive", 1 );
 		mlt_properties_set_int( properties, "seekable", 1 );
+		mlt_properties_set_int( properties, "prefetch", 8 );
+		mlt_properties_set_int( properties, "prefetch_memory", 512 );
 
 		// Validate the resource
 		if ( filename )
@@ -206,6 +208,11 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
 	producer_qimage self = mlt_properties_get_data( properties, "producer_qimage", NULL );
 	mlt_producer producer = &self->parent;
+	mlt_profile profile = mlt_service_profile( MLT_PRODUCER_SERVICE( producer ) );
+
+	// A consumer previews at a reduced scale by requesting less than the profile size.
+	int preview = *width > 0 && *height > 0
+		&& ( mlt_profile_scale_width( profile, *width ) < 1.0 || mlt_profile_scale_height( profile, *height ) < 1.0 );
 
 	// Use the width and height suggested by the rescale filter because we can do our own scaling.
 	if ( mlt_properties_get_int( properties, "rescale_width" ) > 0 )
@@ -213,6 +220,10 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	if ( mlt_properties_get_int( properties, "rescale_height" ) > 0 )
 		*height = mlt_properties_get_int( properties, "rescale_height" );
 	mlt_service_lock( MLT_PRODUCER_SERVICE( &self->parent ) );
+
+	// Then the image need only be read as large as it is scaled to.
+	mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( producer ), "_preview_width", preview ? *width : 0 );
+	mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( producer ), "_preview_height", preview ? *height : 0 );
 	int enable_caching = ( self->count <= 1 || mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( producer ), "ttl" ) > 1 );
 
 	// Refresh the image
@@ -154,6 +154,19 @@ int refresh_qwebp(producer_qwebp self, mlt_frame frame, int enable_caching )
     if (!self->qimage)
     {
         self->current_image = NULL;
+
+        // Decode no larger than a preview scales the image to
+        QSize size = self->image_webp->option(QImageIOHandler::Size).toSize();
+        QSize preview( mlt_properties_get_int( producer_props, "_preview_width" ), mlt_properties_get_int( producer_props, "_preview_height" ) );
+        QSize scaledSize;
+        if ( !preview.isEmpty() && !size.isEmpty() )
+        {
+            double scale = qMax( double( preview.width() ) / size.width(), double( preview.height() ) / size.height() );
+            if ( scale < 1.0 )
+                scaledSize = QSize( ceil( size.width() * scale ), ceil( size.height() * scale ) );
+        }
+        self->image_webp->setOption(QImageIOHandler::ScaledSize, scaledSize);
+
         QImage* qimage = new QImage();
         self->image_webp->read(qimage);
         self->current_frames = self->image_webp->nextImageDelay() / 1000.0 * mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( producer ), "fps" );
@@ -177,9 +190,11 @@ int refresh_qwebp(producer_qwebp self, mlt_frame frame, int enable_caching )
                 mlt_properties_set_data( producer_props, "qwebp.qimage", qimage, 0, ( mlt_destructor )qwebp_delete, NULL );
             }
 
-            // Store the width/height of the qimage
-            self->current_width = qimage->width( );
-            self->current_height = qimage->height( );
+            // Store the width/height of the image, which the qimage may be smaller than
+            if ( size.isEmpty() )
+                size = qimage->size();
+            self->current_width = size.width( );
+            self->current_height = size.height( );
 
             mlt_events_block( producer_props, NULL );
             mlt_properties_set_int( producer_props, "meta.media.width", self->current_width );
@@ -433,6 +448,11 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
     producer_qwebp self = (producer_qwebp)mlt_properties_get_data( properties, "producer_qwebp", NULL );
 	mlt_producer producer = &self->parent;
+	mlt_profile profile = mlt_service_profile( MLT_PRODUCER_SERVICE( producer ) );
+
+	// A consumer previews at a reduced scale by requesting less than the profile size.
+	int preview = *width > 0 && *height > 0
+		&& ( mlt_profile_scale_width( profile, *width ) < 1.0 || mlt_profile_scale_height( profile, *height ) < 1.0 );
 
 	// Use the width and height suggested by the rescale filter because we can do our own scaling.
 	if ( mlt_properties_get_int( properties, "rescale_width" ) > 0 )
@@ -440,6 +460,10 @@ static int producer_get_image( mlt_frame frame, uint8_t **buffer, mlt_image_form
 	if ( mlt_properties_get_int( properties, "rescale_height" ) > 0 )
 		*height = mlt_properties_get_int( properties, "rescale_height" );
 	mlt_service_lock( MLT_PRODUCER_SERVICE( &self->parent ) );
+
+	// Then the image need only be decoded as large as it is scaled to.
+	mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( producer ), "_preview_width", preview ? *width : 0 );
+	mlt_properties_set_int( MLT_PRODUCER_PROPERTIES( producer ), "_preview_height", preview ? *height : 0 );
     int enable_caching = (mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( producer ), "fps" ) > 1 );
 
 	// Refresh the image
@@ -32,6 +32,11 @@
 #include <QImageReader>
 #include <QFileInfo>
 #include <QDir>
+#include <QHash>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
 
 #ifdef USE_EXIF
 #include <libexif/exif-data.h>
@@ -47,6 +52,321 @@
 #include <unistd.h>
 #endif
 
+/** Read an image file.
+ *
+ * \param filename the name of the file
+ * \param autoTransform whether to apply the orientation in its EXIF data
+ * \param scaledTo the size the image will be scaled to, or empty for its full size
+ * \param size set to the full size of the image, which it is read smaller than for \p scaledTo
+ */
+
+static QImage read_file( const QString &filename, bool autoTransform, const QSize &scaledTo, QSize *size )
+{
+	QImageReader reader;
+	reader.setDecideFormatFromContent( true );
+	reader.setFileName( filename );
+	*size = QSize();
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+	// Use Qt's orientation detection
+	reader.setAutoTransform( autoTransform );
+
+	// Let the reader decode no more than is needed, which is much faster for JPEG
+	QSize original = scaledTo.isEmpty() ? QSize() : reader.size();
+	if ( !original.isEmpty() )
+	{
+		// The scaled size applies before the orientation
+		bool transposed = autoTransform && ( reader.transformation() & QImageIOHandler::TransformationRotate90 );
+		QSize target = transposed ? scaledTo.transposed() : scaledTo;
+		double scale = qMax( double( target.width() ) / original.width(), double( target.height() ) / original.height() );
+		if ( scale < 1.0 )
+			reader.setScaledSize( QSize( ceil( original.width() * scale ), ceil( original.height() * scale ) ) );
+		*size = transposed ? original.transposed() : original;
+	}
+#else
+	Q_UNUSED( autoTransform );
+	Q_UNUSED( scaledTo );
+#endif
+	QImage image = reader.read();
+	if ( !size->isValid() )
+		*size = image.size();
+	return image;
+}
+
+/** Decodes the images of a sequence that playback will need next.
+ *
+ * The images are read on a thread pool and kept until they are taken. An
+ * image that is wanted before it is ready is waited for; one that was not
+ * prefetched is read by the caller as before. Each call to schedule()
+ * gives the images wanted next, in order: the others are dropped, or
+ * skipped if they have not started, which is what happens on a seek.
+ */
+
+class QImagePrefetcher
+{
+public:
+	QImagePrefetcher()
+		: m_bytes( 0 )
+		, m_estimate( 0 )
+		, m_autoTransform( true )
+	{}
+
+	~QImagePrefetcher()
+	{
+		clear();
+		m_pool.waitForDone();
+	}
+
+	QImage take( int index, const QString &filename, bool autoTransform, const QSize &scaledTo, QSize *size )
+	{
+		QMutexLocker locker( &m_mutex );
+		setOptions( autoTransform, scaledTo );
+		if ( m_entries.contains( index ) )
+			m_entries[index].cancelled = false;
+		while ( m_entries.contains( index ) && !m_entries[index].done )
+			m_done.wait( &m_mutex );
+		if ( m_entries.contains( index ) )
+		{
+			QImage image = m_entries[index].image;
+			*size = m_entries[index].size;
+			m_bytes -= m_entries[index].bytes;
+			m_entries.remove( index );
+			return image;
+		}
+		locker.unlock();
+		QImage image = read_file( filename, autoTransform, scaledTo, size );
+
+		// This seeds the estimate before the first schedule()
+		locker.relock();
+		if ( !image.isNull() && autoTransform == m_autoTransform && scaledTo == m_scaledTo )
+			m_estimate = qint64( image.bytesPerLine() ) * image.height();
+		return image;
+	}
+
+	void schedule( const QList<int> &indices, const QStringList &filenames, bool autoTransform, const QSize &scaledTo, qint64 limit )
+	{
+		QMutexLocker locker( &m_mutex );
+		setOptions( autoTransform, scaledTo );
+
+		// Forget what is no longer wanted
+		for ( auto it = m_entries.begin(); it != m_entries.end(); )
+		{
+			if ( indices.contains( it.key() ) )
+			{
+				++it;
+			}
+			else if ( it->done )
+			{
+				m_bytes -= it->bytes;
+				it = m_entries.erase( it );
+			}
+			else
+			{
+				it->cancelled = true;
+				++it;
+			}
+		}
+
+		// Queue the rest in order while they fit, assuming they are like the last one read.
+		// Until one has been read there is nothing to go by, so only one is queued.
+		int pending = 0;
+		for ( const Entry &entry : m_entries )
+			pending += !entry.done;
+		m_pool.setMaxThreadCount( qBound( 1, indices.size(), QThread::idealThreadCount() ) );
+		for ( int i = 0; i < indices.size(); i++ )
+		{
+			int index = indices[i];
+			if ( m_entries.contains( index ) )
+			{
+				m_entries[index].cancelled = false;
+				continue;
+			}
+			if ( m_bytes + ( pending + 1 ) * m_estimate > limit || ( m_estimate == 0 && pending > 0 ) )
+				break;
+			m_entries.insert( index, Entry() );
+			pending ++;
+			m_pool.start( new Job( this, index, filenames[i], autoTransform, scaledTo ), indices.size() - i );
+		}
+	}
+
+	void clear()
+	{
+		QMutexLocker locker( &m_mutex );
+		discard();
+	}
+
+private:
+	struct Entry
+	{
+		Entry() : bytes( 0 ), done( false ), cancelled( false ) {}
+		QImage image;
+		QSize size;
+		qint64 bytes;
+		bool done;
+		bool cancelled;
+	};
+
+	class Job : public QRunnable
+	{
+	public:
+		Job( QImagePrefetcher *prefetcher, int index, const QString &filename, bool autoTransform, const QSize &scaledTo )
+			: m_prefetcher( prefetcher )
+			, m_index( index )
+			, m_filename( filename )
+			, m_autoTransform( autoTransform )
+			, m_scaledTo( scaledTo )
+		{}
+
+		void run() override
+		{
+			m_prefetcher->run( m_index, m_filename, m_autoTransform, m_scaledTo );
+		}
+
+	private:
+		QImagePrefetcher *m_prefetcher;
+		int m_index;
+		QString m_filename;
+		bool m_autoTransform;
+		QSize m_scaledTo;
+	};
+
+	void run( int index, const QString &filename, bool autoTransform, const QSize &scaledTo )
+	{
+		QMutexLocker locker( &m_mutex );
+		if ( !m_entries[index].cancelled )
+		{
+			locker.unlock();
+			QSize size;
+			QImage image = read_file( filename, autoTransform, scaledTo, &size );
+			locker.relock();
+			if ( !m_entries[index].cancelled )
+			{
+				Entry &entry = m_entries[index];
+				entry.image = image;
+				entry.size = size;
+				entry.bytes = qint64( image.bytesPerLine() ) * image.height();
+				entry.done = true;
+				m_bytes += entry.bytes;
+				m_estimate = entry.bytes;
+				m_done.wakeAll();
+				return;
+			}
+		}
+		m_entries.remove( index );
+		m_done.wakeAll();
+	}
+
+	// Drop the images that are ready and cancel the others, with the mutex held
+	void discard()
+	{
+		for ( auto it = m_entries.begin(); it != m_entries.end(); )
+		{
+			if ( it->done )
+			{
+				m_bytes -= it->bytes;
+				it = m_entries.erase( it );
+			}
+			else
+			{
+				it->cancelled = true;
+				++it;
+			}
+		}
+	}
+
+	// Images read with other options are not what the caller wants
+	void setOptions( bool autoTransform, const QSize &scaledTo )
+	{
+		if ( autoTransform != m_autoTransform || scaledTo != m_scaledTo )
+		{
+			m_autoTransform = autoTransform;
+			m_scaledTo = scaledTo;
+			m_estimate = 0;
+			discard();
+		}
+	}
+
+	QThreadPool m_pool;
+	QMutex m_mutex;
+	QWaitCondition m_done;
+	QHash<int, Entry> m_entries;
+	qint64 m_bytes;
+	qint64 m_estimate;
+	bool m_autoTransform;
+	QSize m_scaledTo;
+};
+
+static void prefetcher_delete( void *data )
+{
+	delete static_cast<QImagePrefetcher *>( data );
+}
+
+/** Read an image of the sequence and prefetch the ones after it.
+ *
+ * The images after it are in the direction of playback, or of the last
+ * step when paused, for the next \em prefetch frames.
+ */
+
+static QImage read_image( producer_qimage self, int image_idx, int disable_exif, const QSize &scaledTo, QSize *size )
+{
+	mlt_producer producer = &self->parent;
+	mlt_properties producer_props = MLT_PRODUCER_PROPERTIES( producer );
+	QString filename = QString::fromUtf8( mlt_properties_get_value( self->filenames, image_idx ) );
+	int prefetch = mlt_properties_get_int( producer_props, "prefetch" );
+
+	if ( self->count < 2 || prefetch <= 0 )
+	{
+		mlt_properties_set_data( producer_props, "_prefetcher", NULL, 0, NULL, NULL );
+		return read_file( filename, !disable_exif, scaledTo, size );
+	}
+
+	QImagePrefetcher *prefetcher = static_cast<QImagePrefetcher *>( mlt_properties_get_data( producer_props, "_prefetcher", NULL ) );
+	if ( !prefetcher )
+	{
+		prefetcher = new QImagePrefetcher();
+		mlt_properties_set_data( producer_props, "_prefetcher", prefetcher, 0, prefetcher_delete, NULL );
+	}
+
+	// Work out the direction of playback
+	int direction = mlt_properties_get_int( producer_props, "_prefetch_direction" );
+	double speed = mlt_producer_get_speed( producer );
+	if ( speed != 0.0 )
+	{
+		direction = speed > 0.0 ? 1 : -1;
+	}
+	else if ( mlt_properties_exists( producer_props, "_prefetch_index" ) )
+	{
+		int delta = image_idx - mlt_properties_get_int( producer_props, "_prefetch_index" );
+		if ( delta > self->count / 2 )
+			delta -= self->count;
+		else if ( delta < -self->count / 2 )
+			delta += self->count;
+		if ( delta )
+			direction = delta > 0 ? 1 : -1;
+	}
+	if ( !direction )
+		direction = 1;
+	mlt_properties_set_int( producer_props, "_prefetch_index", image_idx );
+	mlt_properties_set_int( producer_props, "_prefetch_direction", direction );
+
+	QImage image = prefetcher->take( image_idx, filename, !disable_exif, scaledTo, size );
+
+	// Queue the images that will be shown next
+	int ttl = qMax( 1, mlt_properties_get_int( producer_props, "ttl" ) );
+	int ahead = qMin( ( prefetch + ttl - 1 ) / ttl, self->count - 1 );
+	QList<int> indices;
+	QStringList filenames;
+	for ( int i = 1; i <= ahead; i++ )
+	{
+		int index = ( ( image_idx + i * direction ) % self->count + self->count ) % self->count;
+		indices << index;
+		filenames << QString::fromUtf8( mlt_properties_get_value( self->filenames, index ) );
+	}
+	qint64 limit = qint64( qMax( 0, mlt_properties_get_int( producer_props, "prefetch_memory" ) ) ) << 20;
+	prefetcher->schedule( indices, filenames, !disable_exif, scaledTo, limit );
+
+	return image;
+}
+
 extern "C" {
 
 #include <framework/mlt_pool.h>
@@ -160,6 +480,9 @@ int refresh_qimage( producer_qimage self, mlt_frame frame, int enable_caching )
 		self->qimage = NULL;
 		self->current_image = NULL;
 		mlt_properties_set_int( producer_props, "force_reload", 0 );
+		QImagePrefetcher *prefetcher = static_cast<QImagePrefetcher *>( mlt_properties_get_data( producer_props, "_prefetcher", NULL ) );
+		if ( prefetcher )
+			prefetcher->clear();
 	}
 
 	// Get the original position of this frame
@@ -171,21 +494,26 @@ int refresh_qimage( producer_qimage self, mlt_frame frame, int enable_caching )
 
 	int disable_exif = mlt_properties_get_int( producer_props, "disable_exif" );
 
+	// The size a preview scales the image to, which it need not be read larger than
+	QSize preview( mlt_properties_get_int( producer_props, "_preview_width" ),
+		mlt_properties_get_int( producer_props, "_preview_height" ) );
+
 	if ( image_idx != self->qimage_idx )
 	{
 		self->qimage = NULL;
 	}
+	else if ( self->qimage && mlt_properties_get_int( producer_props, "_qimage_reduced" ) )
+	{
+		// Read it again if it was reduced for a smaller preview
+		QImage *qimage = static_cast<QImage*>( self->qimage );
+		if ( preview.isEmpty() || qimage->width() < preview.width() || qimage->height() < preview.height() )
+			self->qimage = NULL;
+	}
 	if ( !self->qimage || mlt_properties_get_int( producer_props, "_disable_exif" ) != disable_exif )
 	{
 		self->current_image = NULL;
-		QImageReader reader;
-#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
-		// Use Qt's orientation detection
-		reader.setAutoTransform(!disable_exif);
-#endif
-		reader.setDecideFormatFromContent( true );
-		reader.setFileName( QString::fromUtf8( mlt_properties_get_value( self->filenames, image_idx ) ) );
-		QImage *qimage = new  QImage( reader.read() );
+		QSize size;
+		QImage *qimage = new QImage( read_image( self, image_idx, disable_exif, preview, &size ) );
 		self->qimage = qimage;
 
 		if ( !qimage->isNull( ) )
@@ -212,14 +540,18 @@ int refresh_qimage( producer_qimage self, mlt_frame frame, int enable_caching )
 			}
 			self->qimage_idx = image_idx;
 
-			// Store the width/height of the qimage
-			self->current_width = qimage->width( );
-			self->current_height = qimage->height( );
+			// Store the width/height of the image, which the qimage may be smaller than
+#if QT_VERSION < QT_VERSION_CHECK(5, 5, 0)
+			size = qimage->size();
+#endif
+			self->current_width = size.width( );
+			self->current_height = size.height( );
 
 			mlt_events_block( producer_props, NULL );
 			mlt_properties_set_int( producer_props, "meta.media.width", self->current_width );
 			mlt_properties_set_int( producer_props, "meta.media.height", self->current_height );
 			mlt_properties_set_int( producer_props, "_disable_exif", disable_exif );
+			mlt_properties_set_int( producer_props, "_qimage_reduced", qimage->size() != size );
 			mlt_events_unblock( producer_props, NULL );
 		}
 		else
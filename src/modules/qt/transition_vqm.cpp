@@ -23,6 +23,7 @@
 #include <string.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <QImage>
 #include <QColor>
 #include <QPainter>
@@ -30,76 +31,536 @@
 #include <QFont>
 #include <QString>
 
-static double calc_psnr( const uint8_t *a, const uint8_t *b, int size, int bpp )
+#if defined(USE_SSE) && defined(ARCH_X86_64)
+#include <emmintrin.h>
+#define USE_VQM_SSE2
+#endif
+
+#define GAUSSIAN_SIZE 11
+
+/** The SSIM constants (0.01 * 255)^2 and (0.03 * 255)^2 */
+#define SSIM_C1 6.5025
+#define SSIM_C2 58.5225
+
+/** The sums for one plane over the rows of a slice */
+typedef struct
+{
+	uint64_t sse;   /**< the sum of squared differences */
+	double ssim;    /**< the sum of the SSIM of each window or pixel */
+	int64_t count;  /**< the number of SSIM windows or pixels */
+} plane_sums;
+
+/** Where a plane is within a packed yuv422 image */
+typedef struct
+{
+	int offset;     /**< the byte offset of the first sample */
+	int step;       /**< the bytes between samples */
+	int divisor;    /**< the image width divided by the samples per row */
+} plane_layout;
+
+static const plane_layout layouts[3] = { { 0, 2, 1 }, { 1, 4, 2 }, { 3, 4, 2 } };
+
+typedef struct
+{
+	const uint8_t *a;
+	const uint8_t *b;
+	int width;
+	int height;
+	int window_size;
+	int gaussian;
+	plane_sums *sums; /**< three per job */
+} slice_desc;
+
+/** Add the squared differences of a packed yuv422 row to the Y, Cb and Cr sums. */
+
+static void row_sse( const uint8_t *a, const uint8_t *b, int width, plane_sums sums[3] )
+{
+	uint32_t sse[3] = { 0, 0, 0 };
+	int i = 0;
+
+#ifdef USE_VQM_SSE2
+	const __m128i luma = _mm_set1_epi16( 0xff );
+	const __m128i even = _mm_set1_epi32( 0xffff );
+	__m128i y = _mm_setzero_si128(), u = _mm_setzero_si128(), v = _mm_setzero_si128();
+	uint32_t lanes[4];
+
+	// 8 pixels at a time, with the sums of squares of each plane in 32 bit lanes
+	for ( ; i + 8 <= width; i += 8 )
+	{
+		__m128i pa = _mm_loadu_si128( (const __m128i*) ( a + i * 2 ) );
+		__m128i pb = _mm_loadu_si128( (const __m128i*) ( b + i * 2 ) );
+		__m128i d = _mm_sub_epi16( _mm_and_si128( pa, luma ), _mm_and_si128( pb, luma ) );
+		y = _mm_add_epi32( y, _mm_madd_epi16( d, d ) );
+		d = _mm_sub_epi16( _mm_srli_epi16( pa, 8 ), _mm_srli_epi16( pb, 8 ) );
+		__m128i du = _mm_and_si128( d, even );
+		__m128i dv = _mm_srli_epi32( d, 16 );
+		u = _mm_add_epi32( u, _mm_madd_epi16( du, du ) );
+		v = _mm_add_epi32( v, _mm_madd_epi16( dv, dv ) );
+	}
+	_mm_storeu_si128( (__m128i*) lanes, y );
+	sse[0] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm_storeu_si128( (__m128i*) lanes, u );
+	sse[1] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	_mm_storeu_si128( (__m128i*) lanes, v );
+	sse[2] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+	for ( ; i < width; i++ )
+	{
+		int diff = a[i * 2] - b[i * 2];
+		sse[0] += diff * diff;
+		diff = a[i * 2 + 1] - b[i * 2 + 1];
+		sse[1 + ( i & 1 )] += diff * diff;
+	}
+	for ( i = 0; i < 3; i++ )
+		sums[i].sse += sse[i];
+}
+
+/** Add a packed row to the sums of a, a², b, b² and ab down each byte column.
+ *
+ * Working on the packed bytes serves all three planes at once.
+ */
+
+static void accumulate_columns( const uint8_t *a, const uint8_t *b, int bytes, uint32_t *columns )
+{
+	uint32_t *ref_acc = columns, *ref_acc_2 = columns + bytes, *cmp_acc = columns + 2 * bytes,
+		*cmp_acc_2 = columns + 3 * bytes, *ref_cmp_acc = columns + 4 * bytes;
+	int i = 0;
+
+#ifdef USE_VQM_SSE2
+	const __m128i zero = _mm_setzero_si128();
+
+	// Widen 8 bytes to 16 bits, where their products still fit, and add them as 32 bits
+#define ACCUMULATE( array, value ) \
+	_mm_storeu_si128( (__m128i*) ( array + i ), _mm_add_epi32( _mm_loadu_si128( (__m128i*) ( array + i ) ), \
+		_mm_unpacklo_epi16( value, zero ) ) ); \
+	_mm_storeu_si128( (__m128i*) ( array + i + 4 ), _mm_add_epi32( _mm_loadu_si128( (__m128i*) ( array + i + 4 ) ), \
+		_mm_unpackhi_epi16( value, zero ) ) )
+
+	for ( ; i + 8 <= bytes; i += 8 )
+	{
+		__m128i pa = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*) ( a + i ) ), zero );
+		__m128i pb = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*) ( b + i ) ), zero );
+		ACCUMULATE( ref_acc, pa );
+		ACCUMULATE( cmp_acc, pb );
+		ACCUMULATE( ref_acc_2, _mm_mullo_epi16( pa, pa ) );
+		ACCUMULATE( cmp_acc_2, _mm_mullo_epi16( pb, pb ) );
+		ACCUMULATE( ref_cmp_acc, _mm_mullo_epi16( pa, pb ) );
+	}
+#undef ACCUMULATE
+#endif
+
+	for ( ; i < bytes; i++ )
+	{
+		ref_acc[i] += a[i];
+		ref_acc_2[i] += a[i] * a[i];
+		cmp_acc[i] += b[i];
+		cmp_acc_2[i] += b[i] * b[i];
+		ref_cmp_acc[i] += a[i] * b[i];
+	}
+}
+
+static inline double window_ssim( double n_samples, uint64_t ref_acc, uint64_t ref_acc_2,
+	uint64_t cmp_acc, uint64_t cmp_acc_2, uint64_t ref_cmp_acc )
+{
+	// http://en.wikipedia.org/wiki/SSIM
+	// http://en.wikipedia.org/wiki/Variance
+	// http://en.wikipedia.org/wiki/Covariance
+	double ref_avg = ref_acc / n_samples,
+		ref_var = ref_acc_2 / n_samples - ref_avg * ref_avg,
+		cmp_avg = cmp_acc / n_samples,
+		cmp_var = cmp_acc_2 / n_samples - cmp_avg * cmp_avg,
+		ref_cmp_cov = ref_cmp_acc / n_samples - ref_avg * cmp_avg,
+		ssim_num = (2.0 * ref_avg * cmp_avg + SSIM_C1) * (2.0 * ref_cmp_cov + SSIM_C2),
+		ssim_den = (ref_avg * ref_avg + cmp_avg * cmp_avg + SSIM_C1) * (ref_var + cmp_var + SSIM_C2);
+	return ssim_num / ssim_den;
+}
+
+/** Accumulate the squared error and the SSIM of non-overlapping windows.
+ *
+ * The rows [start, end) must begin on a window boundary. The window sums
+ * are integers, so the result is the same however the rows are sliced.
+ */
+
+static void measure_windows( const slice_desc *desc, int start, int end, uint32_t *columns, plane_sums sums[3] )
+{
+	int stride = desc->width * 2;
+	int ws = desc->window_size;
+	int windows_y = ws > 0 ? desc->height / ws : 0;
+
+	for ( int y = start; y < end; y++ )
+	{
+		const uint8_t *a = desc->a + y * stride;
+		const uint8_t *b = desc->b + y * stride;
+		row_sse( a, b, desc->width, sums );
+
+		if ( y >= windows_y * ws )
+			continue;
+
+		// Sum the columns down each row of windows
+		if ( y % ws == 0 )
+			memset( columns, 0, 5 * stride * sizeof( *columns ) );
+		accumulate_columns( a, b, stride, columns );
+		if ( y % ws != ws - 1 )
+			continue;
+
+		for ( int p = 0; p < 3; p++ )
+		{
+			const plane_layout *layout = &layouts[p];
+			int windows_x = desc->width / layout->divisor / ws;
+			for ( int x = 0; x < windows_x; x++ )
+			{
+				uint64_t acc[5] = { 0, 0, 0, 0, 0 };
+				int first = layout->offset + x * ws * layout->step;
+				int last = first + ws * layout->step;
+				for ( int i = first; i < last; i += layout->step )
+					for ( int k = 0; k < 5; k++ )
+						acc[k] += columns[ k * stride + i ];
+				sums[p].ssim += window_ssim( ws * ws, acc[0], acc[1], acc[2], acc[3], acc[4] );
+				sums[p].count ++;
+			}
+		}
+	}
+}
+
+/** Filter the rows in a ring vertically, giving the weighted a, b, a², b² and ab. */
+
+static void filter_vertical( const float *ring_a, const float *ring_b, int top, int width,
+	const float *weights, float *mu_a, float *mu_b, float *aa, float *bb, float *ab )
+{
+	memset( mu_a, 0, 5 * width * sizeof( float ) );
+	for ( int k = 0; k < GAUSSIAN_SIZE; k++ )
+	{
+		const float *fa = ring_a + ( ( top + k ) % GAUSSIAN_SIZE ) * width;
+		const float *fb = ring_b + ( ( top + k ) % GAUSSIAN_SIZE ) * width;
+		float w = weights[k];
+		int i = 0;
+#ifdef USE_VQM_SSE2
+		__m128 vw = _mm_set1_ps( w );
+		for ( ; i + 4 <= width; i += 4 )
+		{
+			__m128 va = _mm_loadu_ps( fa + i ), vb = _mm_loadu_ps( fb + i );
+			__m128 wa = _mm_mul_ps( vw, va ), wb = _mm_mul_ps( vw, vb );
+			_mm_storeu_ps( mu_a + i, _mm_add_ps( _mm_loadu_ps( mu_a + i ), wa ) );
+			_mm_storeu_ps( mu_b + i, _mm_add_ps( _mm_loadu_ps( mu_b + i ), wb ) );
+			_mm_storeu_ps( aa + i, _mm_add_ps( _mm_loadu_ps( aa + i ), _mm_mul_ps( wa, va ) ) );
+			_mm_storeu_ps( bb + i, _mm_add_ps( _mm_loadu_ps( bb + i ), _mm_mul_ps( wb, vb ) ) );
+			_mm_storeu_ps( ab + i, _mm_add_ps( _mm_loadu_ps( ab + i ), _mm_mul_ps( wa, vb ) ) );
+		}
+#endif
+		for ( ; i < width; i++ )
+		{
+			mu_a[i] += w * fa[i];
+			mu_b[i] += w * fb[i];
+			aa[i] += w * fa[i] * fa[i];
+			bb[i] += w * fb[i] * fb[i];
+			ab[i] += w * fa[i] * fb[i];
+		}
+	}
+}
+
+/** Filter horizontally and sum the SSIM of each pixel of a row. */
+
+static double filter_horizontal( int width, const float *weights,
+	const float *mu_a, const float *mu_b, const float *aa, const float *bb, const float *ab )
+{
+	double sum = 0.0;
+	int i = 0;
+
+#ifdef USE_VQM_SSE2
+	const __m128 c1 = _mm_set1_ps( SSIM_C1 ), c2 = _mm_set1_ps( SSIM_C2 ), two = _mm_set1_ps( 2.0f );
+	__m128 total = _mm_setzero_ps();
+	float lanes[4];
+
+	for ( ; i + 4 <= width; i += 4 )
+	{
+		__m128 ma = _mm_setzero_ps(), mb = _mm_setzero_ps(), saa = _mm_setzero_ps(),
+			sbb = _mm_setzero_ps(), sab = _mm_setzero_ps();
+		for ( int k = 0; k < GAUSSIAN_SIZE; k++ )
+		{
+			__m128 w = _mm_set1_ps( weights[k] );
+			ma = _mm_add_ps( ma, _mm_mul_ps( w, _mm_loadu_ps( mu_a + i + k ) ) );
+			mb = _mm_add_ps( mb, _mm_mul_ps( w, _mm_loadu_ps( mu_b + i + k ) ) );
+			saa = _mm_add_ps( saa, _mm_mul_ps( w, _mm_loadu_ps( aa + i + k ) ) );
+			sbb = _mm_add_ps( sbb, _mm_mul_ps( w, _mm_loadu_ps( bb + i + k ) ) );
+			sab = _mm_add_ps( sab, _mm_mul_ps( w, _mm_loadu_ps( ab + i + k ) ) );
+		}
+		__m128 mab = _mm_mul_ps( ma, mb );
+		__m128 sq = _mm_add_ps( _mm_mul_ps( ma, ma ), _mm_mul_ps( mb, mb ) );
+		__m128 num = _mm_mul_ps( _mm_add_ps( _mm_mul_ps( two, mab ), c1 ),
+			_mm_add_ps( _mm_mul_ps( two, _mm_sub_ps( sab, mab ) ), c2 ) );
+		__m128 den = _mm_mul_ps( _mm_add_ps( sq, c1 ), _mm_add_ps( _mm_sub_ps( _mm_add_ps( saa, sbb ), sq ), c2 ) );
+		total = _mm_add_ps( total, _mm_div_ps( num, den ) );
+	}
+	_mm_storeu_ps( lanes, total );
+	sum = (double) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+	for ( ; i < width; i++ )
+	{
+		float ma = 0.0f, mb = 0.0f, saa = 0.0f, sbb = 0.0f, sab = 0.0f;
+		for ( int k = 0; k < GAUSSIAN_SIZE; k++ )
+		{
+			ma += weights[k] * mu_a[i + k];
+			mb += weights[k] * mu_b[i + k];
+			saa += weights[k] * aa[i + k];
+			sbb += weights[k] * bb[i + k];
+			sab += weights[k] * ab[i + k];
+		}
+		float mab = ma * mb, sq = ma * ma + mb * mb;
+		sum += ( ( 2.0f * mab + (float) SSIM_C1 ) * ( 2.0f * ( sab - mab ) + (float) SSIM_C2 ) )
+			/ ( ( sq + (float) SSIM_C1 ) * ( saa + sbb - sq + (float) SSIM_C2 ) );
+	}
+	return sum;
+}
+
+/** Accumulate the SSIM of every pixel using an 11x11 Gaussian window.
+ *
+ * This follows Wang et al. with a standard deviation of 1.5 over the
+ * pixels that the window fits around, computed at full resolution.
+ * The output rows are [start, end), and the window reads 10 rows further.
+ */
+
+static void measure_gaussian( const slice_desc *desc, const plane_layout *layout, int start, int end,
+	float *buffer, plane_sums *sums )
 {
-	double mse = 0.0;
-	int n = size + 1;
+	int width = desc->width / layout->divisor;
+	int stride = desc->width * 2;
+	int out_width = width - GAUSSIAN_SIZE + 1;
+	float weights[GAUSSIAN_SIZE];
+	float *ring_a = buffer, *ring_b = buffer + GAUSSIAN_SIZE * width;
+	float *mu_a = ring_b + GAUSSIAN_SIZE * width, *mu_b = mu_a + width,
+		*aa = mu_b + width, *bb = aa + width, *ab = bb + width;
+	double total = 0.0;
+
+	if ( end > desc->height - GAUSSIAN_SIZE + 1 )
+		end = desc->height - GAUSSIAN_SIZE + 1;
+	if ( out_width < 1 || start >= end )
+		return;
 
-	while ( --n )
+	for ( int k = 0; k < GAUSSIAN_SIZE; k++ )
 	{
-		int diff = *a - *b;
-		mse += diff * diff;
-		a += bpp;
-		b += bpp;
+		double d = k - GAUSSIAN_SIZE / 2;
+		weights[k] = exp( -d * d / ( 2.0 * 1.5 * 1.5 ) );
+		total += weights[k];
 	}
+	for ( int k = 0; k < GAUSSIAN_SIZE; k++ )
+		weights[k] /= total;
+
+	for ( int y = start; y < end + GAUSSIAN_SIZE - 1; y++ )
+	{
+		// Keep the last rows of the plane as floats in a ring
+		const uint8_t *a = desc->a + y * stride + layout->offset;
+		const uint8_t *b = desc->b + y * stride + layout->offset;
+		float *ra = ring_a + ( y % GAUSSIAN_SIZE ) * width;
+		float *rb = ring_b + ( y % GAUSSIAN_SIZE ) * width;
+		for ( int i = 0; i < width; i++ )
+		{
+			ra[i] = a[i * layout->step];
+			rb[i] = b[i * layout->step];
+		}
+		if ( y < start + GAUSSIAN_SIZE - 1 )
+			continue;
+
+		filter_vertical( ring_a, ring_b, y - GAUSSIAN_SIZE + 1, width, weights, mu_a, mu_b, aa, bb, ab );
+		sums->ssim += filter_horizontal( out_width, weights, mu_a, mu_b, aa, bb, ab );
+		sums->count += out_width;
+	}
+}
+
+static int measure_slice( int id, int index, int jobs, void *data )
+{
+	(void) id; // unused
+	slice_desc *desc = (slice_desc*) data;
+	plane_sums *sums = &desc->sums[ index * 3 ];
+	int unit = desc->gaussian || desc->window_size < 1 ? 1 : desc->window_size;
+	int units = desc->height / unit;
+	int start = 0;
+	int count = mlt_slices_size_slice( jobs, index, units, &start );
+	int end = ( start + count ) * unit;
+	void *scratch;
+
+	// Slices hold whole rows of windows, and the last also takes any rows below them
+	start *= unit;
+	if ( ( count > 0 && end == units * unit ) || ( units == 0 && index == 0 ) )
+		end = desc->height;
+
+	if ( desc->gaussian )
+	{
+		slice_desc psnr = *desc;
+		psnr.window_size = 0;
+		scratch = malloc( ( 2 * GAUSSIAN_SIZE + 5 ) * desc->width * sizeof( float ) );
+		measure_windows( &psnr, start, end, NULL, sums );
+		for ( int p = 0; p < 3; p++ )
+			measure_gaussian( desc, &layouts[p], start, end, (float*) scratch, &sums[p] );
+	}
+	else
+	{
+		scratch = malloc( 5 * desc->width * 2 * sizeof( uint32_t ) );
+		measure_windows( desc, start, end, (uint32_t*) scratch, sums );
+	}
+	free( scratch );
+	return 0;
+}
+
+/** Measure the PSNR and SSIM of the Y, Cb and Cr planes of a yuv422 image.
+ *
+ * The fourth value of each result combines the planes weighted by their
+ * number of samples.
+ */
+
+static void measure( const uint8_t *a, const uint8_t *b, int width, int height, int window_size,
+	int gaussian, double psnr[4], double ssim[4] )
+{
+	int jobs = height >= 64 ? mlt_slices_count_normal() : 1;
+	plane_sums *sums = (plane_sums*) calloc( jobs * 3, sizeof( plane_sums ) );
+	slice_desc desc = { a, b, width, height, window_size, gaussian, sums };
+	double samples[3] = { (double) width * height, width * height / 2.0, width * height / 2.0 };
+	uint64_t sse = 0;
+
+	// Give each slice at least one row of windows
+	if ( !gaussian && window_size > 1 )
+		jobs = CLAMP( jobs, 1, MAX( height / window_size, 1 ) );
+	if ( jobs > 1 )
+		mlt_slices_run_normal( jobs, measure_slice, &desc );
+	else
+		measure_slice( 0, 0, 1, &desc );
+
+	for ( int p = 0; p < 3; p++ )
+	{
+		plane_sums total = { 0, 0.0, 0 };
+		for ( int i = 0; i < jobs; i++ )
+		{
+			total.sse += sums[ i * 3 + p ].sse;
+			total.ssim += sums[ i * 3 + p ].ssim;
+			total.count += sums[ i * 3 + p ].count;
+		}
+		psnr[p] = 10.0 * log10( 255.0 * 255.0 / ( total.sse == 0 ? 1e-10 : total.sse / samples[p] ) );
+		ssim[p] = total.count ? total.ssim / total.count : 0.0;
+		sse += total.sse;
+	}
+	psnr[3] = 10.0 * log10( 255.0 * 255.0 / ( sse == 0 ? 1e-10 : sse / ( 2.0 * width * height ) ) );
+	ssim[3] = ( 2.0 * ssim[0] + ssim[1] + ssim[2] ) / 4.0;
+	free( sums );
+}
+
+/** The most frames that wait for an earlier one before they are written.
+ *
+ * With real_time > 1 the consumer renders frames on several threads, and
+ * they finish out of order. This is far more than any consumer has threads,
+ * so only a frame that is never rendered, such as one that is dropped or
+ * skipped by a seek, holds the rows back this long.
+ */
+#define MAX_PENDING 64
+
+/** The metrics of a frame */
+typedef struct
+{
+	int position;
+	double psnr[4];
+	double ssim[4];
+} frame_metrics;
+
+typedef struct
+{
+	FILE *output;     /**< the file receiving the metrics, if any */
+	int json;         /**< whether to write JSON lines instead of CSV */
+	int started;      /**< whether the output was opened or the header printed */
+	int frames;       /**< the number of frames measured */
+	double psnr[4];   /**< the sums of the PSNR of each frame */
+	double ssim[4];   /**< the sums of the SSIM of each frame */
+	int next;         /**< the position of the next row to write */
+	int pending_count;
+	frame_metrics pending[MAX_PENDING]; /**< the frames measured ahead of next, in order */
+} private_data;
+
+/** Write the metrics of a frame and add them to the sums for the averages. */
 
-	return 10.0 * log10( 255.0 * 255.0 / ( mse == 0 ? 1e-10 : mse/size ) );
+static void write_row( mlt_transition transition, const frame_metrics *metrics )
+{
+	private_data *pdata = (private_data*) transition->child;
+	const char *output = mlt_properties_get( MLT_TRANSITION_PROPERTIES( transition ), "output" );
+	int position = metrics->position;
+	const double *psnr = metrics->psnr, *ssim = metrics->ssim;
+
+	if ( pdata->output && pdata->json )
+		fprintf( pdata->output, "{\"frame\":%d,\"psnr\":{\"y\":%.4f,\"cb\":%.4f,\"cr\":%.4f,\"all\":%.4f},"
+			"\"ssim\":{\"y\":%.6f,\"cb\":%.6f,\"cr\":%.6f,\"all\":%.6f}}\n",
+			position, psnr[0], psnr[1], psnr[2], psnr[3], ssim[0], ssim[1], ssim[2], ssim[3] );
+	else if ( pdata->output )
+		fprintf( pdata->output, "%d,%.4f,%.4f,%.4f,%.4f,%.6f,%.6f,%.6f,%.6f\n",
+			position, psnr[0], psnr[1], psnr[2], psnr[3], ssim[0], ssim[1], ssim[2], ssim[3] );
+	else if ( !output || !strcmp( output, "" ) )
+		printf( "%05d %05.2f %05.2f %05.2f %5.3f %5.3f %5.3f\n",
+			position, psnr[0], psnr[1], psnr[2], ssim[0], ssim[1], ssim[2] );
+	for ( int i = 0; i < 4; i++ )
+	{
+		pdata->psnr[i] += psnr[i];
+		pdata->ssim[i] += ssim[i];
+	}
+	pdata->frames ++;
+	pdata->next = position + 1;
 }
 
-static double calc_ssim( const uint8_t *a, const uint8_t *b, int width, int height, int window_size, int bpp )
+/** Write the earliest pending frame. */
+
+static void write_pending( mlt_transition transition )
 {
-	int	windows_x = width / window_size;
-	int windows_y = height / window_size;
-	double	avg = 0.0;
+	private_data *pdata = (private_data*) transition->child;
 
-	if ( !windows_x || !windows_y )
-		return 0.0;
+	write_row( transition, &pdata->pending[0] );
+	pdata->pending_count --;
+	memmove( &pdata->pending[0], &pdata->pending[1], pdata->pending_count * sizeof( frame_metrics ) );
+}
 
-	// for each window
-	for ( int y = 0; y < windows_y; ++y )
-		for ( int x = 0; x < windows_x; ++x )
+/** Write the metrics of a frame to stdout or the file named by "output".
+ *
+ * Rows are written in the order of the frames rather than the order in which
+ * they finish, so a frame waits until the frames before it are written.
+ */
+
+static void report( mlt_transition transition, int position, const double psnr[4], const double ssim[4] )
+{
+	private_data *pdata = (private_data*) transition->child;
+	mlt_properties properties = MLT_TRANSITION_PROPERTIES( transition );
+	const char *output = mlt_properties_get( properties, "output" );
+	int i;
+
+	mlt_service_lock( MLT_TRANSITION_SERVICE( transition ) );
+	if ( !pdata->started )
+	{
+		pdata->started = 1;
+		pdata->next = mlt_transition_get_in( transition );
+		if ( output && strcmp( output, "" ) )
 		{
-			int	base_offset = x * window_size + y * window_size * width;
-			double	ref_acc = 0.0,
-					ref_acc_2 = 0.0,
-					cmp_acc = 0.0,
-					cmp_acc_2 = 0.0,
-					ref_cmp_acc = 0.0;
-
-			// accumulate the pixel values for this window
-			for ( int j = 0; j < window_size; ++j )
-				for ( int i = 0; i < window_size; ++i )
-				{
-					uint8_t c_a = a[bpp * (base_offset + j * width + i)];
-					uint8_t c_b = b[bpp * (base_offset + j * width + i)];
-					ref_acc += c_a;
-					ref_acc_2 += c_a * c_a;
-					cmp_acc += c_b;
-					cmp_acc_2 += c_b * c_b;
-					ref_cmp_acc += c_a * c_b;
-				}
-
-			// compute the SSIM for this window
-			// http://en.wikipedia.org/wiki/SSIM
-			// http://en.wikipedia.org/wiki/Variance
-			// http://en.wikipedia.org/wiki/Covariance
-			double n_samples = window_size * window_size,
-					ref_avg = ref_acc / n_samples,
-					ref_var = ref_acc_2 / n_samples - ref_avg * ref_avg,
-					cmp_avg = cmp_acc / n_samples,
-					cmp_var = cmp_acc_2 / n_samples - cmp_avg * cmp_avg,
-					ref_cmp_cov = ref_cmp_acc / n_samples - ref_avg * cmp_avg,
-					c1 = 6.5025, // (0.01*255.0)^2
-					c2 = 58.5225, // (0.03*255)^2
-					ssim_num = (2.0 * ref_avg * cmp_avg + c1) * (2.0 * ref_cmp_cov + c2),
-					ssim_den = (ref_avg * ref_avg + cmp_avg * cmp_avg + c1) * (ref_var + cmp_var + c2);
-
-			// accumulate the SSIM
-			avg += ssim_num / ssim_den;
+			size_t length = strlen( output );
+			pdata->json = ( length > 5 && !strcmp( output + length - 5, ".json" ) )
+				|| ( length > 6 && !strcmp( output + length - 6, ".jsonl" ) );
+			pdata->output = fopen( output, "w" );
+			if ( !pdata->output )
+				mlt_log_error( MLT_TRANSITION_SERVICE( transition ), "failed to open %s\n", output );
+			else if ( !pdata->json )
+				fprintf( pdata->output, "frame,psnr_y,psnr_cb,psnr_cr,psnr,ssim_y,ssim_cb,ssim_cr,ssim\n" );
 		}
+		else
+		{
+			printf( "frame psnr[Y] psnr[Cb] psnr[Cr] ssim[Y] ssim[Cb] ssim[Cr]\n" );
+		}
+	}
 
-	// return the average SSIM
-	return avg / windows_x / windows_y;
+	if ( pdata->pending_count == MAX_PENDING )
+		write_pending( transition );
+	for ( i = pdata->pending_count; i > 0 && pdata->pending[i - 1].position > position; i-- )
+		pdata->pending[i] = pdata->pending[i - 1];
+	pdata->pending[i].position = position;
+	memcpy( pdata->pending[i].psnr, psnr, sizeof( pdata->pending[i].psnr ) );
+	memcpy( pdata->pending[i].ssim, ssim, sizeof( pdata->pending[i].ssim ) );
+	pdata->pending_count ++;
+
+	// A frame rendered again after a seek back is written at once
+	while ( pdata->pending_count && pdata->pending[0].position <= pdata->next )
+		write_pending( transition );
+	mlt_service_unlock( MLT_TRANSITION_SERVICE( transition ) );
 }
 
 static int get_image( mlt_frame a_frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
@@ -109,27 +570,24 @@ static int get_image( mlt_frame a_frame, uint8_t **image, mlt_image_format *form
 	mlt_transition transition = MLT_TRANSITION( mlt_frame_pop_service( a_frame ) );
 	uint8_t *b_image;
 	int window_size = mlt_properties_get_int( MLT_TRANSITION_PROPERTIES( transition ), "window_size" );
-	double psnr[3], ssim[3];
+	const char *method = mlt_properties_get( MLT_TRANSITION_PROPERTIES( transition ), "ssim" );
+	int gaussian = method && !strcmp( method, "gaussian" );
+	double psnr[4], ssim[4];
 
 	*format = mlt_image_yuv422;
 	mlt_frame_get_image( b_frame, &b_image, format, width, height, writable );
 	mlt_frame_get_image( a_frame, image, format, width, height, writable );
 
-	psnr[0] = calc_psnr( *image, b_image, *width * *height, 2 );
-	psnr[1] = calc_psnr( *image + 1, b_image + 1, *width * *height / 2, 4 );
-	psnr[2] = calc_psnr( *image + 3, b_image + 3, *width * *height / 2, 4 );
-	ssim[0] = calc_ssim( *image, b_image, *width, *height, window_size, 2 );
-	ssim[1] = calc_ssim( *image + 1, b_image + 1, *width / 2, *height, window_size, 4 );
-	ssim[2] = calc_ssim( *image + 3, b_image + 3, *width / 2, *height, window_size, 4 );
+	measure( *image, b_image, *width, *height, window_size, gaussian, psnr, ssim );
 	mlt_properties_set_double( properties, "meta.vqm.psnr.y", psnr[0] );
 	mlt_properties_set_double( properties, "meta.vqm.psnr.cb", psnr[1] );
 	mlt_properties_set_double( properties, "meta.vqm.psnr.cr", psnr[2] );
+	mlt_properties_set_double( properties, "meta.vqm.psnr", psnr[3] );
 	mlt_properties_set_double( properties, "meta.vqm.ssim.y", ssim[0] );
 	mlt_properties_set_double( properties, "meta.vqm.ssim.cb", ssim[1] );
 	mlt_properties_set_double( properties, "meta.vqm.ssim.cr", ssim[2] );
-	printf( "%05d %05.2f %05.2f %05.2f %5.3f %5.3f %5.3f\n",
-			mlt_frame_get_position( a_frame ), psnr[0], psnr[1], psnr[2],
-			ssim[0], ssim[1], ssim[2] );
+	mlt_properties_set_double( properties, "meta.vqm.ssim", ssim[3] );
+	report( transition, mlt_frame_get_position( a_frame ), psnr, ssim );
 
 	// copy the B frame to the bottom of the A frame for comparison
 	window_size = mlt_image_format_size( *format, *width, *height, NULL ) / 2;
@@ -138,6 +596,10 @@ static int get_image( mlt_frame a_frame, uint8_t **image, mlt_image_format *form
 	if ( !mlt_properties_get_int( MLT_TRANSITION_PROPERTIES( transition ), "render" ) )
 		return 0;
 
+	// Only drawing needs Qt, so measuring works without a display
+	if ( !createQApplicationIfNeeded( MLT_TRANSITION_SERVICE( transition ) ) )
+		return 0;
+
 	// get RGBA image for Qt drawing
 	*format = mlt_image_rgba;
 	mlt_frame_get_image( a_frame, image, format, width, height, 1 );
@@ -216,25 +678,60 @@ static mlt_frame process( mlt_transition transition, mlt_frame a_frame, mlt_fram
 	return a_frame;
 }
 
+static void transition_close( mlt_transition transition )
+{
+	private_data *pdata = (private_data*) transition->child;
+
+	while ( pdata->pending_count )
+		write_pending( transition );
+	if ( pdata->frames )
+	{
+		double psnr[4], ssim[4];
+		for ( int i = 0; i < 4; i++ )
+		{
+			psnr[i] = pdata->psnr[i] / pdata->frames;
+			ssim[i] = pdata->ssim[i] / pdata->frames;
+		}
+		if ( pdata->output && pdata->json )
+			fprintf( pdata->output, "{\"frames\":%d,\"average\":{\"psnr\":{\"y\":%.4f,\"cb\":%.4f,\"cr\":%.4f,\"all\":%.4f},"
+				"\"ssim\":{\"y\":%.6f,\"cb\":%.6f,\"cr\":%.6f,\"all\":%.6f}}}\n",
+				pdata->frames, psnr[0], psnr[1], psnr[2], psnr[3], ssim[0], ssim[1], ssim[2], ssim[3] );
+		mlt_log_info( MLT_TRANSITION_SERVICE( transition ), "average of %d frames: PSNR %.2f SSIM %.4f\n",
+			pdata->frames, psnr[3], ssim[3] );
+	}
+	if ( pdata->output )
+		fclose( pdata->output );
+	free( pdata );
+	transition->child = NULL;
+	transition->close = NULL;
+	mlt_transition_close( transition );
+}
+
 extern "C" {
 
 mlt_transition transition_vqm_init( mlt_profile profile, mlt_service_type type, const char *id, void *arg )
 {
 	mlt_transition transition = mlt_transition_new();
+	private_data *pdata = (private_data*) calloc( 1, sizeof( private_data ) );
 
-	if ( transition )
+	if ( transition && pdata )
 	{
 		mlt_properties properties = MLT_TRANSITION_PROPERTIES( transition );
 
-		if ( !createQApplicationIfNeeded( MLT_TRANSITION_SERVICE(transition) ) )
-		{
-			mlt_transition_close( transition );
-			return NULL;
-		}
+		transition->child = pdata;
+		transition->close = transition_close;
 		transition->process = process;
 		mlt_properties_set_int( properties, "_transition_type", 1 ); // video only
 		mlt_properties_set_int( properties, "window_size", 8 );
-		printf( "frame psnr[Y] psnr[Cb] psnr[Cr] ssim[Y] ssim[Cb] ssim[Cr]\n" );
+		mlt_properties_set( properties, "ssim", "window" );
+		if ( arg )
+			mlt_properties_set( properties, "output", (const char*) arg );
+	}
+	else
+	{
+		mlt_transition_close( transition );
+		free( pdata );
+		transition = NULL;
 	}
 
 	return transition;
@@ -140,6 +140,9 @@ mlt_consumer consumer_sdl2_init( mlt_profile profile, mlt_service_type type, con
 		// Default audio buffer
 		mlt_properties_set_int( self->properties, "audio_buffer", 2048 );
 
+		// Keep the audio flowing while images render
+		mlt_properties_set_int( self->properties, "audio_first", 1 );
+
 		// Default scrub audio
 		mlt_properties_set_int( self->properties, "scrub_audio", 1 );
 
@@ -715,6 +718,7 @@ static void *video_thread( void *arg )
 
 	// Get real time flag
 	int real_time = mlt_properties_get_int( self->properties, "real_time" );
+	int audio_first = real_time > 0 && mlt_properties_get_int( self->properties, "audio_first" );
 
 	// Determine start time
 	gettimeofday( &now, NULL );
@@ -746,6 +750,20 @@ static void *video_thread( void *arg )
 		// Get the elapsed time
 		elapsed = ( ( int64_t )now.tv_sec * 1000000 + now.tv_usec ) - start;
 
+		// The image may still be rendering: give it until its playout time
+		if ( audio_first && speed == 1.0 )
+		{
+			int64_t scheduled = mlt_properties_get_int( properties, "playtime" );
+			while ( self->running && elapsed < scheduled && !mlt_properties_get_int( properties, "rendered" ) )
+			{
+				tm.tv_sec = 0;
+				tm.tv_nsec = 1000000;
+				nanosleep( &tm, NULL );
+				gettimeofday( &now, NULL );
+				elapsed = ( ( int64_t )now.tv_sec * 1000000 + now.tv_usec ) - start;
+			}
+		}
+
 		// See if we have to delay the display of the current frame
 		if ( mlt_properties_get_int( properties, "rendered" ) == 1 && self->running )
 		{
@@ -0,0 +1,187 @@
+/*
+ * test_imageconvert.c -- check the SIMD kernels of filter_imageconvert
+ * Copyright (C) 2024 Meltytech, LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <modules/core/image_proc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(USE_SSE) && defined(ARCH_X86_64)
+
+/** The largest difference from the scalar path that is accepted. */
+#define TOLERANCE 0
+
+#define MAX_WIDTH 96
+
+// The matrices of filter_imageconvert.c
+static const yuv_to_rgb_matrix yuv_to_rgb[] =
+{
+	{ 16, 1192, 1634, 401, 832, 2066 },
+	{ 0, 1024, 1436, 352, 731, 1815 },
+	{ 16, 1192, 1836, 218, 546, 2163 },
+	{ 0, 1024, 1613, 192, 479, 1900 },
+};
+
+static const rgb_to_yuv_matrix rgb_to_yuv[] =
+{
+	{ 16, 263, 516, 100, -152, -300, 450, 450, -377, -73 },
+	{ 0, 306, 601, 117, -173, -339, 512, 512, -429, -83 },
+	{ 16, 187, 629, 63, -103, -347, 450, 450, -409, -41 },
+	{ 0, 218, 732, 74, -117, -395, 512, 512, -465, -47 },
+};
+
+typedef int ( *yuv_to_rgb_kernel )( uint8_t *dst, const uint8_t *src, const uint8_t *alpha, int width, const yuv_to_rgb_matrix *m );
+typedef int ( *rgb_to_yuv_kernel )( uint8_t *dst, uint8_t *alpha, const uint8_t *src, int width, const rgb_to_yuv_matrix *m );
+
+static int clamp( int x )
+{
+	return x < 0 ? 0 : x > 255 ? 255 : x;
+}
+
+/** The scalar conversion of filter_imageconvert.c, as image_proc.h gives it.
+*/
+
+static void yuv422_to_rgba_scalar( uint8_t *dst, const uint8_t *src, const uint8_t *alpha, int width, const yuv_to_rgb_matrix *m )
+{
+	for ( int x = 0; x < width; x++ )
+	{
+		int y = src[ x * 2 ] - m->y_offset;
+		int u = src[ ( x & ~1 ) * 2 + 1 ] - 128;
+		int v = src[ ( x & ~1 ) * 2 + 3 ] - 128;
+		dst[ x * 4 + 0 ] = clamp( ( m->y_scale * y + m->v_r * v ) >> 10 );
+		dst[ x * 4 + 1 ] = clamp( ( m->y_scale * y - m->v_g * v - m->u_g * u ) >> 10 );
+		dst[ x * 4 + 2 ] = clamp( ( m->y_scale * y + m->u_b * u ) >> 10 );
+		dst[ x * 4 + 3 ] = alpha ? alpha[ x ] : 0xff;
+	}
+}
+
+static void rgba_to_yuv422_scalar( uint8_t *dst, uint8_t *alpha, const uint8_t *src, int width, const rgb_to_yuv_matrix *m )
+{
+	for ( int x = 0; x + 1 < width; x += 2 )
+	{
+		int u[2], v[2];
+		for ( int i = 0; i < 2; i++ )
+		{
+			const uint8_t *p = src + ( x + i ) * 4;
+			dst[ ( x + i ) * 2 ] = ( ( m->r_y * p[0] + m->g_y * p[1] + m->b_y * p[2] ) >> 10 ) + m->y_offset;
+			u[i] = ( ( m->r_u * p[0] + m->g_u * p[1] + m->b_u * p[2] ) >> 10 ) + 128;
+			v[i] = ( ( m->r_v * p[0] + m->g_v * p[1] + m->b_v * p[2] ) >> 10 ) + 128;
+			alpha[ x + i ] = p[3];
+		}
+		dst[ x * 2 + 1 ] = ( u[0] + u[1] ) >> 1;
+		dst[ x * 2 + 3 ] = ( v[0] + v[1] ) >> 1;
+	}
+}
+
+/** Fill a line with random values, or with only 0 and 255 to reach the extremes.
+*/
+
+static void fill( uint8_t *buffer, int size, int extremes )
+{
+	for ( int i = 0; i < size; i++ )
+		buffer[i] = extremes ? ( rand() & 1 ) * 255 : rand() & 0xff;
+}
+
+static int compare( const char *name, int width, const uint8_t *expected, const uint8_t *actual, int size )
+{
+	for ( int i = 0; i < size; i++ )
+	{
+		if ( abs( expected[i] - actual[i] ) > TOLERANCE )
+		{
+			fprintf( stderr, "%s: width %d: byte %d is %d but should be %d\n", name, width, i, actual[i], expected[i] );
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int test_yuv_to_rgb( const char *name, yuv_to_rgb_kernel kernel )
+{
+	uint8_t src[ MAX_WIDTH * 2 + 4 ], alpha[ MAX_WIDTH ];
+	uint8_t expected[ MAX_WIDTH * 4 ], actual[ MAX_WIDTH * 4 ];
+	int failures = 0;
+
+	for ( int i = 0; i < 4; i++ )
+	for ( int width = 2; width <= MAX_WIDTH; width += 2 )
+	for ( int run = 0; run < 64; run++ )
+	{
+		const uint8_t *a = run & 1 ? alpha : NULL;
+		fill( src, sizeof( src ), run & 2 );
+		fill( alpha, sizeof( alpha ), 0 );
+		memset( actual, 0, sizeof( actual ) );
+		int done = kernel( actual, src, a, width, &yuv_to_rgb[i] );
+		yuv422_to_rgba_scalar( expected, src, a, done, &yuv_to_rgb[i] );
+		failures += compare( name, width, expected, actual, done * 4 );
+	}
+	return failures;
+}
+
+static int test_rgb_to_yuv( const char *name, rgb_to_yuv_kernel kernel )
+{
+	uint8_t src[ MAX_WIDTH * 4 ];
+	uint8_t expected[ MAX_WIDTH * 2 ], actual[ MAX_WIDTH * 2 ];
+	uint8_t expected_alpha[ MAX_WIDTH ], actual_alpha[ MAX_WIDTH ];
+	int failures = 0;
+
+	for ( int i = 0; i < 4; i++ )
+	for ( int width = 1; width <= MAX_WIDTH; width++ )
+	for ( int run = 0; run < 64; run++ )
+	{
+		fill( src, sizeof( src ), run & 2 );
+		memset( actual, 0, sizeof( actual ) );
+		memset( actual_alpha, 0, sizeof( actual_alpha ) );
+		int done = kernel( actual, actual_alpha, src, width, &rgb_to_yuv[i] );
+		rgba_to_yuv422_scalar( expected, expected_alpha, src, done, &rgb_to_yuv[i] );
+		failures += compare( name, width, expected, actual, done * 2 );
+		failures += compare( name, width, expected_alpha, actual_alpha, done );
+	}
+	return failures;
+}
+
+int main( int argc, char **argv )
+{
+	int failures = 0;
+
+	srand( 1 );
+	failures += test_yuv_to_rgb( "yuv422 to rgba sse2", convert_line_yuv422_to_rgba_sse2 );
+	failures += test_rgb_to_yuv( "rgba to yuv422 sse2", convert_line_rgba_to_yuv422_sse2 );
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports( "avx2" ) )
+	{
+		failures += test_yuv_to_rgb( "yuv422 to rgba avx2", convert_line_yuv422_to_rgba_avx2 );
+		failures += test_rgb_to_yuv( "rgba to yuv422 avx2", convert_line_rgba_to_yuv422_avx2 );
+	}
+	else
+	{
+		printf( "skipped avx2: not supported by this CPU\n" );
+	}
+	printf( "%s\n", failures ? "FAIL" : "PASS" );
+	return failures ? 1 : 0;
+}
+
+#else
+
+int main( int argc, char **argv )
+{
+	printf( "skipped: no SIMD kernels on this architecture\n" );
+	return 0;
+}
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * test_loudness.c -- check the loudness meter against EBU reference signals
+ * Copyright (C) 2024 Meltytech, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <modules/normalize/loudness_meter.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define FREQUENCY 48000
+#define CHANNELS 2
+
+/** A run of stereo 1 kHz sine at the same peak level on both channels.
+*/
+
+typedef struct
+{
+	double seconds;
+	double level;  /* dBFS */
+}
+tone_segment;
+
+/** Measure a sequence of tones, feeding the meter a frame of 1920 samples
+    at a time as the filter does, and optionally with two meters that each
+    measure half of the programme.
+*/
+
+static void measure( const tone_segment *segments, int count, int meters, loudness_result *result )
+{
+	int64_t total = 0, position = 0;
+	int samples = 1920;
+	float *buffer = malloc( samples * CHANNELS * sizeof( float ) );
+	loudness_meter meter = loudness_meter_new( FREQUENCY, CHANNELS );
+	int block_size = loudness_meter_block_size( meter );
+	double *energy;
+	int *blocks_count;
+	int blocks, i, m;
+	double true_peak = -HUGE_VAL, sample_peak = -HUGE_VAL;
+
+	for ( i = 0; i < count; i++ )
+		total += segments[ i ].seconds * FREQUENCY;
+	blocks = ( total + block_size - 1 ) / block_size;
+	energy = calloc( blocks, sizeof( double ) );
+	blocks_count = calloc( blocks, sizeof( int ) );
+	loudness_meter_close( meter );
+
+	for ( m = 0; m < meters; m++ )
+	{
+		int64_t start = (int64_t) blocks * m / meters * block_size;
+		int64_t end = (int64_t) blocks * ( m + 1 ) / meters * block_size;
+		int segment = 0;
+		int64_t segment_end = segments[ 0 ].seconds * FREQUENCY;
+
+		if ( end > total )
+			end = total;
+		meter = loudness_meter_new( FREQUENCY, CHANNELS );
+		loudness_meter_set_range( meter, start, end, energy, blocks_count );
+
+		// Start a second early so that the K-weighting settles, as the filter does
+		position = start > FREQUENCY ? start - FREQUENCY : 0;
+		while ( segment < count - 1 && position >= segment_end )
+			segment_end += segments[ ++segment ].seconds * FREQUENCY;
+
+		while ( position < end )
+		{
+			int n = end - position < samples ? end - position : samples;
+			for ( i = 0; i < n; i++ )
+			{
+				double amplitude, value;
+				if ( position + i >= segment_end && segment < count - 1 )
+					segment_end += segments[ ++segment ].seconds * FREQUENCY;
+				amplitude = pow( 10.0, segments[ segment ].level / 20.0 );
+				value = amplitude * sin( 2.0 * M_PI * 1000.0 * ( position + i ) / FREQUENCY );
+				buffer[ i * CHANNELS ] = buffer[ i * CHANNELS + 1 ] = value;
+			}
+			loudness_meter_process( meter, buffer, n, position );
+			position += n;
+		}
+		if ( loudness_meter_true_peak( meter ) > true_peak )
+			true_peak = loudness_meter_true_peak( meter );
+		if ( loudness_meter_sample_peak( meter ) > sample_peak )
+			sample_peak = loudness_meter_sample_peak( meter );
+		loudness_meter_close( meter );
+	}
+
+	loudness_compute( energy, blocks_count, blocks, result );
+	result->true_peak = true_peak;
+	result->sample_peak = sample_peak;
+	free( energy );
+	free( blocks_count );
+	free( buffer );
+}
+
+static int check( const char *name, double value, double expected, double tolerance )
+{
+	int ok = fabs( value - expected ) <= tolerance;
+	printf( "%-44s %8.2f (expected %.1f +/- %.1f) %s\n", name, value, expected, tolerance, ok ? "ok" : "FAIL" );
+	return !ok;
+}
+
+int main( int argc, char **argv )
+{
+	// EBU Tech 3341 cases 1 and 2
+	static const tone_segment minus23[] = { { 20, -23 } };
+	static const tone_segment minus33[] = { { 20, -33 } };
+	// EBU Tech 3341 case 3, where the gates must drop the quiet parts
+	static const tone_segment gated[] = { { 10, -36 }, { 60, -23 }, { 10, -36 } };
+	// EBU Tech 3342 cases 1 and 2
+	static const tone_segment range10[] = { { 20, -20 }, { 20, -30 } };
+	static const tone_segment range5[] = { { 20, -20 }, { 20, -15 } };
+	loudness_result result;
+	int errors = 0;
+	int meters;
+
+	for ( meters = 1; meters <= 2; meters++ )
+	{
+		printf( "%d meter%s\n", meters, meters > 1 ? "s" : "" );
+		measure( minus23, 1, meters, &result );
+		errors += check( "3341 case 1 integrated (LUFS)", result.integrated, -23.0, 0.1 );
+		errors += check( "3341 case 1 sample peak (dBFS)", result.sample_peak, -23.0, 0.1 );
+		errors += check( "3341 case 1 true peak (dBTP)", result.true_peak, -23.0, 0.5 );
+		measure( minus33, 1, meters, &result );
+		errors += check( "3341 case 2 integrated (LUFS)", result.integrated, -33.0, 0.1 );
+		measure( gated, 3, meters, &result );
+		errors += check( "3341 case 3 integrated (LUFS)", result.integrated, -23.0, 0.1 );
+		measure( range10, 2, meters, &result );
+		errors += check( "3342 case 1 loudness range (LU)", result.range, 10.0, 1.0 );
+		measure( range5, 2, meters, &result );
+		errors += check( "3342 case 2 loudness range (LU)", result.range, 5.0, 1.0 );
+	}
+
+	printf( "%s\n", errors ? "FAIL" : "PASS" );
+	return errors ? 1 : 0;
+}
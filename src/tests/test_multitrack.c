@@ -0,0 +1,332 @@
+/*
+ * test_multitrack.c -- check that a parallel tractor matches a serial one
+ * Copyright (C) 2024 Meltytech, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <framework/mlt.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WIDTH 64
+#define HEIGHT 36
+#define FREQUENCY 48000
+#define CHANNELS 2
+#define SAMPLES 1920
+#define FRAMES 25
+#define CHANGE 12
+
+static pthread_t main_thread;
+static pthread_mutex_t count_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int elsewhere;
+
+/** Count the source renders that did not happen on the thread that asked for the frame.
+*/
+
+static void count_thread( )
+{
+	pthread_mutex_lock( &count_mutex );
+	elsewhere += !pthread_equal( pthread_self( ), main_thread );
+	pthread_mutex_unlock( &count_mutex );
+}
+
+/** Fill an image that depends on the producer, the position and the size.
+*/
+
+static int source_get_image( mlt_frame frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	int seed = mlt_properties_get_int( properties, "test.seed" );
+	int position = mlt_properties_get_int( properties, "test.position" );
+	int size, i;
+
+	count_thread( );
+	*format = mlt_image_rgba;
+	if ( *width <= 0 || *height <= 0 )
+	{
+		*width = WIDTH;
+		*height = HEIGHT;
+	}
+	size = mlt_image_format_size( *format, *width, *height, NULL );
+	*image = mlt_pool_alloc( size );
+	for ( i = 0; i < size; i ++ )
+		( *image )[ i ] = ( seed * 131 + position * 7 + i * ( seed + 3 ) + *width
+			+ mlt_properties_get_int( properties, "test.change" ) * 17 ) & 0xff;
+	mlt_frame_set_image( frame, *image, size, mlt_pool_release );
+	return 0;
+}
+
+static int source_get_audio( mlt_frame frame, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
+{
+	mlt_properties properties = MLT_FRAME_PROPERTIES( frame );
+	int seed = mlt_properties_get_int( properties, "test.seed" );
+	int position = mlt_properties_get_int( properties, "test.position" );
+	int size, i;
+	int16_t *pcm;
+
+	count_thread( );
+	*format = mlt_audio_s16;
+	*frequency = FREQUENCY;
+	*channels = CHANNELS;
+	*samples = SAMPLES;
+	size = mlt_audio_format_size( *format, *samples, *channels );
+	pcm = mlt_pool_alloc( size );
+	for ( i = 0; i < *samples * *channels; i ++ )
+		pcm[ i ] = ( seed * 977 + position * 31 + i * seed ) % 8000;
+	*buffer = pcm;
+	mlt_frame_set_audio( frame, pcm, *format, size, mlt_pool_release );
+	return 0;
+}
+
+static int source_get_frame( mlt_producer producer, mlt_frame_ptr frame, int index )
+{
+	mlt_properties properties;
+
+	*frame = mlt_frame_init( MLT_PRODUCER_SERVICE( producer ) );
+	properties = MLT_FRAME_PROPERTIES( *frame );
+
+	// Leave time for another track to move a shared producer between its seek and this
+	usleep( 200 );
+
+	mlt_frame_set_position( *frame, mlt_producer_position( producer ) );
+	mlt_properties_set_int( properties, "test.position", mlt_producer_position( producer ) );
+	mlt_properties_set_int( properties, "test.seed", mlt_properties_get_int( MLT_PRODUCER_PROPERTIES( producer ), "test.seed" ) );
+	mlt_frame_push_get_image( *frame, source_get_image );
+	mlt_frame_push_audio( *frame, source_get_audio );
+	mlt_producer_prepare_next( producer );
+	return 0;
+}
+
+static mlt_producer source_new( mlt_profile profile, int seed )
+{
+	mlt_producer producer = mlt_producer_new( profile );
+	mlt_properties properties = MLT_PRODUCER_PROPERTIES( producer );
+	producer->get_frame = source_get_frame;
+	mlt_properties_set_int( properties, "test.seed", seed );
+	mlt_properties_set_position( properties, "length", 10 * FRAMES );
+	mlt_properties_set_position( properties, "out", 10 * FRAMES - 1 );
+	return producer;
+}
+
+/** Blend the b frame into the a frame.
+ *
+ * From position CHANGE on, the b frame is asked for at half the size, and
+ * with a property set, so a render ahead with the previous request is wrong.
+ */
+
+static int mix_get_image( mlt_frame a_frame, uint8_t **image, mlt_image_format *format, int *width, int *height, int writable )
+{
+	mlt_frame b_frame = mlt_frame_pop_frame( a_frame );
+	mlt_image_format b_format = mlt_image_rgba;
+	int change = mlt_frame_get_position( a_frame ) >= CHANGE;
+	int b_width = *width >> change;
+	int b_height = *height >> change;
+	uint8_t *b_image = NULL;
+	int error, i, size;
+
+	mlt_properties_set_int( MLT_FRAME_PROPERTIES( b_frame ), "test.change", change );
+	error = mlt_frame_get_image( a_frame, image, format, width, height, 1 );
+	if ( !error )
+		error = mlt_frame_get_image( b_frame, &b_image, &b_format, &b_width, &b_height, 0 );
+	if ( !error )
+	{
+		size = mlt_image_format_size( *format, *width < b_width ? *width : b_width, *height < b_height ? *height : b_height, NULL );
+		for ( i = 0; i < size; i ++ )
+			( *image )[ i ] = ( ( *image )[ i ] * 3 + b_image[ i ] ) / 4;
+	}
+	return error;
+}
+
+static int mix_get_audio( mlt_frame a_frame, void **buffer, mlt_audio_format *format, int *frequency, int *channels, int *samples )
+{
+	mlt_frame b_frame = mlt_frame_pop_audio( a_frame );
+	mlt_audio_format b_format = mlt_audio_s16;
+	int b_frequency = *frequency;
+	int b_channels = *channels;
+	int b_samples = *samples;
+	int16_t *b_pcm = NULL;
+	int16_t *pcm;
+	int i;
+
+	mlt_frame_get_audio( a_frame, buffer, format, frequency, channels, samples );
+	mlt_frame_get_audio( b_frame, ( void ** )&b_pcm, &b_format, &b_frequency, &b_channels, &b_samples );
+	pcm = *buffer;
+	for ( i = 0; i < *samples * *channels && i < b_samples * b_channels; i ++ )
+		pcm[ i ] = ( pcm[ i ] + b_pcm[ i ] ) / 2;
+	return 0;
+}
+
+static mlt_frame mix_image_process( mlt_transition transition, mlt_frame a_frame, mlt_frame b_frame )
+{
+	mlt_frame_push_frame( a_frame, b_frame );
+	mlt_frame_push_get_image( a_frame, mix_get_image );
+	return a_frame;
+}
+
+static mlt_frame mix_audio_process( mlt_transition transition, mlt_frame a_frame, mlt_frame b_frame )
+{
+	mlt_frame_push_audio( a_frame, b_frame );
+	mlt_frame_push_audio( a_frame, mix_get_audio );
+	return a_frame;
+}
+
+static void plant_mix( mlt_field field, int type, int b_track )
+{
+	mlt_transition transition = mlt_transition_new( );
+	transition->process = type == 1 ? mix_image_process : mix_audio_process;
+	mlt_properties_set_int( MLT_TRANSITION_PROPERTIES( transition ), "_transition_type", type );
+	mlt_field_plant_transition( field, transition, 0, b_track );
+	mlt_transition_close( transition );
+}
+
+/** Build a tractor with one track that plays a cut of a producer.
+*/
+
+static mlt_producer nested_new( mlt_profile profile, mlt_producer producer, int in )
+{
+	mlt_tractor tractor = mlt_tractor_new( );
+	mlt_playlist playlist = mlt_playlist_new( profile );
+	mlt_playlist_append_io( playlist, producer, in, in + FRAMES - 1 );
+	mlt_multitrack_connect( mlt_tractor_multitrack( tractor ), MLT_PLAYLIST_PRODUCER( playlist ), 0 );
+	mlt_playlist_close( playlist );
+	return MLT_TRACTOR_PRODUCER( tractor );
+}
+
+/** Build a tractor that mixes every track into the first one.
+ *
+ * Every third track plays a cut of the same producer, so those tracks seek
+ * one parent. With more than two tracks, the last two reach that producer
+ * through nested tractors.
+ */
+
+static mlt_tractor tractor_new( mlt_profile profile, int tracks, int parallel )
+{
+	mlt_tractor tractor = mlt_tractor_new( );
+	mlt_field field = mlt_tractor_field( tractor );
+	mlt_multitrack multitrack = mlt_tractor_multitrack( tractor );
+	mlt_producer shared = source_new( profile, 1000 );
+	int i;
+
+	for ( i = 0; i < tracks; i ++ )
+	{
+		mlt_playlist playlist = mlt_playlist_new( profile );
+		if ( i >= tracks - 2 && tracks > 2 )
+		{
+			mlt_producer nested = nested_new( profile, shared, i * 5 );
+			mlt_playlist_append_io( playlist, nested, 0, FRAMES - 1 );
+			mlt_producer_close( nested );
+		}
+		else if ( i % 3 == 2 )
+		{
+			mlt_playlist_append_io( playlist, shared, i * 5, i * 5 + FRAMES - 1 );
+		}
+		else
+		{
+			mlt_producer producer = source_new( profile, i + 1 );
+			mlt_playlist_append_io( playlist, producer, i, i + FRAMES - 1 );
+			mlt_producer_close( producer );
+		}
+		mlt_multitrack_connect( multitrack, MLT_PLAYLIST_PRODUCER( playlist ), i );
+		mlt_playlist_close( playlist );
+
+		if ( i > 0 )
+		{
+			plant_mix( field, 1, i );
+			plant_mix( field, 2, i );
+		}
+	}
+	mlt_producer_close( shared );
+	mlt_properties_set_int( MLT_TRACTOR_PROPERTIES( tractor ), "parallel", parallel );
+	return tractor;
+}
+
+static uint64_t hash( uint64_t h, const void *data, int size )
+{
+	const uint8_t *p = data;
+	while ( size -- )
+		h = ( h ^ *p ++ ) * 0x100000001b3ULL;
+	return h;
+}
+
+/** Render a tractor and hash its images and audio.
+*/
+
+static uint64_t render( mlt_profile profile, int tracks, int parallel )
+{
+	mlt_tractor tractor = tractor_new( profile, tracks, parallel );
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int i;
+
+	for ( i = 0; i < FRAMES; i ++ )
+	{
+		mlt_frame frame = NULL;
+		mlt_image_format format = mlt_image_rgba;
+		mlt_audio_format audio_format = mlt_audio_s16;
+		int width = WIDTH, height = HEIGHT;
+		int frequency = FREQUENCY, channels = CHANNELS, samples = SAMPLES;
+		uint8_t *image = NULL;
+		void *audio = NULL;
+
+		mlt_service_get_frame( MLT_TRACTOR_SERVICE( tractor ), &frame, 0 );
+		if ( !mlt_frame_get_image( frame, &image, &format, &width, &height, 0 ) && image )
+			h = hash( h, image, mlt_image_format_size( format, width, height, NULL ) );
+		if ( !mlt_frame_get_audio( frame, &audio, &audio_format, &frequency, &channels, &samples ) && audio )
+			h = hash( h, audio, mlt_audio_format_size( audio_format, samples, channels ) );
+		mlt_frame_close( frame );
+	}
+	mlt_tractor_close( tractor );
+	return h;
+}
+
+int main( int argc, char **argv )
+{
+	static const int tracks[] = { 2, 7, 12 };
+	mlt_profile profile;
+	int failed = 0;
+	int i;
+
+	main_thread = pthread_self( );
+
+	// Use several threads even on a single processor
+	setenv( "MLT_SLICES_COUNT", "4", 0 );
+	mlt_factory_init( NULL );
+	profile = mlt_profile_init( NULL );
+
+	for ( i = 0; i < sizeof( tracks ) / sizeof( tracks[0] ); i ++ )
+	{
+		uint64_t serial = render( profile, tracks[i], 0 );
+		uint64_t parallel;
+		int ok;
+
+		elsewhere = 0;
+		parallel = render( profile, tracks[i], 1 );
+
+		// The tracks that do not share a producer must render on other threads
+		ok = serial == parallel && elsewhere > 0;
+		printf( "%-4s %2d tracks: serial %016llx parallel %016llx, %d renders on other threads\n", ok ? "ok" : "FAIL",
+			tracks[i], ( unsigned long long )serial, ( unsigned long long )parallel, elsewhere );
+		failed += !ok;
+	}
+
+	mlt_profile_close( profile );
+	mlt_factory_close( );
+	return failed ? 1 : 0;
+}